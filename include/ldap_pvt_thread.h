@@ -219,6 +219,13 @@ ldap_pvt_thread_pool_submit LDAP_P((
 	ldap_pvt_thread_start_t *start,
 	void *arg ));
 
+LDAP_F( int )
+ldap_pvt_thread_pool_submit_hash LDAP_P((
+	ldap_pvt_thread_pool_t *pool,
+	ldap_pvt_thread_start_t *start,
+	void *arg,
+	unsigned long hash ));
+
 LDAP_F( int )
 ldap_pvt_thread_pool_retract LDAP_P((
 	ldap_pvt_thread_pool_t *pool,
@@ -230,6 +237,11 @@ ldap_pvt_thread_pool_maxthreads LDAP_P((
 	ldap_pvt_thread_pool_t *pool,
 	int max_threads ));
 
+LDAP_F( int )
+ldap_pvt_thread_pool_queues LDAP_P((
+	ldap_pvt_thread_pool_t *pool,
+	int numqs ));
+
 #ifndef LDAP_PVT_THREAD_H_DONE
 typedef enum {
 	LDAP_PVT_THREAD_POOL_PARAM_UNKNOWN = -1,
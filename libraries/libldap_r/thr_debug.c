@@ -1187,6 +1187,21 @@ ldap_pvt_thread_pool_submit(
 	return rc;
 }
 
+int
+ldap_pvt_thread_pool_submit_hash(
+	ldap_pvt_thread_pool_t *tpool,
+	ldap_pvt_thread_start_t *start_routine, void *arg,
+	unsigned long hash )
+{
+	int rc, has_pool;
+	ERROR_IF( !threading_enabled, "ldap_pvt_thread_pool_submit_hash" );
+	has_pool = (tpool && *tpool);
+	rc = ldap_int_thread_pool_submit_hash( tpool, start_routine, arg, hash );
+	if( has_pool )
+		ERROR_IF( rc, "ldap_pvt_thread_pool_submit_hash" );
+	return rc;
+}
+
 int
 ldap_pvt_thread_pool_maxthreads(
 	ldap_pvt_thread_pool_t *tpool,
@@ -1196,6 +1211,15 @@ ldap_pvt_thread_pool_maxthreads(
 	return ldap_int_thread_pool_maxthreads(	tpool, max_threads );
 }
 
+int
+ldap_pvt_thread_pool_queues(
+	ldap_pvt_thread_pool_t *tpool,
+	int numqs )
+{
+	ERROR_IF( !threading_enabled, "ldap_pvt_thread_pool_queues" );
+	return ldap_int_thread_pool_queues( tpool, numqs );
+}
+
 int
 ldap_pvt_thread_pool_backload( ldap_pvt_thread_pool_t *tpool )
 {
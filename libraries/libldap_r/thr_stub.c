@@ -166,6 +166,16 @@ ldap_pvt_thread_pool_submit (
 	return(0);
 }
 
+int
+ldap_pvt_thread_pool_submit_hash (
+	ldap_pvt_thread_pool_t *pool,
+	ldap_pvt_thread_start_t *start_routine, void *arg,
+	unsigned long hash )
+{
+	(start_routine)(NULL, arg);
+	return(0);
+}
+
 int
 ldap_pvt_thread_pool_retract (
 	ldap_pvt_thread_pool_t *pool,
@@ -180,6 +190,12 @@ ldap_pvt_thread_pool_maxthreads ( ldap_pvt_thread_pool_t *tpool, int max_threads
 	return(0);
 }
 
+int
+ldap_pvt_thread_pool_queues ( ldap_pvt_thread_pool_t *tpool, int numqs )
+{
+	return(0);
+}
+
 int
 ldap_pvt_thread_pool_query( ldap_pvt_thread_pool_t *tpool,
 	ldap_pvt_thread_pool_param_t param, void *value )
@@ -0,0 +1,181 @@
+/* tpbench.c - thread pool submit/complete throughput */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 1998-2012 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/*
+ * Submits tasks to a thread pool from several threads, and reports
+ * how many tasks per second the pool gets done, for 1, 2, 4... up to
+ * the given number of pool threads.  The tasks are hashed over the
+ * queues of the pool like slapd does with its connections.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/time.h>
+#include <ac/unistd.h>
+
+#include "ldap_pvt_thread.h"
+
+static ldap_pvt_thread_pool_t pool;
+
+static int ntasks = 1000000;
+static int nsubmitters = 1;
+static int nconns = 1000;
+static int work = 0;
+
+static void
+usage( char *name )
+{
+	fprintf( stderr, "usage: %s [-t <max threads>] [-q <queues>] "
+		"[-s <submitters>] [-n <tasks>] [-c <connections>] [-w <work>]\n",
+		name );
+	exit( EXIT_FAILURE );
+}
+
+static void *
+bench_task( void *ctx, void *arg )
+{
+	volatile int i;
+
+	/* stand-in for the work of an operation */
+	for ( i = 0; i < work; i++ )
+		;
+	return NULL;
+}
+
+static void *
+bench_submitter( void *arg )
+{
+	long s = (long) arg;
+	int i, n = ntasks / nsubmitters;
+
+	for ( i = 0; i < n; i++ ) {
+		/* spread the tasks over nconns pretend connections */
+		while ( ldap_pvt_thread_pool_submit_hash( &pool, bench_task, NULL,
+			( s * n + i ) % nconns ) != 0 )
+		{
+			ldap_pvt_thread_yield();
+		}
+	}
+	return NULL;
+}
+
+static int
+bench_run( int nthreads, int nqueues )
+{
+	ldap_pvt_thread_t *tids;
+	struct timeval start, end;
+	double secs;
+	long s;
+
+	if ( ldap_pvt_thread_pool_init( &pool, nthreads, 0 ) != 0 ||
+		ldap_pvt_thread_pool_queues( &pool, nqueues ) != 0 )
+	{
+		fprintf( stderr, "cannot set up a pool of %d threads in %d queues\n",
+			nthreads, nqueues );
+		return -1;
+	}
+
+	tids = calloc( nsubmitters, sizeof( ldap_pvt_thread_t ) );
+	if ( tids == NULL ) {
+		perror( "calloc" );
+		return -1;
+	}
+
+	gettimeofday( &start, NULL );
+	for ( s = 0; s < nsubmitters; s++ ) {
+		if ( ldap_pvt_thread_create( &tids[s], 0, bench_submitter,
+			(void *) s ) != 0 )
+		{
+			fprintf( stderr, "cannot create submitter thread\n" );
+			return -1;
+		}
+	}
+	for ( s = 0; s < nsubmitters; s++ )
+		ldap_pvt_thread_join( tids[s], NULL );
+
+	/* returns once all the tasks are done */
+	ldap_pvt_thread_pool_destroy( &pool, 1 );
+	gettimeofday( &end, NULL );
+
+	secs = ( end.tv_sec - start.tv_sec ) +
+		( end.tv_usec - start.tv_usec ) / 1000000.0;
+	if ( secs <= 0 )
+		secs = 0.000001;
+	printf( "%8d %7d %11d %12d %9.3f %12.0f\n",
+		nthreads, nqueues < nthreads ? nqueues : nthreads, nsubmitters,
+		ntasks / nsubmitters * nsubmitters, secs,
+		ntasks / nsubmitters * nsubmitters / secs );
+	fflush( stdout );
+
+	free( tids );
+	return 0;
+}
+
+int
+main( int argc, char **argv )
+{
+	int i, maxthreads = 8, nqueues = 1;
+
+	while ( ( i = getopt( argc, argv, "c:n:q:s:t:w:" ) ) != EOF ) {
+		switch ( i ) {
+		case 'c':
+			nconns = atoi( optarg );
+			break;
+		case 'n':
+			ntasks = atoi( optarg );
+			break;
+		case 'q':
+			nqueues = atoi( optarg );
+			break;
+		case 's':
+			nsubmitters = atoi( optarg );
+			break;
+		case 't':
+			maxthreads = atoi( optarg );
+			break;
+		case 'w':
+			work = atoi( optarg );
+			break;
+		default:
+			usage( argv[0] );
+		}
+	}
+	if ( maxthreads < 1 || nqueues < 1 || nsubmitters < 1 ||
+		nconns < 1 || ntasks < nsubmitters || work < 0 || optind < argc )
+	{
+		usage( argv[0] );
+	}
+
+	ldap_pvt_thread_initialize();
+
+	printf( "%8s %7s %11s %12s %9s %12s\n",
+		"threads", "queues", "submitters", "tasks", "seconds", "tasks/sec" );
+	for ( i = 1; ; i *= 2 ) {
+		if ( i > maxthreads )
+			i = maxthreads;
+		if ( bench_run( i, nqueues ) )
+			return EXIT_FAILURE;
+		if ( i == maxthreads )
+			break;
+	}
+
+	ldap_pvt_thread_destroy();
+	return EXIT_SUCCESS;
+}
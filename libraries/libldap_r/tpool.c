@@ -53,8 +53,11 @@ typedef struct ldap_int_tpool_key_s {
 /* pool->ltp_pause values */
 enum { NOT_PAUSED = 0, WANT_PAUSE = 1, PAUSED = 2 };
 
+struct ldap_int_thread_poolq_s;
+
 /* Context: thread ID and thread-specific key/data pairs */
 typedef struct ldap_int_thread_userctx_s {
+	struct ldap_int_thread_poolq_s *ltu_pq;	/* NULL if not a pool thread */
 	ldap_pvt_thread_t ltu_id;
 	ldap_int_tpool_key_t ltu_key[MAXKEYS];
 } ldap_int_thread_userctx_t;
@@ -91,10 +94,17 @@ typedef struct ldap_int_thread_task_s {
 
 typedef LDAP_STAILQ_HEAD(tcq, ldap_int_thread_task_s) ldap_int_tpool_plist_t;
 
-struct ldap_int_thread_pool_s {
-	LDAP_STAILQ_ENTRY(ldap_int_thread_pool_s) ltp_next;
+/* A work queue with its own threads.  Tasks are spread over the
+ * queues of the pool by pool_submit_hash(), so submitters and
+ * threads of different queues do not contend for one mutex.  A
+ * thread with nothing to do in its own queue takes pending tasks
+ * from the other queues.
+ */
+struct ldap_int_thread_poolq_s {
+	struct ldap_int_thread_pool_s *ltp_pool;
+	int ltp_idx;				/* position in ltp_wqs[] */
 
-	/* protect members below, and protect thread_keys[] during pauses */
+	/* protect members below */
 	ldap_pvt_thread_mutex_t ltp_mutex;
 
 	/* not paused and something to do for pool_<wrapper/pause/destroy>() */
@@ -112,14 +122,56 @@ struct ldap_int_thread_pool_s {
 	ldap_int_tpool_plist_t ltp_pending_list;
 	LDAP_SLIST_HEAD(tcl, ldap_int_thread_task_s) ltp_free_list;
 
+	/* This queue's share of the pool's max threads and pending tasks,
+	 * ltp_max_pending is negated when the pool is finishing.
+	 */
+	int ltp_max_count;
+	int ltp_max_pending;
+
+	int ltp_pending_count;		/* Pending + paused + idle tasks */
+	int ltp_active_count;		/* Active, not paused/idle tasks */
+	int ltp_open_count;			/* Number of threads, negated when ltp_pause */
+	int ltp_starting;			/* Currenlty starting threads */
+
+	/* Threads waiting for a task.  pool_submit() peeks at it
+	 * without the lock, to find a queue that can take over a task.
+	 */
+	int ltp_idle_count;
+
+	/* >0 if paused or we may open a thread, <0 if we should close a thread.
+	 * Updated when ltp_<finishing/pause/max_count/open_count> change.
+	 * Maintained to reduce the time ltp_mutex must be locked in
+	 * ldap_pvt_thread_pool_<submit/wrapper>().
+	 */
+	int ltp_vary_open_count;
+#	define SET_VARY_OPEN_COUNT(pq)	\
+		((pq)->ltp_vary_open_count =	\
+		 (pq)->ltp_pool->ltp_pause      ?  1 :	\
+		 (pq)->ltp_pool->ltp_finishing  ? -1 :	\
+		 (pq)->ltp_max_count - (pq)->ltp_open_count)
+};
+
+struct ldap_int_thread_pool_s {
+	LDAP_STAILQ_ENTRY(ldap_int_thread_pool_s) ltp_next;
+
+	/* serialize pauses and pool-wide changes.  It is not held
+	 * while a task runs, the queues have their own mutexes.
+	 */
+	ldap_pvt_thread_mutex_t ltp_mutex;
+
+	/* a pause has ended, for pool_pause() */
+	ldap_pvt_thread_cond_t ltp_cond;
+
 	/* The pool is finishing, waiting for its threads to close.
-	 * They close when ltp_pending_list is done.  pool_submit()
-	 * rejects new tasks.  ltp_max_pending = -(its old value).
+	 * They close when their ltp_pending_list is done.  pool_submit()
+	 * rejects new tasks.  The queues' ltp_max_pending are negated.
 	 */
 	int ltp_finishing;
 
 	/* Some active task needs to be the sole active task.
 	 * Atomic variable so ldap_pvt_thread_pool_pausing() can read it.
+	 * Written with ltp_mutex locked, and PAUSED only with the mutexes
+	 * of all queues locked too.
 	 * Note: Pauses adjust ltp_<open_count/vary_open_count/work_list>,
 	 * so pool_<submit/wrapper>() mostly can avoid testing ltp_pause.
 	 */
@@ -128,26 +180,12 @@ struct ldap_int_thread_pool_s {
 	/* Max number of threads in pool, or 0 for default (LDAP_MAXTHR) */
 	int ltp_max_count;
 
-	/* Max pending + paused + idle tasks, negated when ltp_finishing */
+	/* Max pending + paused + idle tasks */
 	int ltp_max_pending;
 
-	int ltp_pending_count;		/* Pending + paused + idle tasks */
-	int ltp_active_count;		/* Active, not paused/idle tasks */
-	int ltp_open_count;			/* Number of threads, negated when ltp_pause */
-	int ltp_starting;			/* Currenlty starting threads */
-
-	/* >0 if paused or we may open a thread, <0 if we should close a thread.
-	 * Updated when ltp_<finishing/pause/max_count/open_count> change.
-	 * Maintained to reduce the time ltp_mutex must be locked in
-	 * ldap_pvt_thread_pool_<submit/wrapper>().
-	 */
-	int ltp_vary_open_count;
-#	define SET_VARY_OPEN_COUNT(pool)	\
-		((pool)->ltp_vary_open_count =	\
-		 (pool)->ltp_pause      ?  1 :	\
-		 (pool)->ltp_finishing  ? -1 :	\
-		 ((pool)->ltp_max_count ? (pool)->ltp_max_count : LDAP_MAXTHR) \
-		 - (pool)->ltp_open_count)
+	/* The work queues.  Only changed while the pool has no threads */
+	int ltp_numqs;
+	struct ldap_int_thread_poolq_s **ltp_wqs;
 };
 
 static ldap_int_tpool_plist_t empty_pending_list =
@@ -160,7 +198,7 @@ static LDAP_STAILQ_HEAD(tpq, ldap_int_thread_pool_s)
 
 static ldap_pvt_thread_mutex_t ldap_pvt_thread_pool_mutex;
 
-static void *ldap_int_thread_pool_wrapper( void *pool );
+static void *ldap_int_thread_pool_wrapper( void *pq );
 
 static ldap_pvt_thread_key_t	ldap_tpool_key;
 
@@ -189,6 +227,78 @@ ldap_int_thread_pool_shutdown ( void )
 }
 
 
+static struct ldap_int_thread_poolq_s *
+poolq_new( struct ldap_int_thread_pool_s *pool, int idx )
+{
+	struct ldap_int_thread_poolq_s *pq;
+
+	pq = (struct ldap_int_thread_poolq_s *) LDAP_CALLOC(1,
+		sizeof(struct ldap_int_thread_poolq_s));
+	if (pq == NULL)
+		return(NULL);
+
+	if (ldap_pvt_thread_mutex_init(&pq->ltp_mutex) != 0 ||
+		ldap_pvt_thread_cond_init(&pq->ltp_cond) != 0 ||
+		ldap_pvt_thread_cond_init(&pq->ltp_pcond) != 0)
+	{
+		LDAP_FREE(pq);
+		return(NULL);
+	}
+
+	pq->ltp_pool = pool;
+	pq->ltp_idx = idx;
+	LDAP_STAILQ_INIT(&pq->ltp_pending_list);
+	pq->ltp_work_list = &pq->ltp_pending_list;
+	LDAP_SLIST_INIT(&pq->ltp_free_list);
+	return(pq);
+}
+
+static void
+poolq_free( struct ldap_int_thread_poolq_s *pq )
+{
+	ldap_int_thread_task_t *task;
+
+	while ((task = LDAP_STAILQ_FIRST(&pq->ltp_pending_list)) != NULL) {
+		LDAP_STAILQ_REMOVE_HEAD(&pq->ltp_pending_list, ltt_next.q);
+		LDAP_FREE(task);
+	}
+	while ((task = LDAP_SLIST_FIRST(&pq->ltp_free_list)) != NULL) {
+		LDAP_SLIST_REMOVE_HEAD(&pq->ltp_free_list, ltt_next.l);
+		LDAP_FREE(task);
+	}
+	ldap_pvt_thread_cond_destroy(&pq->ltp_pcond);
+	ldap_pvt_thread_cond_destroy(&pq->ltp_cond);
+	ldap_pvt_thread_mutex_destroy(&pq->ltp_mutex);
+	LDAP_FREE(pq);
+}
+
+/* Share the pool's max threads and pending tasks among its queues.
+ * Every queue gets at least one thread.
+ */
+static void
+poolq_limits( struct ldap_int_thread_pool_s *pool )
+{
+	struct ldap_int_thread_poolq_s *pq;
+	int i, n = pool->ltp_numqs;
+	int max_count = pool->ltp_max_count ? pool->ltp_max_count : LDAP_MAXTHR;
+
+	for (i = 0; i < n; i++) {
+		pq = pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		pq->ltp_max_count = max_count / n + (i < max_count % n);
+		if (pq->ltp_max_count < 1)
+			pq->ltp_max_count = 1;
+		pq->ltp_max_pending = pool->ltp_max_pending / n +
+			(i < pool->ltp_max_pending % n);
+		if (pq->ltp_max_pending < 1)
+			pq->ltp_max_pending = 1;
+		if (pool->ltp_finishing)
+			pq->ltp_max_pending = -pq->ltp_max_pending;
+		SET_VARY_OPEN_COUNT(pq);
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	}
+}
+
 /* Create a thread pool */
 int
 ldap_pvt_thread_pool_init (
@@ -217,21 +327,22 @@ ldap_pvt_thread_pool_init (
 	if (rc != 0)
 		return(rc);
 	rc = ldap_pvt_thread_cond_init(&pool->ltp_cond);
-	if (rc != 0)
-		return(rc);
-	rc = ldap_pvt_thread_cond_init(&pool->ltp_pcond);
 	if (rc != 0)
 		return(rc);
 
+	pool->ltp_wqs = LDAP_MALLOC(sizeof(struct ldap_int_thread_poolq_s *));
+	if (pool->ltp_wqs == NULL)
+		return(-1);
+	pool->ltp_wqs[0] = poolq_new(pool, 0);
+	if (pool->ltp_wqs[0] == NULL)
+		return(-1);
+	pool->ltp_numqs = 1;
+
 	ldap_int_has_thread_pool = 1;
 
 	pool->ltp_max_count = max_threads;
-	SET_VARY_OPEN_COUNT(pool);
 	pool->ltp_max_pending = max_pending;
-
-	LDAP_STAILQ_INIT(&pool->ltp_pending_list);
-	pool->ltp_work_list = &pool->ltp_pending_list;
-	LDAP_SLIST_INIT(&pool->ltp_free_list);
+	poolq_limits(pool);
 
 	ldap_pvt_thread_mutex_lock(&ldap_pvt_thread_pool_mutex);
 	LDAP_STAILQ_INSERT_TAIL(&ldap_int_thread_pool_list, pool, ltp_next);
@@ -248,16 +359,141 @@ ldap_pvt_thread_pool_init (
 	return(0);
 }
 
+/* Set the number of work queues.  Only possible while the pool has
+ * no threads and no pending tasks, i.e. before the first submit.
+ */
+int
+ldap_pvt_thread_pool_queues(
+	ldap_pvt_thread_pool_t *tpool,
+	int numqs )
+{
+	struct ldap_int_thread_pool_s *pool;
+	struct ldap_int_thread_poolq_s *pq, **wqs;
+	int i, rc = 0;
 
-/* Submit a task to be performed by the thread pool */
+	if (tpool == NULL)
+		return(-1);
+
+	pool = *tpool;
+
+	if (pool == NULL)
+		return(-1);
+
+	if (numqs < 1)
+		numqs = 1;
+	if (pool->ltp_max_count && numqs > pool->ltp_max_count)
+		numqs = pool->ltp_max_count;
+	if (numqs > LDAP_MAXTHR)
+		numqs = LDAP_MAXTHR;
+
+	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		pq = pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		if (pq->ltp_open_count || pq->ltp_pending_count)
+			rc = -1;
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	}
+	if (rc || numqs == pool->ltp_numqs)
+		goto done;
+
+	wqs = LDAP_CALLOC(numqs, sizeof(struct ldap_int_thread_poolq_s *));
+	if (wqs == NULL) {
+		rc = -1;
+		goto done;
+	}
+	for (i = 0; i < numqs; i++) {
+		wqs[i] = poolq_new(pool, i);
+		if (wqs[i] == NULL) {
+			while (--i >= 0)
+				poolq_free(wqs[i]);
+			LDAP_FREE(wqs);
+			rc = -1;
+			goto done;
+		}
+	}
+
+	for (i = 0; i < pool->ltp_numqs; i++)
+		poolq_free(pool->ltp_wqs[i]);
+	LDAP_FREE(pool->ltp_wqs);
+	pool->ltp_wqs = wqs;
+	pool->ltp_numqs = numqs;
+	poolq_limits(pool);
+
+ done:
+	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	return(rc);
+}
+
+/* Find an idle thread in another queue than pq to take over a task
+ * that is waiting in pq.  Called without any queue locked.
+ */
+static void
+poolq_wake_other( struct ldap_int_thread_poolq_s *pq )
+{
+	struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
+	struct ldap_int_thread_poolq_s *oq;
+	int i, n = pool->ltp_numqs, woke = 0;
+
+	for (i = 1; i < n && !woke; i++) {
+		oq = pool->ltp_wqs[(pq->ltp_idx + i) % n];
+		/* only a hint, checked again with the lock */
+		if (!oq->ltp_idle_count)
+			continue;
+		ldap_pvt_thread_mutex_lock(&oq->ltp_mutex);
+		if (oq->ltp_idle_count) {
+			ldap_pvt_thread_cond_signal(&oq->ltp_cond);
+			woke = 1;
+		}
+		ldap_pvt_thread_mutex_unlock(&oq->ltp_mutex);
+	}
+}
+
+/* Take a pending task from another queue, for an idle thread of pq.
+ * Called with pq->ltp_mutex locked.  Busy queues are skipped rather
+ * than waited for, their own threads will get to their tasks.
+ */
+static ldap_int_thread_task_t *
+poolq_steal( struct ldap_int_thread_poolq_s *pq )
+{
+	struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
+	struct ldap_int_thread_poolq_s *oq;
+	ldap_int_thread_task_t *task = NULL;
+	int i, n = pool->ltp_numqs;
+
+	/* a pause may already have waited out pq */
+	if (pool->ltp_pause)
+		return(NULL);
+
+	for (i = 1; i < n && task == NULL; i++) {
+		oq = pool->ltp_wqs[(pq->ltp_idx + i) % n];
+		if (ldap_pvt_thread_mutex_trylock(&oq->ltp_mutex) != 0)
+			continue;
+		task = LDAP_STAILQ_FIRST(oq->ltp_work_list);
+		if (task) {
+			LDAP_STAILQ_REMOVE_HEAD(oq->ltp_work_list, ltt_next.q);
+			oq->ltp_pending_count--;
+		}
+		ldap_pvt_thread_mutex_unlock(&oq->ltp_mutex);
+	}
+	return(task);
+}
+
+/* Submit a task to be performed by the thread pool.
+ * Tasks with the same hash go to the same queue.
+ */
 int
-ldap_pvt_thread_pool_submit (
+ldap_pvt_thread_pool_submit_hash (
 	ldap_pvt_thread_pool_t *tpool,
-	ldap_pvt_thread_start_t *start_routine, void *arg )
+	ldap_pvt_thread_start_t *start_routine, void *arg,
+	unsigned long hash )
 {
 	struct ldap_int_thread_pool_s *pool;
+	struct ldap_int_thread_poolq_s *pq;
 	ldap_int_thread_task_t *task;
 	ldap_pvt_thread_t thr;
+	int wake_other = 0;
 
 	if (tpool == NULL)
 		return(-1);
@@ -267,14 +503,16 @@ ldap_pvt_thread_pool_submit (
 	if (pool == NULL)
 		return(-1);
 
-	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+	pq = pool->ltp_wqs[hash % pool->ltp_numqs];
 
-	if (pool->ltp_pending_count >= pool->ltp_max_pending)
+	ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+
+	if (pq->ltp_pending_count >= pq->ltp_max_pending)
 		goto failed;
 
-	task = LDAP_SLIST_FIRST(&pool->ltp_free_list);
+	task = LDAP_SLIST_FIRST(&pq->ltp_free_list);
 	if (task) {
-		LDAP_SLIST_REMOVE_HEAD(&pool->ltp_free_list, ltt_next.l);
+		LDAP_SLIST_REMOVE_HEAD(&pq->ltp_free_list, ltt_next.l);
 	} else {
 		task = (ldap_int_thread_task_t *) LDAP_MALLOC(sizeof(*task));
 		if (task == NULL)
@@ -284,49 +522,49 @@ ldap_pvt_thread_pool_submit (
 	task->ltt_start_routine = start_routine;
 	task->ltt_arg = arg;
 
-	pool->ltp_pending_count++;
-	LDAP_STAILQ_INSERT_TAIL(&pool->ltp_pending_list, task, ltt_next.q);
+	pq->ltp_pending_count++;
+	LDAP_STAILQ_INSERT_TAIL(&pq->ltp_pending_list, task, ltt_next.q);
 
 	/* true if ltp_pause != 0 or we should open (create) a thread */
-	if (pool->ltp_vary_open_count > 0 &&
-		pool->ltp_open_count < pool->ltp_active_count+pool->ltp_pending_count)
+	if (pq->ltp_vary_open_count > 0 &&
+		pq->ltp_open_count < pq->ltp_active_count+pq->ltp_pending_count)
 	{
 		if (pool->ltp_pause)
 			goto done;
 
-		pool->ltp_starting++;
-		pool->ltp_open_count++;
-		SET_VARY_OPEN_COUNT(pool);
+		pq->ltp_starting++;
+		pq->ltp_open_count++;
+		SET_VARY_OPEN_COUNT(pq);
 
 		if (0 != ldap_pvt_thread_create(
-			&thr, 1, ldap_int_thread_pool_wrapper, pool))
+			&thr, 1, ldap_int_thread_pool_wrapper, pq))
 		{
 			/* couldn't create thread.  back out of
 			 * ltp_open_count and check for even worse things.
 			 */
-			pool->ltp_starting--;
-			pool->ltp_open_count--;
-			SET_VARY_OPEN_COUNT(pool);
+			pq->ltp_starting--;
+			pq->ltp_open_count--;
+			SET_VARY_OPEN_COUNT(pq);
 
-			if (pool->ltp_open_count == 0) {
+			if (pq->ltp_open_count == 0) {
 				/* no open threads at all?!?
 				 */
 				ldap_int_thread_task_t *ptr;
 
 				/* let pool_destroy know there are no more threads */
-				ldap_pvt_thread_cond_signal(&pool->ltp_cond);
+				ldap_pvt_thread_cond_signal(&pq->ltp_cond);
 
-				LDAP_STAILQ_FOREACH(ptr, &pool->ltp_pending_list, ltt_next.q)
+				LDAP_STAILQ_FOREACH(ptr, &pq->ltp_pending_list, ltt_next.q)
 					if (ptr == task) break;
 				if (ptr == task) {
 					/* no open threads, task not handled, so
 					 * back out of ltp_pending_count, free the task,
 					 * report the error.
 					 */
-					pool->ltp_pending_count--;
-					LDAP_STAILQ_REMOVE(&pool->ltp_pending_list, task,
+					pq->ltp_pending_count--;
+					LDAP_STAILQ_REMOVE(&pq->ltp_pending_list, task,
 						ldap_int_thread_task_s, ltt_next.q);
-					LDAP_SLIST_INSERT_HEAD(&pool->ltp_free_list, task,
+					LDAP_SLIST_INSERT_HEAD(&pq->ltp_free_list, task,
 						ltt_next.l);
 					goto failed;
 				}
@@ -336,17 +574,34 @@ ldap_pvt_thread_pool_submit (
 			 */
 		}
 	}
-	ldap_pvt_thread_cond_signal(&pool->ltp_cond);
+	ldap_pvt_thread_cond_signal(&pq->ltp_cond);
+
+	/* no thread of this queue is free to take the task */
+	if (pool->ltp_numqs > 1 && !pq->ltp_idle_count && !pq->ltp_starting)
+		wake_other = 1;
 
  done:
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	if (wake_other)
+		poolq_wake_other(pq);
 	return(0);
 
  failed:
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 	return(-1);
 }
 
+/* Submit a task to be performed by the thread pool */
+int
+ldap_pvt_thread_pool_submit (
+	ldap_pvt_thread_pool_t *tpool,
+	ldap_pvt_thread_start_t *start_routine, void *arg )
+{
+	/* low bits of a pointer are mostly zero */
+	return ldap_pvt_thread_pool_submit_hash(tpool, start_routine, arg,
+		(unsigned long) arg >> 4);
+}
+
 static void *
 no_task( void *ctx, void *arg )
 {
@@ -363,7 +618,9 @@ ldap_pvt_thread_pool_retract (
 	ldap_pvt_thread_start_t *start_routine, void *arg )
 {
 	struct ldap_int_thread_pool_s *pool;
-	ldap_int_thread_task_t *task;
+	struct ldap_int_thread_poolq_s *pq;
+	ldap_int_thread_task_t *task = NULL;
+	int i;
 
 	if (tpool == NULL)
 		return(-1);
@@ -373,18 +630,21 @@ ldap_pvt_thread_pool_retract (
 	if (pool == NULL)
 		return(-1);
 
-	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
-	LDAP_STAILQ_FOREACH(task, &pool->ltp_pending_list, ltt_next.q)
-		if (task->ltt_start_routine == start_routine &&
-			task->ltt_arg == arg) {
-			/* Could LDAP_STAILQ_REMOVE the task, but that
-			 * walks ltp_pending_list again to find it.
-			 */
-			task->ltt_start_routine = no_task;
-			task->ltt_arg = NULL;
-			break;
-		}
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	for (i = 0; i < pool->ltp_numqs && task == NULL; i++) {
+		pq = pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		LDAP_STAILQ_FOREACH(task, &pq->ltp_pending_list, ltt_next.q)
+			if (task->ltt_start_routine == start_routine &&
+				task->ltt_arg == arg) {
+				/* Could LDAP_STAILQ_REMOVE the task, but that
+				 * walks ltp_pending_list again to find it.
+				 */
+				task->ltt_start_routine = no_task;
+				task->ltt_arg = NULL;
+				break;
+			}
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+	}
 	return task != NULL;
 }
 
@@ -407,12 +667,10 @@ ldap_pvt_thread_pool_maxthreads(
 	if (pool == NULL)
 		return(-1);
 
-	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
-
+	/* Not ltp_mutex, a pause may be waiting for this task */
 	pool->ltp_max_count = max_threads;
-	SET_VARY_OPEN_COUNT(pool);
+	poolq_limits(pool);
 
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
 	return(0);
 }
 
@@ -424,7 +682,8 @@ ldap_pvt_thread_pool_query(
 	void *value )
 {
 	struct ldap_int_thread_pool_s	*pool;
-	int				count = -1;
+	struct ldap_int_thread_poolq_s	*pq;
+	int				count = -1, i;
 
 	if ( tpool == NULL || value == NULL ) {
 		return -1;
@@ -436,7 +695,6 @@ ldap_pvt_thread_pool_query(
 		return 0;
 	}
 
-	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
 	switch ( param ) {
 	case LDAP_PVT_THREAD_POOL_PARAM_MAX:
 		count = pool->ltp_max_count;
@@ -444,38 +702,45 @@ ldap_pvt_thread_pool_query(
 
 	case LDAP_PVT_THREAD_POOL_PARAM_MAX_PENDING:
 		count = pool->ltp_max_pending;
-		if (count < 0)
-			count = -count;
 		if (count == MAX_PENDING)
 			count = 0;
 		break;
 
 	case LDAP_PVT_THREAD_POOL_PARAM_OPEN:
-		count = pool->ltp_open_count;
-		if (count < 0)
-			count = -count;
-		break;
-
 	case LDAP_PVT_THREAD_POOL_PARAM_STARTING:
-		count = pool->ltp_starting;
-		break;
-
 	case LDAP_PVT_THREAD_POOL_PARAM_ACTIVE:
-		count = pool->ltp_active_count;
+	case LDAP_PVT_THREAD_POOL_PARAM_PENDING:
+	case LDAP_PVT_THREAD_POOL_PARAM_BACKLOAD:
+		count = 0;
+		for ( i = 0; i < pool->ltp_numqs; i++ ) {
+			pq = pool->ltp_wqs[i];
+			ldap_pvt_thread_mutex_lock( &pq->ltp_mutex );
+			switch ( param ) {
+			case LDAP_PVT_THREAD_POOL_PARAM_OPEN:
+				count += pq->ltp_open_count < 0 ?
+					-pq->ltp_open_count : pq->ltp_open_count;
+				break;
+			case LDAP_PVT_THREAD_POOL_PARAM_STARTING:
+				count += pq->ltp_starting;
+				break;
+			case LDAP_PVT_THREAD_POOL_PARAM_ACTIVE:
+				count += pq->ltp_active_count;
+				break;
+			case LDAP_PVT_THREAD_POOL_PARAM_PENDING:
+				count += pq->ltp_pending_count;
+				break;
+			default:
+				count += pq->ltp_pending_count + pq->ltp_active_count;
+				break;
+			}
+			ldap_pvt_thread_mutex_unlock( &pq->ltp_mutex );
+		}
 		break;
 
 	case LDAP_PVT_THREAD_POOL_PARAM_PAUSING:
 		count = (pool->ltp_pause != 0);
 		break;
 
-	case LDAP_PVT_THREAD_POOL_PARAM_PENDING:
-		count = pool->ltp_pending_count;
-		break;
-
-	case LDAP_PVT_THREAD_POOL_PARAM_BACKLOAD:
-		count = pool->ltp_pending_count + pool->ltp_active_count;
-		break;
-
 	case LDAP_PVT_THREAD_POOL_PARAM_ACTIVE_MAX:
 		break;
 
@@ -486,16 +751,25 @@ ldap_pvt_thread_pool_query(
 		break;
 
 	case LDAP_PVT_THREAD_POOL_PARAM_STATE:
-		*((char **)value) =
-			pool->ltp_pause ? "pausing" :
-			!pool->ltp_finishing ? "running" :
-			pool->ltp_pending_count ? "finishing" : "stopping";
+		if ( pool->ltp_pause ) {
+			*((char **)value) = "pausing";
+		} else if ( !pool->ltp_finishing ) {
+			*((char **)value) = "running";
+		} else {
+			int pending = 0;
+			for ( i = 0; i < pool->ltp_numqs; i++ ) {
+				pq = pool->ltp_wqs[i];
+				ldap_pvt_thread_mutex_lock( &pq->ltp_mutex );
+				pending += pq->ltp_pending_count;
+				ldap_pvt_thread_mutex_unlock( &pq->ltp_mutex );
+			}
+			*((char **)value) = pending ? "finishing" : "stopping";
+		}
 		break;
 
 	case LDAP_PVT_THREAD_POOL_PARAM_UNKNOWN:
 		break;
 	}
-	ldap_pvt_thread_mutex_unlock( &pool->ltp_mutex );
 
 	if ( count > -1 ) {
 		*((int *)value) = count;
@@ -545,7 +819,9 @@ int
 ldap_pvt_thread_pool_destroy ( ldap_pvt_thread_pool_t *tpool, int run_pending )
 {
 	struct ldap_int_thread_pool_s *pool, *pptr;
+	struct ldap_int_thread_poolq_s *pq;
 	ldap_int_thread_task_t *task;
+	int i;
 
 	if (tpool == NULL)
 		return(-1);
@@ -565,34 +841,42 @@ ldap_pvt_thread_pool_destroy ( ldap_pvt_thread_pool_t *tpool, int run_pending )
 	if (pool != pptr) return(-1);
 
 	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
-
 	pool->ltp_finishing = 1;
-	SET_VARY_OPEN_COUNT(pool);
-	if (pool->ltp_max_pending > 0)
-		pool->ltp_max_pending = -pool->ltp_max_pending;
+	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
 
-	if (!run_pending) {
-		while ((task = LDAP_STAILQ_FIRST(&pool->ltp_pending_list)) != NULL) {
-			LDAP_STAILQ_REMOVE_HEAD(&pool->ltp_pending_list, ltt_next.q);
-			LDAP_FREE(task);
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		pq = pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+
+		SET_VARY_OPEN_COUNT(pq);
+		if (pq->ltp_max_pending > 0)
+			pq->ltp_max_pending = -pq->ltp_max_pending;
+
+		if (!run_pending) {
+			while ((task = LDAP_STAILQ_FIRST(&pq->ltp_pending_list)) != NULL) {
+				LDAP_STAILQ_REMOVE_HEAD(&pq->ltp_pending_list, ltt_next.q);
+				LDAP_FREE(task);
+			}
+			pq->ltp_pending_count = 0;
 		}
-		pool->ltp_pending_count = 0;
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 	}
 
-	while (pool->ltp_open_count) {
-		if (!pool->ltp_pause)
-			ldap_pvt_thread_cond_broadcast(&pool->ltp_cond);
-		ldap_pvt_thread_cond_wait(&pool->ltp_cond, &pool->ltp_mutex);
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		pq = pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		while (pq->ltp_open_count) {
+			if (!pool->ltp_pause)
+				ldap_pvt_thread_cond_broadcast(&pq->ltp_cond);
+			ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
+		}
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 	}
 
-	while ((task = LDAP_SLIST_FIRST(&pool->ltp_free_list)) != NULL)
-	{
-		LDAP_SLIST_REMOVE_HEAD(&pool->ltp_free_list, ltt_next.l);
-		LDAP_FREE(task);
-	}
+	for (i = 0; i < pool->ltp_numqs; i++)
+		poolq_free(pool->ltp_wqs[i]);
+	LDAP_FREE(pool->ltp_wqs);
 
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
-	ldap_pvt_thread_cond_destroy(&pool->ltp_pcond);
 	ldap_pvt_thread_cond_destroy(&pool->ltp_cond);
 	ldap_pvt_thread_mutex_destroy(&pool->ltp_mutex);
 	LDAP_FREE(pool);
@@ -603,14 +887,16 @@ ldap_pvt_thread_pool_destroy ( ldap_pvt_thread_pool_t *tpool, int run_pending )
 
 /* Thread loop.  Accept and handle submitted tasks. */
 static void *
-ldap_int_thread_pool_wrapper ( 
-	void *xpool )
+ldap_int_thread_pool_wrapper (
+	void *xpq )
 {
-	struct ldap_int_thread_pool_s *pool = xpool;
+	struct ldap_int_thread_poolq_s *pq = xpq;
+	struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
 	ldap_int_thread_task_t *task;
 	ldap_int_tpool_plist_t *work_list;
 	ldap_int_thread_userctx_t ctx, *kctx;
 	unsigned i, keyslot, hash;
+	int stolen;
 
 	assert(pool != NULL);
 
@@ -618,16 +904,17 @@ ldap_int_thread_pool_wrapper (
 		ctx.ltu_key[i].ltk_key = NULL;
 	}
 
+	ctx.ltu_pq = pq;
 	ctx.ltu_id = ldap_pvt_thread_self();
 	TID_HASH(ctx.ltu_id, hash);
 
 	ldap_pvt_thread_key_setdata( ldap_tpool_key, &ctx );
 
-	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
 
 	/* thread_keys[] is read-only when paused */
 	while (pool->ltp_pause)
-		ldap_pvt_thread_cond_wait(&pool->ltp_cond, &pool->ltp_mutex);
+		ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
 
 	/* find a key slot to give this thread ID and store a
 	 * pointer to our keys there; start at the thread ID
@@ -640,20 +927,21 @@ ldap_int_thread_pool_wrapper (
 	thread_keys[keyslot].ctx = &ctx;
 	ldap_pvt_thread_mutex_unlock(&ldap_pvt_thread_pool_mutex);
 
-	pool->ltp_starting--;
-	pool->ltp_active_count++;
+	pq->ltp_starting--;
+	pq->ltp_active_count++;
 
 	for (;;) {
-		work_list = pool->ltp_work_list; /* help the compiler a bit */
+		work_list = pq->ltp_work_list; /* help the compiler a bit */
 		task = LDAP_STAILQ_FIRST(work_list);
+		stolen = 0;
 		if (task == NULL) {	/* paused or no pending tasks */
-			if (--(pool->ltp_active_count) < 2) {
+			if (--(pq->ltp_active_count) < 2) {
 				/* Notify pool_pause it is the sole active thread. */
-				ldap_pvt_thread_cond_signal(&pool->ltp_pcond);
+				ldap_pvt_thread_cond_signal(&pq->ltp_pcond);
 			}
 
-			do {
-				if (pool->ltp_vary_open_count < 0) {
+			for (;;) {
+				if (pq->ltp_vary_open_count < 0) {
 					/* Not paused, and either finishing or too many
 					 * threads running (can happen if ltp_max_count
 					 * was reduced).  Let this thread die.
@@ -661,54 +949,76 @@ ldap_int_thread_pool_wrapper (
 					goto done;
 				}
 
+				if (pool->ltp_numqs > 1 &&
+					(task = poolq_steal(pq)) != NULL)
+				{
+					stolen = 1;
+					break;
+				}
+
 				/* We could check an idle timer here, and let the
 				 * thread die if it has been inactive for a while.
 				 * Only die if there are other open threads (i.e.,
 				 * always have at least one thread open).
 				 * The check should be like this:
-				 *   if (pool->ltp_open_count>1 && pool->ltp_starting==0)
+				 *   if (pq->ltp_open_count>1 && pq->ltp_starting==0)
 				 *       check timer, wait if ltp_pause, leave thread;
 				 *
 				 * Just use pthread_cond_timedwait() if we want to
 				 * check idle time.
 				 */
-				ldap_pvt_thread_cond_wait(&pool->ltp_cond, &pool->ltp_mutex);
+				pq->ltp_idle_count++;
+				ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
+				pq->ltp_idle_count--;
 
-				work_list = pool->ltp_work_list;
+				work_list = pq->ltp_work_list;
 				task = LDAP_STAILQ_FIRST(work_list);
-			} while (task == NULL);
+				if (task != NULL)
+					break;
+			}
 
-			pool->ltp_active_count++;
+			pq->ltp_active_count++;
 		}
 
-		LDAP_STAILQ_REMOVE_HEAD(work_list, ltt_next.q);
-		pool->ltp_pending_count--;
-		ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+		if (!stolen) {
+			LDAP_STAILQ_REMOVE_HEAD(work_list, ltt_next.q);
+			pq->ltp_pending_count--;
+		}
+		ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 
 		task->ltt_start_routine(&ctx, task->ltt_arg);
 
-		ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
-		LDAP_SLIST_INSERT_HEAD(&pool->ltp_free_list, task, ltt_next.l);
+		/* Keep only our own queue's task objects, or the free
+		 * lists of queues that lose tasks would keep growing.
+		 */
+		if (stolen)
+			LDAP_FREE(task);
+		ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+		if (!stolen)
+			LDAP_SLIST_INSERT_HEAD(&pq->ltp_free_list, task, ltt_next.l);
 	}
  done:
 
-	assert(!pool->ltp_pause); /* thread_keys writable, ltp_open_count >= 0 */
+	/* thread_keys writable, ltp_open_count >= 0: a pause
+	 * cannot get past this queue while we hold its mutex.
+	 */
+	assert(pool->ltp_pause != PAUSED);
 
-	/* The ltp_mutex lock protects ctx->ltu_key from pool_purgekey()
-	 * during this call, since it prevents new pauses. */
+	/* The pq->ltp_mutex lock protects ctx->ltu_key from pool_purgekey()
+	 * during this call, since the pool cannot get PAUSED meanwhile. */
 	ldap_pvt_thread_pool_context_reset(&ctx);
 
 	ldap_pvt_thread_mutex_lock(&ldap_pvt_thread_pool_mutex);
 	thread_keys[keyslot].ctx = DELETED_THREAD_CTX;
 	ldap_pvt_thread_mutex_unlock(&ldap_pvt_thread_pool_mutex);
 
-	pool->ltp_open_count--;
-	SET_VARY_OPEN_COUNT(pool);
+	pq->ltp_open_count--;
+	SET_VARY_OPEN_COUNT(pq);
 	/* let pool_destroy know we're all done */
-	if (pool->ltp_open_count == 0)
-		ldap_pvt_thread_cond_signal(&pool->ltp_cond);
+	if (pq->ltp_open_count == 0)
+		ldap_pvt_thread_cond_signal(&pq->ltp_cond);
 
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 
 	ldap_pvt_thread_exit(NULL);
 	return(NULL);
@@ -724,10 +1034,85 @@ ldap_int_thread_pool_wrapper (
 #define PAUSE_ARG(a) \
 		((a) | ((a) & (GO_IDLE|GO_UNIDLE) ? GO_IDLE-1 : CHECK_PAUSE))
 
+/* Pause the pool for the task running in pq.  The task goes idle
+ * while it waits for ltp_mutex and for the other tasks, so that
+ * concurrent pause requests and pausechecks do not wait for it.
+ */
+static int
+pause_pool( struct ldap_int_thread_pool_s *pool,
+	struct ldap_int_thread_poolq_s *pq )
+{
+	struct ldap_int_thread_poolq_s *oq;
+	int i, busy;
+
+	ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+	pq->ltp_pending_count++;
+	pq->ltp_active_count--;
+	if (pool->ltp_pause && pq->ltp_active_count < 2) {
+		/* Tell the task waiting to DO_PAUSE it can proceed */
+		ldap_pvt_thread_cond_signal(&pq->ltp_pcond);
+	}
+	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+
+	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+
+	/* Wait out other pauses */
+	while (pool->ltp_pause)
+		ldap_pvt_thread_cond_wait(&pool->ltp_cond, &pool->ltp_mutex);
+
+	/* Tell everyone else to pause or finish */
+	pool->ltp_pause = WANT_PAUSE;
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		oq = pool->ltp_wqs[i];
+		ldap_pvt_thread_mutex_lock(&oq->ltp_mutex);
+		/* Let ldap_pvt_thread_pool_submit() through to its ltp_pause test,
+		 * and do not finish threads in ldap_pvt_thread_pool_wrapper() */
+		oq->ltp_open_count = -oq->ltp_open_count;
+		SET_VARY_OPEN_COUNT(oq);
+		/* Hide pending tasks from ldap_pvt_thread_pool_wrapper() */
+		oq->ltp_work_list = &empty_pending_list;
+		ldap_pvt_thread_mutex_unlock(&oq->ltp_mutex);
+	}
+
+	/* Await that.  Tasks can still unidle until the pool is PAUSED,
+	 * so check all the queues at once.
+	 */
+	for (;;) {
+		busy = -1;
+		for (i = 0; i < pool->ltp_numqs; i++) {
+			oq = pool->ltp_wqs[i];
+			ldap_pvt_thread_mutex_lock(&oq->ltp_mutex);
+			if (busy < 0 && oq->ltp_active_count > 0)
+				busy = i;
+		}
+		if (busy < 0) {
+			pool->ltp_pause = PAUSED;
+			pq->ltp_pending_count--;
+			pq->ltp_active_count++;
+		}
+		for (i = 0; i < pool->ltp_numqs; i++) {
+			if (i != busy)
+				ldap_pvt_thread_mutex_unlock(&pool->ltp_wqs[i]->ltp_mutex);
+		}
+		if (busy < 0)
+			break;
+
+		oq = pool->ltp_wqs[busy];
+		while (oq->ltp_active_count > 0)
+			ldap_pvt_thread_cond_wait(&oq->ltp_pcond, &oq->ltp_mutex);
+		ldap_pvt_thread_mutex_unlock(&oq->ltp_mutex);
+	}
+
+	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	return(0);
+}
+
 static int
 handle_pause( ldap_pvt_thread_pool_t *tpool, int pause_type )
 {
 	struct ldap_int_thread_pool_s *pool;
+	struct ldap_int_thread_poolq_s *pq;
+	ldap_int_thread_userctx_t *ctx;
 	int ret = 0, pause, max_ltp_pause;
 
 	if (tpool == NULL)
@@ -741,10 +1126,20 @@ handle_pause( ldap_pvt_thread_pool_t *tpool, int pause_type )
 	if (pause_type == CHECK_PAUSE && !pool->ltp_pause)
 		return(0);
 
+	/* The queue of the calling task.  Threads outside the pool,
+	 * including those of another pool, are counted in the first queue.
+	 */
+	ctx = ldap_pvt_thread_pool_context();
+	pq = ctx->ltu_pq && ctx->ltu_pq->ltp_pool == pool ?
+		ctx->ltu_pq : pool->ltp_wqs[0];
+
+	if (pause_type & DO_PAUSE)
+		return pause_pool(pool, pq);
+
 	/* Let pool_unidle() ignore requests for new pauses */
 	max_ltp_pause = pause_type==PAUSE_ARG(GO_UNIDLE) ? WANT_PAUSE : NOT_PAUSED;
 
-	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
 
 	pause = pool->ltp_pause;	/* NOT_PAUSED, WANT_PAUSE or PAUSED */
 
@@ -752,11 +1147,11 @@ handle_pause( ldap_pvt_thread_pool_t *tpool, int pause_type )
 	pause_type -= pause;
 
 	if (pause_type & GO_IDLE) {
-		pool->ltp_pending_count++;
-		pool->ltp_active_count--;
-		if (pause && pool->ltp_active_count < 2) {
+		pq->ltp_pending_count++;
+		pq->ltp_active_count--;
+		if (pause && pq->ltp_active_count < 2) {
 			/* Tell the task waiting to DO_PAUSE it can proceed */
-			ldap_pvt_thread_cond_signal(&pool->ltp_pcond);
+			ldap_pvt_thread_cond_signal(&pq->ltp_pcond);
 		}
 	}
 
@@ -765,33 +1160,14 @@ handle_pause( ldap_pvt_thread_pool_t *tpool, int pause_type )
 		if (pause > max_ltp_pause) {
 			ret = 1;
 			do {
-				ldap_pvt_thread_cond_wait(&pool->ltp_cond, &pool->ltp_mutex);
+				ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
 			} while (pool->ltp_pause > max_ltp_pause);
 		}
-		pool->ltp_pending_count--;
-		pool->ltp_active_count++;
-	}
-
-	if (pause_type & DO_PAUSE) {
-		/* Tell everyone else to pause or finish, then await that */
-		ret = 0;
-		assert(!pool->ltp_pause);
-		pool->ltp_pause = WANT_PAUSE;
-		/* Let ldap_pvt_thread_pool_submit() through to its ltp_pause test,
-		 * and do not finish threads in ldap_pvt_thread_pool_wrapper() */
-		pool->ltp_open_count = -pool->ltp_open_count;
-		SET_VARY_OPEN_COUNT(pool);
-		/* Hide pending tasks from ldap_pvt_thread_pool_wrapper() */
-		pool->ltp_work_list = &empty_pending_list;
-		/* Wait for this task to become the sole active task */
-		while (pool->ltp_active_count > 1) {
-			ldap_pvt_thread_cond_wait(&pool->ltp_pcond, &pool->ltp_mutex);
-		}
-		assert(pool->ltp_pause == WANT_PAUSE);
-		pool->ltp_pause = PAUSED;
+		pq->ltp_pending_count--;
+		pq->ltp_active_count++;
 	}
 
-	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
+	ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 	return(ret);
 }
 
@@ -833,10 +1209,12 @@ ldap_pvt_thread_pool_pause( ldap_pvt_thread_pool_t *tpool )
 
 /* End a pause */
 int
-ldap_pvt_thread_pool_resume ( 
+ldap_pvt_thread_pool_resume (
 	ldap_pvt_thread_pool_t *tpool )
 {
 	struct ldap_int_thread_pool_s *pool;
+	struct ldap_int_thread_poolq_s *pq;
+	int i;
 
 	if (tpool == NULL)
 		return(-1);
@@ -848,13 +1226,27 @@ ldap_pvt_thread_pool_resume (
 
 	ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
 
+	/* pool_submit() tests ltp_pause with only its queue locked, so
+	 * no queue may see the pause end before its ltp_open_count is
+	 * restored.  Lock them all, as pause_pool() does to set PAUSED.
+	 */
+	for (i = 0; i < pool->ltp_numqs; i++)
+		ldap_pvt_thread_mutex_lock(&pool->ltp_wqs[i]->ltp_mutex);
+
 	assert(pool->ltp_pause == PAUSED);
 	pool->ltp_pause = 0;
-	if (pool->ltp_open_count <= 0) /* true when paused, but be paranoid */
-		pool->ltp_open_count = -pool->ltp_open_count;
-	SET_VARY_OPEN_COUNT(pool);
-	pool->ltp_work_list = &pool->ltp_pending_list;
+	for (i = 0; i < pool->ltp_numqs; i++) {
+		pq = pool->ltp_wqs[i];
+		if (pq->ltp_open_count <= 0) /* true when paused, but be paranoid */
+			pq->ltp_open_count = -pq->ltp_open_count;
+		SET_VARY_OPEN_COUNT(pq);
+		pq->ltp_work_list = &pq->ltp_pending_list;
+
+		ldap_pvt_thread_cond_broadcast(&pq->ltp_cond);
+	}
 
+	for (i = 0; i < pool->ltp_numqs; i++)
+		ldap_pvt_thread_mutex_unlock(&pool->ltp_wqs[i]->ltp_mutex);
 	ldap_pvt_thread_cond_broadcast(&pool->ltp_cond);
 
 	ldap_pvt_thread_mutex_unlock(&pool->ltp_mutex);
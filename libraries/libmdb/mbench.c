@@ -0,0 +1,296 @@
+/* mbench.c - memory-mapped database commit benchmark */
+/*
+ * Copyright 2012 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Commits a series of small write transactions against a fresh
+ * database, once with the default malloc'd dirty pages, once
+ * with MDB_WRITEMAP and once with MDB_WRITEMAP|MDB_MAPASYNC, and
+ * reports the commit throughput of each. Use -S to sync on every
+ * commit instead of running with MDB_NOSYNC.
+ *
+ * With -m the transactions instead keep rewriting and deleting a
+ * fixed set of keys, a quarter of them with multi-page values, while
+ * a reader snapshot is held across every other batch of commits.
+ * This mostly exercises free page reuse, so the final size of the
+ * data file is reported as well.
+ *
+ * With -d it instead loads a DIT of a million DNs in reverse RDN
+ * order, whose neighbouring keys share long prefixes, and then looks
+ * them all up again. It does so once with the default key order and
+ * once with an identical user comparison function, which keeps the
+ * separators in branch pages from being shortened, and reports the
+ * tree shape, file size and lookup rate of each. Use -n to change
+ * the number of entries.
+ */
+#define _XOPEN_SOURCE 500		/* srandom(), random() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include "mdb.h"
+
+#define DBPATH	"./bench.mdb"
+
+static int ntxns = 10000;
+static int nputs = 10;
+static unsigned int envflags = MDB_NOSYNC;
+static int modify;
+static int dit;
+
+#define NKEYS	1000	/* keys rewritten by -m */
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int
+run(const char *name, unsigned int flags)
+{
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_txn *txn, *rtxn = NULL;
+	MDB_val key, data;
+	char kval[32], dval[32768];
+	struct stat st;
+	double t0, t1;
+	int i, j, rc;
+
+	unlink(DBPATH);
+	unlink(DBPATH "-lock");
+
+	rc = mdb_env_create(&env);
+	rc = mdb_env_set_mapsize(env, 256*1048576);
+	rc = mdb_env_open(env, DBPATH, flags | MDB_NOSUBDIR, 0664);
+	if (rc) {
+		printf("mdb_env_open failed, error %d %s\n", rc, mdb_strerror(rc));
+		return rc;
+	}
+	rc = mdb_txn_begin(env, NULL, 0, &txn);
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	rc = mdb_txn_commit(txn);
+
+	memset(dval, 'x', sizeof(dval));
+	key.mv_data = kval;
+	data.mv_size = 100;
+	data.mv_data = dval;
+
+	srandom(1);
+	t0 = now();
+	for (i=0; i<ntxns; i++) {
+		rc = mdb_txn_begin(env, NULL, 0, &txn);
+		if (rc) break;
+		for (j=0; j<nputs; j++) {
+			if (!modify) {
+				key.mv_size = sprintf(kval, "%08lx", random());
+				rc = mdb_put(txn, dbi, &key, &data, 0);
+				if (rc) break;
+				continue;
+			}
+			key.mv_size = sprintf(kval, "%08ld", random() % NKEYS);
+			if (random() % 10 == 0) {
+				rc = mdb_del(txn, dbi, &key, NULL);
+				if (rc == MDB_NOTFOUND)
+					rc = 0;
+			} else {
+				data.mv_size = random() % 4 ? 100 :
+					8192 + random() % (sizeof(dval) - 8192);
+				rc = mdb_put(txn, dbi, &key, &data, 0);
+			}
+			if (rc) break;
+		}
+		if (rc) {
+			mdb_txn_abort(txn);
+			break;
+		}
+		rc = mdb_txn_commit(txn);
+		if (rc) break;
+		if (modify && i % 100 == 99) {
+			if (rtxn) {
+				mdb_txn_abort(rtxn);
+				rtxn = NULL;
+			} else {
+				rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &rtxn);
+				if (rc) break;
+			}
+		}
+	}
+	if (rtxn)
+		mdb_txn_abort(rtxn);
+	if (!rc)
+		rc = mdb_env_sync(env, 1);
+	t1 = now();
+	if (rc)
+		printf("%s: failed after %d txns, error %d %s\n", name, i, rc,
+			mdb_strerror(rc));
+	else
+		printf("%-10s %d txns of %d puts in %.3fs: %.0f commits/sec\n",
+			name, ntxns, nputs, t1 - t0, ntxns / (t1 - t0));
+
+	mdb_close(env, dbi);
+	mdb_env_close(env);
+	if (!rc && modify && !stat(DBPATH, &st))
+		printf("%-10s data file is %ld KB\n", name, (long)(st.st_size / 1024));
+	unlink(DBPATH);
+	unlink(DBPATH "-lock");
+	return rc;
+}
+
+/* Orders keys just like the default comparison. But since it is a
+ * user function, MDB can't assume plain lexicographic order and keeps
+ * whole keys in the branch pages.
+ */
+static int
+fullcmp(const MDB_val *a, const MDB_val *b)
+{
+	size_t len = a->mv_size < b->mv_size ? a->mv_size : b->mv_size;
+	int diff = memcmp(a->mv_data, b->mv_data, len);
+	return diff ? diff : (a->mv_size > b->mv_size) - (a->mv_size < b->mv_size);
+}
+
+/* The DN of entry i, for -d */
+static int
+dn(char *buf, int i)
+{
+	return sprintf(buf, "dc=com,dc=example,ou=people,ou=region%02d,"
+		"ou=unit%04d,uid=user%07d", i / 100000, i / 1000, i);
+}
+
+static int
+rundit(const char *name, MDB_cmp_func *cmp)
+{
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_txn *txn;
+	MDB_val key, data;
+	MDB_stat mst;
+	char kval[128], dval[64];
+	struct stat st;
+	double t0, t1, t2;
+	int i, rc = 0, n = ntxns;
+
+	unlink(DBPATH);
+	unlink(DBPATH "-lock");
+
+	rc = mdb_env_create(&env);
+	rc = mdb_env_set_mapsize(env, 2048UL*1048576);
+	rc = mdb_env_open(env, DBPATH, envflags | MDB_NOSUBDIR, 0664);
+	if (rc) {
+		printf("mdb_env_open failed, error %d %s\n", rc, mdb_strerror(rc));
+		return rc;
+	}
+	rc = mdb_txn_begin(env, NULL, 0, &txn);
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	if (cmp)
+		mdb_set_compare(txn, dbi, cmp);
+	rc = mdb_txn_commit(txn);
+
+	/* Add the entries in a scattered order, like a DIT that grew
+	 * over time, 10000 per txn.
+	 */
+	memset(dval, 'x', sizeof(dval));
+	key.mv_data = kval;
+	data.mv_size = 8;
+	data.mv_data = dval;
+	t0 = now();
+	for (i=0; i<n && !rc; i++) {
+		if (i % 10000 == 0 && (rc = mdb_txn_begin(env, NULL, 0, &txn)))
+			break;
+		key.mv_size = dn(kval, (int)(((long)i * 7919 + 13) % n));
+		rc = mdb_put(txn, dbi, &key, &data, 0);
+		if (rc)
+			mdb_txn_abort(txn);
+		else if (i % 10000 == 9999 || i == n-1)
+			rc = mdb_txn_commit(txn);
+	}
+	t1 = now();
+
+	/* Look every entry up in a different scattered order */
+	if (!rc)
+		rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (!rc) {
+		for (i=0; i<n && !rc; i++) {
+			key.mv_size = dn(kval, (int)(((long)i * 104729 + 7) % n));
+			rc = mdb_get(txn, dbi, &key, &data);
+		}
+		t2 = now();
+		mdb_stat(txn, dbi, &mst);
+		mdb_txn_abort(txn);
+	}
+	if (rc) {
+		printf("%s: failed after %d entries, error %d %s\n", name, i, rc,
+			mdb_strerror(rc));
+	} else {
+		printf("%-10s loaded %d entries in %.3fs, %.0f lookups/sec\n",
+			name, n, t1 - t0, n / (t2 - t1));
+		printf("%-10s depth %u, %zu branch pages, %zu leaf pages\n",
+			name, mst.ms_depth, mst.ms_branch_pages, mst.ms_leaf_pages);
+	}
+
+	mdb_close(env, dbi);
+	mdb_env_close(env);
+	if (!rc && !stat(DBPATH, &st))
+		printf("%-10s data file is %ld KB\n", name, (long)(st.st_size / 1024));
+	unlink(DBPATH);
+	unlink(DBPATH "-lock");
+	return rc;
+}
+
+int main(int argc,char * argv[])
+{
+	int i, rc;
+
+	while ((i = getopt(argc, argv, "c:dmn:S")) != EOF) {
+		switch(i) {
+		case 'c':
+			nputs = atoi(optarg);
+			break;
+		case 'd':
+			dit = 1;
+			ntxns = 1000000;
+			break;
+		case 'm':
+			modify = 1;
+			break;
+		case 'n':
+			ntxns = atoi(optarg);
+			break;
+		case 'S':
+			envflags &= ~MDB_NOSYNC;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n txns] [-c puts/txn] [-m|-d] [-S]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	if (dit) {
+		rc = rundit("short", NULL);
+		rc |= rundit("full", fullcmp);
+		return rc ? 1 : 0;
+	}
+
+	rc = run("default", envflags);
+	if (!modify) {
+		/* with a writable map the file is always the full map size */
+		rc |= run("writemap", envflags | MDB_WRITEMAP);
+		rc |= run("mapasync", envflags | MDB_WRITEMAP | MDB_MAPASYNC);
+	}
+
+	return rc ? 1 : 0;
+}
@@ -49,6 +49,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdarg.h>
 #include <stddef.h>
 #include <inttypes.h>
 #include <stdio.h>
@@ -153,6 +154,18 @@
 #define GET_PAGESIZE(x) {SYSTEM_INFO si; GetSystemInfo(&si); (x) = si.dwPageSize;}
 #define	close(fd)	CloseHandle(fd)
 #define	munmap(ptr,len)	UnmapViewOfFile(ptr)
+#define	MDB_MSYNC(addr,len,flags)	(!FlushViewOfFile(addr,len))
+#define	MS_SYNC	1
+#define	MS_ASYNC	0
+#define	THREAD_RET	DWORD WINAPI
+#define	THREAD_CREATE(thr,start,arg)	(((thr)=CreateThread(NULL,0,start,arg,0,NULL)) ? 0 : ErrCode())
+#define	THREAD_FINISH(thr)	(WaitForSingleObject(thr, INFINITE), CloseHandle(thr))
+#define	THREAD_PAUSE()	Sleep(1)
+#define	MUTEX_INIT(mx)	(((mx)=CreateMutex(NULL,FALSE,NULL)) ? 0 : ErrCode())
+#define	MUTEX_FREE(mx)	CloseHandle(mx)
+#define	MUTEX_LOCK(mx)	pthread_mutex_lock(mx)
+#define	MUTEX_UNLOCK(mx)	pthread_mutex_unlock(mx)
+typedef HANDLE	mdb_thread_t;
 #else
 #ifdef USE_POSIX_SEM
 #define LOCK_MUTEX_R(env)	sem_wait((env)->me_rmutex)
@@ -202,6 +215,27 @@
 	 *	fundamental to the use of memory-mapped files.
 	 */
 #define	GET_PAGESIZE(x)	((x) = sysconf(_SC_PAGE_SIZE))
+
+	/** Flush a range of the memory map to disk.
+	 *	Only used when the map is writable, see #MDB_WRITEMAP.
+	 */
+#define	MDB_MSYNC(addr,len,flags)	msync(addr,len,flags)
+
+	/** @name Threads and private mutexes
+	 *	Used by #mdb_verify() to check a database with several threads.
+	 *	@{
+	 */
+#define	THREAD_RET	void *
+#define	THREAD_CREATE(thr,start,arg)	pthread_create(&(thr),NULL,start,arg)
+#define	THREAD_FINISH(thr)	pthread_join(thr,NULL)
+	/** Wait a little while for another thread to make progress */
+#define	THREAD_PAUSE()	usleep(1000)
+#define	MUTEX_INIT(mx)	pthread_mutex_init(&(mx),NULL)
+#define	MUTEX_FREE(mx)	pthread_mutex_destroy(&(mx))
+#define	MUTEX_LOCK(mx)	pthread_mutex_lock(&(mx))
+#define	MUTEX_UNLOCK(mx)	pthread_mutex_unlock(&(mx))
+typedef pthread_t	mdb_thread_t;
+	/** @} */
 #endif
 
 #if defined(_WIN32) || defined(USE_POSIX_SEM)
@@ -316,6 +350,13 @@ static txnid_t mdb_debug_start;
 	/**	The version number for a database's file format. */
 #define MDB_VERSION	 1
 
+	/**	The file format of an environment created with #MDB_CHECKSUM.
+	 *	Its pages are laid out as in #MDB_VERSION, except that the last
+	 *	8 bytes of each page, or of each run of overflow pages, hold
+	 *	the checksum. Older versions of the library refuse to open it.
+	 */
+#define MDB_VERSION_CKSUM	 2
+
 	/**	The maximum size of a key in the database.
 	 *	While data items have essentially unbounded size, we require that
 	 *	keys all fit onto a regular page. This limit could be raised a bit
@@ -566,8 +607,8 @@ typedef struct MDB_page {
 #define SIZELEFT(p)	 (indx_t)((p)->mp_upper - (p)->mp_lower)
 
 	/** The percentage of space used in the page, in tenths of a percent. */
-#define PAGEFILL(env, p) (1000L * ((env)->me_psize - PAGEHDRSZ - SIZELEFT(p)) / \
-				((env)->me_psize - PAGEHDRSZ))
+#define PAGEFILL(env, p) (1000L * (PAGEROOM(env) - PAGEHDRSZ - SIZELEFT(p)) / \
+				(PAGEROOM(env) - PAGEHDRSZ))
 	/** The minimum page fill factor, in tenths of a percent.
 	 *	Pages emptier than this are candidates for merging.
 	 */
@@ -584,8 +625,24 @@ typedef struct MDB_page {
 	/** Test if a page is a sub page */
 #define IS_SUBP(p)	 F_ISSET((p)->mp_flags, P_SUBP)
 
+	/** The end of the space for nodes in a page, before the checksum
+	 *	trailer if the environment has #MDB_CHECKSUM.
+	 */
+#define PAGEROOM(env)	 ((env)->me_psize - (env)->me_ptrail)
+
+	/** The number of bytes a page spans, with the pages following an
+	 *	overflow page.
+	 */
+#define PAGESPAN(env, p)	 ((size_t)(env)->me_psize * \
+				(IS_OVERFLOW(p) ? (p)->mp_pages : 1))
+
+	/** The checksum trailer of a page, see #MDB_CHECKSUM */
+#define PAGECKSUM(env, p)	 (*(uint64_t *)((char *)(p) + \
+				PAGESPAN(env, p) - sizeof(uint64_t)))
+
 	/** The number of overflow pages needed to store the given size. */
-#define OVPAGES(size, psize)	((PAGEHDRSZ-1 + (size)) / (psize) + 1)
+#define OVPAGES(env, size)	((PAGEHDRSZ-1 + (env)->me_ptrail + (size)) / \
+				(env)->me_psize + 1)
 
 	/** Header for a single key/data pair within a page.
 	 * We guarantee 2-byte alignment for nodes.
@@ -870,18 +927,6 @@ typedef struct MDB_xcursor {
 	unsigned char mx_dbflag;
 } MDB_xcursor;
 
-	/** A set of pages freed by an earlier transaction. */
-typedef struct MDB_oldpages {
-	/** Usually we only read one record from the FREEDB at a time, but
-	 *	in case we read more, this will chain them together.
-	 */
-	struct MDB_oldpages *mo_next;
-	/**	The ID of the transaction in which these pages were freed. */
-	txnid_t		mo_txnid;
-	/** An #MDB_IDL of the pages */
-	pgno_t		mo_pages[1];	/* dynamic */
-} MDB_oldpages;
-
 	/** The database environment. */
 struct MDB_env {
 	HANDLE		me_fd;		/**< The main data file */
@@ -891,7 +936,9 @@ struct MDB_env {
 #define	MDB_FATAL_ERROR	0x80000000U
 	uint32_t 	me_flags;		/**< @ref mdb_env */
 	unsigned int	me_psize;	/**< size of a page, from #GET_PAGESIZE */
+	unsigned int	me_ptrail;	/**< bytes for the checksum at the end of a page */
 	unsigned int	me_maxreaders;	/**< size of the reader table */
+	pid_t		me_pid;		/**< process ID of this env */
 	MDB_dbi		me_numdbs;		/**< number of DBs opened */
 	MDB_dbi		me_maxdbs;		/**< size of the DB table */
 	char		*me_path;		/**< path to the DB files */
@@ -902,12 +949,14 @@ struct MDB_env {
 	size_t		me_mapsize;		/**< size of the data memory map */
 	off_t		me_size;		/**< current file size */
 	pgno_t		me_maxpg;		/**< me_mapsize / me_psize */
-	txnid_t		me_pgfirst;		/**< ID of first old page record we used */
 	txnid_t		me_pglast;		/**< ID of last old page record we used */
+	txnid_t		me_pgoldest;	/**< oldest reader seen by the last scan */
 	MDB_dbx		*me_dbxs;		/**< array of static DB info */
 	uint16_t	*me_dbflags;	/**< array of DB flags */
-	MDB_oldpages *me_pghead;	/**< list of old page records */
-	MDB_oldpages *me_pgfree;	/**< list of page records to free */
+	/** IDL of old pages reclaimed from the freelist, merged from
+	 *	all the records read so far and kept sorted.
+	 */
+	MDB_IDL		me_pghead;
 	pthread_key_t	me_txkey;	/**< thread-key for readers */
 	MDB_page	*me_dpages;		/**< list of malloc'd blocks for re-use */
 	/** IDL of pages that became unused in a write txn */
@@ -930,11 +979,12 @@ struct MDB_env {
 #define MDB_COMMIT_PAGES	IOV_MAX
 #endif
 
-static MDB_page *mdb_page_alloc(MDB_cursor *mc, int num);
-static MDB_page *mdb_page_new(MDB_cursor *mc, uint32_t flags, int num);
+static int  mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp);
+static int  mdb_page_new(MDB_cursor *mc, uint32_t flags, int num, MDB_page **mp);
 static int 		mdb_page_touch(MDB_cursor *mc);
 
 static int  mdb_page_get(MDB_txn *txn, pgno_t pgno, MDB_page **mp);
+static uint64_t	mdb_page_cksum(MDB_env *env, MDB_page *mp);
 static int  mdb_page_search_root(MDB_cursor *mc,
 			    MDB_val *key, int modify);
 #define MDB_PS_MODIFY	1
@@ -982,6 +1032,7 @@ static void	mdb_xcursor_init1(MDB_cursor *mc, MDB_node *node);
 
 static int	mdb_drop0(MDB_cursor *mc, int subs);
 static void mdb_default_cmp(MDB_txn *txn, MDB_dbi dbi);
+static void mdb_default_cmp0(uint16_t f, MDB_dbx *dbx);
 
 /** @cond */
 static MDB_cmp_func	mdb_cmp_memn, mdb_cmp_memnr, mdb_cmp_int, mdb_cmp_cint, mdb_cmp_long;
@@ -1008,9 +1059,11 @@ static char *const mdb_errstr[] = {
 	"MDB_KEYEXIST: Key/data pair already exists",
 	"MDB_NOTFOUND: No matching key/data pair found",
 	"MDB_PAGE_NOTFOUND: Requested page not found",
-	"MDB_CORRUPTED: Located page was wrong type",
+	"MDB_CORRUPTED: Located page was wrong type or damaged",
 	"MDB_PANIC: Update of meta page failed",
-	"MDB_VERSION_MISMATCH: Database environment version mismatch"
+	"MDB_VERSION_MISMATCH: Database environment version mismatch",
+	"MDB_MAP_FULL: Environment mapsize limit reached",
+	"MDB_MAP_RESIZED: Database contents grew beyond environment mapsize"
 };
 
 char *
@@ -1019,7 +1072,7 @@ mdb_strerror(int err)
 	if (!err)
 		return ("Successful return: 0");
 
-	if (err >= MDB_KEYEXIST && err <= MDB_VERSION_MISMATCH)
+	if (err >= MDB_KEYEXIST && err <= MDB_MAP_RESIZED)
 		return mdb_errstr[err - MDB_KEYEXIST];
 
 	return strerror(err);
@@ -1172,17 +1225,78 @@ mdb_page_malloc(MDB_cursor *mc) {
 	return ret;
 }
 
+/** Return a dirty page to the env's free page pool.
+ * Single pages are kept for reuse, large overflow pages are freed.
+ */
+static void
+mdb_dpage_free(MDB_env *env, MDB_page *dp)
+{
+	if (!IS_OVERFLOW(dp) || dp->mp_pages == 1) {
+		dp->mp_next = env->me_dpages;
+		VGMEMP_FREE(env, dp);
+		env->me_dpages = dp;
+	} else {
+		/* large pages just get freed directly */
+		VGMEMP_FREE(env, dp);
+		free(dp);
+	}
+}
+
+/** Look up a page in the dirty lists of a txn and its parents.
+ * A nested txn sees the uncommitted pages of all of its ancestors.
+ * @param[in] txn the write transaction to search from
+ * @param[in] pgno the page number to find
+ * @return the innermost dirty copy of the page, or NULL if no
+ *	txn in the chain has touched it.
+ */
+static MDB_page *
+mdb_dpage_find(MDB_txn *txn, pgno_t pgno)
+{
+	do {
+		MDB_ID2L dl = txn->mt_u.dirty_list;
+		if (dl[0].mid) {
+			unsigned x = mdb_mid2l_search(dl, pgno);
+			if (x <= dl[0].mid && dl[x].mid == pgno)
+				return dl[x].mptr;
+		}
+	} while ((txn = txn->mt_parent) != NULL);
+	return NULL;
+}
+
+/** Find the oldest txnid still in use by a reader.
+ * @param[in] txn the current write transaction
+ * @return the oldest snapshot txnid, or the last committed txnid
+ *	if there are no readers.
+ */
+static txnid_t
+mdb_find_oldest(MDB_txn *txn)
+{
+	MDB_reader *r = txn->mt_env->me_txns->mti_readers;
+	txnid_t oldest = txn->mt_txnid - 1;
+	unsigned int i;
+
+	for (i=0; i<txn->mt_env->me_txns->mti_numreaders; i++) {
+		txnid_t mr = r[i].mr_txnid;
+		if (mr && mr < oldest)
+			oldest = mr;
+	}
+	return oldest;
+}
+
 /** Allocate pages for writing.
  * If there are free pages available from older transactions, they
  * will be re-used first. Otherwise a new page will be allocated.
  * @param[in] mc cursor A cursor handle identifying the transaction and
  *	database for which we are allocating.
  * @param[in] num the number of pages to allocate.
- * @return Address of the allocated page(s). Requests for multiple pages
+ * @param[out] mp Address of the allocated page(s). Requests for multiple pages
  *  will always be satisfied by a single contiguous chunk of memory.
+ *  With #MDB_WRITEMAP the page is returned directly from the memory map.
+ * @return 0 on success, #MDB_MAP_FULL if the map has no room left,
+ *  or ENOMEM.
  */
-static MDB_page *
-mdb_page_alloc(MDB_cursor *mc, int num)
+static int
+mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 {
 	MDB_txn *txn = mc->mc_txn;
 	MDB_page *np;
@@ -1194,110 +1308,88 @@ mdb_page_alloc(MDB_cursor *mc, int num)
 	 * after txn 3 commits, and so will be safe to re-use in txn 4.
 	 */
 	if (txn->mt_txnid > 3) {
+		MDB_env *env = txn->mt_env;
+		pgno_t *mop = env->me_pghead;
+		unsigned int i, j, n;
 
-		if (!txn->mt_env->me_pghead &&
-			txn->mt_dbs[FREE_DBI].md_root != P_INVALID) {
-			/* See if there's anything in the free DB */
+		for (;;) {
 			MDB_cursor m2;
-			MDB_node *leaf;
-			MDB_val data;
-			txnid_t *kptr, oldest, last;
+			MDB_val key, data;
+			txnid_t last;
+			pgno_t *idl;
+			int rc;
+
+			/* Look for num contiguous pages. The list is sorted in
+			 * descending order; start at the tail so the lowest
+			 * pages get reused first and the file stays compact.
+			 */
+			if (mop && (n = mop[0]) >= (unsigned)num) {
+				for (i = n; i >= (unsigned)num; i--) {
+					j = i - num + 1;
+					if (mop[j] == mop[i] + num - 1) {
+						pgno = mop[i];
+						/* close the gap */
+						memmove(&mop[j], &mop[i+1], (n - i) * sizeof(pgno_t));
+						mop[0] = n - num;
+						break;
+					}
+				}
+				if (pgno != P_INVALID)
+					break;
+			}
+
+			/* While the freelist itself is being saved, the
+			 * records we have loaded must stay as they are.
+			 */
+			if (mc->mc_dbi == FREE_DBI ||
+				txn->mt_dbs[FREE_DBI].md_root == P_INVALID)
+				break;
 
+			/* Read the next record from the free DB */
 			mdb_cursor_init(&m2, txn, FREE_DBI, NULL);
-			if (!txn->mt_env->me_pgfirst) {
-				mdb_page_search(&m2, NULL, 0);
-				leaf = NODEPTR(m2.mc_pg[m2.mc_top], 0);
-				kptr = (txnid_t *)NODEKEY(leaf);
-				last = *kptr;
-			} else {
-				MDB_val key;
-				int rc, exact;
-again:
-				exact = 0;
-				last = txn->mt_env->me_pglast + 1;
-				leaf = NULL;
+			if (env->me_pglast) {
+				last = env->me_pglast + 1;
 				key.mv_data = &last;
 				key.mv_size = sizeof(last);
-				rc = mdb_cursor_set(&m2, &key, &data, MDB_SET, &exact);
-				if (rc)
-					goto none;
-				last = *(txnid_t *)key.mv_data;
+				rc = mdb_cursor_get(&m2, &key, &data, MDB_SET_RANGE);
+			} else {
+				rc = mdb_cursor_get(&m2, &key, &data, MDB_FIRST);
 			}
+			if (rc)
+				break;
+			last = *(txnid_t *)key.mv_data;
 
-			{
-				unsigned int i;
-				oldest = txn->mt_txnid - 1;
-				for (i=0; i<txn->mt_env->me_txns->mti_numreaders; i++) {
-					txnid_t mr = txn->mt_env->me_txns->mti_readers[i].mr_txnid;
-					if (mr && mr < oldest)
-						oldest = mr;
-				}
+			/* Only rescan the reader table when the cached
+			 * oldest reader would keep us from using this record.
+			 * A new reader always starts on the latest snapshot,
+			 * so the oldest reader never moves backwards.
+			 */
+			if (last >= env->me_pgoldest) {
+				env->me_pgoldest = mdb_find_oldest(txn);
+				if (last >= env->me_pgoldest)
+					break;
 			}
 
-			if (oldest > last) {
-				/* It's usable, grab it.
-				 */
-				MDB_oldpages *mop;
-				pgno_t *idl;
-
-				if (!txn->mt_env->me_pgfirst) {
-					mdb_node_read(txn, leaf, &data);
-				}
-				txn->mt_env->me_pglast = last;
-				if (!txn->mt_env->me_pgfirst)
-					txn->mt_env->me_pgfirst = last;
-				idl = (MDB_ID *) data.mv_data;
-				/* We might have a zero-length IDL due to freelist growth
-				 * during a prior commit
-				 */
-				if (!idl[0]) goto again;
-				mop = malloc(sizeof(MDB_oldpages) + MDB_IDL_SIZEOF(idl) - sizeof(pgno_t));
-				mop->mo_next = txn->mt_env->me_pghead;
-				mop->mo_txnid = last;
-				txn->mt_env->me_pghead = mop;
-				memcpy(mop->mo_pages, idl, MDB_IDL_SIZEOF(idl));
+			/* It's usable, grab it.
+			 */
+			idl = (MDB_ID *) data.mv_data;
+			if (!mop) {
+				if (!(env->me_pghead = mop = mdb_midl_alloc(idl[0])))
+					return ENOMEM;
+				mop[0] = 0;
+			}
+			if (mdb_midl_xmerge(&env->me_pghead, idl))
+				return ENOMEM;
+			mop = env->me_pghead;
+			env->me_pglast = last;
 
 #if MDB_DEBUG > 1
-				{
-					unsigned int i;
-					DPRINTF("IDL read txn %zu root %zu num %zu",
-						mop->mo_txnid, txn->mt_dbs[FREE_DBI].md_root, idl[0]);
-					for (i=0; i<idl[0]; i++) {
-						DPRINTF("IDL %zu", idl[i+1]);
-					}
-				}
-#endif
-			}
-		}
-none:
-		if (txn->mt_env->me_pghead) {
-			MDB_oldpages *mop = txn->mt_env->me_pghead;
-			if (num > 1) {
-				/* FIXME: For now, always use fresh pages. We
-				 * really ought to search the free list for a
-				 * contiguous range.
-				 */
-				;
-			} else {
-				/* peel pages off tail, so we only have to truncate the list */
-				pgno = MDB_IDL_LAST(mop->mo_pages);
-				if (MDB_IDL_IS_RANGE(mop->mo_pages)) {
-					mop->mo_pages[2]++;
-					if (mop->mo_pages[2] > mop->mo_pages[1])
-						mop->mo_pages[0] = 0;
-				} else {
-					mop->mo_pages[0]--;
-				}
-				if (MDB_IDL_IS_ZERO(mop->mo_pages)) {
-					txn->mt_env->me_pghead = mop->mo_next;
-					if (mc->mc_dbi == FREE_DBI) {
-						mop->mo_next = txn->mt_env->me_pgfree;
-						txn->mt_env->me_pgfree = mop;
-					} else {
-						free(mop);
-					}
-				}
+			DPRINTF("IDL read txn %zu root %zu num %zu",
+				last, txn->mt_dbs[FREE_DBI].md_root, idl[0]);
+			for (i=0; i<idl[0]; i++) {
+				DPRINTF("IDL %zu", idl[i+1]);
 			}
+#endif
 		}
 	}
 
@@ -1305,10 +1397,13 @@ none:
 		/* DB size is maxed out */
 		if (txn->mt_next_pgno + num >= txn->mt_env->me_maxpg) {
 			DPUTS("DB size maxed out");
-			return NULL;
+			return MDB_MAP_FULL;
 		}
 	}
-	if (txn->mt_env->me_dpages && num == 1) {
+	if (txn->mt_env->me_flags & MDB_WRITEMAP) {
+		np = (MDB_page *)(txn->mt_env->me_map + txn->mt_env->me_psize *
+			(pgno == P_INVALID ? txn->mt_next_pgno : pgno));
+	} else if (txn->mt_env->me_dpages && num == 1) {
 		np = txn->mt_env->me_dpages;
 		VGMEMP_ALLOC(txn->mt_env, np, txn->mt_env->me_psize);
 		VGMEMP_DEFINED(np, sizeof(np->mp_next));
@@ -1316,7 +1411,7 @@ none:
 	} else {
 		size_t sz = txn->mt_env->me_psize * num;
 		if ((np = malloc(sz)) == NULL)
-			return NULL;
+			return ENOMEM;
 		VGMEMP_ALLOC(txn->mt_env, np, sz);
 	}
 	if (pgno == P_INVALID) {
@@ -1328,8 +1423,9 @@ none:
 	mid.mid = np->mp_pgno;
 	mid.mptr = np;
 	mdb_mid2l_insert(txn->mt_u.dirty_list, &mid);
+	*mp = np;
 
-	return np;
+	return MDB_SUCCESS;
 }
 
 /** Copy a page: avoid copying unused portions of the page.
@@ -1365,14 +1461,15 @@ mdb_page_touch(MDB_cursor *mc)
 
 	if (!F_ISSET(mp->mp_flags, P_DIRTY)) {
 		MDB_page *np;
-		if ((np = mdb_page_alloc(mc, 1)) == NULL)
-			return ENOMEM;
+		int rc;
+		if ((rc = mdb_page_alloc(mc, 1, &np)))
+			return rc;
 		DPRINTF("touched db %u page %zu -> %zu", mc->mc_dbi, mp->mp_pgno, np->mp_pgno);
 		assert(mp->mp_pgno != np->mp_pgno);
 		mdb_midl_append(&mc->mc_txn->mt_free_pgs, mp->mp_pgno);
 		if (SIZELEFT(mp)) {
 			/* If page isn't full, just copy the used portion */
-			mdb_page_copy(np, mp, mc->mc_txn->mt_env->me_psize);
+			mdb_page_copy(np, mp, PAGEROOM(mc->mc_txn->mt_env));
 		} else {
 			pgno = np->mp_pgno;
 			memcpy(np, mp, mc->mc_txn->mt_env->me_psize);
@@ -1413,11 +1510,12 @@ finish:
 			SETPGNO(NODEPTR(mc->mc_pg[mc->mc_top-1], mc->mc_ki[mc->mc_top-1]), mp->mp_pgno);
 		else
 			mc->mc_db->md_root = mp->mp_pgno;
-	} else if (mc->mc_txn->mt_parent) {
+	} else if (mc->mc_txn->mt_parent && !IS_SUBP(mp)) {
 		MDB_page *np;
 		MDB_ID2 mid;
 		/* If txn has a parent, make sure the page is in our
-		 * dirty list.
+		 * dirty list. Sub-pages live inside their leaf page
+		 * and are never on a dirty list themselves.
 		 */
 		if (mc->mc_txn->mt_u.dirty_list[0].mid) {
 			unsigned x = mdb_mid2l_search(mc->mc_txn->mt_u.dirty_list, mp->mp_pgno);
@@ -1431,7 +1529,8 @@ finish:
 			}
 		}
 		/* No - copy it */
-		np = mdb_page_malloc(mc);
+		if ((np = mdb_page_malloc(mc)) == NULL)
+			return ENOMEM;
 		memcpy(np, mp, mc->mc_txn->mt_env->me_psize);
 		mid.mid = np->mp_pgno;
 		mid.mptr = np;
@@ -1447,7 +1546,16 @@ mdb_env_sync(MDB_env *env, int force)
 {
 	int rc = 0;
 	if (force || !F_ISSET(env->me_flags, MDB_NOSYNC)) {
-		if (MDB_FDATASYNC(env->me_fd))
+		if (env->me_flags & MDB_WRITEMAP) {
+			int flags = ((env->me_flags & MDB_MAPASYNC) && !force)
+				? MS_ASYNC : MS_SYNC;
+			if (MDB_MSYNC(env->me_map, env->me_mapsize, flags))
+				rc = ErrCode();
+#ifdef _WIN32
+			else if (flags == MS_SYNC && MDB_FDATASYNC(env->me_fd))
+				rc = ErrCode();
+#endif
+		} else if (MDB_FDATASYNC(env->me_fd))
 			rc = ErrCode();
 	}
 	return rc;
@@ -1528,12 +1636,26 @@ mdb_cursor_merge(MDB_txn *txn)
 					unsigned int j;
 					m2->mc_snum = mc->mc_snum;
 					m2->mc_top = mc->mc_top;
+					m2->mc_flags = (m2->mc_flags & C_ALLOCD) |
+						(mc->mc_flags & ~(C_SHADOW|C_ALLOCD));
 					for (j=0; j<mc->mc_snum; j++) {
 						m2->mc_pg[j] = mc->mc_pg[j];
 						m2->mc_ki[j] = mc->mc_ki[j];
 					}
+					if (mc->mc_xcursor) {
+						MDB_xcursor *mx = mc->mc_xcursor, *mx2 = m2->mc_xcursor;
+						mx2->mx_db = mx->mx_db;
+						mx2->mx_dbflag = mx->mx_dbflag;
+						mx2->mx_cursor.mc_snum = mx->mx_cursor.mc_snum;
+						mx2->mx_cursor.mc_top = mx->mx_cursor.mc_top;
+						mx2->mx_cursor.mc_flags = mx->mx_cursor.mc_flags & ~C_SHADOW;
+						for (j=0; j<mx->mx_cursor.mc_snum; j++) {
+							mx2->mx_cursor.mc_pg[j] = mx->mx_cursor.mc_pg[j];
+							mx2->mx_cursor.mc_ki[j] = mx->mx_cursor.mc_ki[j];
+						}
+					}
 				}
-				if (mc->mc_flags & C_ALLOCD)
+				if (mc->mc_flags & (C_SHADOW|C_ALLOCD))
 					free(mc);
 			}
 		}
@@ -1584,6 +1706,11 @@ mdb_txn_renew0(MDB_txn *txn)
 		txn->mt_txnid = r->mr_txnid = env->me_txns->mti_txnid;
 		txn->mt_toggle = txn->mt_txnid & 1;
 		txn->mt_next_pgno = env->me_metas[txn->mt_toggle]->mm_last_pg+1;
+		/* another process grew the DB past our map */
+		if (txn->mt_next_pgno > env->me_maxpg) {
+			r->mr_txnid = 0;
+			return MDB_MAP_RESIZED;
+		}
 		txn->mt_u.reader = r;
 	} else {
 		LOCK_MUTEX_W(env);
@@ -1591,6 +1718,10 @@ mdb_txn_renew0(MDB_txn *txn)
 		txn->mt_txnid = env->me_txns->mti_txnid;
 		txn->mt_toggle = txn->mt_txnid & 1;
 		txn->mt_next_pgno = env->me_metas[txn->mt_toggle]->mm_last_pg+1;
+		if (txn->mt_next_pgno > env->me_maxpg) {
+			UNLOCK_MUTEX_W(env);
+			return MDB_MAP_RESIZED;
+		}
 		txn->mt_txnid++;
 #if MDB_DEBUG
 		if (txn->mt_txnid == mdb_debug_start)
@@ -1651,6 +1782,11 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 		if (parent->mt_child) {
 			return EINVAL;
 		}
+		/* child txns can't keep private copies of pages
+		 * that live in a writable map
+		 */
+		if (env->me_flags & MDB_WRITEMAP)
+			return EINVAL;
 	}
 	size = sizeof(MDB_txn) + env->me_maxdbs * (sizeof(MDB_db)+1);
 	if (!(flags & MDB_RDONLY))
@@ -1671,14 +1807,14 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 	txn->mt_env = env;
 
 	if (parent) {
-		txn->mt_free_pgs = mdb_midl_alloc();
+		txn->mt_free_pgs = mdb_midl_alloc(MDB_IDL_UM_MAX);
 		if (!txn->mt_free_pgs) {
 			free(txn);
 			return ENOMEM;
 		}
 		txn->mt_u.dirty_list = malloc(sizeof(MDB_ID2)*MDB_IDL_UM_SIZE);
 		if (!txn->mt_u.dirty_list) {
-			free(txn->mt_free_pgs);
+			mdb_midl_free(txn->mt_free_pgs);
 			free(txn);
 			return ENOMEM;
 		}
@@ -1693,8 +1829,12 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 		txn->mt_dbxs = parent->mt_dbxs;
 		memcpy(txn->mt_dbs, parent->mt_dbs, txn->mt_numdbs * sizeof(MDB_db));
 		memcpy(txn->mt_dbflags, parent->mt_dbflags, txn->mt_numdbs);
-		mdb_cursor_shadow(parent, txn);
-		rc = 0;
+		rc = mdb_cursor_shadow(parent, txn);
+		if (rc) {
+			mdb_txn_reset0(txn);
+			free(txn);
+			return rc;
+		}
 	} else {
 		rc = mdb_txn_renew0(txn);
 	}
@@ -1710,6 +1850,13 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 	return rc;
 }
 
+size_t
+mdb_txn_id(MDB_txn *txn)
+{
+	if (!txn) return 0;
+	return txn->mt_txnid;
+}
+
 /** Common code for #mdb_txn_reset() and #mdb_txn_abort().
  * @param[in] txn the transaction handle to reset
  */
@@ -1721,7 +1868,6 @@ mdb_txn_reset0(MDB_txn *txn)
 	if (F_ISSET(txn->mt_flags, MDB_TXN_RDONLY)) {
 		txn->mt_u.reader->mr_txnid = 0;
 	} else {
-		MDB_oldpages *mop;
 		MDB_page *dp;
 		unsigned int i;
 
@@ -1731,29 +1877,61 @@ mdb_txn_reset0(MDB_txn *txn)
 				MDB_cursor *mc;
 				while ((mc = txn->mt_cursors[i])) {
 					txn->mt_cursors[i] = mc->mc_next;
-					if (mc->mc_flags & C_ALLOCD)
+					/* shadows are private copies, the parent's
+					 * cursors are left as they were.
+					 */
+					if (mc->mc_flags & (C_SHADOW|C_ALLOCD))
 						free(mc);
 				}
 			}
 		}
 
-		/* return all dirty pages to dpage list */
-		for (i=1; i<=txn->mt_u.dirty_list[0].mid; i++) {
-			dp = txn->mt_u.dirty_list[i].mptr;
-			if (!IS_OVERFLOW(dp) || dp->mp_pages == 1) {
-				dp->mp_next = txn->mt_env->me_dpages;
-				VGMEMP_FREE(txn->mt_env, dp);
-				txn->mt_env->me_dpages = dp;
-			} else {
-				/* large pages just get freed directly */
-				VGMEMP_FREE(txn->mt_env, dp);
-				free(dp);
+		if (txn->mt_parent) {
+			MDB_txn *parent = txn->mt_parent;
+			MDB_IDL idl = NULL;
+
+			/* Pages we took from me_pghead must go back there,
+			 * or they would be lost until the next free DB load.
+			 * They are the ones below the parent's next_pgno that
+			 * are not simply our copies of an ancestor's page.
+			 */
+			for (i=txn->mt_u.dirty_list[0].mid; i>0; i--) {
+				pgno_t pg = txn->mt_u.dirty_list[i].mid;
+				int j, num;
+				if (pg >= parent->mt_next_pgno || mdb_dpage_find(parent, pg))
+					continue;
+				dp = txn->mt_u.dirty_list[i].mptr;
+				num = IS_OVERFLOW(dp) ? dp->mp_pages : 1;
+				if (!idl) {
+					if (!(idl = mdb_midl_alloc(MDB_IDL_UM_MAX)))
+						break;
+					idl[0] = 0;
+				}
+				for (j=num-1; j>=0 && idl[0] < MDB_IDL_UM_MAX; j--)
+					idl[++idl[0]] = pg + j;
 			}
+			if (idl) {
+				if (idl[0]) {
+					if (!env->me_pghead) {
+						if ((env->me_pghead = mdb_midl_alloc(idl[0])))
+							env->me_pghead[0] = 0;
+					}
+					if (env->me_pghead)
+						mdb_midl_xmerge(&env->me_pghead, idl);
+				}
+				mdb_midl_free(idl);
+			}
+		}
+
+		/* return all dirty pages to dpage list */
+		if (!(env->me_flags & MDB_WRITEMAP)) {
+			for (i=1; i<=txn->mt_u.dirty_list[0].mid; i++)
+				mdb_dpage_free(env, txn->mt_u.dirty_list[i].mptr);
 		}
 
 		if (txn->mt_parent) {
 			txn->mt_parent->mt_child = NULL;
-			free(txn->mt_free_pgs);
+			mdb_midl_free(txn->mt_free_pgs);
 			free(txn->mt_u.dirty_list);
 			return;
 		} else {
@@ -1761,12 +1939,11 @@ mdb_txn_reset0(MDB_txn *txn)
 				env->me_free_pgs = txn->mt_free_pgs;
 		}
 
-		while ((mop = txn->mt_env->me_pghead)) {
-			txn->mt_env->me_pghead = mop->mo_next;
-			free(mop);
+		if (env->me_pghead) {
+			mdb_midl_free(env->me_pghead);
+			env->me_pghead = NULL;
 		}
-		txn->mt_env->me_pgfirst = 0;
-		txn->mt_env->me_pglast = 0;
+		env->me_pglast = 0;
 
 		env->me_txn = NULL;
 		/* The writer mutex was locked in mdb_txn_begin. */
@@ -1846,56 +2023,63 @@ mdb_txn_commit(MDB_txn *txn)
 		return EINVAL;
 	}
 
-	/* Merge (and close) our cursors with parent's */
-	mdb_cursor_merge(txn);
-
 	if (txn->mt_parent) {
-		MDB_db *ip, *jp;
-		MDB_dbi i;
-		unsigned x, y;
+		MDB_txn *parent = txn->mt_parent;
+		unsigned x, y, len;
 		MDB_ID2L dst, src;
 
-		/* Update parent's DB table */
-		ip = &txn->mt_parent->mt_dbs[2];
-		jp = &txn->mt_dbs[2];
-		for (i = 2; i < txn->mt_numdbs; i++) {
-			if (ip->md_root != jp->md_root)
-				*ip = *jp;
-			ip++; jp++;
+		/* Make sure the merged dirty list will fit before we
+		 * change anything in the parent.
+		 */
+		dst = parent->mt_u.dirty_list;
+		src = txn->mt_u.dirty_list;
+		len = dst[0].mid;
+		for (x=1, y=1; y<=src[0].mid; y++) {
+			while (x <= dst[0].mid && dst[x].mid < src[y].mid) x++;
+			if (x > dst[0].mid || dst[x].mid != src[y].mid)
+				len++;
+		}
+		if (len >= MDB_IDL_UM_MAX ||
+			mdb_midl_append_list(&parent->mt_free_pgs, txn->mt_free_pgs)) {
+			mdb_txn_abort(txn);
+			return ENOMEM;
 		}
-		txn->mt_parent->mt_numdbs = txn->mt_numdbs;
-
-		/* Append our free list to parent's */
-		mdb_midl_append_list(&txn->mt_parent->mt_free_pgs,
-			txn->mt_free_pgs);
 		mdb_midl_free(txn->mt_free_pgs);
 
-		/* Merge our dirty list with parent's */
-		dst = txn->mt_parent->mt_u.dirty_list;
-		src = txn->mt_u.dirty_list;
-		x = mdb_mid2l_search(dst, src[1].mid);
-		for (y=1; y<=src[0].mid; y++) {
-			while (x <= dst[0].mid && dst[x].mid != src[y].mid) x++;
-			if (x > dst[0].mid)
-				break;
-			free(dst[x].mptr);
-			dst[x].mptr = src[y].mptr;
-		}
+		/* Merge (and close) our cursors with parent's */
+		mdb_cursor_merge(txn);
+
+		/* Update parent's DB table, including the main and free DBs */
+		memcpy(parent->mt_dbs, txn->mt_dbs, txn->mt_numdbs * sizeof(MDB_db));
+		memcpy(parent->mt_dbflags, txn->mt_dbflags, txn->mt_numdbs);
+		parent->mt_numdbs = txn->mt_numdbs;
+		parent->mt_next_pgno = txn->mt_next_pgno;
+
+		/* Merge our dirty list with parent's, both are sorted.
+		 * Fill in from the tail; where both have a page, ours is
+		 * the newer copy and the parent's is released.
+		 */
 		x = dst[0].mid;
-		for (; y<=src[0].mid; y++) {
-			if (++x >= MDB_IDL_UM_MAX) {
-				mdb_txn_abort(txn);
-				return ENOMEM;
+		y = src[0].mid;
+		dst[0].mid = len;
+		while (y) {
+			if (x && dst[x].mid > src[y].mid) {
+				dst[len--] = dst[x--];
+			} else {
+				if (x && dst[x].mid == src[y].mid)
+					mdb_dpage_free(env, dst[x--].mptr);
+				dst[len--] = src[y--];
 			}
-			dst[x] = src[y];
 		}
-		dst[0].mid = x;
 		free(txn->mt_u.dirty_list);
-		txn->mt_parent->mt_child = NULL;
+		parent->mt_child = NULL;
 		free(txn);
 		return MDB_SUCCESS;
 	}
 
+	/* Close our cursors */
+	mdb_cursor_merge(txn);
+
 	if (txn != env->me_txn) {
 		DPUTS("attempt to commit unknown transaction");
 		mdb_txn_abort(txn);
@@ -1927,31 +2111,27 @@ mdb_txn_commit(MDB_txn *txn)
 
 	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
 
-	/* should only be one record now */
-	if (env->me_pghead) {
-		/* make sure first page of freeDB is touched and on freelist */
-		mdb_page_search(&mc, NULL, MDB_PS_MODIFY);
-	}
-
-	/* Delete IDLs we used from the free list */
-	if (env->me_pgfirst) {
-		txnid_t cur;
+	/* Delete the records we merged into me_pghead. They are
+	 * the first ones in the free DB, up to and including me_pglast.
+	 */
+	if (env->me_pglast) {
 		MDB_val key;
-		int exact = 0;
-
-		key.mv_size = sizeof(cur);
-		for (cur = env->me_pgfirst; cur <= env->me_pglast; cur++) {
-			key.mv_data = &cur;
 
-			mdb_cursor_set(&mc, &key, NULL, MDB_SET, &exact);
-			rc = mdb_cursor_del(&mc, 0);
+		for (;;) {
+			mc.mc_flags &= ~C_INITIALIZED;
+			rc = mdb_cursor_first(&mc, &key, NULL);
+			if (rc == MDB_NOTFOUND)
+				break;
+			if (rc == MDB_SUCCESS) {
+				if (*(txnid_t *)key.mv_data > env->me_pglast)
+					break;
+				rc = mdb_cursor_del(&mc, 0);
+			}
 			if (rc) {
 				mdb_txn_abort(txn);
 				return rc;
 			}
 		}
-		env->me_pgfirst = 0;
-		env->me_pglast = 0;
 	}
 
 	/* save to free list */
@@ -1995,49 +2175,40 @@ free2:
 			}
 		} while (freecnt != txn->mt_free_pgs[0]);
 	}
-	/* should only be one record now */
-again:
-	if (env->me_pghead) {
+	/* Put back the reclaimed pages we didn't use, as a single
+	 * record under the key of the last record we consumed. Saving
+	 * it may use up more of these pages, so repeat until the
+	 * stored list matches.
+	 */
+	if (env->me_pglast) {
 		MDB_val key, data;
-		MDB_oldpages *mop;
+		pgno_t *mop = env->me_pghead;
 		pgno_t orig;
-		txnid_t id;
+		int exact = 0;
 
-		mop = env->me_pghead;
-		id = mop->mo_txnid;
-		key.mv_size = sizeof(id);
-		key.mv_data = &id;
-		data.mv_size = MDB_IDL_SIZEOF(mop->mo_pages);
-		data.mv_data = mop->mo_pages;
-		orig = mop->mo_pages[0];
-		/* These steps may grow the freelist again
-		 * due to freed overflow pages...
-		 */
-		mdb_cursor_put(&mc, &key, &data, 0);
-		if (mop == env->me_pghead && env->me_pghead->mo_txnid == id) {
-			/* could have been used again here */
-			if (mop->mo_pages[0] != orig) {
-				data.mv_size = MDB_IDL_SIZEOF(mop->mo_pages);
-				data.mv_data = mop->mo_pages;
-				id = mop->mo_txnid;
-				mdb_cursor_put(&mc, &key, &data, 0);
+		key.mv_size = sizeof(env->me_pglast);
+		key.mv_data = &env->me_pglast;
+		for (;;) {
+			orig = mop[0];
+			if (!orig) {
+				/* all used up; drop the record if we wrote one */
+				rc = mdb_cursor_set(&mc, &key, NULL, MDB_SET, &exact);
+				if (rc == MDB_SUCCESS)
+					rc = mdb_cursor_del(&mc, 0);
+				else if (rc == MDB_NOTFOUND)
+					rc = MDB_SUCCESS;
+				break;
 			}
-			env->me_pghead = NULL;
-			free(mop);
-		} else {
-			/* was completely used up */
-			mdb_cursor_del(&mc, 0);
-			if (env->me_pghead)
-				goto again;
+			data.mv_size = MDB_IDL_SIZEOF(mop);
+			data.mv_data = mop;
+			rc = mdb_cursor_put(&mc, &key, &data, 0);
+			if (rc || mop[0] == orig)
+				break;
+		}
+		if (rc) {
+			mdb_txn_abort(txn);
+			return rc;
 		}
-		env->me_pgfirst = 0;
-		env->me_pglast = 0;
-	}
-
-	while (env->me_pgfree) {
-		MDB_oldpages *mop = env->me_pgfree;
-		env->me_pgfree = mop->mo_next;
-		free(mop);;
 	}
 
 	/* Check for growth of freelist again */
@@ -2053,6 +2224,29 @@ again:
 	mdb_audit(txn);
 #endif
 
+	/* The dirty flag isn't written out, so it must be cleared
+	 * before summing the page.
+	 */
+	if (env->me_flags & MDB_CHECKSUM) {
+		for (i=1; i<=txn->mt_u.dirty_list[0].mid; i++) {
+			dp = txn->mt_u.dirty_list[i].mptr;
+			dp->mp_flags &= ~P_DIRTY;
+			PAGECKSUM(env, dp) = mdb_page_cksum(env, dp);
+		}
+	}
+
+	if (env->me_flags & MDB_WRITEMAP) {
+		/* The dirty pages are already in the map, nothing to write.
+		 */
+		for (i=1; i<=txn->mt_u.dirty_list[0].mid; i++) {
+			dp = txn->mt_u.dirty_list[i].mptr;
+			dp->mp_flags &= ~P_DIRTY;
+			txn->mt_u.dirty_list[i].mid = 0;
+		}
+		txn->mt_u.dirty_list[0].mid = 0;
+		goto sync;
+	}
+
 	/* Commit up to MDB_COMMIT_PAGES dirty pages to disk until done.
 	 */
 	next = 0;
@@ -2161,6 +2355,7 @@ again:
 	}
 	txn->mt_u.dirty_list[0].mid = 0;
 
+sync:
 	if ((n = mdb_env_sync(env, 0)) != 0 ||
 	    (n = mdb_env_write_meta(txn)) != MDB_SUCCESS) {
 		mdb_txn_abort(txn);
@@ -2168,6 +2363,11 @@ again:
 	}
 
 done:
+	if (env->me_pghead) {
+		mdb_midl_free(env->me_pghead);
+		env->me_pghead = NULL;
+	}
+	env->me_pglast = 0;
 	env->me_txn = NULL;
 	if (txn->mt_numdbs > env->me_numdbs) {
 		/* update the DB flags */
@@ -2229,7 +2429,8 @@ mdb_env_read_header(MDB_env *env, MDB_meta *meta)
 		return EINVAL;
 	}
 
-	if (m->mm_version != MDB_VERSION) {
+	if (m->mm_version != ((m->mm_flags & MDB_CHECKSUM) ?
+		MDB_VERSION_CKSUM : MDB_VERSION)) {
 		DPRINTF("database is version %u, expected version %u",
 		    m->mm_version, MDB_VERSION);
 		return MDB_VERSION_MISMATCH;
@@ -2257,7 +2458,8 @@ mdb_env_init_meta(MDB_env *env, MDB_meta *meta)
 	GET_PAGESIZE(psize);
 
 	meta->mm_magic = MDB_MAGIC;
-	meta->mm_version = MDB_VERSION;
+	meta->mm_version = (env->me_flags & MDB_CHECKSUM) ?
+		MDB_VERSION_CKSUM : MDB_VERSION;
 	meta->mm_psize = psize;
 	meta->mm_last_pg = 1;
 	meta->mm_flags = env->me_flags & 0xffff;
@@ -2305,6 +2507,7 @@ mdb_env_write_meta(MDB_txn *txn)
 	MDB_meta	meta, metab;
 	off_t off;
 	int rc, len, toggle;
+	size_t mapsize;
 	char *ptr;
 #ifdef _WIN32
 	OVERLAPPED ov;
@@ -2323,15 +2526,50 @@ mdb_env_write_meta(MDB_txn *txn)
 	metab.mm_last_pg = env->me_metas[toggle]->mm_last_pg;
 
 	ptr = (char *)&meta;
-	off = offsetof(MDB_meta, mm_dbs[0].md_depth);
+	/* Record a grown map, so it is used by later opens and by
+	 * other processes. A smaller one is never recorded.
+	 */
+	mapsize = env->me_metas[!toggle]->mm_mapsize;
+	if (mapsize < env->me_mapsize)
+		mapsize = env->me_mapsize;
+	if (mapsize != env->me_metas[toggle]->mm_mapsize) {
+		meta.mm_mapsize = mapsize;
+		off = offsetof(MDB_meta, mm_mapsize);
+	} else {
+		off = offsetof(MDB_meta, mm_dbs[0].md_depth);
+	}
 	len = sizeof(MDB_meta) - off;
 
 	ptr += off;
 	meta.mm_dbs[0] = txn->mt_dbs[0];
 	meta.mm_dbs[1] = txn->mt_dbs[1];
+	/* these share the free DB's record */
+	meta.mm_psize = env->me_metas[toggle]->mm_psize;
+	meta.mm_flags = env->me_metas[toggle]->mm_flags;
 	meta.mm_last_pg = txn->mt_next_pgno - 1;
 	meta.mm_txnid = txn->mt_txnid;
 
+	if (env->me_flags & MDB_WRITEMAP) {
+		/* Update the meta page in place, then flush it */
+		memcpy((char *)env->me_metas[toggle] + off, ptr, len);
+		if (!(env->me_flags & (MDB_NOMETASYNC|MDB_NOSYNC))) {
+			int flags = (env->me_flags & MDB_MAPASYNC) ? MS_ASYNC : MS_SYNC;
+			ptr = env->me_map;
+			if (toggle)
+				ptr += env->me_psize;
+			if (MDB_MSYNC(ptr, env->me_psize, flags)) {
+				rc = ErrCode();
+				DPUTS("msync failed, disk error?");
+				/* Put the old values back so nobody uses the new meta */
+				env->me_metas[toggle]->mm_last_pg = metab.mm_last_pg;
+				env->me_metas[toggle]->mm_txnid = metab.mm_txnid;
+				env->me_flags |= MDB_FATAL_ERROR;
+				return rc;
+			}
+		}
+		goto done;
+	}
+
 	if (toggle)
 		off += env->me_psize;
 	off += PAGEHDRSZ;
@@ -2364,6 +2602,7 @@ mdb_env_write_meta(MDB_txn *txn)
 		env->me_flags |= MDB_FATAL_ERROR;
 		return rc;
 	}
+done:
 	/* Memory ordering issues are irrelevant; since the entire writer
 	 * is wrapped by wmutex, all of these changes will become visible
 	 * after the wmutex is unlocked. Since the DB is multi-version,
@@ -2394,7 +2633,7 @@ mdb_env_create(MDB_env **env)
 	if (!e)
 		return ENOMEM;
 
-	e->me_free_pgs = mdb_midl_alloc();
+	e->me_free_pgs = mdb_midl_alloc(MDB_IDL_UM_MAX);
 	if (!e->me_free_pgs) {
 		free(e);
 		return ENOMEM;
@@ -2409,11 +2648,126 @@ mdb_env_create(MDB_env **env)
 	return MDB_SUCCESS;
 }
 
+/** Map the data file into memory.
+ * With #MDB_WRITEMAP pages are written through the map, so the file
+ * is first extended to cover all of it.
+ * @param[in] env the environment handle, with me_mapsize set
+ * @param[in] addr the address to map at, or NULL to let the OS pick
+ * @param[in] grow non-zero if the file should first be extended to the
+ *	map size, where the OS requires that
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_env_map(MDB_env *env, void *addr, int grow)
+{
+	unsigned int flags = env->me_flags;
+#ifdef _WIN32
+	HANDLE mh;
+	LONG sizelo, sizehi;
+
+	sizelo = env->me_mapsize & 0xffffffff;
+	sizehi = env->me_mapsize >> 16;		/* pointless on WIN32, only needed on W64 */
+	sizehi >>= 16;
+	/* Windows won't create mappings for zero length files,
+	 * and a read-only mapping can't be larger than the file.
+	 * Just allocate the maxsize right now.
+	 */
+	if (grow) {
+		SetFilePointer(env->me_fd, sizelo, sizehi ? &sizehi : NULL, 0);
+		if (!SetEndOfFile(env->me_fd))
+			return ErrCode();
+		SetFilePointer(env->me_fd, 0, NULL, 0);
+	}
+	mh = CreateFileMapping(env->me_fd, NULL, (flags & MDB_WRITEMAP) ?
+		PAGE_READWRITE : PAGE_READONLY, sizehi, sizelo, NULL);
+	if (!mh)
+		return ErrCode();
+	env->me_map = MapViewOfFileEx(mh, (flags & MDB_WRITEMAP) ?
+		FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, env->me_mapsize,
+		addr);
+	CloseHandle(mh);
+	if (!env->me_map)
+		return ErrCode();
+#else
+	int prot = PROT_READ, mflags = MAP_SHARED;
+
+	if (flags & MDB_WRITEMAP) {
+		/* Pages will be written directly through the map, so
+		 * the file must cover all of it or we'll get SIGBUS.
+		 */
+		off_t size = lseek(env->me_fd, 0, SEEK_END);
+		if (size < 0)
+			return ErrCode();
+		if ((size_t)size < env->me_mapsize &&
+			ftruncate(env->me_fd, env->me_mapsize) < 0)
+			return ErrCode();
+		lseek(env->me_fd, 0, SEEK_SET);
+		prot |= PROT_WRITE;
+	}
+	if (addr && (flags & MDB_FIXEDMAP))
+		mflags |= MAP_FIXED;
+	env->me_map = mmap(addr, env->me_mapsize, prot, mflags,
+		env->me_fd, 0);
+	if (env->me_map == MAP_FAILED) {
+		env->me_map = NULL;
+		return ErrCode();
+	}
+#endif
+	return MDB_SUCCESS;
+}
+
 int
 mdb_env_set_mapsize(MDB_env *env, size_t size)
 {
-	if (env->me_map)
-		return EINVAL;
+	/* An open env gets a new map. Holding the write mutex keeps
+	 * our writers out; readers can't be stopped, the caller has
+	 * to make sure none of ours are running.
+	 */
+	if (env->me_map) {
+		MDB_meta *meta;
+		MDB_reader *r;
+		void *old = env->me_map;
+		size_t oldsize = env->me_mapsize, minsize;
+		unsigned int i;
+		int rc;
+
+		if (env->me_txn)
+			return EINVAL;
+		LOCK_MUTEX_W(env);
+		r = env->me_txns->mti_readers;
+		for (i=0; i<env->me_txns->mti_numreaders; i++) {
+			if (r[i].mr_pid == env->me_pid && r[i].mr_txnid) {
+				UNLOCK_MUTEX_W(env);
+				return EBUSY;
+			}
+		}
+		meta = env->me_metas[mdb_env_pick_meta(env)];
+		if (!size)
+			size = meta->mm_mapsize;
+		minsize = (meta->mm_last_pg + 1) * env->me_psize;
+		if (size < minsize)
+			size = minsize;
+		munmap(env->me_map, env->me_mapsize);
+		env->me_mapsize = size;
+		if (!(env->me_flags & MDB_FIXEDMAP))
+			old = NULL;
+		rc = mdb_env_map(env, old, !(env->me_flags & MDB_RDONLY));
+		if (rc) {
+			/* Try to get the old map back */
+			env->me_mapsize = oldsize;
+			if (mdb_env_map(env, old, 0)) {
+				env->me_flags |= MDB_FATAL_ERROR;
+				env->me_map = NULL;
+			}
+		}
+		if (env->me_map) {
+			env->me_metas[0] = METADATA((MDB_page *)env->me_map);
+			env->me_metas[1] = (MDB_meta *)((char *)env->me_metas[0] + env->me_psize);
+		}
+		env->me_maxpg = env->me_mapsize / env->me_psize;
+		UNLOCK_MUTEX_W(env);
+		return rc;
+	}
 	env->me_mapsize = size;
 	if (env->me_psize)
 		env->me_maxpg = env->me_mapsize / env->me_psize;
@@ -2452,7 +2806,7 @@ mdb_env_get_maxreaders(MDB_env *env, unsigned int *readers)
 static int
 mdb_env_open2(MDB_env *env, unsigned int flags)
 {
-	int i, newenv = 0;
+	int i, newenv = 0, usersize = env->me_mapsize != 0;
 	MDB_meta meta;
 	MDB_page *p;
 
@@ -2471,43 +2825,9 @@ mdb_env_open2(MDB_env *env, unsigned int flags)
 		env->me_mapsize = newenv ? DEFAULT_MAPSIZE : meta.mm_mapsize;
 	}
 
-#ifdef _WIN32
-	{
-		HANDLE mh;
-		LONG sizelo, sizehi;
-		sizelo = env->me_mapsize & 0xffffffff;
-		sizehi = env->me_mapsize >> 16;		/* pointless on WIN32, only needed on W64 */
-		sizehi >>= 16;
-		/* Windows won't create mappings for zero length files.
-		 * Just allocate the maxsize right now.
-		 */
-		if (newenv) {
-			SetFilePointer(env->me_fd, sizelo, sizehi ? &sizehi : NULL, 0);
-			if (!SetEndOfFile(env->me_fd))
-				return ErrCode();
-			SetFilePointer(env->me_fd, 0, NULL, 0);
-		}
-		mh = CreateFileMapping(env->me_fd, NULL, PAGE_READONLY,
-			sizehi, sizelo, NULL);
-		if (!mh)
-			return ErrCode();
-		env->me_map = MapViewOfFileEx(mh, FILE_MAP_READ, 0, 0, env->me_mapsize,
-			meta.mm_address);
-		CloseHandle(mh);
-		if (!env->me_map)
-			return ErrCode();
-	}
-#else
-	i = MAP_SHARED;
-	if (meta.mm_address && (flags & MDB_FIXEDMAP))
-		i |= MAP_FIXED;
-	env->me_map = mmap(meta.mm_address, env->me_mapsize, PROT_READ, i,
-		env->me_fd, 0);
-	if (env->me_map == MAP_FAILED) {
-		env->me_map = NULL;
-		return ErrCode();
-	}
-#endif
+	i = mdb_env_map(env, meta.mm_address, newenv);
+	if (i)
+		return i;
 
 	if (newenv) {
 		meta.mm_mapsize = env->me_mapsize;
@@ -2521,12 +2841,37 @@ mdb_env_open2(MDB_env *env, unsigned int flags)
 	}
 	env->me_psize = meta.mm_psize;
 
-	env->me_maxpg = env->me_mapsize / env->me_psize;
+	/* Whether pages carry checksums was fixed when the environment
+	 * was created.
+	 */
+	env->me_flags = (env->me_flags & ~MDB_CHECKSUM) |
+		(meta.mm_flags & MDB_CHECKSUM);
+	env->me_ptrail = (env->me_flags & MDB_CHECKSUM) ? sizeof(uint64_t) : 0;
+
+	env->me_maxpg = env->me_mapsize / env->me_psize;
 
 	p = (MDB_page *)env->me_map;
 	env->me_metas[0] = METADATA(p);
 	env->me_metas[1] = (MDB_meta *)((char *)env->me_metas[0] + meta.mm_psize);
 
+	/* The header we read may not be the newest meta, which can
+	 * record a larger map. And never map less than the data
+	 * already in use.
+	 */
+	if (!newenv) {
+		MDB_meta *m = env->me_metas[mdb_env_pick_meta(env)];
+		size_t size = usersize ? env->me_mapsize : m->mm_mapsize;
+		size_t minsize = (m->mm_last_pg + 1) * env->me_psize;
+		if (size < minsize)
+			size = minsize;
+		if (size != env->me_mapsize) {
+			DPRINTF("remapping with size %zu", size);
+			i = mdb_env_set_mapsize(env, size);
+			if (i)
+				return i;
+		}
+	}
+
 #if MDB_DEBUG
 	{
 		int toggle = mdb_env_pick_meta(env);
@@ -2562,6 +2907,108 @@ mdb_env_reader_dest(void *ptr)
 	reader->mr_tid = 0;
 }
 
+#ifdef _WIN32
+enum Pidlock_op {
+	Pidset, Pidcheck
+};
+#else
+enum Pidlock_op {
+	Pidset = F_SETLK, Pidcheck = F_GETLK
+};
+#endif
+
+/** Set or check a pid lock.
+ *	Every process using an environment holds a write lock on the
+ *	byte of the lock file whose offset is its process ID. The lock
+ *	is released by the OS however the process exits, so a reader
+ *	slot whose pid has no such lock belongs to a dead process.
+ *	Windows has no byte range lock that survives a query from the
+ *	owning process, so there the process handle is checked instead.
+ * @param[in] env the environment
+ * @param[in] op #Pidset to take our lock, #Pidcheck to test another pid
+ * @param[in] pid the process ID to lock or test
+ * @return 0 on success or if the process is alive, #MDB_NOTFOUND
+ *	if it is dead, otherwise an error code.
+ */
+static int
+mdb_reader_pid(MDB_env *env, enum Pidlock_op op, pid_t pid)
+{
+#ifdef _WIN32
+	HANDLE h;
+	int ret = 0;
+
+	if (op == Pidset)
+		return 0;
+	h = OpenProcess(SYNCHRONIZE, FALSE, pid);
+	if (!h)
+		return ErrCode() == ERROR_INVALID_PARAMETER ? MDB_NOTFOUND : 0;
+	if (WaitForSingleObject(h, 0) == WAIT_OBJECT_0)
+		ret = MDB_NOTFOUND;
+	CloseHandle(h);
+	return ret;
+#else
+	struct flock lock_info;
+	int rc;
+
+	memset((void *)&lock_info, 0, sizeof(lock_info));
+	lock_info.l_type = F_WRLCK;
+	lock_info.l_whence = SEEK_SET;
+	lock_info.l_start = pid;
+	lock_info.l_len = 1;
+	while ((rc = fcntl(env->me_lfd, op, &lock_info)) &&
+		(rc = ErrCode()) == EINTR) ;
+	if (rc)
+		return rc;
+	if (op == Pidcheck && lock_info.l_type == F_UNLCK)
+		return MDB_NOTFOUND;
+	return 0;
+#endif
+}
+
+int
+mdb_reader_check(MDB_env *env, int *dead)
+{
+	MDB_reader *mr;
+	unsigned int i, j;
+	pid_t pid;
+	int rc, count = 0;
+
+	if (!env)
+		return EINVAL;
+	if (dead)
+		*dead = 0;
+	if (!env->me_txns)
+		return MDB_SUCCESS;
+
+	mr = env->me_txns->mti_readers;
+	LOCK_MUTEX_R(env);
+	for (i=0; i<env->me_txns->mti_numreaders; i++) {
+		pid = mr[i].mr_pid;
+		if (!pid || pid == env->me_pid)
+			continue;
+		rc = mdb_reader_pid(env, Pidcheck, pid);
+		if (rc == MDB_NOTFOUND) {
+			/* clear every slot this process held */
+			DPRINTF("clearing stale reader slots of pid %u", (unsigned) pid);
+			for (j=i; j<env->me_txns->mti_numreaders; j++) {
+				if (mr[j].mr_pid == pid) {
+					mr[j].mr_txnid = 0;
+					mr[j].mr_tid = 0;
+					mr[j].mr_pid = 0;
+					count++;
+				}
+			}
+		} else if (rc) {
+			UNLOCK_MUTEX_R(env);
+			return rc;
+		}
+	}
+	UNLOCK_MUTEX_R(env);
+	if (dead)
+		*dead = count;
+	return MDB_SUCCESS;
+}
+
 #ifdef _WIN32
 /** Junk for arranging thread-specific callbacks on Windows. This is
  *	necessarily platform and compiler-specific. Windows supports up
@@ -3028,10 +3475,19 @@ mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mode_t mode)
 		sprintf(dpath, "%s" DATANAME, path);
 	}
 
+	/* a read-only environment can't write through the map */
+	if (flags & MDB_RDONLY)
+		flags &= ~MDB_WRITEMAP;
+
 	rc = mdb_env_setup_locks(env, lpath, mode, &excl);
 	if (rc)
 		goto leave;
 
+	env->me_pid = getpid();
+	rc = mdb_reader_pid(env, Pidset, env->me_pid);
+	if (rc)
+		goto leave;
+
 #ifdef _WIN32
 	if (F_ISSET(flags, MDB_RDONLY)) {
 		oflags = GENERIC_READ;
@@ -3057,7 +3513,7 @@ mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mode_t mode)
 	}
 
 	if ((rc = mdb_env_open2(env, flags)) == MDB_SUCCESS) {
-		if (flags & (MDB_RDONLY|MDB_NOSYNC|MDB_NOMETASYNC)) {
+		if (flags & (MDB_RDONLY|MDB_NOSYNC|MDB_NOMETASYNC|MDB_WRITEMAP)) {
 			env->me_mfd = env->me_fd;
 		} else {
 			/* synchronous fd for meta writes */
@@ -3087,6 +3543,9 @@ mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mode_t mode)
 #endif
 		if (excl)
 			mdb_env_share_locks(env);
+		else
+			/* free up slots left behind by crashed processes */
+			mdb_reader_check(env, NULL);
 		env->me_numdbs = 2;
 		env->me_dbxs = calloc(env->me_maxdbs, sizeof(MDB_dbx));
 		env->me_dbflags = calloc(env->me_maxdbs, sizeof(uint16_t));
@@ -3109,6 +3568,353 @@ leave:
 	return rc;
 }
 
+/** Size of the write buffer used by #mdb_env_copyfd() */
+#define MDB_WBUF	(1024*1024)
+
+/** State of an environment copy in progress. */
+typedef struct mdb_copy {
+	MDB_txn		*mc_txn;		/**< the snapshot being copied */
+	HANDLE		 mc_fd;			/**< where to write it */
+	char		*mc_wbuf;		/**< buffered output */
+	size_t		 mc_wlen;		/**< bytes in #mc_wbuf */
+	pgno_t		 mc_next_pgno;	/**< pgno of the next page written */
+} mdb_copy;
+
+/** Write an entire buffer to a file descriptor.
+ * @param[in] fd the file to write to
+ * @param[in] ptr the data to write
+ * @param[in] len the number of bytes to write
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_fd_write(HANDLE fd, const char *ptr, size_t len)
+{
+	while (len > 0) {
+		size_t chunk = len > 0x40000000 ? 0x40000000 : len;
+#ifdef _WIN32
+		DWORD w;
+		if (!WriteFile(fd, ptr, chunk, &w, NULL))
+			return ErrCode();
+#else
+		ssize_t w = write(fd, ptr, chunk);
+		if (w < 0) {
+			if (ErrCode() == EINTR)
+				continue;
+			return ErrCode();
+		}
+#endif
+		if (w == 0)
+			return EIO;
+		ptr += w;
+		len -= w;
+	}
+	return MDB_SUCCESS;
+}
+
+/** Append pages to a compacting copy, assigning them the next page numbers.
+ * @param[in] my the copy in progress
+ * @param[in] ptr the page(s) to write
+ * @param[in] num the number of pages
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_env_cput(mdb_copy *my, const void *ptr, pgno_t num)
+{
+	size_t len = num * my->mc_txn->mt_env->me_psize;
+	int rc = MDB_SUCCESS;
+
+	my->mc_next_pgno += num;
+	if (my->mc_wlen + len > MDB_WBUF) {
+		rc = mdb_fd_write(my->mc_fd, my->mc_wbuf, my->mc_wlen);
+		my->mc_wlen = 0;
+		if (rc)
+			return rc;
+	}
+	if (len >= MDB_WBUF)
+		return mdb_fd_write(my->mc_fd, ptr, len);
+	memcpy(my->mc_wbuf + my->mc_wlen, ptr, len);
+	my->mc_wlen += len;
+	return rc;
+}
+
+/** Copy a tree to a compacting copy, renumbering its pages.
+ *	Pages are written in post-order, so every page is written after
+ *	the pages it refers to and the root of the tree comes last.
+ * @param[in] my the copy in progress
+ * @param[in,out] pg the root of the tree; set to its new page number
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_env_cwalk(mdb_copy *my, pgno_t *pg)
+{
+	MDB_env *env = my->mc_txn->mt_env;
+	MDB_page *mp, *copy;
+	MDB_node *ni;
+	unsigned int i, nkeys;
+	int rc;
+
+	if ((rc = mdb_page_get(my->mc_txn, *pg, &mp)))
+		return rc;
+	if ((copy = malloc(env->me_psize)) == NULL)
+		return ENOMEM;
+	memcpy(copy, mp, env->me_psize);
+	nkeys = NUMKEYS(copy);
+
+	if (IS_BRANCH(copy)) {
+		for (i=0; i<nkeys; i++) {
+			pgno_t pgno;
+			ni = NODEPTR(copy, i);
+			pgno = NODEPGNO(ni);
+			if ((rc = mdb_env_cwalk(my, &pgno)))
+				goto done;
+			SETPGNO(ni, pgno);
+		}
+	} else if (!IS_LEAF2(copy)) {
+		for (i=0; i<nkeys; i++) {
+			ni = NODEPTR(copy, i);
+			if (ni->mn_flags & F_BIGDATA) {
+				MDB_page *omp, *op;
+				pgno_t pgno;
+				unsigned int n;
+				memcpy(&pgno, NODEDATA(ni), sizeof(pgno));
+				if ((rc = mdb_page_get(my->mc_txn, pgno, &omp)))
+					goto done;
+				pgno = my->mc_next_pgno;
+				/* only the first page has a header to update, but
+				 * a checksum covers the whole run and ends it
+				 */
+				n = (env->me_flags & MDB_CHECKSUM) ? omp->mp_pages : 1;
+				if ((op = malloc(n * env->me_psize)) == NULL) {
+					rc = ENOMEM;
+					goto done;
+				}
+				memcpy(op, omp, n * env->me_psize);
+				op->mp_pgno = pgno;
+				if (env->me_flags & MDB_CHECKSUM)
+					PAGECKSUM(env, op) = mdb_page_cksum(env, op);
+				rc = mdb_env_cput(my, op, n);
+				free(op);
+				if (rc)
+					goto done;
+				if (omp->mp_pages > n && (rc = mdb_env_cput(my,
+					(char *)omp + n * env->me_psize, omp->mp_pages - n)))
+					goto done;
+				memcpy(NODEDATA(ni), &pgno, sizeof(pgno));
+			} else if (ni->mn_flags & F_SUBDATA) {
+				/* a named database, or the sub-DB of a DUPSORT key */
+				MDB_db db;
+				memcpy(&db, NODEDATA(ni), sizeof(db));
+				if (db.md_root != P_INVALID) {
+					if ((rc = mdb_env_cwalk(my, &db.md_root)))
+						goto done;
+					memcpy(NODEDATA(ni), &db, sizeof(db));
+				}
+			}
+		}
+	}
+	*pg = my->mc_next_pgno;
+	copy->mp_pgno = *pg;
+	if (env->me_flags & MDB_CHECKSUM)
+		PAGECKSUM(env, copy) = mdb_page_cksum(env, copy);
+	rc = mdb_env_cput(my, copy, 1);
+done:
+	free(copy);
+	return rc;
+}
+
+/** Copy the environment, dropping free pages and the freelist.
+ * @param[in] env the environment to copy
+ * @param[in] txn a read-only snapshot of it
+ * @param[in] fd where to write the copy
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_env_copy_compact(MDB_env *env, MDB_txn *txn, HANDLE fd)
+{
+	mdb_copy my;
+	MDB_cursor mc;
+	MDB_val key, data;
+	MDB_page *mp;
+	MDB_meta *mm;
+	pgno_t freecount, root;
+	int rc, i;
+
+	/* Count the pages the copy will leave out, so that the meta
+	 * pages can be written up front and the rest streamed.
+	 */
+	freecount = txn->mt_dbs[FREE_DBI].md_branch_pages +
+		txn->mt_dbs[FREE_DBI].md_leaf_pages +
+		txn->mt_dbs[FREE_DBI].md_overflow_pages;
+	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
+	rc = mdb_cursor_first(&mc, &key, &data);
+	while (rc == MDB_SUCCESS) {
+		MDB_IDL idl = data.mv_data;
+		freecount += MDB_IDL_IS_RANGE(idl) ?
+			MDB_IDL_RANGE_LAST(idl) - MDB_IDL_RANGE_FIRST(idl) + 1 : idl[0];
+		rc = mdb_cursor_next(&mc, &key, &data, MDB_NEXT);
+	}
+	if (rc != MDB_NOTFOUND)
+		return rc;
+
+	my.mc_txn = txn;
+	my.mc_fd = fd;
+	my.mc_wlen = 0;
+	my.mc_next_pgno = 0;
+	if ((my.mc_wbuf = malloc(MDB_WBUF)) == NULL)
+		return ENOMEM;
+
+	if ((mp = calloc(2, env->me_psize)) == NULL) {
+		rc = ENOMEM;
+		goto leave;
+	}
+	root = txn->mt_dbs[MAIN_DBI].md_root;
+	for (i=0; i<2; i++) {
+		MDB_page *p = (MDB_page *)((char *)mp + i * env->me_psize);
+		p->mp_pgno = i;
+		p->mp_flags = P_META;
+		mm = METADATA(p);
+		*mm = *env->me_metas[txn->mt_toggle];
+		mm->mm_dbs[FREE_DBI].md_depth = 0;
+		mm->mm_dbs[FREE_DBI].md_branch_pages = 0;
+		mm->mm_dbs[FREE_DBI].md_leaf_pages = 0;
+		mm->mm_dbs[FREE_DBI].md_overflow_pages = 0;
+		mm->mm_dbs[FREE_DBI].md_entries = 0;
+		mm->mm_dbs[FREE_DBI].md_root = P_INVALID;
+		mm->mm_dbs[MAIN_DBI] = txn->mt_dbs[MAIN_DBI];
+		mm->mm_last_pg = txn->mt_next_pgno - 1 - freecount;
+		mm->mm_txnid = txn->mt_txnid;
+		/* the walk writes the main root last */
+		if (root != P_INVALID)
+			mm->mm_dbs[MAIN_DBI].md_root = mm->mm_last_pg;
+	}
+	rc = mdb_env_cput(&my, mp, 2);
+	if (rc == MDB_SUCCESS && root != P_INVALID)
+		rc = mdb_env_cwalk(&my, &root);
+	if (rc == MDB_SUCCESS && my.mc_wlen)
+		rc = mdb_fd_write(fd, my.mc_wbuf, my.mc_wlen);
+	if (rc == MDB_SUCCESS && my.mc_next_pgno != mm->mm_last_pg + 1) {
+		/* The freelist didn't account for every unused page.
+		 * Fix the meta pages if the output is seekable.
+		 */
+		DPRINTF("compacted copy has %zu pages, expected %zu",
+			my.mc_next_pgno, mm->mm_last_pg + 1);
+		for (i=0; i<2; i++) {
+			mm = METADATA((char *)mp + i * env->me_psize);
+			mm->mm_last_pg = my.mc_next_pgno - 1;
+			if (root != P_INVALID)
+				mm->mm_dbs[MAIN_DBI].md_root = root;
+		}
+#ifdef _WIN32
+		if (SetFilePointer(fd, 0, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+#else
+		if (lseek(fd, 0, SEEK_SET) != 0)
+#endif
+			rc = EIO;
+		else
+			rc = mdb_fd_write(fd, (char *)mp, 2 * env->me_psize);
+	}
+	free(mp);
+leave:
+	free(my.mc_wbuf);
+	return rc;
+}
+
+int
+mdb_env_copyfd(MDB_env *env, mdb_filehandle_t fd, unsigned int flags)
+{
+	MDB_txn *txn = NULL;
+	size_t wsize;
+	int rc;
+
+	if (!env || !env->me_map)
+		return EINVAL;
+
+	/* Do the lock/unlock of the reader mutex before starting the
+	 * write txn. Otherwise other read txns could block writers.
+	 */
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		return rc;
+
+	if (flags & MDB_CP_COMPACT) {
+		rc = mdb_env_copy_compact(env, txn, fd);
+		goto leave;
+	}
+
+	/* We must start the actual read txn after blocking writers */
+	mdb_txn_reset0(txn);
+
+	/* Temporarily block writers until we snapshot the meta pages */
+	LOCK_MUTEX_W(env);
+
+	rc = mdb_txn_renew0(txn);
+	if (rc) {
+		UNLOCK_MUTEX_W(env);
+		goto leave;
+	}
+
+	wsize = env->me_psize * 2;
+	rc = mdb_fd_write(fd, env->me_map, wsize);
+	UNLOCK_MUTEX_W(env);
+
+	if (rc == MDB_SUCCESS) {
+		/* The rest is protected by our read txn */
+		rc = mdb_fd_write(fd, env->me_map + wsize,
+			txn->mt_next_pgno * env->me_psize - wsize);
+	}
+
+leave:
+	mdb_txn_abort(txn);
+	return rc;
+}
+
+int
+mdb_env_copy(MDB_env *env, const char *path, unsigned int flags)
+{
+	int rc, len;
+	char *lpath;
+	HANDLE newfd = INVALID_HANDLE_VALUE;
+
+	if (!env || !path)
+		return EINVAL;
+
+	if (env->me_flags & MDB_NOSUBDIR) {
+		lpath = (char *)path;
+	} else {
+		len = strlen(path);
+		len += sizeof(DATANAME);
+		lpath = malloc(len);
+		if (!lpath)
+			return ENOMEM;
+		sprintf(lpath, "%s" DATANAME, path);
+	}
+
+	/* The destination path must exist, but the destination file must not.
+	 */
+#ifdef _WIN32
+	newfd = CreateFile(lpath, GENERIC_WRITE, 0, NULL, CREATE_NEW,
+				FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+	newfd = open(lpath, O_WRONLY|O_CREAT|O_EXCL, 0666);
+#endif
+	if (newfd == INVALID_HANDLE_VALUE) {
+		rc = ErrCode();
+		goto leave;
+	}
+
+	rc = mdb_env_copyfd(env, newfd, flags);
+	if (rc == MDB_SUCCESS && MDB_FDATASYNC(newfd))
+		rc = ErrCode();
+
+leave:
+	if (!(env->me_flags & MDB_NOSUBDIR))
+		free(lpath);
+	if (newfd != INVALID_HANDLE_VALUE)
+		close(newfd);
+
+	return rc;
+}
+
 void
 mdb_env_close(MDB_env *env)
 {
@@ -3419,7 +4225,32 @@ mdb_cursor_push(MDB_cursor *mc, MDB_page *mp)
 	return MDB_SUCCESS;
 }
 
+/** Compute the checksum of a page, see #MDB_CHECKSUM.
+ *	This is a Fletcher-style pair of sums over the 32-bit words of
+ *	the page, up to the checksum trailer at its end. The pages following
+ *	an overflow page are summed along with it.
+ * @param[in] env the environment the page belongs to.
+ * @param[in] mp the page to sum.
+ * @return the checksum.
+ */
+static uint64_t
+mdb_page_cksum(MDB_env *env, MDB_page *mp)
+{
+	uint32_t *w = (uint32_t *)mp;
+	uint32_t *end = (uint32_t *)((char *)mp + PAGESPAN(env, mp) -
+		sizeof(uint64_t));
+	uint64_t s1 = 1, s2 = 0;
+
+	for (; w < end; w++) {
+		s1 += *w;
+		s2 += s1;
+	}
+	return (s2 << 32) ^ s1;
+}
+
 /** Find the address of the page corresponding to a given page number.
+ *	With #MDB_VERIFY set, pages read from the map in an environment
+ *	with #MDB_CHECKSUM are checked before they are returned.
  * @param[in] txn the transaction for this access.
  * @param[in] pgno the page number for the page to retrieve.
  * @param[out] ret address of a pointer where the page's address will be stored.
@@ -3430,16 +4261,22 @@ mdb_page_get(MDB_txn *txn, pgno_t pgno, MDB_page **ret)
 {
 	MDB_page *p = NULL;
 
-	if (!F_ISSET(txn->mt_flags, MDB_TXN_RDONLY) && txn->mt_u.dirty_list[0].mid) {
-		unsigned x;
-		x = mdb_mid2l_search(txn->mt_u.dirty_list, pgno);
-		if (x <= txn->mt_u.dirty_list[0].mid && txn->mt_u.dirty_list[x].mid == pgno) {
-			p = txn->mt_u.dirty_list[x].mptr;
-		}
-	}
+	if (!F_ISSET(txn->mt_flags, MDB_TXN_RDONLY))
+		p = mdb_dpage_find(txn, pgno);
 	if (!p) {
-		if (pgno < txn->mt_next_pgno)
-			p = (MDB_page *)(txn->mt_env->me_map + txn->mt_env->me_psize * pgno);
+		if (pgno < txn->mt_next_pgno) {
+			MDB_env *env = txn->mt_env;
+			p = (MDB_page *)(env->me_map + env->me_psize * pgno);
+			if ((env->me_flags & (MDB_CHECKSUM|MDB_VERIFY)) ==
+				(MDB_CHECKSUM|MDB_VERIFY) &&
+				(p->mp_pgno != pgno || (IS_OVERFLOW(p) &&
+				(!p->mp_pages || pgno + p->mp_pages > txn->mt_next_pgno)) ||
+				PAGECKSUM(env, p) != mdb_page_cksum(env, p))) {
+				DPRINTF("page %zu is damaged", pgno);
+				*ret = NULL;
+				return MDB_CORRUPTED;
+			}
+		}
 	}
 	*ret = p;
 	if (!p) {
@@ -3953,8 +4790,14 @@ mdb_cursor_set(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 			}
 		}
 		if (!mc->mc_top) {
-			/* There are no other pages */
+			/* There are no other pages, and the key is below
+			 * the first node.
+			 */
 			mc->mc_ki[mc->mc_top] = 0;
+			if (op == MDB_SET_RANGE && !exactp) {
+				rc = 0;
+				goto set1;
+			}
 			return MDB_NOTFOUND;
 		}
 	}
@@ -4019,7 +4862,9 @@ set1:
 			if (rc) {
 				if (op == MDB_GET_BOTH || rc > 0)
 					return MDB_NOTFOUND;
+				rc = 0;
 			}
+			*data = d2;
 
 		} else {
 			if (mc->mc_xcursor)
@@ -4087,8 +4932,9 @@ mdb_cursor_last(MDB_cursor *mc, MDB_val *key, MDB_val *data)
 	int		 rc;
 	MDB_node	*leaf;
 
-	if (!(mc->mc_flags & C_EOF)) {
-
+	/* Always search again: C_EOF may be left over from an earlier
+	 * position that a put has since moved away from the end.
+	 */
 	if (!(mc->mc_flags & C_INITIALIZED) || mc->mc_top) {
 		MDB_val	lkey;
 
@@ -4102,7 +4948,6 @@ mdb_cursor_last(MDB_cursor *mc, MDB_val *key, MDB_val *data)
 
 	mc->mc_ki[mc->mc_top] = NUMKEYS(mc->mc_pg[mc->mc_top]) - 1;
 	mc->mc_flags |= C_INITIALIZED|C_EOF;
-	}
 	leaf = NODEPTR(mc->mc_pg[mc->mc_top], mc->mc_ki[mc->mc_top]);
 
 	if (IS_LEAF2(mc->mc_pg[mc->mc_top])) {
@@ -4162,9 +5007,17 @@ mdb_cursor_get(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 			rc = EINVAL;
 			break;
 		}
+		if (!(mc->mc_xcursor->mx_cursor.mc_flags & C_INITIALIZED)) {
+			/* A key with a single data item has no sub-DB,
+			 * return the item by itself.
+			 */
+			MDB_node *leaf = NODEPTR(mc->mc_pg[mc->mc_top],
+				mc->mc_ki[mc->mc_top]);
+			rc = mdb_node_read(mc->mc_txn, leaf, data);
+			break;
+		}
 		rc = MDB_SUCCESS;
-		if (!(mc->mc_xcursor->mx_cursor.mc_flags & C_INITIALIZED) ||
-			(mc->mc_xcursor->mx_cursor.mc_flags & C_EOF))
+		if (mc->mc_xcursor->mx_cursor.mc_flags & C_EOF)
 			break;
 		goto fetchm;
 	case MDB_NEXT_MULTIPLE:
@@ -4302,8 +5155,8 @@ mdb_cursor_put(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 		MDB_page *np;
 		/* new database, write a root leaf page */
 		DPUTS("allocating new root leaf page");
-		if ((np = mdb_page_new(mc, P_LEAF, 1)) == NULL) {
-			return ENOMEM;
+		if ((rc2 = mdb_page_new(mc, P_LEAF, 1, &np))) {
+			return rc2;
 		}
 		mc->mc_snum = 0;
 		mdb_cursor_push(mc, np);
@@ -4437,7 +5290,7 @@ reuse:
 				}
 				offset += offset & 1;
 				if (NODESIZE + sizeof(indx_t) + NODEKSZ(leaf) + NODEDSZ(leaf) +
-					offset >= (mc->mc_txn->mt_env->me_psize - PAGEHDRSZ) /
+					offset >= (PAGEROOM(mc->mc_txn->mt_env) - PAGEHDRSZ) /
 						MDB_MINKEYS) {
 					/* yes, convert it */
 					dummy.md_flags = 0;
@@ -4455,10 +5308,9 @@ reuse:
 					rdata = &xdata;
 					xdata.mv_size = sizeof(MDB_db);
 					xdata.mv_data = &dummy;
-					mp = mdb_page_alloc(mc, 1);
-					if (!mp)
-						return ENOMEM;
-					offset = mc->mc_txn->mt_env->me_psize - NODEDSZ(leaf);
+					if ((rc = mdb_page_alloc(mc, 1, &mp)))
+						return rc;
+					offset = PAGEROOM(mc->mc_txn->mt_env) - NODEDSZ(leaf);
 					flags |= F_DUPDATA|F_SUBDATA;
 					dummy.md_root = mp->mp_pgno;
 				} else {
@@ -4495,14 +5347,24 @@ current:
 		if (F_ISSET(leaf->mn_flags, F_BIGDATA)) {
 			MDB_page *omp;
 			pgno_t pg;
-			int ovpages, dpages;
+			int ovpages, dpages, writable;
 
-			ovpages = OVPAGES(NODEDSZ(leaf), mc->mc_txn->mt_env->me_psize);
-			dpages = OVPAGES(data->mv_size, mc->mc_txn->mt_env->me_psize);
+			ovpages = OVPAGES(mc->mc_txn->mt_env, NODEDSZ(leaf));
+			dpages = OVPAGES(mc->mc_txn->mt_env, data->mv_size);
 			memcpy(&pg, NODEDATA(leaf), sizeof(pg));
 			mdb_page_get(mc->mc_txn, pg, &omp);
+			writable = (omp->mp_flags & P_DIRTY) != 0;
+			/* A nested txn may only write pages in its own dirty
+			 * list, the ones it shares with its parent must stay
+			 * intact in case we abort.
+			 */
+			if (writable && mc->mc_txn->mt_parent) {
+				MDB_ID2L dl = mc->mc_txn->mt_u.dirty_list;
+				unsigned x = mdb_mid2l_search(dl, pg);
+				writable = x <= dl[0].mid && dl[x].mid == pg;
+			}
 			/* Is the ov page writable and large enough? */
-			if ((omp->mp_flags & P_DIRTY) && ovpages >= dpages) {
+			if (writable && ovpages >= dpages) {
 				/* yes, overwrite it. Note in this case we don't
 				 * bother to try shrinking the node if the new data
 				 * is smaller than the overflow threshold.
@@ -4615,6 +5477,8 @@ put_sub:
 						}
 					}
 				}
+				/* don't write it again on the next MDB_MULTIPLE item */
+				dkey.mv_size = 0;
 			}
 			if (flags & MDB_APPENDDUP)
 				xflags |= MDB_APPEND;
@@ -4700,20 +5564,22 @@ mdb_cursor_del(MDB_cursor *mc, unsigned int flags)
  * @param[in] flags flags defining what type of page is being allocated.
  * @param[in] num the number of pages to allocate. This is usually 1,
  * unless allocating overflow pages for a large record.
- * @return Address of a page, or NULL on failure.
+ * @param[out] mp Address of the new page(s).
+ * @return 0 on success, non-zero on failure.
  */
-static MDB_page *
-mdb_page_new(MDB_cursor *mc, uint32_t flags, int num)
+static int
+mdb_page_new(MDB_cursor *mc, uint32_t flags, int num, MDB_page **mp)
 {
 	MDB_page	*np;
+	int rc;
 
-	if ((np = mdb_page_alloc(mc, num)) == NULL)
-		return NULL;
+	if ((rc = mdb_page_alloc(mc, num, &np)))
+		return rc;
 	DPRINTF("allocated new mpage %zu, page size %u",
 	    np->mp_pgno, mc->mc_txn->mt_env->me_psize);
 	np->mp_flags = flags | P_DIRTY;
 	np->mp_lower = PAGEHDRSZ;
-	np->mp_upper = mc->mc_txn->mt_env->me_psize;
+	np->mp_upper = PAGEROOM(mc->mc_txn->mt_env);
 
 	if (IS_BRANCH(np))
 		mc->mc_db->md_branch_pages++;
@@ -4723,8 +5589,9 @@ mdb_page_new(MDB_cursor *mc, uint32_t flags, int num)
 		mc->mc_db->md_overflow_pages += num;
 		np->mp_pages = num;
 	}
+	*mp = np;
 
-	return np;
+	return 0;
 }
 
 /** Calculate the size of a leaf node.
@@ -4744,7 +5611,7 @@ mdb_leaf_size(MDB_env *env, MDB_val *key, MDB_val *data)
 	size_t		 sz;
 
 	sz = LEAFSIZE(key, data);
-	if (sz >= env->me_psize / MDB_MINKEYS) {
+	if (sz >= PAGEROOM(env) / MDB_MINKEYS) {
 		/* put on overflow page */
 		sz -= data->mv_size - sizeof(pgno_t);
 	}
@@ -4769,7 +5636,7 @@ mdb_branch_size(MDB_env *env, MDB_val *key)
 	size_t		 sz;
 
 	sz = INDXSIZE(key);
-	if (sz >= env->me_psize / MDB_MINKEYS) {
+	if (sz >= PAGEROOM(env) / MDB_MINKEYS) {
 		/* put on overflow page */
 		/* not implemented */
 		/* sz -= key->size - sizeof(pgno_t); */
@@ -4798,6 +5665,7 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
     MDB_val *key, MDB_val *data, pgno_t pgno, unsigned int flags)
 {
 	unsigned int	 i;
+	int		 rc;
 	size_t		 node_size = NODESIZE;
 	indx_t		 ofs;
 	MDB_node	*node;
@@ -4837,14 +5705,14 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
 		if (F_ISSET(flags, F_BIGDATA)) {
 			/* Data already on overflow page. */
 			node_size += sizeof(pgno_t);
-		} else if (node_size + data->mv_size >= mc->mc_txn->mt_env->me_psize / MDB_MINKEYS) {
-			int ovpages = OVPAGES(data->mv_size, mc->mc_txn->mt_env->me_psize);
+		} else if (node_size + data->mv_size >= PAGEROOM(mc->mc_txn->mt_env) / MDB_MINKEYS) {
+			int ovpages = OVPAGES(mc->mc_txn->mt_env, data->mv_size);
 			/* Put data on overflow page. */
 			DPRINTF("data size is %zu, node would be %zu, put data on overflow page",
 			    data->mv_size, node_size+data->mv_size);
 			node_size += sizeof(pgno_t);
-			if ((ofp = mdb_page_new(mc, P_OVERFLOW, ovpages)) == NULL)
-				return ENOMEM;
+			if ((rc = mdb_page_new(mc, P_OVERFLOW, ovpages, &ofp)))
+				return rc;
 			DPRINTF("allocated overflow page %zu", ofp->mp_pgno);
 			flags |= F_BIGDATA;
 		} else {
@@ -5755,7 +6623,7 @@ mdb_cursor_del0(MDB_cursor *mc, MDB_node *leaf)
 		pgno_t pg;
 
 		memcpy(&pg, NODEDATA(leaf), sizeof(pg));
-		ovpages = OVPAGES(NODEDSZ(leaf), mc->mc_txn->mt_env->me_psize);
+		ovpages = OVPAGES(mc->mc_txn->mt_env, NODEDSZ(leaf));
 		mc->mc_db->md_overflow_pages -= ovpages;
 		for (i=0; i<ovpages; i++) {
 			DPRINTF("freed ov page %zu", pg);
@@ -5815,6 +6683,27 @@ mdb_del(MDB_txn *txn, MDB_dbi dbi,
 	return rc;
 }
 
+/** Shorten the separator key of a leaf split.
+ *	With plain lexicographic ordering, the shortest prefix of the first
+ *	key of the right page that still sorts after the last key of the
+ *	left page separates the two pages just as well. Branch keys are
+ *	never returned to callers, so only the branch pages see the short
+ *	key, and they hold more of them.
+ * @param[in] lkey The last key of the left page.
+ * @param[in,out] sepkey The first key of the right page.
+ */
+static void
+mdb_sep_shorten(MDB_val *lkey, MDB_val *sepkey)
+{
+	unsigned char *l = lkey->mv_data, *r = sepkey->mv_data;
+	size_t i, n = lkey->mv_size < sepkey->mv_size ? lkey->mv_size : sepkey->mv_size;
+
+	for (i=0; i<n && l[i] == r[i]; i++)
+		;
+	if (i < sepkey->mv_size && (i == lkey->mv_size || r[i] > l[i]))
+		sepkey->mv_size = i + 1;
+}
+
 /** Split a page and insert a new node.
  * @param[in,out] mc Cursor pointing to the page and desired insertion index.
  * The cursor will be updated to point to the actual page and index where
@@ -5850,13 +6739,13 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 	    DKEY(newkey), mc->mc_ki[mc->mc_top]);
 
 	/* Create a right sibling. */
-	if ((rp = mdb_page_new(mc, mp->mp_flags, 1)) == NULL)
-		return ENOMEM;
+	if ((rc = mdb_page_new(mc, mp->mp_flags, 1, &rp)))
+		return rc;
 	DPRINTF("new right sibling: page %zu", rp->mp_pgno);
 
 	if (mc->mc_snum < 2) {
-		if ((pp = mdb_page_new(mc, P_BRANCH, 1)) == NULL)
-			return ENOMEM;
+		if ((rc = mdb_page_new(mc, P_BRANCH, 1, &pp)))
+			return rc;
 		/* shift current top to make room for new parent */
 		mc->mc_pg[1] = mc->mc_pg[0];
 		mc->mc_ki[1] = mc->mc_ki[0];
@@ -5957,7 +6846,7 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 	if (IS_LEAF(mp)) {
 		unsigned int psize, nsize;
 		/* Maximum free space in an empty page */
-		pmax = mc->mc_txn->mt_env->me_psize - PAGEHDRSZ;
+		pmax = PAGEROOM(mc->mc_txn->mt_env) - PAGEHDRSZ;
 		nsize = mdb_leaf_size(mc->mc_txn->mt_env, newkey, newdata);
 		if ((nkeys < 20) || (nsize > pmax/4)) {
 			if (newindx <= split_indx) {
@@ -6013,6 +6902,25 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 	}
 
 newsep:
+	if (IS_LEAF(mp) && mc->mc_dbx->md_cmp == mdb_cmp_memn) {
+		MDB_val lkey;
+		/* Find the last key staying on the left page. LEAF2 keys
+		 * have already been moved, other nodes not yet.
+		 */
+		lkey.mv_data = NULL;
+		if (IS_LEAF2(mp)) {
+			lkey.mv_size = mc->mc_db->md_pad;
+			lkey.mv_data = LEAF2KEY(mp, NUMKEYS(mp) - 1, lkey.mv_size);
+		} else if (newindx == split_indx && !newpos && !(nflags & MDB_APPEND)) {
+			lkey = *newkey;
+		} else if (split_indx) {
+			node = NODEPTR(mp, split_indx - 1);
+			lkey.mv_size = NODEKSZ(node);
+			lkey.mv_data = NODEKEY(node);
+		}
+		if (lkey.mv_data)
+			mdb_sep_shorten(&lkey, &sepkey);
+	}
 	DPRINTF("separator is [%s]", DKEY(&sepkey));
 
 	/* Copy separator key to the parent.
@@ -6078,7 +6986,7 @@ newsep:
 	copy->mp_pgno  = mp->mp_pgno;
 	copy->mp_flags = mp->mp_flags;
 	copy->mp_lower = PAGEHDRSZ;
-	copy->mp_upper = mc->mc_txn->mt_env->me_psize;
+	copy->mp_upper = PAGEROOM(mc->mc_txn->mt_env);
 	mc->mc_pg[mc->mc_top] = copy;
 	for (i = j = 0; i <= nkeys; j++) {
 		if (i == split_indx) {
@@ -6136,7 +7044,7 @@ newsep:
 	mp->mp_lower = copy->mp_lower;
 	mp->mp_upper = copy->mp_upper;
 	memcpy(NODEPTR(mp, nkeys-1), NODEPTR(copy, nkeys-1),
-		mc->mc_txn->mt_env->me_psize - copy->mp_upper);
+		PAGEROOM(mc->mc_txn->mt_env) - copy->mp_upper);
 
 	/* reset back to original page */
 	if (newindx < split_indx || (!newpos && newindx == split_indx)) {
@@ -6170,12 +7078,15 @@ done:
 				m3 = &m2->mc_xcursor->mx_cursor;
 			else
 				m3 = m2;
-			if (!(m3->mc_flags & C_INITIALIZED))
+			if (!(m2->mc_flags & m3->mc_flags & C_INITIALIZED))
 				continue;
 			if (m3->mc_flags & C_SPLITTING)
 				continue;
 			if (new_root) {
 				int k;
+				/* sub cursors may be on a different sub-DB */
+				if (m3->mc_pg[0] != mp)
+					continue;
 				/* root split */
 				for (k=m3->mc_top; k>=0; k--) {
 					m3->mc_ki[k+1] = m3->mc_ki[k];
@@ -6190,7 +7101,7 @@ done:
 				m3->mc_snum++;
 				m3->mc_top++;
 			}
-			if (m3->mc_pg[mc->mc_top] == mp) {
+			if (m3->mc_top >= mc->mc_top && m3->mc_pg[mc->mc_top] == mp) {
 				if (m3->mc_ki[mc->mc_top] >= newindx && !(nflags & MDB_SPLIT_REPLACE))
 					m3->mc_ki[mc->mc_top]++;
 				if (m3->mc_ki[mc->mc_top] >= fixup) {
@@ -6198,7 +7109,8 @@ done:
 					m3->mc_ki[mc->mc_top] -= fixup;
 					m3->mc_ki[ptop] = mn.mc_ki[ptop];
 				}
-			} else if (!did_split && m3->mc_pg[ptop] == mc->mc_pg[ptop] &&
+			} else if (!did_split && m3->mc_top >= ptop &&
+				m3->mc_pg[ptop] == mc->mc_pg[ptop] &&
 				m3->mc_ki[ptop] >= mc->mc_ki[ptop]) {
 				m3->mc_ki[ptop]++;
 			}
@@ -6239,7 +7151,7 @@ mdb_put(MDB_txn *txn, MDB_dbi dbi,
  *	at runtime. Changing other flags requires closing the environment
  *	and re-opening it with the new flags.
  */
-#define	CHANGEABLE	(MDB_NOSYNC|MDB_NOMETASYNC)
+#define	CHANGEABLE	(MDB_NOSYNC|MDB_NOMETASYNC|MDB_MAPASYNC|MDB_VERIFY)
 int
 mdb_env_set_flags(MDB_env *env, unsigned int flag, int onoff)
 {
@@ -6303,6 +7215,24 @@ mdb_env_stat(MDB_env *env, MDB_stat *arg)
 	return mdb_stat0(env, &env->me_metas[toggle]->mm_dbs[MAIN_DBI], arg);
 }
 
+int
+mdb_env_info(MDB_env *env, MDB_envinfo *arg)
+{
+	int toggle;
+
+	if (env == NULL || arg == NULL)
+		return EINVAL;
+
+	toggle = mdb_env_pick_meta(env);
+	arg->me_mapaddr = (env->me_flags & MDB_FIXEDMAP) ? env->me_map : 0;
+	arg->me_mapsize = env->me_mapsize;
+	arg->me_maxreaders = env->me_maxreaders;
+	arg->me_numreaders = env->me_txns->mti_numreaders;
+	arg->me_last_pgno = env->me_metas[toggle]->mm_last_pg;
+	arg->me_last_txnid = env->me_metas[toggle]->mm_txnid;
+	return MDB_SUCCESS;
+}
+
 /** Set the default comparison functions for a database.
  * Called immediately after a database is opened to set the defaults.
  * The user can then override them with #mdb_set_compare() or
@@ -6313,13 +7243,21 @@ mdb_env_stat(MDB_env *env, MDB_stat *arg)
 static void
 mdb_default_cmp(MDB_txn *txn, MDB_dbi dbi)
 {
-	uint16_t f = txn->mt_dbs[dbi].md_flags;
+	mdb_default_cmp0(txn->mt_dbs[dbi].md_flags, &txn->mt_dbxs[dbi]);
+}
 
-	txn->mt_dbxs[dbi].md_cmp =
+/** Set the default comparison functions for a set of database flags.
+ * @param[in] f the flags of the database.
+ * @param[out] dbx the record to set the functions in.
+ */
+static void
+mdb_default_cmp0(uint16_t f, MDB_dbx *dbx)
+{
+	dbx->md_cmp =
 		(f & MDB_REVERSEKEY) ? mdb_cmp_memnr :
 		(f & MDB_INTEGERKEY) ? mdb_cmp_cint  : mdb_cmp_memn;
 
-	txn->mt_dbxs[dbi].md_dcmp =
+	dbx->md_dcmp =
 		!(f & MDB_DUPSORT) ? 0 :
 		((f & MDB_INTEGERDUP)
 		 ? ((f & MDB_DUPFIXED)   ? mdb_cmp_int   : mdb_cmp_cint)
@@ -6423,6 +7361,804 @@ int mdb_stat(MDB_txn *txn, MDB_dbi dbi, MDB_stat *arg)
 	return mdb_stat0(txn->mt_env, &txn->mt_dbs[dbi], arg);
 }
 
+/** @defgroup verify	Consistency Checks
+ *	The pieces of #mdb_verify(). Each thread walks whole subtrees and
+ *	marks the pages it visits in its own bitmap, so the threads share
+ *	nothing but a queue of subtrees and the totals for each database.
+ *	The bitmaps are merged after the walk to find pages used twice or
+ *	not at all.
+ *	@{
+ */
+	/** The number of pages in a word of a page bitmap */
+#define VBITS	(CHAR_BIT * sizeof(size_t))
+
+	/** The number of pages listed in each kind of report on the
+	 *	whole file. The rest are only counted.
+	 */
+#define VMAXLIST	10
+
+	/** A database being checked. */
+typedef struct mdb_vtree {
+	struct mdb_vtree *vt_next;	/**< the next database found */
+	const char	*vt_label;	/**< what to call a database that has no name */
+	MDB_val		vt_name;	/**< the name of a named database */
+	MDB_db		vt_db;		/**< the record of the database */
+	MDB_db		vt_found;	/**< the pages and items found in the walk */
+	MDB_cmp_func	*vt_cmp;	/**< key order, NULL to skip the check */
+	MDB_cmp_func	*vt_dcmp;	/**< duplicate order, NULL to skip the check */
+	unsigned int	vt_errors;	/**< the number of problems found */
+} mdb_vtree;
+
+	/** A subtree waiting to be walked. */
+typedef struct mdb_vtask {
+	struct mdb_vtask *vk_next;
+	mdb_vtree	*vk_tree;	/**< the database it belongs to */
+	pgno_t		vk_pgno;	/**< the root page of the subtree */
+	unsigned int	vk_depth;	/**< the number of levels in the subtree */
+	unsigned int	vk_level;	/**< the number of levels above it */
+	MDB_val		vk_lo;		/**< keys must be at least this, if set */
+	MDB_val		vk_hi;		/**< keys must be below this, if set */
+} mdb_vtask;
+
+	/** The state of a check shared by all its threads. */
+typedef struct mdb_vcheck {
+	MDB_txn		*mv_txn;	/**< the snapshot being checked */
+	MDB_msg_func	*mv_func;	/**< where to report problems */
+	void		*mv_ctx;	/**< passed to #mv_func */
+	unsigned int	mv_flags;	/**< @ref mdb_verify */
+	mdb_vtree	*mv_main;	/**< the main database */
+	pthread_mutex_t	mv_mutex;	/**< protects the fields below */
+	mdb_vtask	*mv_tasks;	/**< subtrees waiting to be walked */
+	mdb_vtree	*mv_trees;	/**< all databases found so far */
+	unsigned int	mv_active;	/**< threads walking a subtree */
+	size_t		mv_errors;	/**< the number of problems found */
+	int			mv_rc;		/**< an error that stops the check */
+} mdb_vcheck;
+
+	/** A thread of a check. */
+typedef struct mdb_vworker {
+	mdb_vcheck	*vw_mv;		/**< the check it works on */
+	size_t		*vw_map;	/**< the pages this thread has visited */
+	mdb_thread_t	vw_thr;
+} mdb_vworker;
+
+	/** How to walk one tree, and what was found in it. */
+typedef struct mdb_vwalk {
+	mdb_vtree	*vc_tree;	/**< the database the tree belongs to */
+	MDB_cmp_func	*vc_cmp;	/**< the order of its keys */
+	unsigned int	vc_ksize;	/**< the size of keys on #P_LEAF2 pages */
+	int			vc_dup;		/**< the tree holds duplicates of one key */
+	MDB_db		vc_found;	/**< the pages and items found */
+} mdb_vwalk;
+
+/** Report a problem.
+ * @param[in] mv the check that found it.
+ * @param[in] vt the database it is in, or NULL.
+ * @param[in] fmt a printf format describing it.
+ */
+static void
+mdb_verify_msg(mdb_vcheck *mv, mdb_vtree *vt, const char *fmt, ...)
+{
+	char buf[256];
+	int len = 0;
+	va_list ap;
+
+	if (vt) {
+		if (vt->vt_label)
+			len = snprintf(buf, sizeof(buf), "%s: ", vt->vt_label);
+		else
+			len = snprintf(buf, sizeof(buf), "database \"%.*s\": ",
+				(int)(vt->vt_name.mv_size < 64 ? vt->vt_name.mv_size : 64),
+				(char *)vt->vt_name.mv_data);
+	}
+	va_start(ap, fmt);
+	vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+	va_end(ap);
+
+	MUTEX_LOCK(mv->mv_mutex);
+	mv->mv_errors++;
+	if (vt)
+		vt->vt_errors++;
+	if (mv->mv_func)
+		mv->mv_func(buf, mv->mv_ctx);
+	MUTEX_UNLOCK(mv->mv_mutex);
+}
+
+/** Stop a check because of an error that isn't a problem in the database.
+ */
+static void
+mdb_verify_fail(mdb_vcheck *mv, int rc)
+{
+	MUTEX_LOCK(mv->mv_mutex);
+	if (!mv->mv_rc)
+		mv->mv_rc = rc;
+	MUTEX_UNLOCK(mv->mv_mutex);
+}
+
+/** Queue a subtree to be walked by any thread.
+ * @return 0 on success, ENOMEM if the task could not be allocated.
+ */
+static int
+mdb_verify_push(mdb_vcheck *mv, mdb_vtree *vt, pgno_t pgno,
+	unsigned int depth, unsigned int level, MDB_val *lo, MDB_val *hi)
+{
+	mdb_vtask *vk;
+
+	if ((vk = malloc(sizeof(mdb_vtask))) == NULL)
+		return ENOMEM;
+	vk->vk_tree = vt;
+	vk->vk_pgno = pgno;
+	vk->vk_depth = depth;
+	vk->vk_level = level;
+	vk->vk_lo = *lo;
+	vk->vk_hi = *hi;
+	MUTEX_LOCK(mv->mv_mutex);
+	vk->vk_next = mv->mv_tasks;
+	mv->mv_tasks = vk;
+	MUTEX_UNLOCK(mv->mv_mutex);
+	return 0;
+}
+
+/** Find the comparison functions to check a database with.
+ *	Those of a database open in the transaction are used if there is
+ *	one, otherwise the defaults for its flags unless #MDB_VERIFY_OPENED
+ *	was given.
+ * @param[in] mv the check.
+ * @param[in,out] vt the database, with #vt_db and its name set.
+ * @param[in] dbi #FREE_DBI or #MAIN_DBI for those, else 0.
+ */
+static void
+mdb_verify_cmp(mdb_vcheck *mv, mdb_vtree *vt, MDB_dbi dbi)
+{
+	MDB_txn *txn = mv->mv_txn;
+	MDB_dbx dbx;
+	MDB_dbi i;
+
+	if (!dbi) {
+		for (i=2; i<txn->mt_numdbs; i++) {
+			if (txn->mt_dbxs[i].md_name.mv_size == vt->vt_name.mv_size &&
+				!memcmp(txn->mt_dbxs[i].md_name.mv_data,
+				vt->vt_name.mv_data, vt->vt_name.mv_size)) {
+				dbi = i;
+				break;
+			}
+		}
+	}
+	if (dbi && txn->mt_dbxs[dbi].md_cmp) {
+		vt->vt_cmp = txn->mt_dbxs[dbi].md_cmp;
+		vt->vt_dcmp = txn->mt_dbxs[dbi].md_dcmp;
+	} else if (dbi < 2 || !(mv->mv_flags & MDB_VERIFY_OPENED)) {
+		mdb_default_cmp0(vt->vt_db.md_flags, &dbx);
+		vt->vt_cmp = dbx.md_cmp;
+		vt->vt_dcmp = dbx.md_dcmp;
+	}
+}
+
+/** Add a named database found in the main database to the check.
+ * @param[in] mv the check.
+ * @param[in] leaf the node of the main database that holds its record.
+ */
+static void
+mdb_verify_named(mdb_vcheck *mv, MDB_node *leaf)
+{
+	mdb_vtree *vt;
+	MDB_val none;
+	int rc;
+
+	if ((vt = calloc(1, sizeof(mdb_vtree))) == NULL) {
+		mdb_verify_fail(mv, ENOMEM);
+		return;
+	}
+	vt->vt_name.mv_size = NODEKSZ(leaf);
+	vt->vt_name.mv_data = NODEKEY(leaf);
+	memcpy(&vt->vt_db, NODEDATA(leaf), sizeof(MDB_db));
+	mdb_verify_cmp(mv, vt, 0);
+	MUTEX_LOCK(mv->mv_mutex);
+	vt->vt_next = mv->mv_trees;
+	mv->mv_trees = vt;
+	MUTEX_UNLOCK(mv->mv_mutex);
+
+	if (vt->vt_db.md_root != P_INVALID) {
+		none.mv_size = 0;
+		none.mv_data = NULL;
+		if ((rc = mdb_verify_push(mv, vt, vt->vt_db.md_root,
+			vt->vt_db.md_depth, 0, &none, &none)))
+			mdb_verify_fail(mv, rc);
+	}
+}
+
+/** Check the header of a page in a tree and mark it as visited.
+ * @param[in] vw the thread doing the check.
+ * @param[in] vt the database the page belongs to.
+ * @param[in] pgno the number of the page.
+ * @param[in] type the page type expected, #P_BRANCH, #P_LEAF or #P_OVERFLOW.
+ * @return the page, or NULL if it should not be looked into.
+ */
+static MDB_page *
+mdb_verify_get(mdb_vworker *vw, mdb_vtree *vt, pgno_t pgno, uint16_t type)
+{
+	mdb_vcheck *mv = vw->vw_mv;
+	MDB_txn *txn = mv->mv_txn;
+	MDB_env *env = txn->mt_env;
+	MDB_page *mp;
+	pgno_t i, n = 1;
+
+	if (pgno < 2 || pgno >= txn->mt_next_pgno) {
+		mdb_verify_msg(mv, vt, "page %zu is out of range", pgno);
+		return NULL;
+	}
+	mp = (MDB_page *)(env->me_map + env->me_psize * pgno);
+	if (mp->mp_pgno != pgno) {
+		mdb_verify_msg(mv, vt, "page %zu has number %zu in its header",
+			pgno, mp->mp_pgno);
+		return NULL;
+	}
+	/* Leaf pages of duplicates that outgrew a sub-page keep its flag */
+	if ((mp->mp_flags & ~(P_LEAF2|P_SUBP)) != type) {
+		mdb_verify_msg(mv, vt, "page %zu has flags 0x%x, expected 0x%x",
+			pgno, mp->mp_flags, type);
+		return NULL;
+	}
+	if (type == P_OVERFLOW) {
+		n = mp->mp_pages;
+		if (!n || pgno + n > txn->mt_next_pgno) {
+			mdb_verify_msg(mv, vt, "overflow page %zu has %zu pages",
+				pgno, n);
+			return NULL;
+		}
+	}
+	if ((env->me_flags & MDB_CHECKSUM) &&
+		PAGECKSUM(env, mp) != mdb_page_cksum(env, mp)) {
+		mdb_verify_msg(mv, vt, "page %zu fails its checksum", pgno);
+		return NULL;
+	}
+	for (i=pgno; i<pgno+n; i++) {
+		size_t bit = (size_t)1 << (i % VBITS);
+		if (vw->vw_map[i / VBITS] & bit) {
+			mdb_verify_msg(mv, vt, "page %zu is used more than once", i);
+			return NULL;
+		}
+		vw->vw_map[i / VBITS] |= bit;
+	}
+	return mp;
+}
+
+/** Check that the nodes of a page lie within it.
+ * @param[in] mv the check.
+ * @param[in] vt the database the page belongs to.
+ * @param[in] mp the page, or a sub-page.
+ * @param[in] size the size of the page.
+ * @param[in] ksize the size of keys on a #P_LEAF2 page.
+ * @return 0 if the page is laid out properly.
+ */
+static int
+mdb_verify_layout(mdb_vcheck *mv, mdb_vtree *vt, MDB_page *mp,
+	unsigned int size, unsigned int ksize)
+{
+	unsigned int i, nkeys, end;
+	MDB_node *node;
+
+	if (mp->mp_lower < PAGEHDRSZ || mp->mp_lower > mp->mp_upper ||
+		mp->mp_upper > size || (mp->mp_lower & 1)) {
+		mdb_verify_msg(mv, vt, "page %zu has bad free space bounds %u-%u",
+			mp->mp_pgno, mp->mp_lower, mp->mp_upper);
+		return 1;
+	}
+	nkeys = NUMKEYS(mp);
+	if (IS_LEAF2(mp)) {
+		if (!ksize || PAGEHDRSZ + nkeys * ksize > size) {
+			mdb_verify_msg(mv, vt, "page %zu has bad fixed size keys",
+				mp->mp_pgno);
+			return 1;
+		}
+		return 0;
+	}
+	for (i=0; i<nkeys; i++) {
+		if (mp->mp_ptrs[i] < mp->mp_upper || mp->mp_ptrs[i] + NODESIZE > size) {
+			mdb_verify_msg(mv, vt, "page %zu: node %u is outside the page",
+				mp->mp_pgno, i);
+			return 1;
+		}
+		node = NODEPTR(mp, i);
+		end = mp->mp_ptrs[i] + NODESIZE + NODEKSZ(node);
+		if (IS_LEAF(mp))
+			end += (node->mn_flags & F_BIGDATA) ? sizeof(pgno_t) : NODEDSZ(node);
+		if (end > size) {
+			mdb_verify_msg(mv, vt, "page %zu: node %u runs past the page",
+				mp->mp_pgno, i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/** Get the key of a node, or of a #P_LEAF2 slot. */
+static void
+mdb_verify_key(MDB_page *mp, unsigned int i, unsigned int ksize, MDB_val *key)
+{
+	if (IS_LEAF2(mp)) {
+		key->mv_size = ksize;
+		key->mv_data = LEAF2KEY(mp, i, ksize);
+	} else {
+		MDB_node *node = NODEPTR(mp, i);
+		key->mv_size = NODEKSZ(node);
+		key->mv_data = NODEKEY(node);
+	}
+}
+
+/** Check that the keys of a page are in order and within the
+ *	range its parent allows.
+ * @param[in] mv the check.
+ * @param[in] vc the tree being walked.
+ * @param[in] mp the page, or a sub-page.
+ * @param[in] ksize the size of keys on a #P_LEAF2 page.
+ * @param[in] lo the smallest key allowed, if not NULL and set.
+ * @param[in] hi keys must be below this, if not NULL and set.
+ */
+static void
+mdb_verify_order(mdb_vcheck *mv, mdb_vwalk *vc, MDB_page *mp,
+	unsigned int ksize, MDB_val *lo, MDB_val *hi)
+{
+	unsigned int i, first = IS_BRANCH(mp), nkeys = NUMKEYS(mp);
+	MDB_val key, prev;
+
+	if (!vc->vc_cmp || nkeys <= first)
+		return;
+	for (i=first; i<nkeys; i++) {
+		mdb_verify_key(mp, i, ksize, &key);
+		if (i == first) {
+			if (lo && lo->mv_data && vc->vc_cmp(lo, &key) > 0)
+				mdb_verify_msg(mv, vc->vc_tree,
+					"page %zu: key %u is below the range of the page",
+					mp->mp_pgno, i);
+		} else if (vc->vc_cmp(&prev, &key) >= 0) {
+			mdb_verify_msg(mv, vc->vc_tree, "page %zu: key %u is out of order",
+				mp->mp_pgno, i);
+		}
+		prev = key;
+	}
+	if (hi && hi->mv_data && vc->vc_cmp(&prev, hi) >= 0)
+		mdb_verify_msg(mv, vc->vc_tree,
+			"page %zu: key %u is above the range of the page",
+			mp->mp_pgno, nkeys - 1);
+}
+
+/** Compare the pages and items found in a tree with its record.
+ * @param[in] what the name of the tree in a message.
+ */
+static void
+mdb_verify_count(mdb_vcheck *mv, mdb_vtree *vt, const char *what,
+	MDB_db *rec, MDB_db *found)
+{
+	if (found->md_branch_pages != rec->md_branch_pages)
+		mdb_verify_msg(mv, vt, "%s has %zu branch pages, its record says %zu",
+			what, found->md_branch_pages, rec->md_branch_pages);
+	if (found->md_leaf_pages != rec->md_leaf_pages)
+		mdb_verify_msg(mv, vt, "%s has %zu leaf pages, its record says %zu",
+			what, found->md_leaf_pages, rec->md_leaf_pages);
+	if (found->md_overflow_pages != rec->md_overflow_pages)
+		mdb_verify_msg(mv, vt, "%s has %zu overflow pages, its record says %zu",
+			what, found->md_overflow_pages, rec->md_overflow_pages);
+	if (found->md_entries != rec->md_entries)
+		mdb_verify_msg(mv, vt, "%s has %zu items, its record says %zu",
+			what, found->md_entries, rec->md_entries);
+}
+
+static void mdb_verify_tree(mdb_vworker *vw, mdb_vwalk *vc, pgno_t pgno,
+	unsigned int depth, unsigned int level, MDB_val *lo, MDB_val *hi);
+
+/** Check the data of a leaf node.
+ * @param[in] vw the thread doing the check.
+ * @param[in] vc the tree being walked.
+ * @param[in] mp the leaf page.
+ * @param[in] i the index of the node.
+ */
+static void
+mdb_verify_leaf(mdb_vworker *vw, mdb_vwalk *vc, MDB_page *mp, unsigned int i)
+{
+	mdb_vcheck *mv = vw->vw_mv;
+	MDB_env *env = mv->mv_txn->mt_env;
+	mdb_vtree *vt = vc->vc_tree;
+	MDB_node *leaf = NODEPTR(mp, i);
+	unsigned int dsize = NODEDSZ(leaf);
+
+	vc->vc_found.md_entries++;
+	if (vc->vc_dup ? leaf->mn_flags != 0 :
+		(leaf->mn_flags & ~(F_BIGDATA|F_SUBDATA|F_DUPDATA)) ||
+		((leaf->mn_flags & F_DUPDATA) &&
+		 !(vt->vt_db.md_flags & MDB_DUPSORT)) ||
+		((leaf->mn_flags & F_SUBDATA) &&
+		 !(leaf->mn_flags & F_DUPDATA) && vt != mv->mv_main) ||
+		((leaf->mn_flags & F_BIGDATA) && (leaf->mn_flags & ~F_BIGDATA))) {
+		mdb_verify_msg(mv, vt, "page %zu: node %u has flags 0x%x",
+			mp->mp_pgno, i, leaf->mn_flags);
+		return;
+	}
+
+	if (leaf->mn_flags & F_BIGDATA) {
+		MDB_page *omp;
+		pgno_t pgno;
+		memcpy(&pgno, NODEDATA(leaf), sizeof(pgno));
+		if ((omp = mdb_verify_get(vw, vt, pgno, P_OVERFLOW)) == NULL)
+			return;
+		if (omp->mp_pages != OVPAGES(env, dsize))
+			mdb_verify_msg(mv, vt,
+				"overflow page %zu has %u pages for %u bytes",
+				pgno, omp->mp_pages, dsize);
+		vc->vc_found.md_overflow_pages += omp->mp_pages;
+	} else if (leaf->mn_flags & F_SUBDATA) {
+		MDB_db db;
+		if (dsize != sizeof(MDB_db)) {
+			mdb_verify_msg(mv, vt, "page %zu: node %u has a record of %u bytes",
+				mp->mp_pgno, i, dsize);
+			return;
+		}
+		if (!(leaf->mn_flags & F_DUPDATA)) {
+			mdb_verify_named(mv, leaf);
+			return;
+		}
+		/* The duplicates of a key in their own tree. Their pages
+		 * are counted in their record, only the items are counted
+		 * in the database.
+		 */
+		memcpy(&db, NODEDATA(leaf), sizeof(db));
+		if (db.md_root != P_INVALID) {
+			mdb_vwalk sub;
+			char what[64];
+			memset(&sub, 0, sizeof(sub));
+			sub.vc_tree = vt;
+			sub.vc_cmp = vt->vt_dcmp;
+			sub.vc_ksize = (db.md_flags & MDB_DUPFIXED) ? db.md_pad : 0;
+			sub.vc_dup = 1;
+			mdb_verify_tree(vw, &sub, db.md_root, db.md_depth, 0, NULL, NULL);
+			sprintf(what, "the duplicates of page %zu node %u", mp->mp_pgno, i);
+			mdb_verify_count(mv, vt, what, &db, &sub.vc_found);
+		}
+		vc->vc_found.md_entries += db.md_entries - 1;
+	} else if (leaf->mn_flags & F_DUPDATA) {
+		/* A few duplicates in a sub-page */
+		MDB_page *fp = NODEDATA(leaf);
+		mdb_vwalk sub;
+		if (dsize < PAGEHDRSZ ||
+			(fp->mp_flags & ~(P_LEAF2|P_DIRTY)) != (P_LEAF|P_SUBP)) {
+			mdb_verify_msg(mv, vt, "page %zu: node %u has a bad sub-page",
+				mp->mp_pgno, i);
+			return;
+		}
+		memset(&sub, 0, sizeof(sub));
+		sub.vc_tree = vt;
+		sub.vc_cmp = vt->vt_dcmp;
+		sub.vc_dup = 1;
+		if (mdb_verify_layout(mv, vt, fp, dsize, fp->mp_pad))
+			return;
+		mdb_verify_order(mv, &sub, fp, fp->mp_pad, NULL, NULL);
+		vc->vc_found.md_entries += NUMKEYS(fp) - 1;
+	}
+}
+
+/** Walk a tree, or a subtree of it.
+ * @param[in] vw the thread doing the walk.
+ * @param[in,out] vc the tree, with the pages and items found so far.
+ * @param[in] pgno the root page of the subtree.
+ * @param[in] depth the number of levels of the subtree.
+ * @param[in] level the number of levels above it.
+ * @param[in] lo the smallest key allowed in it, if not NULL and set.
+ * @param[in] hi keys in it must be below this, if not NULL and set.
+ */
+static void
+mdb_verify_tree(mdb_vworker *vw, mdb_vwalk *vc, pgno_t pgno,
+	unsigned int depth, unsigned int level, MDB_val *lo, MDB_val *hi)
+{
+	mdb_vcheck *mv = vw->vw_mv;
+	MDB_env *env = mv->mv_txn->mt_env;
+	mdb_vtree *vt = vc->vc_tree;
+	MDB_page *mp;
+	unsigned int i, nkeys;
+
+	if (!depth) {
+		mdb_verify_msg(mv, vt, "page %zu is deeper than the tree", pgno);
+		return;
+	}
+	mp = mdb_verify_get(vw, vt, pgno, depth > 1 ? P_BRANCH : P_LEAF);
+	if (!mp)
+		return;
+	if (depth > 1)
+		vc->vc_found.md_branch_pages++;
+	else
+		vc->vc_found.md_leaf_pages++;
+	if (!IS_LEAF2(mp) != !(depth == 1 && vc->vc_ksize)) {
+		mdb_verify_msg(mv, vt, "page %zu has flags 0x%x",
+			pgno, mp->mp_flags);
+		return;
+	}
+	if (mdb_verify_layout(mv, vt, mp, PAGEROOM(env), vc->vc_ksize))
+		return;
+	nkeys = NUMKEYS(mp);
+	if (nkeys < (depth > 1 ? 2U : 1U)) {
+		mdb_verify_msg(mv, vt, "page %zu has only %u keys", pgno, nkeys);
+		return;
+	}
+	mdb_verify_order(mv, vc, mp, vc->vc_ksize, lo, hi);
+
+	if (IS_BRANCH(mp)) {
+		/* Hand the upper subtrees of the shared databases to
+		 * other threads.
+		 */
+		int split = !vc->vc_dup && level < 2 && depth > 2;
+		for (i=0; i<nkeys; i++) {
+			MDB_val clo, chi;
+			if (i)
+				mdb_verify_key(mp, i, 0, &clo);
+			else if (lo)
+				clo = *lo;
+			else
+				clo.mv_data = NULL;
+			if (i+1 < nkeys)
+				mdb_verify_key(mp, i+1, 0, &chi);
+			else if (hi)
+				chi = *hi;
+			else
+				chi.mv_data = NULL;
+			if (!clo.mv_data)
+				clo.mv_size = 0;
+			if (!chi.mv_data)
+				chi.mv_size = 0;
+			if (split && !mdb_verify_push(mv, vt, NODEPGNO(NODEPTR(mp, i)),
+				depth-1, level+1, &clo, &chi))
+				continue;
+			mdb_verify_tree(vw, vc, NODEPGNO(NODEPTR(mp, i)),
+				depth-1, level+1, &clo, &chi);
+		}
+	} else if (IS_LEAF2(mp)) {
+		vc->vc_found.md_entries += nkeys;
+	} else {
+		for (i=0; i<nkeys; i++)
+			mdb_verify_leaf(vw, vc, mp, i);
+	}
+}
+
+/** The body of a thread of a check.
+ *	Walks queued subtrees until there are none left and no other
+ *	thread can add more.
+ * @param[in] arg the #mdb_vworker of the thread.
+ */
+static THREAD_RET
+mdb_verify_thread(void *arg)
+{
+	mdb_vworker *vw = arg;
+	mdb_vcheck *mv = vw->vw_mv;
+	mdb_vtree *vt;
+	mdb_vtask *vk;
+	mdb_vwalk vc;
+
+	for (;;) {
+		MUTEX_LOCK(mv->mv_mutex);
+		vk = mv->mv_rc ? NULL : mv->mv_tasks;
+		if (vk) {
+			mv->mv_tasks = vk->vk_next;
+			mv->mv_active++;
+		} else if (!mv->mv_active || mv->mv_rc) {
+			MUTEX_UNLOCK(mv->mv_mutex);
+			break;
+		}
+		MUTEX_UNLOCK(mv->mv_mutex);
+		if (!vk) {
+			/* the threads that are busy may queue more */
+			THREAD_PAUSE();
+			continue;
+		}
+
+		vt = vk->vk_tree;
+		memset(&vc, 0, sizeof(vc));
+		vc.vc_tree = vt;
+		vc.vc_cmp = vt->vt_cmp;
+		mdb_verify_tree(vw, &vc, vk->vk_pgno, vk->vk_depth, vk->vk_level,
+			&vk->vk_lo, &vk->vk_hi);
+		free(vk);
+
+		MUTEX_LOCK(mv->mv_mutex);
+		vt->vt_found.md_branch_pages += vc.vc_found.md_branch_pages;
+		vt->vt_found.md_leaf_pages += vc.vc_found.md_leaf_pages;
+		vt->vt_found.md_overflow_pages += vc.vc_found.md_overflow_pages;
+		vt->vt_found.md_entries += vc.vc_found.md_entries;
+		mv->mv_active--;
+		MUTEX_UNLOCK(mv->mv_mutex);
+	}
+	return 0;
+}
+
+/** Report a page that is in one of the lists of bad pages.
+ *	Only the first #VMAXLIST pages of each list are reported.
+ * @param[in,out] count the number of pages in the list so far.
+ */
+static void
+mdb_verify_page(mdb_vcheck *mv, size_t *count, pgno_t pgno, const char *what)
+{
+	if (++*count <= VMAXLIST)
+		mdb_verify_msg(mv, NULL, "page %zu %s", pgno, what);
+}
+
+/** Report how many pages of a list were left out by #mdb_verify_page(). */
+static void
+mdb_verify_rest(mdb_vcheck *mv, size_t count, const char *what)
+{
+	if (count > VMAXLIST)
+		mdb_verify_msg(mv, NULL, "%zu more pages %s", count - VMAXLIST, what);
+}
+
+/** Check the freelist against the pages found in use.
+ * @param[in] mv the check.
+ * @param[in] used the pages in use.
+ * @param[out] freed the pages on the freelist.
+ * @return 0 on success, non-zero if the freelist could not be read.
+ */
+static int
+mdb_verify_free(mdb_vcheck *mv, size_t *used, size_t *freed)
+{
+	MDB_txn *txn = mv->mv_txn;
+	MDB_cursor mc;
+	MDB_val key, data;
+	size_t range = 0, twice = 0, both = 0;
+	int rc;
+
+	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
+	rc = mdb_cursor_first(&mc, &key, &data);
+	while (rc == MDB_SUCCESS) {
+		MDB_IDL idl = data.mv_data;
+		pgno_t pg, first, last;
+		txnid_t id;
+
+		memcpy(&id, key.mv_data, sizeof(id));
+		if (data.mv_size < sizeof(MDB_ID) ||
+			data.mv_size != MDB_IDL_SIZEOF(idl)) {
+			mdb_verify_msg(mv, NULL,
+				"freelist record of txn %zu has a bad size", id);
+		} else {
+			if (MDB_IDL_IS_RANGE(idl)) {
+				first = MDB_IDL_RANGE_FIRST(idl);
+				last = MDB_IDL_RANGE_LAST(idl);
+			} else {
+				first = 1;
+				last = idl[0];
+			}
+			for (; first <= last; first++) {
+				pg = MDB_IDL_IS_RANGE(idl) ? first : idl[first];
+				if (pg < 2 || pg >= txn->mt_next_pgno) {
+					mdb_verify_page(mv, &range, pg, "is free but out of range");
+					continue;
+				}
+				if (freed[pg / VBITS] & ((size_t)1 << (pg % VBITS)))
+					mdb_verify_page(mv, &twice, pg, "is free more than once");
+				else if (used[pg / VBITS] & ((size_t)1 << (pg % VBITS)))
+					mdb_verify_page(mv, &both, pg, "is both free and in use");
+				freed[pg / VBITS] |= (size_t)1 << (pg % VBITS);
+			}
+		}
+		rc = mdb_cursor_next(&mc, &key, &data, MDB_NEXT);
+	}
+	mdb_verify_rest(mv, range, "are free but out of range");
+	mdb_verify_rest(mv, twice, "are free more than once");
+	mdb_verify_rest(mv, both, "are both free and in use");
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
+
+int
+mdb_verify(MDB_txn *txn, unsigned int flags, unsigned int threads,
+	MDB_msg_func *func, void *ctx)
+{
+	static const char *labels[] = { "freelist", "main database" };
+	mdb_vcheck mv;
+	mdb_vworker *vw;
+	mdb_vtree *vt;
+	mdb_vtask *vk;
+	MDB_val none;
+	size_t words, w, *used, *freed, twice = 0, lost = 0;
+	unsigned int i, started;
+	pgno_t pg;
+	int rc;
+
+	if (txn == NULL || !F_ISSET(txn->mt_flags, MDB_TXN_RDONLY) || !threads)
+		return EINVAL;
+
+	memset(&mv, 0, sizeof(mv));
+	mv.mv_txn = txn;
+	mv.mv_func = func;
+	mv.mv_ctx = ctx;
+	mv.mv_flags = flags;
+	if ((rc = MUTEX_INIT(mv.mv_mutex)))
+		return rc;
+
+	/* One page bitmap per thread, and one more for the freelist */
+	words = (txn->mt_next_pgno + VBITS - 1) / VBITS;
+	vw = calloc(threads, sizeof(mdb_vworker));
+	used = calloc((threads + 1) * words, sizeof(size_t));
+	if (!vw || !used) {
+		rc = ENOMEM;
+		goto done;
+	}
+	for (i=0; i<threads; i++) {
+		vw[i].vw_mv = &mv;
+		vw[i].vw_map = used + i * words;
+	}
+	freed = used + threads * words;
+
+	none.mv_size = 0;
+	none.mv_data = NULL;
+	for (i=FREE_DBI; i<=MAIN_DBI; i++) {
+		if ((vt = calloc(1, sizeof(mdb_vtree))) == NULL) {
+			rc = ENOMEM;
+			goto done;
+		}
+		vt->vt_label = labels[i];
+		vt->vt_db = txn->mt_dbs[i];
+		vt->vt_next = mv.mv_trees;
+		mv.mv_trees = vt;
+		mdb_verify_cmp(&mv, vt, i);
+		if (vt->vt_db.md_root != P_INVALID &&
+			(rc = mdb_verify_push(&mv, vt, vt->vt_db.md_root,
+			vt->vt_db.md_depth, 0, &none, &none)))
+			goto done;
+	}
+	mv.mv_main = mv.mv_trees;
+
+	/* The caller's thread is the first worker */
+	for (started=1; started<threads; started++)
+		if (THREAD_CREATE(vw[started].vw_thr, mdb_verify_thread, &vw[started]))
+			break;
+	mdb_verify_thread(&vw[0]);
+	for (i=1; i<started; i++)
+		THREAD_FINISH(vw[i].vw_thr);
+	if ((rc = mv.mv_rc))
+		goto done;
+
+	for (vt = mv.mv_trees; vt; vt = vt->vt_next)
+		mdb_verify_count(&mv, vt, "the tree", &vt->vt_db, &vt->vt_found);
+
+	/* Merge what the threads saw. A page seen by more than one of
+	 * them is used more than once.
+	 */
+	for (i=1; i<threads; i++) {
+		for (w=0; w<words; w++) {
+			size_t dup = used[w] & vw[i].vw_map[w];
+			for (pg = w * VBITS; dup; pg++, dup >>= 1)
+				if (dup & 1)
+					mdb_verify_page(&mv, &twice, pg, "is used more than once");
+			used[w] |= vw[i].vw_map[w];
+		}
+	}
+	mdb_verify_rest(&mv, twice, "are used more than once");
+
+	/* Without a sound freelist tree, or with subtrees left out,
+	 * the accounting of the whole file would only add noise.
+	 */
+	if (!mv.mv_errors) {
+		if ((rc = mdb_verify_free(&mv, used, freed)))
+			goto done;
+		for (pg = 2; pg < txn->mt_next_pgno; pg++) {
+			size_t bit = (size_t)1 << (pg % VBITS);
+			if (!((used[pg / VBITS] | freed[pg / VBITS]) & bit))
+				mdb_verify_page(&mv, &lost, pg, "is neither in use nor free");
+		}
+		mdb_verify_rest(&mv, lost, "are neither in use nor free");
+	}
+	rc = mv.mv_errors ? MDB_CORRUPTED : MDB_SUCCESS;
+
+done:
+	while ((vk = mv.mv_tasks) != NULL) {
+		mv.mv_tasks = vk->vk_next;
+		free(vk);
+	}
+	while ((vt = mv.mv_trees) != NULL) {
+		mv.mv_trees = vt->vt_next;
+		free(vt);
+	}
+	free(used);
+	free(vw);
+	MUTEX_FREE(mv.mv_mutex);
+	return rc;
+}
+/** @} */
+
 void mdb_close(MDB_env *env, MDB_dbi dbi)
 {
 	char *ptr;
@@ -103,6 +103,16 @@ extern "C" {
 	MDB_VERFOO(MDB_VERSION_MAJOR,MDB_VERSION_MINOR,MDB_VERSION_PATCH,MDB_VERSION_DATE)
 /**	@} */
 
+/** @brief An abstraction for a file handle.
+ *	On POSIX systems file handles are small integers. On Windows
+ *	they're opaque pointers.
+ */
+#ifdef _WIN32
+typedef	void *mdb_filehandle_t;
+#else
+typedef int mdb_filehandle_t;
+#endif
+
 /** @brief Opaque structure for a database environment.
  *
  * A DB environment supports multiple databases, all residing in the same
@@ -148,6 +158,13 @@ typedef int  (MDB_cmp_func)(const MDB_val *a, const MDB_val *b);
  */
 typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *relctx);
 
+/** @brief A callback function used to report problems found by #mdb_verify().
+ *
+ * @param[in] msg A description of the problem, without a trailing newline.
+ * @param[in] ctx An arbitrary context pointer for the callback.
+ */
+typedef void (MDB_msg_func)(const char *msg, void *ctx);
+
 /** @defgroup	mdb_env	Environment Flags
  *	@{
  */
@@ -155,12 +172,20 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
 #define MDB_FIXEDMAP	0x01
 	/** no environment directory */
 #define MDB_NOSUBDIR	0x02
+	/** store a checksum in every page */
+#define MDB_CHECKSUM	0x100
 	/** don't fsync after commit */
 #define MDB_NOSYNC		0x10000
 	/** read only */
 #define MDB_RDONLY		0x20000
 	/** don't fsync metapage after commit */
 #define MDB_NOMETASYNC		0x40000
+	/** use writable mmap */
+#define MDB_WRITEMAP		0x80000
+	/** use asynchronous msync */
+#define MDB_MAPASYNC		0x100000
+	/** verify page checksums when reading pages */
+#define MDB_VERIFY		0x200000
 /** @} */
 
 /**	@defgroup	mdb_open	Database Flags
@@ -207,6 +232,20 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
 #define MDB_MULTIPLE	0x80000
 /*	@} */
 
+/**	@defgroup mdb_copy	Copy Flags
+ *	@{
+ */
+	/** Compacting copy: omit free pages and renumber the rest */
+#define MDB_CP_COMPACT	0x01
+/*	@} */
+
+/**	@defgroup mdb_verify	Verify Flags
+ *	@{
+ */
+	/** Only check the key order of databases open in the transaction */
+#define MDB_VERIFY_OPENED	0x01
+/*	@} */
+
 /** @brief Cursor Get operations.
  *
  *	This is the set of all operations for retrieving data
@@ -218,16 +257,20 @@ typedef enum MDB_cursor_op {
 								Only for #MDB_DUPSORT */
 	MDB_GET_BOTH,			/**< Position at key/data pair. Only for #MDB_DUPSORT */
 	MDB_GET_BOTH_RANGE,		/**< position at key, nearest data. Only for #MDB_DUPSORT */
-	MDB_GET_MULTIPLE,		/**< Return all the duplicate data items at the current
-								 cursor position. Only for #MDB_DUPFIXED */
+	MDB_GET_MULTIPLE,		/**< Return up to a page of duplicate data items
+								starting at the current cursor position, as one
+								contiguous array, and move the cursor to the last
+								item returned. Only for #MDB_DUPFIXED */
 	MDB_LAST,				/**< Position at last key/data item */
 	MDB_LAST_DUP,			/**< Position at last data item of current key.
 								Only for #MDB_DUPSORT */
 	MDB_NEXT,				/**< Position at next data item */
 	MDB_NEXT_DUP,			/**< Position at next data item of current key.
 								Only for #MDB_DUPSORT */
-	MDB_NEXT_MULTIPLE,		/**< Return all duplicate data items at the next
-								cursor position. Only for #MDB_DUPFIXED */
+	MDB_NEXT_MULTIPLE,		/**< Return the next page of duplicate data items
+								of the current key, as for #MDB_GET_MULTIPLE.
+								Returns #MDB_NOTFOUND after the last one.
+								Only for #MDB_DUPFIXED */
 	MDB_NEXT_NODUP,			/**< Position at first data item of next key.
 								Only for #MDB_DUPSORT */
 	MDB_PREV,				/**< Position at previous data item */
@@ -252,12 +295,16 @@ typedef enum MDB_cursor_op {
 #define MDB_NOTFOUND	(-30798)
 	/** Requested page not found - this usually indicates corruption */
 #define MDB_PAGE_NOTFOUND	(-30797)
-	/** Located page was wrong type */
+	/** Located page was wrong type or damaged */
 #define MDB_CORRUPTED	(-30796)
 	/** Update of meta page failed, probably I/O error */
 #define MDB_PANIC		(-30795)
 	/** Environment version mismatch */
 #define MDB_VERSION_MISMATCH	(-30794)
+	/** Environment mapsize reached */
+#define MDB_MAP_FULL	(-30793)
+	/** Database contents grew beyond environment mapsize */
+#define MDB_MAP_RESIZED	(-30792)
 /** @} */
 
 /** @brief Statistics for a database in the environment */
@@ -271,6 +318,16 @@ typedef struct MDB_stat {
 	size_t		ms_entries;			/**< Number of data items */
 } MDB_stat;
 
+/** @brief Information about the environment */
+typedef struct MDB_envinfo {
+	void	*me_mapaddr;			/**< Address of map, if fixed */
+	size_t	me_mapsize;				/**< Size of the data memory map */
+	size_t	me_last_pgno;			/**< ID of the last used page */
+	size_t	me_last_txnid;			/**< ID of the last committed transaction */
+	unsigned int me_maxreaders;		/**< max reader slots in the environment */
+	unsigned int me_numreaders;		/**< max reader slots used in the environment */
+} MDB_envinfo;
+
 	/** @brief Return the mdb library version information.
 	 *
 	 * @param[out] major if non-NULL, the library major version number is copied here
@@ -347,6 +404,36 @@ int  mdb_env_create(MDB_env **env);
 	 *		lost. This flag may be changed at any time using #mdb_env_set_flags().
 	 *	<li>#MDB_RDONLY
 	 *		Open the environment in read-only mode. No write operations will be allowed.
+	 *	<li>#MDB_WRITEMAP
+	 *		Use a writeable memory map unless #MDB_RDONLY is set. Write transactions
+	 *		then modify pages directly in the map instead of copying them into
+	 *		malloc'd buffers and writing them out at commit time. This is faster
+	 *		and uses fewer mallocs, but loses protection from application bugs
+	 *		like wild pointer writes and other bad updates into the database.
+	 *		The data file is extended to the full map size when the environment
+	 *		is opened. Nested transactions are not supported in this mode.
+	 *	<li>#MDB_MAPASYNC
+	 *		When using #MDB_WRITEMAP, use asynchronous flushes to disk.
+	 *		Commits then only schedule the dirty pages and the meta page for
+	 *		writing instead of waiting for them, so as with #MDB_NOSYNC a
+	 *		system crash may undo the most recent transactions. Calling
+	 *		#mdb_env_sync() with \b force set still performs a synchronous
+	 *		flush, so durability can be bounded by calling it periodically.
+	 *		This flag may be changed at any time using #mdb_env_set_flags().
+	 *	<li>#MDB_CHECKSUM
+	 *		Store a checksum of its contents at the end of every page written.
+	 *		This flag must be specified when creating the environment, and is
+	 *		stored persistently in the environment. Such an environment uses
+	 *		a newer file format that older versions of the library refuse to
+	 *		open; environments created without it keep the original format.
+	 *		Computing the checksums adds some CPU time to every commit. They are checked by #mdb_verify(), and
+	 *		on every page read if #MDB_VERIFY is set.
+	 *	<li>#MDB_VERIFY
+	 *		Check the checksum of each page as it is read from the map, and
+	 *		fail with #MDB_CORRUPTED if it doesn't match. This has no effect
+	 *		if the environment was not created with #MDB_CHECKSUM. Reads get
+	 *		noticeably slower, since every page is summed on every access.
+	 *		This flag may be changed at any time using #mdb_env_set_flags().
 	 * </ul>
 	 * @param[in] mode The UNIX permissions to set on created files. This parameter
 	 * is ignored on Windows.
@@ -363,6 +450,50 @@ int  mdb_env_create(MDB_env **env);
 	 */
 int  mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mode_t mode);
 
+	/** @brief Copy an MDB environment to the specified path.
+	 *
+	 * This function may be used to make a backup of an existing environment
+	 * while it is in use. The copy is taken from a read-only transaction, so
+	 * writers are only blocked for the moment it takes to copy the meta pages.
+	 * No lockfile is created, since it gets recreated at need.
+	 * @note This call can trigger significant file size growth if run in
+	 * parallel with write transactions, because it employs a read-only
+	 * transaction. See #mdb_txn_begin(). It must not be called from a thread
+	 * that has an active write transaction on \b env.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] path The directory in which the copy will reside. This
+	 * directory must already exist and be writable but must otherwise be
+	 * empty. If \b env was opened with #MDB_NOSUBDIR, this is the name of
+	 * the data file to create instead.
+	 * @param[in] flags Special options for this operation. This parameter
+	 * must be set to 0 or by bitwise OR'ing together one or more of the
+	 * values described here.
+	 * <ul>
+	 *	<li>#MDB_CP_COMPACT - Perform compaction while copying: omit free
+	 *		pages and the freelist, and renumber the remaining pages so the
+	 *		copy is as small as possible. This walks every tree in the
+	 *		environment, so it takes more CPU than a plain copy. Writers are
+	 *		not blocked at all.
+	 * </ul>
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_copy(MDB_env *env, const char *path, unsigned int flags);
+
+	/** @brief Copy an MDB environment to the specified file descriptor.
+	 *
+	 * This function works like #mdb_env_copy() but writes the copy
+	 * sequentially to an open file handle, which may also be a pipe.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully.
+	 * @param[in] fd The filedescriptor to write the copy to. It must
+	 * have already been opened for Write access.
+	 * @param[in] flags Special options for this operation, as for
+	 * #mdb_env_copy().
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_copyfd(MDB_env *env, mdb_filehandle_t fd, unsigned int flags);
+
 	/** @brief Return statistics about the MDB environment.
 	 *
 	 * @param[in] env An environment handle returned by #mdb_env_create()
@@ -371,6 +502,17 @@ int  mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mode_t mod
 	 */
 int  mdb_env_stat(MDB_env *env, MDB_stat *stat);
 
+	/** @brief Return information about the MDB environment.
+	 *
+	 * Together with the page size from #mdb_env_stat() this tells how
+	 * much of the map is still free, e.g. to decide when to grow it
+	 * with #mdb_env_set_mapsize().
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[out] stat The address of an #MDB_envinfo structure
+	 * 	where the information will be copied
+	 */
+int  mdb_env_info(MDB_env *env, MDB_envinfo *stat);
+
 	/** @brief Flush the data buffers to disk.
 	 *
 	 * Data is always written to disk when #mdb_txn_commit() is called,
@@ -378,9 +520,9 @@ int  mdb_env_stat(MDB_env *env, MDB_stat *stat);
 	 * the OS buffers upon commit as well, unless the environment was
 	 * opened with #MDB_NOSYNC.
 	 * @param[in] env An environment handle returned by #mdb_env_create()
-	 * @param[in] force If non-zero, force the flush to occur. Otherwise
+	 * @param[in] force If non-zero, force a synchronous flush. Otherwise
 	 *  if the environment has the #MDB_NOSYNC flag set the flushes
-	 *	will be omitted.
+	 *	will be omitted, and with #MDB_MAPASYNC they will be asynchronous.
 	 * @return A non-zero error value on failure and 0 on success. Some possible
 	 * errors are:
 	 * <ul>
@@ -447,13 +589,23 @@ int  mdb_env_get_path(MDB_env *env, const char **path);
 	 * 10485760 bytes. The size of the memory map is also the maximum size
 	 * of the database. The value should be chosen as large as possible,
 	 * to accommodate future growth of the database.
-	 * This function may only be called after #mdb_env_create() and before #mdb_env_open().
+	 * This function may be called after #mdb_env_create() and before #mdb_env_open().
+	 * It may also be called later to grow or shrink the map of an open
+	 * environment. The map is then recreated at the new size, so the caller
+	 * must make sure that no transactions are active in this process and
+	 * that none are started until the call returns. The new size is recorded
+	 * in the database by the next write transaction, and other processes
+	 * pick it up when their transactions fail with #MDB_MAP_RESIZED.
+	 * The size will never be set smaller than the space currently in use.
 	 * @param[in] env An environment handle returned by #mdb_env_create()
-	 * @param[in] size The size in bytes
+	 * @param[in] size The size in bytes. On an open environment, zero
+	 * means the size last recorded in the database.
 	 * @return A non-zero error value on failure and 0 on success. Some possible
 	 * errors are:
 	 * <ul>
-	 *	<li>EINVAL - an invalid parameter was specified, or the environment is already open.
+	 *	<li>EINVAL - an invalid parameter was specified, or a write
+	 *		transaction is active.
+	 *	<li>EBUSY - a read transaction of this process is still active.
 	 * </ul>
 	 */
 int  mdb_env_set_mapsize(MDB_env *env, size_t size);
@@ -485,6 +637,27 @@ int  mdb_env_set_maxreaders(MDB_env *env, unsigned int readers);
 	 */
 int  mdb_env_get_maxreaders(MDB_env *env, unsigned int *readers);
 
+	/** @brief Check for stale entries in the reader lock table.
+	 *
+	 * A process that exits without closing its environment, e.g. by
+	 * crashing or being killed, leaves its reader slots behind. Their
+	 * transaction IDs keep older free pages from being reused, so the
+	 * database file keeps growing. This function clears the slots of
+	 * every process that is no longer running. It is called by
+	 * #mdb_env_open() and may be called at any time afterwards.
+	 *
+	 * Liveness is tracked per process, so an environment should only
+	 * be opened once in a given process.
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[out] dead Number of stale slots that were cleared, or NULL
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_reader_check(MDB_env *env, int *dead);
+
 	/** @brief Set the maximum number of databases for the environment.
 	 *
 	 * This function is only needed if multiple databases will be used in the
@@ -527,12 +700,25 @@ int  mdb_env_set_maxdbs(MDB_env *env, MDB_dbi dbs);
 	 * <ul>
 	 *	<li>#MDB_PANIC - a fatal error occurred earlier and the environment
 	 *		must be shut down.
+	 *	<li>#MDB_MAP_RESIZED - another process wrote data beyond this environment's
+	 *		mapsize and the map must be resized. See #mdb_env_set_mapsize().
 	 *	<li>ENOMEM - out of memory, or a read-only transaction was requested and
 	 *		the reader lock table is full. See #mdb_env_set_maxreaders().
 	 * </ul>
 	 */
 int  mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **txn);
 
+	/** @brief Return the transaction's ID.
+	 *
+	 * A read-only transaction sees the data committed by the write
+	 * transaction with the same ID. A write transaction, and any
+	 * transactions nested in it, get the ID they will commit with,
+	 * one more than that of the last committed transaction.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @return The transaction ID, or 0 if txn is NULL.
+	 */
+size_t mdb_txn_id(MDB_txn *txn);
+
 	/** @brief Commit all the operations of a transaction into the database.
 	 *
 	 * All cursors opened within the transaction will be closed by this call. The cursors
@@ -656,6 +842,40 @@ int  mdb_open(MDB_txn *txn, const char *name, unsigned int flags, MDB_dbi *dbi);
 	 */
 int  mdb_stat(MDB_txn *txn, MDB_dbi dbi, MDB_stat *stat);
 
+	/** @brief Check the consistency of all databases in an environment.
+	 *
+	 * The freelist, the main database and every named database are walked
+	 * in the snapshot of \b txn. Each page is checked for a sane header and
+	 * layout, for its checksum if the environment has #MDB_CHECKSUM, and for
+	 * keys that are in order and within the range its parent page allows.
+	 * The number of pages and items found in each database is compared with
+	 * its record, and every page must either be in use exactly once or be
+	 * on the freelist. Subtrees are walked by several threads in parallel.
+	 *
+	 * Databases that are open in \b txn are checked with their own
+	 * comparison functions, the others with the default ones for their
+	 * flags.
+	 * @param[in] txn A read-only transaction handle returned by #mdb_txn_begin()
+	 * @param[in] flags Special options for this operation. This parameter
+	 * must be set to 0 or to #MDB_VERIFY_OPENED, which skips the key order
+	 * check for databases that are not open in \b txn. Use it when some
+	 * databases have custom comparison functions.
+	 * @param[in] threads The number of threads to walk the trees with. With
+	 * 1 the calling thread does all the work.
+	 * @param[in] func A function called with a description of each problem.
+	 * Calls are serialized. May be NULL.
+	 * @param[in] ctx An arbitrary pointer passed to \b func.
+	 * @return 0 if no problems were found, #MDB_CORRUPTED if some were,
+	 * or another non-zero error value if the check could not be done.
+	 * Some possible errors are:
+	 * <ul>
+	 *	<li>EINVAL - \b txn is not read-only, or \b threads is 0.
+	 *	<li>ENOMEM - out of memory.
+	 * </ul>
+	 */
+int  mdb_verify(MDB_txn *txn, unsigned int flags, unsigned int threads,
+	MDB_msg_func *func, void *ctx);
+
 	/** @brief Close a database handle.
 	 *
 	 * This call is not mutex protected. Handles should only be closed by
@@ -684,7 +904,9 @@ int  mdb_drop(MDB_txn *txn, MDB_dbi dbi, int del);
 	 * key specified by the application with a key currently stored in the database.
 	 * If no comparison function is specified, and no special key flags were specified
 	 * with #mdb_open(), the keys are compared lexically, with shorter keys collating
-	 * before longer keys.
+	 * before longer keys. With that order the branch pages of the tree only keep
+	 * as much of each key as is needed to tell its pages apart, so more of them
+	 * fit in a page. A custom comparison function always keeps whole keys.
 	 * @warning This function must be called before any data access functions are used,
 	 * otherwise data corruption may occur. The same comparison function must be used by every
 	 * program accessing the database, every time the database is used.
@@ -824,7 +1046,7 @@ int  mdb_get(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_val *data);
 	 * <ul>
 	 *	<li>EACCES - an attempt was made to write in a read-only transaction.
 	 *	<li>EINVAL - an invalid parameter was specified.
-	 *	<li>ENOMEM - the database is full, see #mdb_env_set_mapsize().
+	 *	<li>#MDB_MAP_FULL - the database is full, see #mdb_env_set_mapsize().
 	 * </ul>
 	 */
 int  mdb_put(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_val *data,
@@ -947,6 +1169,7 @@ int  mdb_cursor_get(MDB_cursor *cursor, MDB_val *key, MDB_val *data,
 	 * @return A non-zero error value on failure and 0 on success. Some possible
 	 * errors are:
 	 * <ul>
+	 *	<li>#MDB_MAP_FULL - the database is full, see #mdb_env_set_mapsize().
 	 *	<li>EACCES - an attempt was made to modify a read-only database.
 	 *	<li>EINVAL - an invalid parameter was specified.
 	 * </ul>
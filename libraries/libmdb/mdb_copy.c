@@ -0,0 +1,60 @@
+/* mdb_copy.c - memory-mapped database backup tool */
+/*
+ * Copyright 2012 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mdb.h"
+
+int main(int argc,char * argv[])
+{
+	int rc, i;
+	MDB_env *env;
+	unsigned int flags = 0;
+	char *envname;
+
+	while ((i = getopt(argc, argv, "c")) != EOF) {
+		switch(i) {
+		case 'c':
+			flags |= MDB_CP_COMPACT;
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+	}
+
+	if (argc - optind < 1 || argc - optind > 2) {
+		fprintf(stderr, "usage: %s [-c] srcpath [dstpath]\n", argv[0]);
+		exit(1);
+	}
+	envname = argv[optind];
+
+	rc = mdb_env_create(&env);
+
+	rc = mdb_env_open(env, envname, MDB_RDONLY, 0);
+	if (rc) {
+		fprintf(stderr, "mdb_env_open failed, error %d %s\n", rc, mdb_strerror(rc));
+		exit(1);
+	}
+	if (argc - optind == 2)
+		rc = mdb_env_copy(env, argv[optind+1], flags);
+	else
+		rc = mdb_env_copyfd(env, 1, flags);
+	if (rc)
+		fprintf(stderr, "%s copy failed, error %d %s\n", envname, rc, mdb_strerror(rc));
+	mdb_env_close(env);
+
+	return rc ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+/* mdb_verify.c - memory-mapped database consistency checker */
+/*
+ * Copyright 2012 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mdb.h"
+
+static void
+report(const char *msg, void *ctx)
+{
+	size_t *count = ctx;
+
+	printf("%s\n", msg);
+	(*count)++;
+}
+
+int main(int argc,char * argv[])
+{
+	int rc, i;
+	MDB_env *env;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	unsigned int flags = 0, threads = 4;
+	size_t count = 0;
+	char *envname;
+
+	while ((i = getopt(argc, argv, "ot:")) != EOF) {
+		switch(i) {
+		case 'o':
+			flags |= MDB_VERIFY_OPENED;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			if (threads < 1)
+				argc = 0;
+			break;
+		default:
+			argc = 0;
+			break;
+		}
+	}
+
+	if (argc - optind != 1) {
+		fprintf(stderr, "usage: %s [-o] [-t threads] dbpath\n", argv[0]);
+		exit(1);
+	}
+	envname = argv[optind];
+
+	rc = mdb_env_create(&env);
+
+	rc = mdb_env_open(env, envname, MDB_RDONLY, 0);
+	if (rc) {
+		fprintf(stderr, "mdb_env_open failed, error %d %s\n", rc, mdb_strerror(rc));
+		exit(1);
+	}
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc) {
+		fprintf(stderr, "mdb_txn_begin failed, error %d %s\n", rc, mdb_strerror(rc));
+		goto env_close;
+	}
+	/* Opening the main DB sets up the default key order for it */
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	if (!rc)
+		rc = mdb_verify(txn, flags, threads, report, &count);
+	if (rc == MDB_CORRUPTED)
+		printf("%s: %zu problems found\n", envname, count);
+	else if (rc)
+		fprintf(stderr, "%s check failed, error %d %s\n", envname, rc, mdb_strerror(rc));
+	else
+		printf("%s: no problems found\n", envname);
+	mdb_txn_abort(txn);
+env_close:
+	mdb_env_close(env);
+
+	return rc ? 1 : 0;
+}
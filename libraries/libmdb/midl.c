@@ -117,10 +117,11 @@ int mdb_midl_insert( MDB_IDL ids, MDB_ID id )
 }
 #endif
 
-MDB_IDL mdb_midl_alloc()
+MDB_IDL mdb_midl_alloc(int num)
 {
-	MDB_IDL ids = malloc((MDB_IDL_UM_MAX+1) * sizeof(MDB_ID));
-	*ids++ = MDB_IDL_UM_MAX;
+	MDB_IDL ids = malloc((num+2) * sizeof(MDB_ID));
+	if (ids)
+		*ids++ = num;
 	return ids;
 }
 
@@ -148,7 +149,7 @@ int mdb_midl_append( MDB_IDL *idp, MDB_ID id )
 	if (ids[0] >= ids[-1]) {
 		MDB_IDL idn = ids-1;
 		/* grow it */
-		idn = realloc(idn, (*idn + MDB_IDL_UM_MAX + 1) * sizeof(MDB_ID));
+		idn = realloc(idn, (*idn + MDB_IDL_UM_MAX + 2) * sizeof(MDB_ID));
 		if (!idn)
 			return -1;
 		*idn++ += MDB_IDL_UM_MAX;
@@ -167,7 +168,7 @@ int mdb_midl_append_list( MDB_IDL *idp, MDB_IDL app )
 	if (ids[0] + app[0] >= ids[-1]) {
 		MDB_IDL idn = ids-1;
 		/* grow it */
-		idn = realloc(idn, (*idn + app[-1]) * sizeof(MDB_ID));
+		idn = realloc(idn, (*idn + app[-1] + 2) * sizeof(MDB_ID));
 		if (!idn)
 			return -1;
 		*idn++ += app[-1];
@@ -179,6 +180,35 @@ int mdb_midl_append_list( MDB_IDL *idp, MDB_IDL app )
 	return 0;
 }
 
+int mdb_midl_xmerge( MDB_IDL *idp, MDB_IDL merge )
+{
+	MDB_IDL ids = *idp;
+	unsigned i = merge[0], j, k;
+
+	/* Too big? */
+	if (ids[0] + i >= ids[-1]) {
+		MDB_IDL idn = ids-1;
+		/* grow it */
+		idn = realloc(idn, (*idn + i + MDB_IDL_UM_MAX + 1) * sizeof(MDB_ID));
+		if (!idn)
+			return -1;
+		*idn++ += i + MDB_IDL_UM_MAX;
+		ids = idn;
+		*idp = ids;
+	}
+	/* fill in from the tail, which holds the smallest IDs */
+	j = ids[0];
+	k = j + i;
+	ids[0] = k;
+	while (i) {
+		if (j && ids[j] < merge[i])
+			ids[k--] = ids[j--];
+		else
+			ids[k--] = merge[i--];
+	}
+	return 0;
+}
+
 /* Quicksort + Insertion sort for small arrays */
 
 #define SMALL	8
@@ -115,10 +115,11 @@ int mdb_midl_insert( MDB_IDL ids, MDB_ID id );
 #endif
 
 	/** Allocate an IDL.
-	 * Allocates memory for an IDL of a default size.
+	 * Allocates memory for an IDL of the given size.
+	 * @param[in] num	The number of IDs the IDL must hold.
 	 * @return	IDL on success, NULL on failure.
 	 */
-MDB_IDL mdb_midl_alloc();
+MDB_IDL mdb_midl_alloc(int num);
 
 	/** Free an IDL.
 	 * @param[in] ids	The IDL to free.
@@ -146,6 +147,14 @@ int mdb_midl_append( MDB_IDL *idp, MDB_ID id );
 	 */
 int mdb_midl_append_list( MDB_IDL *idp, MDB_IDL app );
 
+	/** Merge an IDL onto an IDL.
+	 * Both IDLs must be sorted, and the result stays sorted.
+	 * @param[in,out] idp	Address of the IDL to merge into.
+	 * @param[in] merge	The IDL to merge.
+	 * @return	0 on success, -1 if the IDL is too large.
+	 */
+int mdb_midl_xmerge( MDB_IDL *idp, MDB_IDL merge );
+
 	/** Sort an IDL.
 	 * @param[in,out] ids	The IDL to sort.
 	 */
@@ -0,0 +1,170 @@
+/* mtest10.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2012 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests that environments without checksums keep the original format */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "mdb.h"
+
+#define NRECS	1000
+
+/* Where the meta page keeps the format version: after the page
+ * header and the magic number.
+ */
+#define VERSION_OFF	(16 + 4)
+
+static int
+version(void)
+{
+	uint32_t v;
+	int fd;
+
+	if ((fd = open("./testdb/data.mdb", O_RDONLY)) < 0 ||
+		pread(fd, &v, sizeof(v), VERSION_OFF) != sizeof(v)) {
+		perror("data.mdb");
+		exit(1);
+	}
+	close(fd);
+	return v;
+}
+
+static int
+put(MDB_env *env, int from, int to)
+{
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	MDB_val key, data;
+	char kbuf[16], dbuf[10000];
+	int i, rc;
+
+	rc = mdb_txn_begin(env, NULL, 0, &txn);
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	for (i=from; i<to && !rc; i++) {
+		sprintf(kbuf, "%08d", i);
+		key.mv_size = 8;
+		key.mv_data = kbuf;
+		/* every tenth record goes on overflow pages */
+		data.mv_size = (i % 10) ? 100 : sizeof(dbuf);
+		data.mv_data = dbuf;
+		memset(dbuf, 'a' + i % 26, data.mv_size);
+		rc = mdb_put(txn, dbi, &key, &data, 0);
+	}
+	if (!rc)
+		rc = mdb_txn_commit(txn);
+	else
+		mdb_txn_abort(txn);
+	return rc;
+}
+
+static int
+check(MDB_env *env, int to)
+{
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	MDB_val key, data;
+	char kbuf[16];
+	int i, rc;
+
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	for (i=0; i<to && !rc; i++) {
+		sprintf(kbuf, "%08d", i);
+		key.mv_size = 8;
+		key.mv_data = kbuf;
+		rc = mdb_get(txn, dbi, &key, &data);
+		if (!rc && (data.mv_size != ((i % 10) ? 100 : 10000) ||
+			((char *)data.mv_data)[data.mv_size-1] != 'a' + i % 26)) {
+			printf("record %d has the wrong data\n", i);
+			rc = MDB_CORRUPTED;
+		}
+	}
+	mdb_txn_abort(txn);
+	return rc;
+}
+
+int main(int argc,char * argv[])
+{
+	int rc;
+	unsigned int flags;
+	MDB_env *env;
+
+	unlink("./testdb/data.mdb");
+	unlink("./testdb/lock.mdb");
+
+	/* A plain environment is written in the original format */
+	rc = mdb_env_create(&env);
+	rc = mdb_env_set_mapsize(env, 104857600);
+	rc = mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664);
+	if (rc || (rc = put(env, 0, NRECS))) {
+		printf("create: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	mdb_env_close(env);
+	printf("plain environment is version %d\n", version());
+	if (version() != 1)
+		return 1;
+
+	/* Asking for checksums when opening it does not change it */
+	rc = mdb_env_create(&env);
+	rc = mdb_env_set_mapsize(env, 104857600);
+	rc = mdb_env_open(env, "./testdb", MDB_CHECKSUM|MDB_VERIFY|MDB_NOSYNC, 0664);
+	if (rc) {
+		printf("reopen: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	mdb_env_get_flags(env, &flags);
+	if (flags & MDB_CHECKSUM) {
+		printf("checksums were enabled on an existing environment\n");
+		return 1;
+	}
+	if ((rc = check(env, NRECS)) || (rc = put(env, NRECS, NRECS * 2)) ||
+		(rc = check(env, NRECS * 2))) {
+		printf("update: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	mdb_env_close(env);
+	if (version() != 1) {
+		printf("environment changed to version %d\n", version());
+		return 1;
+	}
+
+	/* Only a new environment with checksums gets the new format */
+	unlink("./testdb/data.mdb");
+	unlink("./testdb/lock.mdb");
+	rc = mdb_env_create(&env);
+	rc = mdb_env_set_mapsize(env, 104857600);
+	rc = mdb_env_open(env, "./testdb", MDB_CHECKSUM|MDB_VERIFY|MDB_NOSYNC, 0664);
+	if (rc || (rc = put(env, 0, NRECS)) || (rc = check(env, NRECS))) {
+		printf("checksum environment: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	mdb_env_close(env);
+	printf("checksum environment is version %d\n", version());
+	if (version() != 2)
+		return 1;
+
+	rc = mdb_env_create(&env);
+	rc = mdb_env_open(env, "./testdb", MDB_VERIFY|MDB_NOSYNC, 0664);
+	if (rc || (rc = check(env, NRECS))) {
+		printf("checksum reopen: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	mdb_env_close(env);
+
+	return 0;
+}
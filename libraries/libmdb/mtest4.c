@@ -114,6 +114,36 @@ int main(int argc,char * argv[])
 	}
 	mdb_cursor_close(cursor);
 	mdb_txn_abort(txn);
+
+	/* Fetch the same values in bulk, plus a key with only one value */
+	rc = mdb_txn_begin(env, NULL, 0, &txn);
+	strcpy(kval, "002");
+	key.mv_size = sizeof(int);
+	key.mv_data = kval;
+	data.mv_size = sizeof(sval);
+	data.mv_data = sval;
+	rc = mdb_put(txn, dbi, &key, &data, MDB_NODUPDATA);
+	rc = mdb_cursor_open(txn, dbi, &cursor);
+	for (i=1; i<3; i++) {
+		size_t dups = 0;
+		sprintf(kval, "%03d", i);
+		key.mv_data = kval;
+		j = 0;
+		rc = mdb_cursor_get(cursor, &key, &data, MDB_SET);
+		if (rc == 0)
+			rc = mdb_cursor_count(cursor, &dups);
+		if (rc == 0)
+			rc = mdb_cursor_get(cursor, &key, &data, MDB_GET_MULTIPLE);
+		while (rc == 0) {
+			j += data.mv_size / sizeof(sval);
+			rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_MULTIPLE);
+		}
+		printf("key: %s, bulk read %d of %d values%s\n", kval, j,
+			(int) dups, j == (int) dups ? "" : " MISMATCH");
+	}
+	mdb_cursor_close(cursor);
+	mdb_txn_abort(txn);
+	strcpy(kval, "001");
 	j=0;
 
 	for (i= count - 1; i > -1; i-= (random()%3)) {
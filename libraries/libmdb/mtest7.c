@@ -0,0 +1,272 @@
+/* mtest7.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2012 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for nested transactions: committed children are merged
+ * into their parent, aborted ones leave no trace.
+ */
+#define _XOPEN_SOURCE 500		/* srandom(), random() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mdb.h"
+
+#define NKEYS	300
+#define NROUNDS	200
+
+/* What each key should hold: 0 if absent, else the fill byte */
+typedef struct model {
+	unsigned char val[NKEYS];
+} model;
+
+static char *vbuf;
+static size_t psize;
+
+static size_t
+vsize(int k)
+{
+	/* every fourth key uses overflow pages */
+	return (k & 3) ? 24 : psize * 2 + 100;
+}
+
+static int
+put(MDB_txn *txn, MDB_dbi dbi, model *m, int k, unsigned char c)
+{
+	MDB_val key, data;
+	char kbuf[16];
+	int rc;
+
+	sprintf(kbuf, "%05d", k);
+	key.mv_size = 5;
+	key.mv_data = kbuf;
+	data.mv_size = vsize(k);
+	data.mv_data = vbuf;
+	memset(vbuf, c, data.mv_size);
+	rc = mdb_put(txn, dbi, &key, &data, 0);
+	if (!rc)
+		m->val[k] = c;
+	return rc;
+}
+
+static int
+del(MDB_txn *txn, MDB_dbi dbi, model *m, int k)
+{
+	MDB_val key;
+	char kbuf[16];
+	int rc;
+
+	sprintf(kbuf, "%05d", k);
+	key.mv_size = 5;
+	key.mv_data = kbuf;
+	rc = mdb_del(txn, dbi, &key, NULL);
+	if (!rc || rc == MDB_NOTFOUND) {
+		m->val[k] = 0;
+		rc = 0;
+	}
+	return rc;
+}
+
+/* Random changes to about a tenth of the keys */
+static int
+change(MDB_txn *txn, MDB_dbi dbi, model *m)
+{
+	int i, rc = 0;
+
+	for (i=0; i<NKEYS/10 && !rc; i++) {
+		int k = random() % NKEYS;
+		if (random() % 4 == 0)
+			rc = del(txn, dbi, m, k);
+		else
+			rc = put(txn, dbi, m, k, 'a' + random() % 26);
+	}
+	return rc;
+}
+
+static int
+check(MDB_txn *txn, MDB_dbi dbi, model *m, const char *what)
+{
+	MDB_cursor *cursor;
+	MDB_val key, data;
+	model seen;
+	int i, rc, bad = 0;
+
+	memset(&seen, 0, sizeof(seen));
+	rc = mdb_cursor_open(txn, dbi, &cursor);
+	while ((rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) == 0) {
+		char *p = data.mv_data, kbuf[16];
+		int k;
+		memcpy(kbuf, key.mv_data, key.mv_size);
+		kbuf[key.mv_size] = '\0';
+		k = atoi(kbuf);
+		if (data.mv_size != vsize(k) || p[0] != p[data.mv_size-1]) {
+			printf("%s: key %d bad data\n", what, k);
+			bad++;
+		}
+		seen.val[k] = p[0];
+	}
+	mdb_cursor_close(cursor);
+	for (i=0; i<NKEYS; i++) {
+		if (seen.val[i] != m->val[i]) {
+			printf("%s: key %d has %c, expected %c\n", what, i,
+				seen.val[i] ? seen.val[i] : '-', m->val[i] ? m->val[i] : '-');
+			bad++;
+		}
+	}
+	return bad;
+}
+
+/* Add duplicates in nested txns; small sets of them live in
+ * sub-pages inside their leaf page.
+ */
+static int
+dups(MDB_env *env)
+{
+	MDB_txn *txn, *child;
+	MDB_dbi dbi;
+	MDB_cursor *cursor;
+	MDB_val key, data;
+	char kbuf[16], dbuf[16];
+	int i, k, rc, bad = 0;
+	size_t count;
+
+	rc = mdb_txn_begin(env, NULL, 0, &txn);
+	rc = mdb_open(txn, "dups", MDB_CREATE|MDB_DUPSORT, &dbi);
+	for (i=0; i<4 && !rc; i++) {
+		if ((rc = mdb_txn_begin(env, txn, 0, &child)))
+			break;
+		for (k=0; k<NKEYS && !rc; k++) {
+			sprintf(kbuf, "%05d", k);
+			sprintf(dbuf, "%03d", i);
+			key.mv_size = 5;
+			key.mv_data = kbuf;
+			data.mv_size = 3;
+			data.mv_data = dbuf;
+			rc = mdb_put(child, dbi, &key, &data, MDB_NODUPDATA);
+		}
+		if (rc)
+			mdb_txn_abort(child);
+		else
+			rc = mdb_txn_commit(child);
+	}
+	if (rc) {
+		printf("dups: %s\n", mdb_strerror(rc));
+		mdb_txn_abort(txn);
+		return 1;
+	}
+	rc = mdb_txn_commit(txn);
+
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	rc = mdb_cursor_open(txn, dbi, &cursor);
+	for (k=0; k<NKEYS; k++) {
+		sprintf(kbuf, "%05d", k);
+		key.mv_size = 5;
+		key.mv_data = kbuf;
+		if ((rc = mdb_cursor_get(cursor, &key, &data, MDB_SET)) ||
+			mdb_cursor_count(cursor, &count) || count != 4) {
+			printf("dups: key %d missing values\n", k);
+			bad++;
+		}
+	}
+	mdb_cursor_close(cursor);
+	mdb_txn_abort(txn);
+	return bad;
+}
+
+int main(int argc,char * argv[])
+{
+	int i, j, rc, bad = 0;
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_txn *txn, *child, *gchild;
+	MDB_stat mst;
+	model cur, tmp, tmp2;
+
+	srandom(argc > 1 ? atoi(argv[1]) : time(NULL));
+
+	rc = mdb_env_create(&env);
+	rc = mdb_env_set_mapsize(env, 104857600);
+	rc = mdb_env_set_maxdbs(env, 4);
+	rc = mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664);
+	if (rc) {
+		printf("mdb_env_open: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	rc = mdb_txn_begin(env, NULL, 0, &txn);
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	rc = mdb_stat(txn, dbi, &mst);
+	psize = mst.ms_psize;
+	vbuf = malloc(vsize(0));
+	memset(&cur, 0, sizeof(cur));
+	for (i=0; i<NKEYS; i+=2)
+		put(txn, dbi, &cur, i, 'A');
+	rc = mdb_txn_commit(txn);
+
+	printf("Running %d rounds of nested txns\n", NROUNDS);
+	for (i=0; i<NROUNDS && !bad; i++) {
+		rc = mdb_txn_begin(env, NULL, 0, &txn);
+		rc = change(txn, dbi, &cur);
+		for (j=0; j<4 && !rc; j++) {
+			tmp = cur;
+			if ((rc = mdb_txn_begin(env, txn, 0, &child)))
+				break;
+			rc = change(child, dbi, &tmp);
+			/* sometimes go one level deeper */
+			if (!rc && j == 2) {
+				tmp2 = tmp;
+				rc = mdb_txn_begin(env, child, 0, &gchild);
+				if (!rc)
+					rc = change(gchild, dbi, &tmp2);
+				if (!rc && (random() & 1)) {
+					rc = mdb_txn_commit(gchild);
+					tmp = tmp2;
+				} else {
+					mdb_txn_abort(gchild);
+				}
+				if (!rc)
+					bad += check(child, dbi, &tmp, "child after grandchild");
+			}
+			if (rc) {
+				mdb_txn_abort(child);
+				break;
+			}
+			if (j & 1) {
+				mdb_txn_abort(child);
+			} else if (!(rc = mdb_txn_commit(child))) {
+				cur = tmp;
+			}
+			bad += check(txn, dbi, &cur, "parent");
+		}
+		if (rc) {
+			printf("round %d: %s\n", i, mdb_strerror(rc));
+			return 1;
+		}
+		if ((rc = mdb_txn_commit(txn))) {
+			printf("commit: %s\n", mdb_strerror(rc));
+			return 1;
+		}
+		rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+		bad += check(txn, dbi, &cur, "committed");
+		mdb_txn_abort(txn);
+	}
+
+	if (!bad)
+		bad = dups(env);
+
+	printf("%d errors\n", bad);
+	mdb_close(env, dbi);
+	mdb_env_close(env);
+	free(vbuf);
+
+	return bad != 0;
+}
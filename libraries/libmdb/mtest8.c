@@ -0,0 +1,141 @@
+/* mtest8.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2012 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for growing the map of an open environment */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "mdb.h"
+
+#define MAPSIZE	(256*1024)
+#define NRECS	2000
+
+/* Add the records from *next on in one txn */
+static int
+fill(MDB_env *env, MDB_dbi dbi, int *next)
+{
+	MDB_txn *txn;
+	MDB_val key, data;
+	char kbuf[16], dbuf[200];
+	int rc, i = *next;
+
+	rc = mdb_txn_begin(env, NULL, 0, &txn);
+	if (rc)
+		return rc;
+	memset(dbuf, 'x', sizeof(dbuf));
+	for (; i<NRECS; i++) {
+		sprintf(kbuf, "%08d", i);
+		key.mv_size = 8;
+		key.mv_data = kbuf;
+		data.mv_size = sizeof(dbuf);
+		data.mv_data = dbuf;
+		if ((rc = mdb_put(txn, dbi, &key, &data, 0)))
+			break;
+	}
+	if (rc) {
+		mdb_txn_abort(txn);
+		return rc;
+	}
+	rc = mdb_txn_commit(txn);
+	if (!rc)
+		*next = i;
+	return rc;
+}
+
+int main(int argc,char * argv[])
+{
+	int rc, next = 0, grows = 0;
+	size_t mapsize = MAPSIZE;
+	MDB_env *env;
+	MDB_dbi dbi;
+	MDB_txn *txn;
+	MDB_stat mst;
+
+	rc = mdb_env_create(&env);
+	rc = mdb_env_set_mapsize(env, mapsize);
+	rc = mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664);
+	if (rc) {
+		printf("mdb_env_open: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	rc = mdb_txn_begin(env, NULL, 0, &txn);
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	rc = mdb_txn_commit(txn);
+
+	/* Grow the map whenever the remaining records don't fit */
+	while (next < NRECS) {
+		rc = fill(env, dbi, &next);
+		if (rc != MDB_MAP_FULL)
+			break;
+		mapsize *= 2;
+		if ((rc = mdb_env_set_mapsize(env, mapsize))) {
+			printf("mdb_env_set_mapsize: %s\n", mdb_strerror(rc));
+			return 1;
+		}
+		grows++;
+	}
+	if (rc) {
+		printf("fill: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	printf("Stored %d records after growing the map %d times\n", next, grows);
+	if (!grows) {
+		printf("map never filled up\n");
+		return 1;
+	}
+
+	/* The map can't be changed under an active reader */
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	rc = mdb_env_set_mapsize(env, mapsize * 2);
+	if (rc != EBUSY) {
+		printf("resize with a reader: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	rc = mdb_stat(txn, dbi, &mst);
+	mdb_txn_abort(txn);
+	if (mst.ms_entries != NRECS) {
+		printf("%zu entries, expected %d\n", mst.ms_entries, NRECS);
+		return 1;
+	}
+	mdb_close(env, dbi);
+	mdb_env_close(env);
+
+	/* Reopen without a mapsize: the grown size was recorded,
+	 * so there is room to rewrite a record.
+	 */
+	rc = mdb_env_create(&env);
+	rc = mdb_env_open(env, "./testdb", MDB_NOSYNC, 0664);
+	if (rc) {
+		printf("mdb_env_open: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	rc = mdb_txn_begin(env, NULL, 0, &txn);
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	rc = mdb_txn_commit(txn);
+	next = NRECS - 1;
+	rc = fill(env, dbi, &next);
+	if (rc) {
+		printf("rewrite after reopen: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	rc = mdb_stat(txn, dbi, &mst);
+	mdb_txn_abort(txn);
+	printf("Reopened, %zu entries\n", mst.ms_entries);
+	mdb_close(env, dbi);
+	mdb_env_close(env);
+
+	return mst.ms_entries != NRECS;
+}
@@ -0,0 +1,189 @@
+/* mtest9.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2012 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for page checksums and mdb_verify() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "mdb.h"
+
+#define NRECS	2000
+#define NDUPS	40
+
+/* The record to damage, and how to find it in the file */
+#define TARGET	1001
+#define MARK	"damage me"
+
+static void
+report(const char *msg, void *ctx)
+{
+	int *count = ctx;
+
+	printf("  %s\n", msg);
+	(*count)++;
+}
+
+static int
+fill(MDB_env *env, size_t psize)
+{
+	MDB_txn *txn;
+	MDB_dbi dbi, ddbi;
+	MDB_val key, data;
+	char kbuf[16], *dbuf;
+	int i, j, rc;
+
+	dbuf = malloc(psize * 3);
+	memset(dbuf, 'x', psize * 3);
+	rc = mdb_txn_begin(env, NULL, 0, &txn);
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	rc = mdb_open(txn, "dups", MDB_CREATE|MDB_DUPSORT, &ddbi);
+	for (i=0; i<NRECS && !rc; i++) {
+		sprintf(kbuf, "%08d", i);
+		key.mv_size = 8;
+		key.mv_data = kbuf;
+		/* every tenth record goes on overflow pages */
+		data.mv_size = (i % 10) ? 100 : psize * 3;
+		data.mv_data = dbuf;
+		if (i == TARGET)
+			memcpy(dbuf, MARK, sizeof(MARK));
+		rc = mdb_put(txn, dbi, &key, &data, 0);
+		memset(dbuf, 'x', sizeof(MARK));
+		/* the first keys get enough duplicates for a sub-DB */
+		for (j=0; j<(i < 10 ? NDUPS * 10 : NDUPS) && !rc && i < 100; j++) {
+			sprintf(dbuf, "%06d", j);
+			data.mv_size = 6;
+			rc = mdb_put(txn, ddbi, &key, &data, 0);
+			dbuf[0] = 'x';
+		}
+	}
+	if (!rc)
+		rc = mdb_txn_commit(txn);
+	else
+		mdb_txn_abort(txn);
+
+	/* leave some pages on the freelist */
+	if (!rc)
+		rc = mdb_txn_begin(env, NULL, 0, &txn);
+	for (i=0; i<NRECS && !rc; i+=3) {
+		sprintf(kbuf, "%08d", i);
+		key.mv_size = 8;
+		key.mv_data = kbuf;
+		if ((rc = mdb_del(txn, dbi, &key, NULL)) == MDB_NOTFOUND)
+			rc = 0;
+	}
+	if (!rc)
+		rc = mdb_txn_commit(txn);
+	mdb_close(env, ddbi);
+	free(dbuf);
+	return rc;
+}
+
+int main(int argc,char * argv[])
+{
+	int rc, fd, errs = 0;
+	unsigned int flags;
+	MDB_env *env;
+	MDB_stat mst;
+	MDB_dbi dbi;
+	MDB_txn *txn;
+	MDB_val key, data;
+	off_t off, size;
+	char *map, buf[16];
+	int damaged = 0;
+
+	rc = mdb_env_create(&env);
+	rc = mdb_env_set_mapsize(env, 104857600);
+	rc = mdb_env_set_maxdbs(env, 4);
+	rc = mdb_env_open(env, "./testdb", MDB_CHECKSUM|MDB_NOSYNC, 0664);
+	if (rc) {
+		printf("mdb_env_open: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	rc = mdb_env_stat(env, &mst);
+	if ((rc = fill(env, mst.ms_psize))) {
+		printf("fill: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+
+	/* A sound environment has nothing to report */
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	rc = mdb_verify(txn, 0, 4, report, &errs);
+	printf("verify with 4 threads: %s\n", mdb_strerror(rc));
+	if (rc)
+		return 1;
+
+	mdb_txn_abort(txn);
+	mdb_close(env, dbi);
+	mdb_env_close(env);
+
+	/* Damage one byte of the record, and of any old copies of its
+	 * page, so that only the checksums can tell.
+	 */
+	if ((fd = open("./testdb/data.mdb", O_RDWR)) < 0 ||
+		(size = lseek(fd, 0, SEEK_END)) < 0 ||
+		(map = malloc(size)) == NULL || pread(fd, map, size, 0) != size) {
+		perror("data.mdb");
+		return 1;
+	}
+	for (off = 0; off + (off_t)sizeof(MARK) <= size; off++) {
+		if (!memcmp(map + off, MARK, sizeof(MARK))) {
+			map[off] ^= 0x20;
+			if (pwrite(fd, map + off, 1, off) != 1) {
+				perror("data.mdb");
+				return 1;
+			}
+			damaged++;
+		}
+	}
+	close(fd);
+	free(map);
+	if (!damaged) {
+		printf("record not found in data.mdb\n");
+		return 1;
+	}
+
+	/* The checksum setting comes from the environment itself */
+	rc = mdb_env_create(&env);
+	rc = mdb_env_set_maxdbs(env, 4);
+	rc = mdb_env_open(env, "./testdb", MDB_VERIFY|MDB_NOSYNC, 0664);
+	if (rc) {
+		printf("mdb_env_open: %s\n", mdb_strerror(rc));
+		return 1;
+	}
+	mdb_env_get_flags(env, &flags);
+	if (!(flags & MDB_CHECKSUM)) {
+		printf("checksums were not enabled on reopen\n");
+		return 1;
+	}
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	sprintf(buf, "%08d", TARGET);
+	key.mv_size = 8;
+	key.mv_data = buf;
+	rc = mdb_get(txn, dbi, &key, &data);
+	printf("read of the damaged page: %s\n", mdb_strerror(rc));
+	if (rc != MDB_CORRUPTED)
+		return 1;
+	errs = 0;
+	rc = mdb_verify(txn, 0, 1, report, &errs);
+	printf("verify with 1 thread: %s, %d problems\n", mdb_strerror(rc), errs);
+	mdb_txn_abort(txn);
+	mdb_close(env, dbi);
+	mdb_env_close(env);
+
+	return rc != MDB_CORRUPTED || !errs;
+}
@@ -331,6 +331,13 @@ fe_op_add( Operation *op, SlapReply *rs )
 				}
 			}
 
+#ifdef LDAP_X_TXN
+			if ( op->o_txnSpec ) {
+				/* queued, performed when the transaction ends */
+				rc = txn_preop( op, rs );
+				goto done;
+			}
+#endif
 			rc = op->o_bd->be_add( op, rs );
 			if ( rc == LDAP_SUCCESS ) {
 				OpExtra *oex;
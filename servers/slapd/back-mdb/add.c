@@ -44,51 +44,9 @@ mdb_add(Operation *op, SlapReply *rs )
 	LDAPControl *ctrls[SLAP_MAX_RESPONSE_CONTROLS];
 	int num_ctrls = 0;
 
-#ifdef LDAP_X_TXN
-	int settle = 0;
-#endif
-
 	Debug(LDAP_DEBUG_ARGS, "==> " LDAP_XSTRING(mdb_add) ": %s\n",
 		op->ora_e->e_name.bv_val, 0, 0);
 
-#ifdef LDAP_X_TXN
-	if( op->o_txnSpec ) {
-		/* acquire connection lock */
-		ldap_pvt_thread_mutex_lock( &op->o_conn->c_mutex );
-		if( op->o_conn->c_txn == CONN_TXN_INACTIVE ) {
-			rs->sr_text = "invalid transaction identifier";
-			rs->sr_err = LDAP_X_TXN_ID_INVALID;
-			goto txnReturn;
-		} else if( op->o_conn->c_txn == CONN_TXN_SETTLE ) {
-			settle=1;
-			goto txnReturn;
-		}
-
-		if( op->o_conn->c_txn_backend == NULL ) {
-			op->o_conn->c_txn_backend = op->o_bd;
-
-		} else if( op->o_conn->c_txn_backend != op->o_bd ) {
-			rs->sr_text = "transaction cannot span multiple database contexts";
-			rs->sr_err = LDAP_AFFECTS_MULTIPLE_DSAS;
-			goto txnReturn;
-		}
-
-		/* insert operation into transaction */
-
-		rs->sr_text = "transaction specified";
-		rs->sr_err = LDAP_X_TXN_SPECIFY_OKAY;
-
-txnReturn:
-		/* release connection lock */
-		ldap_pvt_thread_mutex_unlock( &op->o_conn->c_mutex );
-
-		if( !settle ) {
-			send_ldap_result( op, rs );
-			return rs->sr_err;
-		}
-	}
-#endif
-
 	ctrls[num_ctrls] = 0;
 
 	/* check entry's schema */
@@ -132,7 +90,15 @@ txnReturn:
 		goto return_results;
 	}
 
-	txn = moi->moi_txn;
+	rs->sr_err = mdb_txn_nest( mdb, moi, &txn );
+	if( rs->sr_err != 0 ) {
+		Debug( LDAP_DEBUG_TRACE,
+			LDAP_XSTRING(mdb_add) ": nested txn_begin failed: "
+			"%s (%d)\n", mdb_strerror(rs->sr_err), rs->sr_err, 0 );
+		rs->sr_err = LDAP_OTHER;
+		rs->sr_text = "internal error";
+		goto return_results;
+	}
 
 	/*
 	 * Get the parent dn and see if the corresponding entry exists.
@@ -398,9 +364,11 @@ txnReturn:
 		}
 	}
 
-	if ( moi == &opinfo ) {
-		LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
-		opinfo.moi_oe.oe_key = NULL;
+	if ( moi == &opinfo || txn != moi->moi_txn ) {
+		if ( moi == &opinfo ) {
+			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
+			opinfo.moi_oe.oe_key = NULL;
+		}
 		if ( op->o_noop ) {
 			mdb_txn_abort( txn );
 			rs->sr_err = LDAP_X_NO_OPERATION;
@@ -439,6 +407,9 @@ return_results:
 		if ( opinfo.moi_oe.oe_key ) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
 		}
+		mdb_map_check( mdb );
+	} else if( txn != NULL && txn != moi->moi_txn ) {
+		mdb_txn_abort( txn );
 	}
 
 	if( success == LDAP_SUCCESS ) {
@@ -133,6 +133,7 @@ mdb_attr_dbs_open(
 				cr->msg, 0, 0 );
 			break;
 		}
+		mdb_monitor_idx_reset( mdb, mdb->mi_attrs[i]->ai_dbi );
 	}
 
 	/* Only commit if this is our txn */
@@ -524,6 +525,12 @@ void mdb_attr_flush( struct mdb_info *mdb )
 	}
 }
 
+/* Records in ad2i that mark a change of the database format. They
+ * are not valid attribute descriptions, and mdb_ad_read() refuses the
+ * database if it finds one it doesn't know.
+ */
+static struct berval mdb_fmt_idlexact = BER_BVC("#idlexact");
+
 int mdb_ad_read( struct mdb_info *mdb, MDB_txn *txn )
 {
 	int i, rc;
@@ -551,6 +558,21 @@ int mdb_ad_read( struct mdb_info *mdb, MDB_txn *txn )
 	while ( rc == MDB_SUCCESS ) {
 		bdata.bv_len = data.mv_size;
 		bdata.bv_val = data.mv_data;
+		if ( bdata.bv_len && bdata.bv_val[0] == '#' ) {
+			if ( !ber_bvcmp( &bdata, &mdb_fmt_idlexact )) {
+				mdb->mi_flags |= MDB_IDL_EXACT|MDB_IDL_EXACT_DB;
+			} else {
+				Debug( LDAP_DEBUG_ANY,
+					"mdb_ad_read: unsupported database format \"%.*s\"\n",
+					(int) bdata.bv_len, bdata.bv_val, 0 );
+				rc = LDAP_OTHER;
+				break;
+			}
+			mdb->mi_ads[i] = NULL;
+			i++;
+			rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT );
+			continue;
+		}
 		ad = NULL;
 		rc = slap_bv2ad( &bdata, &ad, &text );
 		if ( rc ) {
@@ -584,12 +606,13 @@ int mdb_ad_get( struct mdb_info *mdb, MDB_txn *txn, AttributeDescription *ad )
 	int i, rc;
 	MDB_val key, val;
 
+	ldap_pvt_thread_mutex_lock( &mdb->mi_ads_mutex );
 	rc = mdb_ad_read( mdb, txn );
 	if (rc)
-		return rc;
+		goto done;
 
 	if ( mdb->mi_adxs[ad->ad_index] )
-		return 0;
+		goto done;
 
 	i = mdb->mi_numads+1;
 	key.mv_size = sizeof(int);
@@ -608,5 +631,144 @@ int mdb_ad_get( struct mdb_info *mdb, MDB_txn *txn, AttributeDescription *ad )
 			mdb_strerror(rc), rc, 0);
 	}
 
+done:
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_ads_mutex );
+	return rc;
+}
+
+/* Record that index keys may hold any number of IDs, see idlexact
+ * in slapd-mdb(5). It takes the next description number.
+ */
+int mdb_ad_format( struct mdb_info *mdb, MDB_txn *txn )
+{
+	int i, rc;
+	MDB_val key, val;
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_ads_mutex );
+	i = mdb->mi_numads+1;
+	key.mv_size = sizeof(int);
+	key.mv_data = &i;
+	val.mv_size = mdb_fmt_idlexact.bv_len;
+	val.mv_data = mdb_fmt_idlexact.bv_val;
+
+	rc = mdb_put( txn, mdb->mi_ad2id, &key, &val, MDB_NOOVERWRITE );
+	if ( rc == MDB_SUCCESS ) {
+		mdb->mi_ads[i] = NULL;
+		mdb->mi_numads++;
+		mdb->mi_flags |= MDB_IDL_EXACT_DB;
+	} else {
+		Debug( LDAP_DEBUG_ANY,
+			"mdb_ad_format: mdb_put failed %s(%d)\n",
+			mdb_strerror(rc), rc, 0);
+	}
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_ads_mutex );
 	return rc;
 }
+
+/* Forget the descriptions that were assigned since prev_ads was
+ * saved, their records went away with an aborted txn. The caller
+ * must still hold the writer lock or mi_ads_mutex.
+ */
+void mdb_ad_unwind( struct mdb_info *mdb, int prev_ads )
+{
+	int i;
+
+	for (i = mdb->mi_numads; i > prev_ads; i--) {
+		mdb->mi_adxs[mdb->mi_ads[i]->ad_index] = 0;
+		mdb->mi_ads[i] = NULL;
+	}
+	mdb->mi_numads = i;
+}
+
+/* Mark the attributes in am that are ad or one of its subtypes */
+void
+mdb_attrmask_ad( struct mdb_info *mdb, mdb_attrmask *am,
+	AttributeDescription *ad )
+{
+	int i;
+
+	for ( i = 1; i <= am->am_numads; i++ ) {
+		if ( mdb->mi_ads[i] && is_ad_subtype( mdb->mi_ads[i], ad ))
+			am->am_want[i] = 1;
+	}
+}
+
+/* Mark the attributes a filter looks at. Returns -1 if it may
+ * look at any of them.
+ */
+int
+mdb_attrmask_filter( struct mdb_info *mdb, mdb_attrmask *am, Filter *f )
+{
+	AttributeDescription *ad;
+
+	if ( f->f_choice & SLAPD_FILTER_UNDEFINED )
+		return 0;
+
+	switch ( f->f_choice ) {
+	case SLAPD_FILTER_COMPUTED:
+		return 0;
+	case LDAP_FILTER_AND:
+	case LDAP_FILTER_OR:
+		for ( f = f->f_list; f; f = f->f_next ) {
+			if ( mdb_attrmask_filter( mdb, am, f ))
+				return -1;
+		}
+		return 0;
+	case LDAP_FILTER_NOT:
+		return mdb_attrmask_filter( mdb, am, f->f_not );
+	case LDAP_FILTER_EQUALITY:
+	case LDAP_FILTER_GE:
+	case LDAP_FILTER_LE:
+	case LDAP_FILTER_APPROX:
+		ad = f->f_av_desc;
+		break;
+	case LDAP_FILTER_SUBSTRINGS:
+		ad = f->f_sub_desc;
+		break;
+	case LDAP_FILTER_PRESENT:
+		ad = f->f_desc;
+		break;
+	case LDAP_FILTER_EXT:
+		ad = f->f_mr_desc;
+		if ( !ad )
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+	mdb_attrmask_ad( mdb, am, ad );
+	return 0;
+}
+
+/* Mark the attributes of the target entry that ACLs may read.
+ * Returns -1 if we can't tell which those are.
+ */
+int
+mdb_attrmask_acls( struct mdb_info *mdb, mdb_attrmask *am, AccessControl *a )
+{
+	Access *b;
+
+	for ( ; a; a = a->acl_next ) {
+		if ( a->acl_filter && mdb_attrmask_filter( mdb, am, a->acl_filter ))
+			return -1;
+		for ( b = a->acl_access; b; b = b->a_next ) {
+			if ( !BER_BVISEMPTY( &b->a_set_pat ))
+				return -1;
+#ifdef SLAP_DYNACL
+			if ( b->a_dynacl )
+				return -1;
+#endif /* SLAP_DYNACL */
+			if ( b->a_dn_at )
+				mdb_attrmask_ad( mdb, am, b->a_dn_at );
+			if ( b->a_realdn_at )
+				mdb_attrmask_ad( mdb, am, b->a_realdn_at );
+			/* the group may be the target entry itself */
+			if ( !BER_BVISEMPTY( &b->a_group_pat )) {
+				if ( !b->a_group_at )
+					return -1;
+				mdb_attrmask_ad( mdb, am, b->a_group_at );
+			}
+		}
+	}
+	return 0;
+}
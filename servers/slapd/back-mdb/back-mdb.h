@@ -32,7 +32,8 @@ LDAP_BEGIN_DECL
 #define MDB_AD2ID		0
 #define MDB_DN2ID		1
 #define MDB_ID2ENTRY	2
-#define MDB_NDB			3
+#define MDB_ID2VAL		3
+#define MDB_NDB			4
 
 /* The default search IDL stack cache depth */
 #define DEFAULT_SEARCH_STACK_DEPTH	16
@@ -40,10 +41,21 @@ LDAP_BEGIN_DECL
 /* The minimum we can function with */
 #define MINIMUM_SEARCH_STACK_DEPTH	8
 
+/* Fewest candidates worth scanning with several threads */
+#define DEFAULT_SEARCH_MIN	10000
+
+/* Most threads one search may use */
+#define MAXIMUM_SEARCH_THREADS	64
+
 #define MDB_INDICES		128
 
 #define	MDB_MAXADS	65536
 
+/* Largest id2val record, values in there are keys of a sub-DB.
+ * Must match MAXKEYSIZE in libmdb.
+ */
+#define	MDB_MAXVALSIZE	511
+
 /* Default to 10MB max */
 #define DEFAULT_MAPSIZE	(10*1048576)
 
@@ -51,6 +63,44 @@ LDAP_BEGIN_DECL
 #define MDB_MONITOR_IDX
 #endif /* LDAP_DEVEL */
 
+/* room for the explain text of the last filter plan */
+#define MDB_PLAN_TEXT	512
+
+/* The filter plan counters are spread over several mutexes, so that
+ * concurrent searches rarely wait for each other. Only the text of
+ * one plan in MDB_PLAN_SAMPLE is built and kept.
+ */
+#define MDB_PLAN_STRIPES	16
+#define MDB_PLAN_SAMPLE	16
+
+typedef struct mdb_plan_stat {
+	ldap_pvt_thread_mutex_t	ps_mutex;
+	unsigned long	ps_count;
+	unsigned long	ps_skipped;
+} mdb_plan_stat;
+
+/* Usage of an index database, kept while monitoring is on. The
+ * lookups are counted as they happen, the contents are walked at
+ * most every MDB_IDX_SCAN_INTERVAL seconds when the monitor entry
+ * is read.
+ */
+typedef struct mdb_idx_stat {
+	ldap_pvt_thread_mutex_t	is_mutex;
+	time_t		is_since;	/* when the counters were started */
+	unsigned long	is_lookups;
+	unsigned long	is_ids;		/* IDs the lookups returned */
+	unsigned long	is_usec;	/* time spent in the lookups */
+	time_t		is_scanned;	/* when the contents were walked */
+	unsigned long	is_keys;
+	unsigned long	is_total;	/* IDs stored under all keys */
+	unsigned long	is_ranges;	/* keys stored as an ID range */
+} mdb_idx_stat;
+
+#define MDB_IDX_SCAN_INTERVAL	60
+
+/* indexed by MDB_dbi, which also counts the two core databases */
+#define MDB_IDX_STATS	(MDB_INDICES+2)
+
 typedef struct mdb_monitor_t {
 	void		*mdm_cb;
 	struct berval	mdm_ndn;
@@ -59,6 +109,17 @@ typedef struct mdb_monitor_t {
 /* From ldap_rq.h */
 struct re_s;
 
+/* cache.c */
+struct mdb_cache;
+
+typedef struct mdb_cache_stat {
+	size_t		cs_size;
+	unsigned long	cs_count;
+	unsigned long	cs_hits;
+	unsigned long	cs_misses;
+	unsigned long	cs_evictions;
+} mdb_cache_stat;
+
 struct mdb_info {
 	MDB_env		*mi_dbenv;
 
@@ -69,13 +130,32 @@ struct mdb_info {
 	int			mi_dbenv_mode;
 
 	size_t		mi_mapsize;
+	size_t		mi_growsize;	/* auto-grow step, 0 if disabled */
+	struct re_s		*mi_grow_task;
 	ID			mi_nextid;
 
+	/* attributes with more than mi_multi_hi values are kept in id2val
+	 * until they drop below mi_multi_lo. Disabled if mi_multi_hi is 0.
+	 */
+	unsigned	mi_multi_hi;
+	unsigned	mi_multi_lo;
+
+	/* decoded entries shared by readers, disabled if mi_cache_max is 0 */
+	size_t		mi_cache_max;
+	struct mdb_cache	*mi_cache;
+
 	slap_mask_t	mi_defaultmask;
 	int			mi_nattrs;
 	struct mdb_attrinfo		**mi_attrs;
 	void		*mi_search_stack;
 	int			mi_search_stack_depth;
+
+	/* extra threads to scan the candidates of searches that have
+	 * at least mi_search_min of them, 0 if disabled */
+	int			mi_search_threads;
+	ID			mi_search_min;
+	int			mi_search_flags;
+#define MDB_SEARCH_UNORDERED	0x01
 	int			mi_readers;
 
 	int			mi_txn_cp;
@@ -84,7 +164,23 @@ struct mdb_info {
 	struct re_s		*mi_txn_cp_task;
 	struct re_s		*mi_index_task;
 
+	char		*mi_backup_dir;
+	uint32_t	mi_backup_min;
+	unsigned	mi_backup_flags;
+	struct re_s		*mi_backup_task;
+
 	mdb_monitor_t	mi_monitor;
+	/* reader slots of dead processes cleared so far */
+	unsigned long	mi_dead_readers;
+
+	/* filter plans of searches, recorded while monitoring is on */
+	mdb_plan_stat	mi_plan_stats[MDB_PLAN_STRIPES];
+	ldap_pvt_thread_mutex_t	mi_plan_mutex;	/* of the last plan */
+	ber_len_t	mi_plan_len;
+	char		mi_plan_last[MDB_PLAN_TEXT];
+
+	/* usage of the index databases, NULL unless monitored */
+	mdb_idx_stat	*mi_idx_stats;
 
 #ifdef MDB_MONITOR_IDX
 	ldap_pvt_thread_mutex_t	mi_idx_mutex;
@@ -96,8 +192,13 @@ struct mdb_info {
 #define	MDB_OPEN_INDEX	0x02
 #define	MDB_DEL_INDEX	0x08
 #define	MDB_RE_OPEN		0x10
+#define	MDB_IDL_EXACT	0x20	/* keep index keys with any number of IDs */
+#define	MDB_IDL_EXACT_DB	0x40	/* ... and it is recorded in ad2i */
 
 	int mi_numads;
+	/* serializes assigning descriptions with undoing them after
+	 * a failed slapd txn commit */
+	ldap_pvt_thread_mutex_t	mi_ads_mutex;
 
 	MDB_dbi	mi_dbis[MDB_NDB];
 	AttributeDescription *mi_ads[MDB_MAXADS];
@@ -107,15 +208,32 @@ struct mdb_info {
 #define mi_id2entry	mi_dbis[MDB_ID2ENTRY]
 #define mi_dn2id	mi_dbis[MDB_DN2ID]
 #define mi_ad2id	mi_dbis[MDB_AD2ID]
+#define mi_id2val	mi_dbis[MDB_ID2VAL]
 
 typedef struct mdb_op_info {
 	OpExtra		moi_oe;
 	MDB_txn*	moi_txn;
 	int			moi_ref;
+	int			moi_numads;	/* mi_numads when a slapd txn began */
 	char		moi_flag;
 } mdb_op_info;
 #define MOI_READER	0x01
 #define MOI_FREEIT	0x02
+#define MOI_KEEPER	0x04	/* txn spans several ops, see mdb_txn() */
+
+/* The attributes to decode from a stored entry, indexed by our
+ * AD index. Attributes added after the mask was built are always
+ * decoded.
+ */
+typedef struct mdb_attrmask {
+	int		am_numads;
+	int		am_flags;
+	char	*am_want;
+} mdb_attrmask;
+#define MDB_AM_WANT(am, i)	((i) > (am)->am_numads || (am)->am_want[i])
+
+/* The mask only applies to attributes kept in id2val */
+#define MDB_AM_MULTI	0x01
 
 /* Copy an ID "src" to pointer "dst" in big-endian byte order */
 #define MDB_ID2DISK( src, dst )	\
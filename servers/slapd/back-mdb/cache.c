@@ -0,0 +1,422 @@
+/* cache.c - shared cache of decoded entries */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2012 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+
+/* Entries decoded by readers are copied in here, so later readers can
+ * skip the decode. A cached entry owns its values, all in one block,
+ * and is shared by everyone who looks it up; each of them gets their
+ * own Entry and Attributes pointing at it, see mdb_cache_find().
+ *
+ * Only read txns use the cache. An entry is handed to a reader only if
+ * its snapshot is no older than the one the entry was decoded in.
+ * Writers drop the entries they change before they commit, and leave
+ * their txn ID in the entry's bucket; a reader with an older snapshot
+ * can't put its stale copy back after that.
+ *
+ * Each bucket has its own mutex. c_mutex covers the size of the cache
+ * and eviction, which sweeps the buckets in clock order and drops the
+ * entries that weren't looked up since the last sweep. It is always
+ * taken before a bucket's mutex, never after.
+ */
+
+#define MDB_CACHE_BUCKETS	256	/* must be a power of 2 */
+#define MDB_CACHE_BUCKET(c, id)	(&(c)->c_buckets[(id) & (MDB_CACHE_BUCKETS-1)])
+
+typedef struct mdb_centry {
+	struct mdb_centry	*ce_next;
+	struct mdb_cache	*ce_cache;
+	ID			ce_id;
+	size_t		ce_txnid;	/* snapshot it was decoded in */
+	size_t		ce_size;
+	int			ce_ref;
+	int			ce_nattrs;
+	char		ce_used;	/* looked up since the last sweep */
+	char		ce_gone;	/* no longer in the cache */
+	slap_mask_t	ce_ocflags;
+	Attribute	*ce_attrs;
+} mdb_centry;
+
+typedef struct mdb_cbucket {
+	ldap_pvt_thread_mutex_t	cb_mutex;
+	mdb_centry	*cb_head;
+	size_t		cb_txnid;	/* last write txn that dropped an entry here */
+	unsigned long	cb_hits;
+	unsigned long	cb_misses;
+} mdb_cbucket;
+
+struct mdb_cache {
+	ldap_pvt_thread_mutex_t	c_mutex;
+	size_t		c_size;
+	unsigned long	c_count;
+	unsigned long	c_evictions;
+	int			c_hand;
+	mdb_cbucket	c_buckets[MDB_CACHE_BUCKETS];
+};
+
+int
+mdb_cache_open( struct mdb_info *mdb )
+{
+	struct mdb_cache *c;
+	int i;
+
+	if ( !mdb->mi_cache_max || mdb->mi_cache || ( slapMode & SLAP_TOOL_MODE ))
+		return 0;
+
+	c = ch_calloc( 1, sizeof( struct mdb_cache ));
+	ldap_pvt_thread_mutex_init( &c->c_mutex );
+	for ( i = 0; i < MDB_CACHE_BUCKETS; i++ )
+		ldap_pvt_thread_mutex_init( &c->c_buckets[i].cb_mutex );
+	mdb->mi_cache = c;
+	return 0;
+}
+
+/* Drop entries until the cache fits in max bytes. c_mutex must be
+ * held. Gives up after two rounds, by then only entries that are
+ * looked up all the time can be left.
+ */
+static void
+mdb_cache_evict( struct mdb_cache *c, size_t max, int all )
+{
+	mdb_cbucket *cb;
+	mdb_centry *ce, **prev, *dead;
+	int n;
+
+	for ( n = 0; c->c_size > max && n < 2 * MDB_CACHE_BUCKETS; n++ ) {
+		cb = &c->c_buckets[c->c_hand];
+		c->c_hand = ( c->c_hand + 1 ) & ( MDB_CACHE_BUCKETS-1 );
+		dead = NULL;
+
+		ldap_pvt_thread_mutex_lock( &cb->cb_mutex );
+		for ( prev = &cb->cb_head; ( ce = *prev ) != NULL; ) {
+			if ( ce->ce_used && !all ) {
+				ce->ce_used = 0;
+				prev = &ce->ce_next;
+				continue;
+			}
+			*prev = ce->ce_next;
+			ce->ce_gone = 1;
+			c->c_size -= ce->ce_size;
+			c->c_count--;
+			if ( !all )
+				c->c_evictions++;
+			if ( !ce->ce_ref ) {
+				ce->ce_next = dead;
+				dead = ce;
+			}
+			if ( c->c_size <= max )
+				break;
+		}
+		ldap_pvt_thread_mutex_unlock( &cb->cb_mutex );
+
+		while (( ce = dead ) != NULL ) {
+			dead = ce->ce_next;
+			ch_free( ce );
+		}
+	}
+}
+
+/* Apply a new mi_cache_max to an open database */
+void
+mdb_cache_resize( struct mdb_info *mdb )
+{
+	struct mdb_cache *c = mdb->mi_cache;
+
+	if ( !c ) {
+		mdb_cache_open( mdb );
+		return;
+	}
+	ldap_pvt_thread_mutex_lock( &c->c_mutex );
+	mdb_cache_evict( c, mdb->mi_cache_max, mdb->mi_cache_max == 0 );
+	ldap_pvt_thread_mutex_unlock( &c->c_mutex );
+}
+
+/* No entries may be in use any more */
+void
+mdb_cache_close( struct mdb_info *mdb )
+{
+	struct mdb_cache *c = mdb->mi_cache;
+	int i;
+
+	if ( !c )
+		return;
+	mdb_cache_evict( c, 0, 1 );
+	for ( i = 0; i < MDB_CACHE_BUCKETS; i++ )
+		ldap_pvt_thread_mutex_destroy( &c->c_buckets[i].cb_mutex );
+	ldap_pvt_thread_mutex_destroy( &c->c_mutex );
+	ch_free( c );
+	mdb->mi_cache = NULL;
+}
+
+/* If op reads the database in txn, and may use the cache, return the
+ * ID of its snapshot. Otherwise return 0.
+ */
+size_t
+mdb_cache_txnid( Operation *op, struct mdb_info *mdb, MDB_txn *txn )
+{
+	OpExtra *oex;
+	mdb_op_info *moi;
+
+	if ( !mdb->mi_cache || !mdb->mi_cache_max )
+		return 0;
+
+	LDAP_SLIST_FOREACH( oex, &op->o_extra, oe_next ) {
+		if ( oex->oe_key == mdb )
+			break;
+	}
+	moi = (mdb_op_info *)oex;
+	if ( !moi || !( moi->moi_flag & MOI_READER ) || moi->moi_txn != txn )
+		return 0;
+	return mdb_txn_id( txn );
+}
+
+/* Look up entry id for a reader with snapshot txnid. The Entry
+ * returned belongs to op and shares the values of the cached one;
+ * mdb_entry_return() gives it back.
+ */
+Entry *
+mdb_cache_find( Operation *op, struct mdb_info *mdb, ID id, size_t txnid )
+{
+	struct mdb_cache *c = mdb->mi_cache;
+	mdb_cbucket *cb = MDB_CACHE_BUCKET( c, id );
+	mdb_centry *ce;
+	Entry *e;
+	Attribute *a;
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &cb->cb_mutex );
+	for ( ce = cb->cb_head; ce && ce->ce_id != id; ce = ce->ce_next )
+		;
+	if ( ce && ce->ce_txnid <= txnid ) {
+		ce->ce_ref++;
+		ce->ce_used = 1;
+		cb->cb_hits++;
+	} else {
+		ce = NULL;
+		cb->cb_misses++;
+	}
+	ldap_pvt_thread_mutex_unlock( &cb->cb_mutex );
+	if ( !ce )
+		return NULL;
+
+	e = op->o_tmpalloc( sizeof(Entry) + ce->ce_nattrs * sizeof(Attribute),
+		op->o_tmpmemctx );
+	memset( e, 0, sizeof(Entry) );
+	e->e_id = id;
+	e->e_ocflags = ce->ce_ocflags;
+	e->e_private = ce;
+	if ( ce->ce_nattrs ) {
+		a = (Attribute *)(e+1);
+		memcpy( a, ce->ce_attrs, ce->ce_nattrs * sizeof(Attribute) );
+		for ( i = 0; i < ce->ce_nattrs - 1; i++ )
+			a[i].a_next = &a[i+1];
+		a[i].a_next = NULL;
+		e->e_attrs = a;
+	}
+	return e;
+}
+
+/* Drop the reference of an Entry from mdb_cache_find() */
+void
+mdb_cache_release( Entry *e )
+{
+	mdb_centry *ce = e->e_private;
+	mdb_cbucket *cb = MDB_CACHE_BUCKET( ce->ce_cache, ce->ce_id );
+	int dead;
+
+	ldap_pvt_thread_mutex_lock( &cb->cb_mutex );
+	dead = ( --ce->ce_ref == 0 && ce->ce_gone );
+	ldap_pvt_thread_mutex_unlock( &cb->cb_mutex );
+	if ( dead )
+		ch_free( ce );
+}
+
+/* Copy the fully decoded entry e, read in snapshot txnid, into the
+ * cache, unless it is already there or may be stale.
+ */
+void
+mdb_cache_add( struct mdb_info *mdb, Entry *e, size_t txnid )
+{
+	struct mdb_cache *c = mdb->mi_cache;
+	mdb_cbucket *cb = MDB_CACHE_BUCKET( c, e->e_id );
+	mdb_centry *ce, *old;
+	Attribute *a, *b;
+	struct berval *bptr;
+	char *ptr;
+	size_t size = sizeof(mdb_centry);
+	int i, nattrs = 0;
+
+	for ( a = e->e_attrs; a; a = a->a_next ) {
+		nattrs++;
+		size += sizeof(Attribute) + ( a->a_numvals + 1 ) * sizeof(struct berval);
+		for ( i = 0; i < a->a_numvals; i++ )
+			size += a->a_vals[i].bv_len + 1;
+		if ( a->a_nvals != a->a_vals ) {
+			size += ( a->a_numvals + 1 ) * sizeof(struct berval);
+			for ( i = 0; i < a->a_numvals; i++ )
+				size += a->a_nvals[i].bv_len + 1;
+		}
+	}
+	/* don't let one big entry push out everything else */
+	if ( size > mdb->mi_cache_max / 8 )
+		return;
+
+	ldap_pvt_thread_mutex_lock( &cb->cb_mutex );
+	for ( old = cb->cb_head; old && old->ce_id != e->e_id; old = old->ce_next )
+		;
+	i = ( old || cb->cb_txnid > txnid );
+	ldap_pvt_thread_mutex_unlock( &cb->cb_mutex );
+	if ( i )
+		return;
+
+	ce = ch_malloc( size );
+	ce->ce_cache = c;
+	ce->ce_id = e->e_id;
+	ce->ce_txnid = txnid;
+	ce->ce_size = size;
+	ce->ce_ref = 0;
+	ce->ce_nattrs = nattrs;
+	ce->ce_used = 1;
+	ce->ce_gone = 0;
+	ce->ce_ocflags = e->e_ocflags;
+	ce->ce_attrs = (Attribute *)(ce+1);
+	bptr = (struct berval *)(ce->ce_attrs + nattrs);
+	ptr = (char *)bptr;
+	for ( a = e->e_attrs; a; a = a->a_next )
+		ptr += ( a->a_numvals + 1 ) * sizeof(struct berval) *
+			( a->a_nvals != a->a_vals ? 2 : 1 );
+
+	for ( a = e->e_attrs, b = ce->ce_attrs; a; a = a->a_next, b++ ) {
+		*b = *a;
+		b->a_flags = ( a->a_flags & SLAP_ATTR_PERSISTENT_FLAGS ) |
+			SLAP_ATTR_DONT_FREE_DATA | SLAP_ATTR_DONT_FREE_VALS;
+		b->a_next = NULL;
+		b->a_vals = bptr;
+		for ( i = 0; i < a->a_numvals; i++ ) {
+			bptr->bv_len = a->a_vals[i].bv_len;
+			bptr->bv_val = ptr;
+			memcpy( ptr, a->a_vals[i].bv_val, bptr->bv_len );
+			ptr += bptr->bv_len;
+			*ptr++ = '\0';
+			bptr++;
+		}
+		BER_BVZERO( bptr );
+		bptr++;
+		if ( a->a_nvals != a->a_vals ) {
+			b->a_nvals = bptr;
+			for ( i = 0; i < a->a_numvals; i++ ) {
+				bptr->bv_len = a->a_nvals[i].bv_len;
+				bptr->bv_val = ptr;
+				memcpy( ptr, a->a_nvals[i].bv_val, bptr->bv_len );
+				ptr += bptr->bv_len;
+				*ptr++ = '\0';
+				bptr++;
+			}
+			BER_BVZERO( bptr );
+			bptr++;
+		} else {
+			b->a_nvals = b->a_vals;
+		}
+	}
+
+	/* check again, a writer may have come by meanwhile. Count the
+	 * entry before it's visible in the bucket, or an evict or delete
+	 * could take its size off c_size first.
+	 */
+	ldap_pvt_thread_mutex_lock( &c->c_mutex );
+	ldap_pvt_thread_mutex_lock( &cb->cb_mutex );
+	for ( old = cb->cb_head; old && old->ce_id != e->e_id; old = old->ce_next )
+		;
+	if ( old || cb->cb_txnid > txnid ) {
+		ldap_pvt_thread_mutex_unlock( &cb->cb_mutex );
+		ldap_pvt_thread_mutex_unlock( &c->c_mutex );
+		ch_free( ce );
+		return;
+	}
+	c->c_size += size;
+	c->c_count++;
+	ce->ce_next = cb->cb_head;
+	cb->cb_head = ce;
+	ldap_pvt_thread_mutex_unlock( &cb->cb_mutex );
+
+	if ( c->c_size > mdb->mi_cache_max )
+		mdb_cache_evict( c, mdb->mi_cache_max, 0 );
+	ldap_pvt_thread_mutex_unlock( &c->c_mutex );
+}
+
+/* Entry id is changed or deleted by the write txn */
+void
+mdb_cache_delete( struct mdb_info *mdb, MDB_txn *txn, ID id )
+{
+	struct mdb_cache *c = mdb->mi_cache;
+	mdb_cbucket *cb = MDB_CACHE_BUCKET( c, id );
+	mdb_centry *ce, **prev;
+	size_t txnid = mdb_txn_id( txn );
+	size_t size = 0;
+	int dead = 0;
+
+	ldap_pvt_thread_mutex_lock( &cb->cb_mutex );
+	if ( cb->cb_txnid < txnid )
+		cb->cb_txnid = txnid;
+	for ( prev = &cb->cb_head; ( ce = *prev ) != NULL; prev = &ce->ce_next ) {
+		if ( ce->ce_id == id ) {
+			*prev = ce->ce_next;
+			ce->ce_gone = 1;
+			size = ce->ce_size;
+			dead = !ce->ce_ref;
+			break;
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &cb->cb_mutex );
+	/* unless dead, a reader may free ce as soon as it's unlocked */
+	if ( !ce )
+		return;
+
+	ldap_pvt_thread_mutex_lock( &c->c_mutex );
+	c->c_size -= size;
+	c->c_count--;
+	ldap_pvt_thread_mutex_unlock( &c->c_mutex );
+	if ( dead )
+		ch_free( ce );
+}
+
+void
+mdb_cache_stats( struct mdb_info *mdb, mdb_cache_stat *cs )
+{
+	struct mdb_cache *c = mdb->mi_cache;
+	int i;
+
+	memset( cs, 0, sizeof( *cs ));
+	if ( !c )
+		return;
+
+	ldap_pvt_thread_mutex_lock( &c->c_mutex );
+	cs->cs_size = c->c_size;
+	cs->cs_count = c->c_count;
+	cs->cs_evictions = c->c_evictions;
+	ldap_pvt_thread_mutex_unlock( &c->c_mutex );
+	for ( i = 0; i < MDB_CACHE_BUCKETS; i++ ) {
+		ldap_pvt_thread_mutex_lock( &c->c_buckets[i].cb_mutex );
+		cs->cs_hits += c->c_buckets[i].cb_hits;
+		cs->cs_misses += c->c_buckets[i].cb_misses;
+		ldap_pvt_thread_mutex_unlock( &c->c_buckets[i].cb_mutex );
+	}
+}
@@ -21,12 +21,136 @@
 
 #include "back-mdb.h"
 
+/* The attributes compare has to decode: everything kept in the
+ * entry itself, plus whatever the ACLs look at. Values kept in
+ * id2val are looked up directly by mdb_compare_entry().
+ */
+static mdb_attrmask *
+mdb_compare_attrmask( Operation *op )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_attrmask *am;
+	int n = mdb->mi_numads;
+
+	if ( !mdb->mi_multi_hi || get_assert( op ))
+		return NULL;
+
+	am = op->o_tmpalloc( sizeof(mdb_attrmask) + n + 1, op->o_tmpmemctx );
+	am->am_numads = n;
+	am->am_flags = MDB_AM_MULTI;
+	am->am_want = (char *)( am + 1 );
+	memset( am->am_want, 0, n + 1 );
+
+	mdb_attrmask_ad( mdb, am, slap_schema.si_ad_objectClass );
+	mdb_attrmask_ad( mdb, am, slap_schema.si_ad_ref );
+	if ( mdb_attrmask_acls( mdb, am, op->o_bd->be_acl ) ||
+		mdb_attrmask_acls( mdb, am, frontendDB->be_acl ))
+	{
+		op->o_tmpfree( am, op->o_tmpmemctx );
+		return NULL;
+	}
+	return am;
+}
+
+/* Like slap_compare_entry(), for an entry decoded with the mask
+ * from mdb_compare_attrmask(). If the values can't be matched
+ * bytewise, the rest of the entry is decoded after all.
+ */
+static int
+mdb_compare_entry(
+	Operation *op,
+	MDB_txn *txn,
+	mdb_attrmask *am,
+	Entry **ep,
+	AttributeAssertion *ava )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MatchingRule *mr = ava->aa_desc->ad_type->sat_equality;
+	AttributeDescription *ad;
+	Entry *e = *ep;
+	Attribute *a;
+	int i, rc = LDAP_NO_SUCH_ATTRIBUTE;
+
+	if ( ! access_allowed( op, e,
+		ava->aa_desc, &ava->aa_value, ACL_COMPARE, NULL ) )
+	{
+		rc = LDAP_INSUFFICIENT_ACCESS;
+		goto done;
+	}
+
+	for ( a = attrs_find( e->e_attrs, ava->aa_desc );
+		a != NULL;
+		a = attrs_find( a->a_next, ava->aa_desc ))
+	{
+		if (( ava->aa_desc != a->a_desc ) && ! access_allowed( op,
+			e, a->a_desc, &ava->aa_value, ACL_COMPARE, NULL ) )
+		{
+			rc = LDAP_INSUFFICIENT_ACCESS;
+			goto done;
+		}
+		rc = LDAP_COMPARE_FALSE;
+
+		if ( attr_valfind( a,
+			SLAP_MR_ATTRIBUTE_VALUE_NORMALIZED_MATCH |
+				SLAP_MR_ASSERTED_VALUE_NORMALIZED_MATCH,
+			&ava->aa_value, NULL, op->o_tmpmemctx ) == 0 )
+		{
+			rc = LDAP_COMPARE_TRUE;
+			goto done;
+		}
+	}
+
+	for ( i = 1; i <= am->am_numads; i++ ) {
+		ad = mdb->mi_ads[i];
+		if ( !ad || am->am_want[i] || !is_ad_subtype( ad, ava->aa_desc ))
+			continue;
+		/* any values of it? */
+		if ( mdb_mval_find( op, txn, e->e_id, ad, NULL ))
+			continue;
+		if (( ava->aa_desc != ad ) && ! access_allowed( op,
+			e, ad, &ava->aa_value, ACL_COMPARE, NULL ) )
+		{
+			rc = LDAP_INSUFFICIENT_ACCESS;
+			goto done;
+		}
+		rc = LDAP_COMPARE_FALSE;
+
+		/* The stored normalized values can only be looked up
+		 * directly if matching them is a plain byte comparison.
+		 */
+		if ( !mr || ad->ad_type->sat_equality != mr ||
+			( mr->smr_match != slap_schema.si_mr_caseExactMatch->smr_match &&
+			mr->smr_match != slap_schema.si_mr_distinguishedNameMatch->smr_match ))
+		{
+			rc = mdb_entry_complete( op, txn, NULL, ep );
+			if ( rc )
+				return LDAP_OTHER;
+			return slap_compare_entry( op, *ep, ava );
+		}
+		if ( mdb_mval_find( op, txn, e->e_id, ad, &ava->aa_value ) == 0 ) {
+			rc = LDAP_COMPARE_TRUE;
+			goto done;
+		}
+	}
+
+done:
+	if( rc != LDAP_COMPARE_TRUE && rc != LDAP_COMPARE_FALSE ) {
+		if ( ! access_allowed( op, e,
+			slap_schema.si_ad_entry, NULL, ACL_DISCLOSE, NULL ) )
+		{
+			rc = LDAP_NO_SUCH_OBJECT;
+		}
+	}
+	return rc;
+}
+
 int
 mdb_compare( Operation *op, SlapReply *rs )
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	Entry		*e = NULL;
 	int		manageDSAit = get_manageDSAit( op );
+	mdb_attrmask	*am;
 
 	MDB_txn		*rtxn;
 	mdb_op_info	opinfo = {{{0}}}, *moi = &opinfo;
@@ -42,8 +166,11 @@ mdb_compare( Operation *op, SlapReply *rs )
 
 	rtxn = moi->moi_txn;
 
+	am = mdb_compare_attrmask( op );
+
 	/* get entry */
-	rs->sr_err = mdb_dn2entry( op, rtxn, NULL, &op->o_req_ndn, &e, 1 );
+	rs->sr_err = mdb_dn2entry_partial( op, rtxn, NULL, &op->o_req_ndn, am,
+		&e, 1 );
 	switch( rs->sr_err ) {
 	case MDB_NOTFOUND:
 	case 0:
@@ -114,7 +241,10 @@ mdb_compare( Operation *op, SlapReply *rs )
 		goto done;
 	}
 
-	rs->sr_err = slap_compare_entry( op, e, op->orc_ava );
+	if ( !BER_BVISNULL( &e->e_bv ))
+		rs->sr_err = mdb_compare_entry( op, rtxn, am, &e, op->orc_ava );
+	else
+		rs->sr_err = slap_compare_entry( op, e, op->orc_ava );
 
 return_results:
 	send_ldap_result( op, rs );
@@ -127,6 +257,8 @@ return_results:
 	}
 
 done:
+	if ( am )
+		op->o_tmpfree( am, op->o_tmpmemctx );
 	if ( moi == &opinfo ) {
 		mdb_txn_reset( moi->moi_txn );
 		LDAP_SLIST_REMOVE( &op->o_extra, &moi->moi_oe, OpExtra, oe_next );
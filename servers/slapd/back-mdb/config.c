@@ -17,9 +17,11 @@
 #include "portable.h"
 
 #include <stdio.h>
+#include <fcntl.h>
 #include <ac/ctype.h>
 #include <ac/string.h>
 #include <ac/errno.h>
+#include <ac/unistd.h>
 
 #include "back-mdb.h"
 
@@ -31,14 +33,21 @@
 static ConfigDriver mdb_cf_gen;
 
 enum {
-	MDB_CHKPT = 1,
+	MDB_BACKUP = 1,
+	MDB_CHKPT,
 	MDB_DIRECTORY,
 	MDB_DBNOSYNC,
+	MDB_ENTRYCACHE,
+	MDB_ENVFLAGS,
+	MDB_GROWSIZE,
+	MDB_IDLEXACT,
 	MDB_INDEX,
 	MDB_MAXREADERS,
 	MDB_MAXSIZE,
 	MDB_MODE,
-	MDB_SSTACK
+	MDB_MULTIVAL,
+	MDB_SSTACK,
+	MDB_STHREADS
 };
 
 static ConfigTable mdbcfg[] = {
@@ -47,6 +56,10 @@ static ConfigTable mdbcfg[] = {
 			"DESC 'Directory for database content' "
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
+	{ "backup", "dir> <min> <[compact]", 3, 4, 0, ARG_MAGIC|MDB_BACKUP,
+		mdb_cf_gen, "( OLcfgDbAt:12.4 NAME 'olcDbBackup' "
+			"DESC 'Hot backup directory, interval in minutes and options' "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "checkpoint", "kbyte> <min", 3, 3, 0, ARG_MAGIC|MDB_CHKPT,
 		mdb_cf_gen, "( OLcfgDbAt:1.2 NAME 'olcDbCheckpoint' "
 			"DESC 'Database checkpoint interval in kbytes and minutes' "
@@ -55,6 +68,23 @@ static ConfigTable mdbcfg[] = {
 		mdb_cf_gen, "( OLcfgDbAt:1.4 NAME 'olcDbNoSync' "
 			"DESC 'Disable synchronous database writes' "
 			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
+	{ "entrycachesize", "size", 2, 2, 0, ARG_ULONG|ARG_MAGIC|MDB_ENTRYCACHE,
+		mdb_cf_gen, "( OLcfgDbAt:12.7 NAME 'olcDbEntryCacheSize' "
+		"DESC 'Bytes of decoded entries to keep for readers' "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "envflags", "flags", 2, 0, 0, ARG_MAGIC|MDB_ENVFLAGS,
+		mdb_cf_gen, "( OLcfgDbAt:12.3 NAME 'olcDbEnvFlags' "
+			"DESC 'Database environment flags' "
+			"EQUALITY caseIgnoreMatch "
+			"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "growsize", "size", 2, 2, 0, ARG_ULONG|ARG_MAGIC|MDB_GROWSIZE,
+		mdb_cf_gen, "( OLcfgDbAt:12.5 NAME 'olcDbGrowSize' "
+		"DESC 'Grow the DB in steps of this many bytes when it runs low on space' "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "idlexact", NULL, 1, 2, 0, ARG_ON_OFF|ARG_MAGIC|MDB_IDLEXACT,
+		mdb_cf_gen, "( OLcfgDbAt:12.9 NAME 'olcDbIDLExact' "
+		"DESC 'Keep every ID of index keys with more than 65535 of them' "
+		"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
 	{ "index", "attr> <[pres,eq,approx,sub]", 2, 3, 0, ARG_MAGIC|MDB_INDEX,
 		mdb_cf_gen, "( OLcfgDbAt:0.2 NAME 'olcDbIndex' "
 		"DESC 'Attribute index parameters' "
@@ -72,10 +102,20 @@ static ConfigTable mdbcfg[] = {
 		mdb_cf_gen, "( OLcfgDbAt:0.3 NAME 'olcDbMode' "
 		"DESC 'Unix permissions of database files' "
 		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
+	{ "multival", "hi>[,<lo", 2, 2, 0, ARG_MAGIC|MDB_MULTIVAL,
+		mdb_cf_gen, "( OLcfgDbAt:12.6 NAME 'olcDbMultival' "
+		"DESC 'Keep attributes with more than hi values apart from their entry, "
+			"until they drop below lo values' "
+		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "searchstack", "depth", 2, 2, 0, ARG_INT|ARG_MAGIC|MDB_SSTACK,
 		mdb_cf_gen, "( OLcfgDbAt:1.9 NAME 'olcDbSearchStack' "
 		"DESC 'Depth of search stack in IDLs' "
 		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "searchthreads", "num> <[min]> <[unordered]", 2, 4, 0, ARG_MAGIC|MDB_STHREADS,
+		mdb_cf_gen, "( OLcfgDbAt:12.8 NAME 'olcDbSearchThreads' "
+		"DESC 'Threads to scan the candidates of searches with at least min of them, "
+			"and whether results may come out of order' "
+		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ NULL, NULL, 0, 0, 0, ARG_IGNORED,
 		NULL, NULL, NULL, NULL }
 };
@@ -87,27 +127,220 @@ static ConfigOCs mdbocs[] = {
 		"DESC 'MDB backend configuration' "
 		"SUP olcDatabaseConfig "
 		"MUST olcDbDirectory "
-		"MAY ( olcDbCheckpoint $ "
-		"olcDbNoSync $ olcDbIndex $ olcDbMaxReaders $ olcDbMaxsize $ "
-		"olcDbMode $ olcDbSearchStack ) )",
+		"MAY ( olcDbBackup $ olcDbCheckpoint $ olcDbEntryCacheSize $ olcDbEnvFlags $ "
+		"olcDbGrowSize $ olcDbNoSync $ olcDbIDLExact $ olcDbIndex $ olcDbMaxReaders $ "
+		"olcDbMaxsize $ olcDbMode $ olcDbMultival $ olcDbSearchStack $ "
+		"olcDbSearchThreads ) )",
 		 	Cft_Database, mdbcfg },
 	{ NULL, 0, NULL }
 };
 
-/* perform periodic syncs */
+static slap_verbmasks mdb_envflags[] = {
+	{ BER_BVC("nosync"),	MDB_NOSYNC },
+	{ BER_BVC("nometasync"),	MDB_NOMETASYNC },
+	{ BER_BVC("writemap"),	MDB_WRITEMAP },
+	{ BER_BVC("mapasync"),	MDB_MAPASYNC },
+	{ BER_BVC("checksum"),	MDB_CHECKSUM },
+	{ BER_BVC("verify"),	MDB_VERIFY },
+	{ BER_BVNULL, 0 }
+};
+
+/* flags that can be changed without reopening the env */
+#define MDB_ENVFLAGS_LIVE	(MDB_NOSYNC|MDB_NOMETASYNC|MDB_MAPASYNC|MDB_VERIFY)
+
+/* perform periodic syncs. Force them, since the point of
+ * a checkpoint is to bound what nosync or mapasync may lose.
+ */
 static void *
 mdb_checkpoint( void *ctx, void *arg )
 {
 	struct re_s *rtask = arg;
 	struct mdb_info *mdb = rtask->arg;
 
-	mdb_env_sync( mdb->mi_dbenv, 0 );
+	mdb_env_sync( mdb->mi_dbenv, 1 );
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	return NULL;
+}
+
+/* take hot backups of the database. The copy is written next to
+ * the target and renamed into place, so the previous backup stays
+ * intact until a new one is complete.
+ */
+static void *
+mdb_backup( void *ctx, void *arg )
+{
+	struct re_s *rtask = arg;
+	struct mdb_info *mdb = rtask->arg;
+
+	if ( mdb->mi_flags & MDB_IS_OPEN ) {
+		char *path, *tmp, *ptr;
+		int fd, rc = 0, len;
+
+		len = strlen( mdb->mi_backup_dir ) + STRLENOF( LDAP_DIRSEP "data.mdb" );
+		path = ch_malloc( 2 * len + STRLENOF( ".tmp" ) + 2 );
+		ptr = lutil_strcopy( path, mdb->mi_backup_dir );
+		ptr = lutil_strcopy( ptr, LDAP_DIRSEP "data.mdb" );
+		tmp = ptr + 1;
+		ptr = lutil_strcopy( tmp, path );
+		strcpy( ptr, ".tmp" );
+
+		fd = open( tmp, O_WRONLY|O_CREAT|O_TRUNC, mdb->mi_dbenv_mode );
+		if ( fd < 0 ) {
+			rc = errno;
+		} else {
+			rc = mdb_env_copyfd( mdb->mi_dbenv, fd, mdb->mi_backup_flags );
+			if ( rc == 0 && fsync( fd ))
+				rc = errno;
+			close( fd );
+			if ( rc == 0 && rename( tmp, path ))
+				rc = errno;
+			if ( rc )
+				unlink( tmp );
+		}
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_backup)
+				": backup to \"%s\" failed: %s (%d)\n",
+				path, mdb_strerror( rc ), rc );
+		} else {
+			Debug( LDAP_DEBUG_STATS, LDAP_XSTRING(mdb_backup)
+				": backup written to \"%s\"\n", path, 0, 0 );
+		}
+		ch_free( path );
+	}
+
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
+	/* one-shot backups are done */
+	if ( !mdb->mi_backup_min ) {
+		mdb->mi_backup_task = NULL;
+		ldap_pvt_runqueue_remove( &slapd_rq, rtask );
+	}
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	return NULL;
+}
+
+/* stop and remove the backup task */
+void
+mdb_backup_stop( struct mdb_info *mdb )
+{
+	struct re_s *re = mdb->mi_backup_task;
+
+	if ( re ) {
+		mdb->mi_backup_task = NULL;
+		ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+		if ( ldap_pvt_runqueue_isrunning( &slapd_rq, re ) )
+			ldap_pvt_runqueue_stoptask( &slapd_rq, re );
+		ldap_pvt_runqueue_remove( &slapd_rq, re );
+		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	}
+}
+
+/* Space left at the end of the map */
+static size_t
+mdb_map_room( struct mdb_info *mdb, size_t *mapsize )
+{
+	MDB_envinfo mei;
+	MDB_stat mst;
+
+	mdb_env_info( mdb->mi_dbenv, &mei );
+	mdb_env_stat( mdb->mi_dbenv, &mst );
+	*mapsize = mei.me_mapsize;
+	return mei.me_mapsize - ( mei.me_last_pgno + 1 ) * mst.ms_psize;
+}
+
+/* Add a growsize step to the map if it is running low.
+ * No txns of this process may be active.
+ */
+static int
+mdb_map_resize( struct mdb_info *mdb )
+{
+	size_t size;
+	int rc;
+
+	if ( mdb_map_room( mdb, &size ) >= mdb->mi_growsize )
+		return 0;
+	size += mdb->mi_growsize;
+	rc = mdb_env_set_mapsize( mdb->mi_dbenv, size );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_map_resize)
+			": growing map to %lu bytes failed: %s (%d)\n",
+			(unsigned long) size, mdb_strerror( rc ), rc );
+	} else {
+		mdb->mi_mapsize = size;
+		Debug( LDAP_DEBUG_STATS, LDAP_XSTRING(mdb_map_resize)
+			": map grown to %lu bytes\n", (unsigned long) size, 0, 0 );
+	}
+	return rc;
+}
+
+/* grow the map. The pool is paused so that no txns are active
+ * while the map is replaced.
+ */
+static void *
+mdb_map_grow( void *ctx, void *arg )
+{
+	struct re_s *rtask = arg;
+	struct mdb_info *mdb = rtask->arg;
+
+	ldap_pvt_thread_pool_pause( &connection_pool );
+	if (( mdb->mi_flags & MDB_IS_OPEN ) && !slapd_shutdown )
+		mdb_map_resize( mdb );
+	ldap_pvt_thread_pool_resume( &connection_pool );
+
 	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
 	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
+	mdb->mi_grow_task = NULL;
+	ldap_pvt_runqueue_remove( &slapd_rq, rtask );
 	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
 	return NULL;
 }
 
+/* Called after a write txn ends. When less than growsize is left,
+ * tools grow the map right away; the server leaves it to a task
+ * since the ops of other threads may still hold txns.
+ */
+void
+mdb_map_check( struct mdb_info *mdb )
+{
+	size_t size;
+
+	if ( !mdb->mi_growsize || mdb->mi_grow_task ||
+		mdb_map_room( mdb, &size ) >= mdb->mi_growsize )
+		return;
+
+	if ( slapMode & SLAP_TOOL_MODE ) {
+		mdb_map_resize( mdb );
+		return;
+	}
+
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	if ( !mdb->mi_grow_task ) {
+		mdb->mi_grow_task = ldap_pvt_runqueue_insert( &slapd_rq, 36000,
+			mdb_map_grow, mdb, LDAP_XSTRING(mdb_map_grow),
+			mdb->mi_dbenv_home );
+	}
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	slap_wake_listener();
+}
+
+/* stop and remove a pending map grow */
+void
+mdb_map_grow_stop( struct mdb_info *mdb )
+{
+	struct re_s *re = mdb->mi_grow_task;
+
+	if ( re ) {
+		mdb->mi_grow_task = NULL;
+		ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+		if ( ldap_pvt_runqueue_isrunning( &slapd_rq, re ) )
+			ldap_pvt_runqueue_stoptask( &slapd_rq, re );
+		ldap_pvt_runqueue_remove( &slapd_rq, re );
+		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	}
+}
+
 /* reindex entries on the fly */
 static void *
 mdb_online_index( void *ctx, void *arg )
@@ -263,6 +496,22 @@ mdb_cf_gen( ConfigArgs *c )
 			}
 			} break;
 
+		case MDB_BACKUP:
+			if ( mdb->mi_backup_dir ) {
+				char buf[64];
+				struct berval bv;
+				int len = snprintf( buf, sizeof(buf), " %ld%s",
+					(long) mdb->mi_backup_min,
+					( mdb->mi_backup_flags & MDB_CP_COMPACT ) ? " compact" : "" );
+				bv.bv_len = strlen( mdb->mi_backup_dir ) + len;
+				bv.bv_val = ch_malloc( bv.bv_len + 1 );
+				strcpy( lutil_strcopy( bv.bv_val, mdb->mi_backup_dir ), buf );
+				ber_bvarray_add( &c->rvalue_vals, &bv );
+			} else {
+				rc = 1;
+			}
+			break;
+
 		case MDB_CHKPT:
 			if ( mdb->mi_txn_cp ) {
 				char buf[64];
@@ -293,6 +542,18 @@ mdb_cf_gen( ConfigArgs *c )
 				c->value_int = 1;
 			break;
 
+		case MDB_IDLEXACT:
+			if ( mdb->mi_flags & MDB_IDL_EXACT )
+				c->value_int = 1;
+			break;
+
+		case MDB_ENVFLAGS:
+			if ( mdb->mi_dbenv_flags ) {
+				mask_to_verbs( mdb_envflags, mdb->mi_dbenv_flags, &c->rvalue_vals );
+			}
+			if ( !c->rvalue_vals ) rc = 1;
+			break;
+
 		case MDB_INDEX:
 			mdb_attr_index_unparse( mdb, &c->rvalue_vals );
 			if ( !c->rvalue_vals ) rc = 1;
@@ -309,6 +570,48 @@ mdb_cf_gen( ConfigArgs *c )
 		case MDB_MAXSIZE:
 			c->value_ulong = mdb->mi_mapsize;
 			break;
+
+		case MDB_GROWSIZE:
+			if ( mdb->mi_growsize )
+				c->value_ulong = mdb->mi_growsize;
+			else
+				rc = 1;
+			break;
+
+		case MDB_ENTRYCACHE:
+			if ( mdb->mi_cache_max )
+				c->value_ulong = mdb->mi_cache_max;
+			else
+				rc = 1;
+			break;
+
+		case MDB_STHREADS:
+			if ( mdb->mi_search_threads ) {
+				char buf[64];
+				struct berval bv;
+				bv.bv_len = snprintf( buf, sizeof(buf), "%d %lu%s",
+					mdb->mi_search_threads, (unsigned long)mdb->mi_search_min,
+					( mdb->mi_search_flags & MDB_SEARCH_UNORDERED ) ?
+					" unordered" : "" );
+				bv.bv_val = buf;
+				value_add_one( &c->rvalue_vals, &bv );
+			} else {
+				rc = 1;
+			}
+			break;
+
+		case MDB_MULTIVAL:
+			if ( mdb->mi_multi_hi ) {
+				char buf[64];
+				struct berval bv;
+				bv.bv_len = snprintf( buf, sizeof(buf), "%u,%u",
+					mdb->mi_multi_hi, mdb->mi_multi_lo );
+				bv.bv_val = buf;
+				value_add_one( &c->rvalue_vals, &bv );
+			} else {
+				rc = 1;
+			}
+			break;
 		}
 		return rc;
 	} else if ( c->op == LDAP_MOD_DELETE ) {
@@ -328,6 +631,43 @@ mdb_cf_gen( ConfigArgs *c )
 		case MDB_MAXSIZE:
 			break;
 
+		case MDB_GROWSIZE:
+			mdb_map_grow_stop( mdb );
+			mdb->mi_growsize = 0;
+			break;
+
+		case MDB_ENTRYCACHE:
+			mdb->mi_cache_max = 0;
+			if ( mdb->mi_flags & MDB_IS_OPEN )
+				mdb_cache_resize( mdb );
+			break;
+
+		case MDB_STHREADS:
+			mdb->mi_search_threads = 0;
+			mdb->mi_search_min = DEFAULT_SEARCH_MIN;
+			mdb->mi_search_flags = 0;
+			break;
+
+		/* a database already in the exact format stays so */
+		case MDB_IDLEXACT:
+			if ( !( mdb->mi_flags & MDB_IDL_EXACT_DB ))
+				mdb->mi_flags &= ~MDB_IDL_EXACT;
+			break;
+
+		/* attributes already kept apart stay there */
+		case MDB_MULTIVAL:
+			mdb->mi_multi_hi = 0;
+			mdb->mi_multi_lo = 0;
+			break;
+
+		case MDB_BACKUP:
+			mdb_backup_stop( mdb );
+			ch_free( mdb->mi_backup_dir );
+			mdb->mi_backup_dir = NULL;
+			mdb->mi_backup_min = 0;
+			mdb->mi_backup_flags = 0;
+			break;
+
 		case MDB_CHKPT:
 			if ( mdb->mi_txn_cp_task ) {
 				struct re_s *re = mdb->mi_txn_cp_task;
@@ -350,6 +690,25 @@ mdb_cf_gen( ConfigArgs *c )
 		case MDB_DBNOSYNC:
 			mdb_env_set_flags( mdb->mi_dbenv, MDB_NOSYNC, 0 );
 			break;
+		case MDB_ENVFLAGS: {
+			slap_mask_t old = mdb->mi_dbenv_flags;
+			if ( c->valx == -1 ) {
+				mdb->mi_dbenv_flags = 0;
+			} else {
+				int i = verb_to_mask( c->line, mdb_envflags );
+				mdb->mi_dbenv_flags &= ~mdb_envflags[i].mask;
+			}
+			if ( mdb->mi_flags & MDB_IS_OPEN ) {
+				if (( old ^ mdb->mi_dbenv_flags ) & ~MDB_ENVFLAGS_LIVE ) {
+					mdb->mi_flags |= MDB_RE_OPEN;
+					c->cleanup = mdb_cf_cleanup;
+				} else {
+					mdb_env_set_flags( mdb->mi_dbenv,
+						old & ~mdb->mi_dbenv_flags, 0 );
+				}
+			}
+			}
+			break;
 		case MDB_INDEX:
 			if ( c->valx == -1 ) {
 				int i;
@@ -449,6 +808,52 @@ mdb_cf_gen( ConfigArgs *c )
 			mdb->mi_dbenv_mode = mode;
 		}
 		break;
+	case MDB_BACKUP: {
+		unsigned long l;
+		unsigned flags = 0;
+		if ( lutil_atoulx( &l, c->argv[2], 0 ) != 0 ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s: "
+				"invalid minutes \"%s\" in \"backup\"",
+				c->log, c->argv[2] );
+			Debug( LDAP_DEBUG_ANY, "%s\n", c->cr_msg, 0, 0 );
+			return 1;
+		}
+		if ( c->argc > 3 ) {
+			if ( strcasecmp( c->argv[3], "compact" )) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s: "
+					"unknown option \"%s\" in \"backup\"",
+					c->log, c->argv[3] );
+				Debug( LDAP_DEBUG_ANY, "%s\n", c->cr_msg, 0, 0 );
+				return 1;
+			}
+			flags |= MDB_CP_COMPACT;
+		}
+		if ( c->be->be_suffix == NULL || BER_BVISNULL( &c->be->be_suffix[0] ) ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s: "
+				"\"backup\" must occur after \"suffix\"", c->log );
+			Debug( LDAP_DEBUG_ANY, "%s\n", c->cr_msg, 0, 0 );
+			return 1;
+		}
+		mdb_backup_stop( mdb );
+		ch_free( mdb->mi_backup_dir );
+		mdb->mi_backup_dir = ch_strdup( c->argv[1] );
+		mdb->mi_backup_min = l;
+		mdb->mi_backup_flags = flags;
+		/* Periodic backups start with the server. Setting the value
+		 * on a running server takes a backup right away, which is
+		 * the only one taken when the interval is zero.
+		 */
+		if (( slapMode & SLAP_SERVER_MODE ) &&
+			( mdb->mi_backup_min || ( mdb->mi_flags & MDB_IS_OPEN ))) {
+			ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+			mdb->mi_backup_task = ldap_pvt_runqueue_insert( &slapd_rq,
+				mdb->mi_backup_min ? mdb->mi_backup_min * 60 : 36000,
+				mdb_backup, mdb,
+				LDAP_XSTRING(mdb_backup), c->be->be_suffix[0].bv_val );
+			ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+		}
+		} break;
+
 	case MDB_CHKPT: {
 		long	l;
 		mdb->mi_txn_cp = 1;
@@ -530,6 +935,42 @@ mdb_cf_gen( ConfigArgs *c )
 		}
 		break;
 
+	/* Turning it on changes the database format. An open database
+	 * is reopened to record that, see mdb_ad_format().
+	 */
+	case MDB_IDLEXACT:
+		if ( c->value_int ) {
+			mdb->mi_flags |= MDB_IDL_EXACT;
+			if (( mdb->mi_flags & (MDB_IS_OPEN|MDB_IDL_EXACT_DB)) == MDB_IS_OPEN ) {
+				mdb->mi_flags |= MDB_RE_OPEN;
+				c->cleanup = mdb_cf_cleanup;
+			}
+		} else if ( !( mdb->mi_flags & MDB_IDL_EXACT_DB )) {
+			mdb->mi_flags &= ~MDB_IDL_EXACT;
+		}
+		break;
+
+	case MDB_ENVFLAGS: {
+		slap_mask_t flags = 0;
+		int i = verbs_to_mask( c->argc, c->argv, mdb_envflags, &flags );
+		if ( i ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s: "
+				"unknown flag \"%s\"", c->log, c->argv[i] );
+			Debug( LDAP_DEBUG_ANY, "%s\n", c->cr_msg, 0, 0 );
+			return 1;
+		}
+		if ( mdb->mi_flags & MDB_IS_OPEN ) {
+			if ( flags & ~( mdb->mi_dbenv_flags | MDB_ENVFLAGS_LIVE )) {
+				mdb->mi_flags |= MDB_RE_OPEN;
+				c->cleanup = mdb_cf_cleanup;
+			} else {
+				mdb_env_set_flags( mdb->mi_dbenv, flags, 1 );
+			}
+		}
+		mdb->mi_dbenv_flags |= flags;
+		}
+		break;
+
 	case MDB_INDEX:
 		rc = mdb_attr_index_config( mdb, c->fname, c->lineno,
 			c->argc - 1, &c->argv[1], &c->reply);
@@ -565,6 +1006,41 @@ mdb_cf_gen( ConfigArgs *c )
 		mdb->mi_search_stack_depth = c->value_int;
 		break;
 
+	case MDB_STHREADS: {
+		int threads, flags = 0, i;
+		unsigned long min = DEFAULT_SEARCH_MIN;
+		char *next;
+
+		if ( lutil_atoi( &threads, c->argv[1] ) || threads < 0 ||
+			threads > MAXIMUM_SEARCH_THREADS )
+		{
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s: "
+				"invalid number of threads \"%s\", must be 0 to %d",
+				c->log, c->argv[1], MAXIMUM_SEARCH_THREADS );
+			Debug( LDAP_DEBUG_ANY, "%s\n", c->cr_msg, 0, 0 );
+			return 1;
+		}
+		for ( i = 2; i < c->argc; i++ ) {
+			if ( !strcasecmp( c->argv[i], "unordered" )) {
+				flags |= MDB_SEARCH_UNORDERED;
+			} else if ( !strcasecmp( c->argv[i], "ordered" )) {
+				flags &= ~MDB_SEARCH_UNORDERED;
+			} else {
+				min = strtoul( c->argv[i], &next, 10 );
+				if ( *next || next == c->argv[i] || !min ) {
+					snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s: "
+						"invalid argument \"%s\"", c->log, c->argv[i] );
+					Debug( LDAP_DEBUG_ANY, "%s\n", c->cr_msg, 0, 0 );
+					return 1;
+				}
+			}
+		}
+		mdb->mi_search_threads = threads;
+		mdb->mi_search_min = min;
+		mdb->mi_search_flags = flags;
+		}
+		break;
+
 	case MDB_MAXREADERS:
 		mdb->mi_readers = c->value_int;
 		if ( mdb->mi_flags & MDB_IS_OPEN ) {
@@ -574,10 +1050,53 @@ mdb_cf_gen( ConfigArgs *c )
 		break;
 
 	case MDB_MAXSIZE:
-		mdb->mi_mapsize = c->value_ulong;
+		/* The pool is paused, the map can be replaced in place */
 		if ( mdb->mi_flags & MDB_IS_OPEN ) {
-			mdb->mi_flags |= MDB_RE_OPEN;
-			c->cleanup = mdb_cf_cleanup;
+			MDB_envinfo mei;
+
+			rc = mdb_env_set_mapsize( mdb->mi_dbenv, c->value_ulong );
+			if ( rc ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s: "
+					"failed to resize map: %s (%d)",
+					c->log, mdb_strerror( rc ), rc );
+				Debug( LDAP_DEBUG_ANY, "%s\n", c->cr_msg, 0, 0 );
+				return 1;
+			}
+			/* it is never made smaller than the data */
+			mdb_env_info( mdb->mi_dbenv, &mei );
+			c->value_ulong = mei.me_mapsize;
+		}
+		mdb->mi_mapsize = c->value_ulong;
+		break;
+
+	case MDB_GROWSIZE:
+		mdb->mi_growsize = c->value_ulong;
+		break;
+
+	case MDB_ENTRYCACHE:
+		mdb->mi_cache_max = c->value_ulong;
+		if ( mdb->mi_flags & MDB_IS_OPEN )
+			mdb_cache_resize( mdb );
+		break;
+
+	case MDB_MULTIVAL: {
+		unsigned long hi, lo;
+		char *next;
+
+		hi = strtoul( c->argv[1], &next, 10 );
+		if ( *next == ',' )
+			lo = strtoul( next + 1, &next, 10 );
+		else
+			lo = hi / 2;
+		if ( *next || next == c->argv[1] || lo > hi || hi > UINT_MAX ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ), "%s: "
+				"invalid value \"%s\", must be <hi>[,<lo>] with lo <= hi",
+				c->log, c->argv[1] );
+			Debug( LDAP_DEBUG_ANY, "%s\n", c->cr_msg, 0, 0 );
+			return 1;
+		}
+		mdb->mi_multi_hi = hi;
+		mdb->mi_multi_lo = lo;
 		}
 		break;
 
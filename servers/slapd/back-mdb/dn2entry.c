@@ -35,6 +35,22 @@ mdb_dn2entry(
 	struct berval *dn,
 	Entry **e,
 	int matched )
+{
+	return mdb_dn2entry_partial( op, tid, m2, dn, NULL, e, matched );
+}
+
+/* Like mdb_dn2entry, but only decode what am wants, see
+ * mdb_id2entry_partial().
+ */
+int
+mdb_dn2entry_partial(
+	Operation *op,
+	MDB_txn *tid,
+	MDB_cursor *m2,
+	struct berval *dn,
+	mdb_attrmask *am,
+	Entry **e,
+	int matched )
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	int rc, rc2;
@@ -52,7 +68,7 @@ mdb_dn2entry(
 		if ( matched ) {
 			rc2 = mdb_cursor_open( tid, mdb->mi_id2entry, &mc );
 			if ( rc2 == MDB_SUCCESS ) {
-				rc2 = mdb_id2entry( op, mc, id, e );
+				rc2 = mdb_id2entry_partial( op, mc, id, am, e );
 				mdb_cursor_close( mc );
 			}
 		}
@@ -60,7 +76,7 @@ mdb_dn2entry(
 	} else {
 		rc = mdb_cursor_open( tid, mdb->mi_id2entry, &mc );
 		if ( rc == MDB_SUCCESS ) {
-			rc = mdb_id2entry( op, mc, id, e );
+			rc = mdb_id2entry_partial( op, mc, id, am, e );
 			mdb_cursor_close(mc);
 		}
 	}
@@ -524,7 +524,7 @@ mdb_idscope(
 	MDB_dbi dbi = mdb->mi_dn2id;
 	MDB_val		key, data;
 	MDB_cursor	*cursor;
-	ID ida, id, cid, ci0, idc = 0;
+	ID ida, id, cid = 0, ci0, idc = 0;
 	char	*ptr;
 	int		rc;
 
@@ -537,8 +537,8 @@ mdb_idscope(
 
 	ida = mdb_idl_first( ids, &cid );
 
-	/* Don't bother moving out of ids if it's a range */
-	if (!MDB_IDL_IS_RANGE(ids)) {
+	/* Don't bother moving out of ids if it's a range or bitmap */
+	if (MDB_IDL_IS_LIST(ids)) {
 		idc = ids[0];
 		ci0 = cid;
 	}
@@ -578,7 +578,7 @@ mdb_idscope(
 		}
 		ida = mdb_idl_next( ids, &cid );
 	}
-	if (!MDB_IDL_IS_RANGE( ids ))
+	if (MDB_IDL_IS_LIST( ids ))
 		ids[0] = idc;
 
 	mdb_cursor_close( cursor );
@@ -66,6 +66,15 @@ static int list_candidates(
 	ID *tmp,
 	ID *stack );
 
+static int plan_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	Filter *flist,
+	int nf,
+	ID *ids,
+	ID *tmp,
+	ID *stack );
+
 static int
 ext_candidates(
         Operation *op,
@@ -533,6 +542,360 @@ base:
 	return 0;
 }
 
+/* Testing a candidate against the filter costs about as much as
+ * reading this many IDs from an index. An AND component whose lookup
+ * would cost more than testing the candidates found so far is left
+ * to test_filter().
+ */
+#define MDB_PLAN_ENTRY_COST	32
+
+typedef struct filter_plan {
+	Filter	*fp_f;
+	ID	fp_est;		/* most entries it can match, NOID if unknown */
+	ID	fp_cost;	/* IDs read from the index to find them */
+} filter_plan;
+
+static ID
+plan_add( ID a, ID b )
+{
+	return a >= NOID - b ? NOID : a + b;
+}
+
+/* estimate the IDs of an indexed assertion from the sizes of its keys */
+static void
+keys_estimate(
+	Operation *op,
+	MDB_txn *rtxn,
+	AttributeDescription *desc,
+	MatchingRule *mr,
+	int ftype,
+	void *assertion,
+	ID *est,
+	ID *cost )
+{
+	MDB_dbi dbi;
+	MDB_cursor *mc;
+	slap_mask_t mask;
+	struct berval prefix = {0, NULL};
+	struct berval *keys = NULL, pres[2];
+	ID n;
+	int i, rc;
+
+	*est = NOID;
+	*cost = 0;
+
+	rc = mdb_index_param( op->o_bd, desc,
+		ftype == LDAP_FILTER_GE || ftype == LDAP_FILTER_LE ?
+			LDAP_FILTER_EQUALITY : ftype,
+		&dbi, &mask, &prefix );
+	if ( rc != LDAP_SUCCESS )
+		return;
+
+	if ( ftype == LDAP_FILTER_PRESENT ) {
+		if ( prefix.bv_val == NULL )
+			return;
+		pres[0] = prefix;
+		BER_BVZERO( &pres[1] );
+		keys = pres;
+	} else if ( ftype == LDAP_FILTER_GE || ftype == LDAP_FILTER_LE ) {
+		MDB_stat ms;
+
+		/* the range is unknown without walking it, guess at half
+		 * of all the IDs in the index */
+		if ( mdb_stat( rtxn, dbi, &ms ) == 0 ) {
+			*est = ms.ms_entries / 2 + 1;
+			*cost = *est;
+		} else {
+			*cost = NOID;
+		}
+		return;
+	} else {
+		if ( !mr || !mr->smr_filter )
+			return;
+		rc = (mr->smr_filter)( ftype, mask, desc->ad_type->sat_syntax,
+			mr, &prefix, assertion, &keys, op->o_tmpmemctx );
+		if ( rc != LDAP_SUCCESS || keys == NULL )
+			return;
+	}
+
+	rc = mdb_cursor_open( rtxn, dbi, &mc );
+	if ( rc == 0 ) {
+		/* the candidates are the intersection of all the keys */
+		for ( i = 0; keys[i].bv_val != NULL; i++ ) {
+			rc = mdb_key_count( mc, &keys[i], &n );
+			if ( rc != 0 )
+				break;
+			if ( n < *est )
+				*est = n;
+			*cost = plan_add( *cost, n );
+			if ( n == 0 )
+				break;
+		}
+		mdb_cursor_close( mc );
+	}
+	if ( rc != 0 ) {
+		*est = NOID;
+		*cost = NOID;
+	}
+
+	if ( keys != pres )
+		ber_bvarray_free_x( keys, op->o_tmpmemctx );
+}
+
+/* Estimate how many entries a filter can match, and how many IDs
+ * mdb_filter_candidates() reads to find them. An estimate of NOID
+ * means it returns all IDs, e.g. when the attribute is not indexed.
+ */
+static void
+filter_estimate(
+	Operation *op,
+	MDB_txn *rtxn,
+	Filter *f,
+	ID *est,
+	ID *cost )
+{
+	AttributeDescription *desc;
+	Filter *fl;
+	ID e, c;
+
+	*est = NOID;
+	*cost = 0;
+
+	if ( f->f_choice & SLAPD_FILTER_UNDEFINED ) {
+		*est = 0;
+		return;
+	}
+
+	switch ( f->f_choice ) {
+	case SLAPD_FILTER_COMPUTED:
+		if ( f->f_result != LDAP_COMPARE_TRUE && f->f_result != LDAP_SUCCESS )
+			*est = 0;
+		break;
+
+	case LDAP_FILTER_PRESENT:
+		if ( f->f_desc != slap_schema.si_ad_objectClass )
+			keys_estimate( op, rtxn, f->f_desc, NULL, LDAP_FILTER_PRESENT,
+				NULL, est, cost );
+		break;
+
+	case LDAP_FILTER_EQUALITY:
+		desc = f->f_av_desc;
+		if ( desc == slap_schema.si_ad_entryDN ) {
+			*est = 1;
+			*cost = 1;
+#ifdef LDAP_COMP_MATCH
+		} else if ( is_aliased_attribute && is_aliased_attribute( desc )) {
+			*cost = NOID;
+#endif
+		} else {
+			keys_estimate( op, rtxn, desc, desc->ad_type->sat_equality,
+				LDAP_FILTER_EQUALITY, &f->f_av_value, est, cost );
+		}
+		break;
+
+	case LDAP_FILTER_APPROX:
+		desc = f->f_av_desc;
+		keys_estimate( op, rtxn, desc, desc->ad_type->sat_approx ?
+			desc->ad_type->sat_approx : desc->ad_type->sat_equality,
+			LDAP_FILTER_APPROX, &f->f_av_value, est, cost );
+		break;
+
+	case LDAP_FILTER_SUBSTRINGS:
+		desc = f->f_sub_desc;
+		keys_estimate( op, rtxn, desc, desc->ad_type->sat_substr,
+			LDAP_FILTER_SUBSTRINGS, f->f_sub, est, cost );
+		break;
+
+	case LDAP_FILTER_GE:
+	case LDAP_FILTER_LE:
+		desc = f->f_av_desc;
+		if( desc->ad_type->sat_ordering &&
+			( desc->ad_type->sat_ordering->smr_usage & SLAP_MR_ORDERED_INDEX ) )
+			keys_estimate( op, rtxn, desc, NULL, f->f_choice,
+				NULL, est, cost );
+		else if ( desc != slap_schema.si_ad_objectClass )
+			keys_estimate( op, rtxn, desc, NULL, LDAP_FILTER_PRESENT,
+				NULL, est, cost );
+		break;
+
+	case LDAP_FILTER_AND:
+		for ( fl = f->f_and; fl != NULL; fl = fl->f_next ) {
+			if ( fl->f_choice == SLAPD_FILTER_COMPUTED &&
+				fl->f_result == LDAP_SUCCESS )
+				continue;
+			filter_estimate( op, rtxn, fl, &e, &c );
+			if ( e < *est )
+				*est = e;
+			*cost = plan_add( *cost, c );
+		}
+		break;
+
+	case LDAP_FILTER_OR:
+		*est = 0;
+		for ( fl = f->f_or; fl != NULL; fl = fl->f_next ) {
+			filter_estimate( op, rtxn, fl, &e, &c );
+			*est = plan_add( *est, e );
+			*cost = plan_add( *cost, c );
+		}
+		break;
+
+	case LDAP_FILTER_EXT:
+		if ( f->f_mr_desc == slap_schema.si_ad_entryDN &&
+			f->f_mr_rule == slap_schema.si_mr_distinguishedNameMatch ) {
+			*est = 1;
+			*cost = 1;
+		}
+		break;
+	}
+}
+
+static int
+plan_cmp( const filter_plan *a, const filter_plan *b )
+{
+	if ( a->fp_est != b->fp_est )
+		return a->fp_est < b->fp_est ? -1 : 1;
+	if ( a->fp_cost != b->fp_cost )
+		return a->fp_cost < b->fp_cost ? -1 : 1;
+	return 0;
+}
+
+static void
+plan_explain( Operation *op, struct berval *out, size_t size,
+	filter_plan *fp, const char *what, ID n )
+{
+	struct berval fstr = BER_BVNULL;
+	int len;
+
+	/* keep the last byte for a terminator */
+	if ( out->bv_len >= size - 1 )
+		return;
+	filter2bv_x( op, fp->fp_f, &fstr );
+	len = snprintf( out->bv_val + out->bv_len, size - out->bv_len,
+		"%s%s est=%ld cost=%ld %s",
+		out->bv_len ? " " : "",
+		fstr.bv_val ? fstr.bv_val : "?",
+		fp->fp_est == NOID ? -1L : (long) fp->fp_est,
+		fp->fp_cost == NOID ? -1L : (long) fp->fp_cost,
+		what );
+	if ( n != NOID && len > 0 && (size_t)len < size - out->bv_len )
+		len += snprintf( out->bv_val + out->bv_len + len,
+			size - out->bv_len - len, "=%ld", (long) n );
+	out->bv_len = len < 0 ? size : out->bv_len + len;
+	if ( out->bv_len >= size - 1 ) {
+		/* truncated, mark it */
+		out->bv_len = size - 1;
+		out->bv_val[ out->bv_len - 1 ] = '.';
+		out->bv_val[ out->bv_len - 2 ] = '.';
+		out->bv_val[ out->bv_len - 3 ] = '.';
+	}
+	op->o_tmpfree( fstr.bv_val, op->o_tmpmemctx );
+}
+
+/* Find the candidates of an AND with nf components, the smallest
+ * ones first. Components that cannot narrow the candidates, or that
+ * would cost more to look up than testing the candidates found so far,
+ * are skipped; search will test them on the entries anyway.
+ */
+static int
+plan_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	Filter	*flist,
+	int		nf,
+	ID *ids,
+	ID *tmp,
+	ID *save )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	filter_plan *fp, fn;
+	Filter	*f;
+	ID n, limit = NOID;
+	int i, j, rc, fetched = 0, skipped = 0, monitor, explain;
+	char buf[ MDB_PLAN_TEXT ];
+	struct berval bv;
+
+	/* only spend the time on the text for one plan in MDB_PLAN_SAMPLE,
+	 * unless it is logged */
+	monitor = SLAP_DBMONITORING( op->o_bd );
+	explain = LogTest( LDAP_DEBUG_FILTER ) || ( monitor &&
+		( op->o_connid + op->o_opid ) % MDB_PLAN_SAMPLE == 0 );
+
+	fp = op->o_tmpalloc( nf * sizeof( filter_plan ), op->o_tmpmemctx );
+	for ( i = 0, f = flist; f != NULL; f = f->f_next ) {
+		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
+		     f->f_result == LDAP_SUCCESS ) {
+			continue;
+		}
+		fn.fp_f = f;
+		filter_estimate( op, rtxn, f, &fn.fp_est, &fn.fp_cost );
+		for ( j = i; j > 0 && plan_cmp( &fp[j-1], &fn ) > 0; j-- )
+			fp[j] = fp[j-1];
+		fp[j] = fn;
+		i++;
+	}
+
+	/* never leave more candidates than the unchecked limit allows
+	 * if the full lookup might have come in under it */
+	if ( op->ors_limit && op->ors_limit->lms_s_unchecked != -1 )
+		limit = op->ors_limit->lms_s_unchecked;
+
+	bv.bv_val = buf;
+	bv.bv_len = 0;
+
+	MDB_IDL_ALL( ids );
+	for ( i = 0; i < nf; i++ ) {
+		if ( fetched ) {
+			n = MDB_IDL_N( ids );
+			if ( fp[i].fp_est == NOID && fp[i].fp_cost == 0 ) {
+				/* would return all IDs */
+				if ( explain )
+					plan_explain( op, &bv, sizeof(buf), &fp[i], "all", NOID );
+				continue;
+			}
+			if ( MDB_IDL_IS_ZERO( ids )) {
+				if ( explain )
+					plan_explain( op, &bv, sizeof(buf), &fp[i], "unneeded", NOID );
+				continue;
+			}
+			if ( n <= limit && fp[i].fp_cost / MDB_PLAN_ENTRY_COST >= n ) {
+				skipped++;
+				if ( explain )
+					plan_explain( op, &bv, sizeof(buf), &fp[i], "skipped", NOID );
+				continue;
+			}
+		}
+
+		MDB_IDL_ZERO( save );
+		rc = mdb_filter_candidates( op, rtxn, fp[i].fp_f, save, tmp,
+			save+MDB_IDL_UM_SIZE );
+		if ( rc != 0 ) {
+			/* an AND still has the other components */
+			if ( explain )
+				plan_explain( op, &bv, sizeof(buf), &fp[i], "failed", NOID );
+			continue;
+		}
+
+		if ( !fetched ) {
+			MDB_IDL_CPY( ids, save );
+			fetched = 1;
+		} else {
+			mdb_idl_intersection( ids, save );
+		}
+		if ( explain )
+			plan_explain( op, &bv, sizeof(buf), &fp[i], "ids", MDB_IDL_N( ids ));
+	}
+	op->o_tmpfree( fp, op->o_tmpmemctx );
+
+	if ( explain )
+		Debug( LDAP_DEBUG_FILTER, "<= mdb_plan_candidates: %s\n",
+			bv.bv_len ? bv.bv_val : "", 0, 0 );
+	if ( monitor )
+		mdb_monitor_plan_add( mdb, op->o_connid,
+			explain ? &bv : NULL, skipped );
+
+	return 0;
+}
+
 static int
 list_candidates(
 	Operation *op,
@@ -547,6 +910,18 @@ list_candidates(
 	Filter	*f;
 
 	Debug( LDAP_DEBUG_FILTER, "=> mdb_list_candidates 0x%x\n", ftype, 0, 0 );
+	if ( ftype == LDAP_FILTER_AND ) {
+		int nf = 0;
+
+		for ( f = flist; f != NULL; f = f->f_next ) {
+			if ( f->f_choice != SLAPD_FILTER_COMPUTED ||
+			     f->f_result != LDAP_SUCCESS )
+				nf++;
+		}
+		if ( nf > 1 )
+			return plan_candidates( op, rtxn, flist, nf, ids, tmp, save );
+	}
+
 	for ( f = flist; f != NULL; f = f->f_next ) {
 		/* ignore precomputed scopes */
 		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
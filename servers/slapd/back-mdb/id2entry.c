@@ -37,6 +37,382 @@ static Entry *mdb_entry_alloc( Operation *op, int nattrs, int nvals );
 
 #define ADD_FLAGS	(MDB_NOOVERWRITE|MDB_APPEND)
 
+#define HIGH_BIT (1<<(sizeof(unsigned int)*CHAR_BIT-1))
+#define MULTI_BIT (1U<<(sizeof(unsigned int)*CHAR_BIT-2))
+#define SORTED_BIT (1U<<(sizeof(unsigned int)*CHAR_BIT-3))
+
+/* Attributes with many values may have them kept in id2val instead
+ * of their entry, so a single value can be added or deleted without
+ * rewriting the whole entry. The records of an entry are keyed by its
+ * ID. Each holds the AD index and the length of the normalized value,
+ * both big-endian, then the normalized value and, if the attribute
+ * has separate normalized values, the value itself. Both are NUL
+ * terminated, so they can be used in place just like the values in
+ * id2entry.
+ */
+#define MVAL_HDR	8
+
+static void
+mdb_mval_hdr( unsigned char *ptr, int adx, ber_len_t nlen )
+{
+	ptr[0] = (adx >> 24) & 0xff;
+	ptr[1] = (adx >> 16) & 0xff;
+	ptr[2] = (adx >> 8) & 0xff;
+	ptr[3] = adx & 0xff;
+	ptr[4] = (nlen >> 24) & 0xff;
+	ptr[5] = (nlen >> 16) & 0xff;
+	ptr[6] = (nlen >> 8) & 0xff;
+	ptr[7] = nlen & 0xff;
+}
+
+static ber_len_t
+mdb_mval_nlen( unsigned char *ptr )
+{
+	return ((ber_len_t)ptr[4] << 24) | (ptr[5] << 16) | (ptr[6] << 8) | ptr[7];
+}
+
+static ber_len_t
+mdb_mval_size( Attribute *a, int i )
+{
+	ber_len_t len = MVAL_HDR + a->a_nvals[i].bv_len + 1;
+
+	if ( a->a_nvals != a->a_vals )
+		len += a->a_vals[i].bv_len + 1;
+	return len;
+}
+
+/* Can all values of a be kept in id2val? */
+static int
+mdb_mval_fits( Attribute *a )
+{
+	int i;
+
+	for ( i = 0; i < a->a_numvals; i++ ) {
+		if ( mdb_mval_size( a, i ) > MDB_MAXVALSIZE )
+			return 0;
+	}
+	return 1;
+}
+
+/* Position mc on the record of attribute adx with the normalized
+ * value nval, or on the first record of the attribute if nval is
+ * NULL. Returns MDB_NOTFOUND if there is none.
+ */
+static int
+mdb_mval_seek( MDB_cursor *mc, MDB_val *key, int adx, struct berval *nval,
+	MDB_val *data )
+{
+	unsigned char buf[MDB_MAXVALSIZE];
+	ber_len_t len = 4;
+	int rc;
+
+	if ( nval ) {
+		len = MVAL_HDR + nval->bv_len + 1;
+		if ( len > sizeof(buf) )
+			return MDB_NOTFOUND;
+		memcpy( buf + MVAL_HDR, nval->bv_val, nval->bv_len );
+		buf[len-1] = '\0';
+	}
+	mdb_mval_hdr( buf, adx, nval ? nval->bv_len : 0 );
+	data->mv_data = buf;
+	data->mv_size = len;
+	rc = mdb_cursor_get( mc, key, data, MDB_GET_BOTH_RANGE );
+	if ( rc == 0 && ( data->mv_size < len ||
+		memcmp( data->mv_data, buf, len )))
+		rc = MDB_NOTFOUND;
+	return rc;
+}
+
+/* Store value i of attribute a */
+static int
+mdb_mval_put1( MDB_cursor *mc, MDB_val *key, int adx, Attribute *a, int i )
+{
+	unsigned char buf[MDB_MAXVALSIZE], *ptr;
+	MDB_val data;
+	int rc;
+
+	if ( mdb_mval_size( a, i ) > sizeof(buf) )
+		return EINVAL;
+	mdb_mval_hdr( buf, adx, a->a_nvals[i].bv_len );
+	ptr = buf + MVAL_HDR;
+	memcpy( ptr, a->a_nvals[i].bv_val, a->a_nvals[i].bv_len );
+	ptr += a->a_nvals[i].bv_len;
+	*ptr++ = '\0';
+	if ( a->a_nvals != a->a_vals ) {
+		memcpy( ptr, a->a_vals[i].bv_val, a->a_vals[i].bv_len );
+		ptr += a->a_vals[i].bv_len;
+		*ptr++ = '\0';
+	}
+	data.mv_data = buf;
+	data.mv_size = ptr - buf;
+	rc = mdb_cursor_put( mc, key, &data, MDB_NODUPDATA );
+	if ( rc == MDB_KEYEXIST )
+		rc = 0;
+	return rc;
+}
+
+/* Delete the record of attribute adx with the normalized value nval,
+ * or all records of the attribute if nval is NULL.
+ */
+static int
+mdb_mval_del1( MDB_cursor *mc, MDB_val *key, int adx, struct berval *nval )
+{
+	MDB_val data;
+	int rc;
+
+	do {
+		rc = mdb_mval_seek( mc, key, adx, nval, &data );
+		if ( rc == 0 )
+			rc = mdb_cursor_del( mc, 0 );
+	} while ( rc == 0 && !nval );
+	return rc;
+}
+
+/* Give a its own copy of its values. Pages a write txn has already
+ * dirtied are updated in place, so values pointing into them would
+ * change under the entry when a later update in the same txn writes
+ * to id2val. The copy is freed by mdb_entry_return().
+ */
+static void
+mdb_mval_copy( Operation *op, Attribute *a )
+{
+	int have_nval = a->a_nvals != a->a_vals;
+	ber_len_t len;
+	BerVarray vals;
+	char *ptr;
+	int i;
+
+	len = ( a->a_numvals + 1 ) * sizeof(struct berval);
+	if ( have_nval )
+		len *= 2;
+	for ( i = 0; i < a->a_numvals; i++ ) {
+		len += a->a_nvals[i].bv_len + 1;
+		if ( have_nval )
+			len += a->a_vals[i].bv_len + 1;
+	}
+	vals = op->o_tmpalloc( len, op->o_tmpmemctx );
+	ptr = (char *)( vals + ( a->a_numvals + 1 ) * ( have_nval ? 2 : 1 ));
+	for ( i = 0; i < a->a_numvals; i++ ) {
+		vals[i].bv_len = a->a_vals[i].bv_len;
+		vals[i].bv_val = ptr;
+		memcpy( ptr, a->a_vals[i].bv_val, a->a_vals[i].bv_len + 1 );
+		ptr += a->a_vals[i].bv_len + 1;
+	}
+	BER_BVZERO( &vals[i] );
+	if ( have_nval ) {
+		BerVarray nvals = vals + a->a_numvals + 1;
+		for ( i = 0; i < a->a_numvals; i++ ) {
+			nvals[i].bv_len = a->a_nvals[i].bv_len;
+			nvals[i].bv_val = ptr;
+			memcpy( ptr, a->a_nvals[i].bv_val, a->a_nvals[i].bv_len + 1 );
+			ptr += a->a_nvals[i].bv_len + 1;
+		}
+		BER_BVZERO( &nvals[i] );
+		a->a_nvals = nvals;
+	} else {
+		a->a_nvals = vals;
+	}
+	a->a_vals = vals;
+	a->a_flags &= ~SLAP_ATTR_DONT_FREE_VALS;
+}
+
+/* Read the values of attribute a, which are kept in id2val, into
+ * the array at bptr, or into a copy if copy is set.
+ */
+static int
+mdb_mval_get( Operation *op, MDB_cursor *mc, ID id, int adx, Attribute *a,
+	int have_nval, BerVarray bptr, int copy )
+{
+	MDB_val key, data;
+	unsigned char *ptr;
+	ber_len_t nlen;
+	int i, rc;
+
+	key.mv_data = &id;
+	key.mv_size = sizeof(ID);
+	a->a_vals = bptr;
+	a->a_nvals = have_nval ? bptr + a->a_numvals + 1 : bptr;
+	rc = mdb_mval_seek( mc, &key, adx, NULL, &data );
+	for ( i = 0; i < a->a_numvals; i++ ) {
+		if ( rc )
+			break;
+		ptr = data.mv_data;
+		nlen = mdb_mval_nlen( ptr );
+		if ( data.mv_size < MVAL_HDR + nlen + 1 )
+			break;
+		a->a_nvals[i].bv_len = nlen;
+		a->a_nvals[i].bv_val = (char *)ptr + MVAL_HDR;
+		if ( have_nval ) {
+			if ( data.mv_size < MVAL_HDR + nlen + 2 )
+				break;
+			a->a_vals[i].bv_len = data.mv_size - MVAL_HDR - nlen - 2;
+			a->a_vals[i].bv_val = (char *)ptr + MVAL_HDR + nlen + 1;
+		}
+		rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_DUP );
+		if ( rc == 0 && memcmp( data.mv_data, ptr, 4 ))
+			rc = MDB_NOTFOUND;
+	}
+	if ( i < a->a_numvals ) {
+		Debug( LDAP_DEBUG_ANY,
+			"mdb_mval_get: entry %lx is missing values of %s (%d found)\n",
+			(long) id, a->a_desc->ad_cname.bv_val, i );
+		return LDAP_OTHER;
+	}
+	BER_BVZERO( &a->a_vals[i] );
+	if ( have_nval )
+		BER_BVZERO( &a->a_nvals[i] );
+	if ( copy )
+		mdb_mval_copy( op, a );
+	return 0;
+}
+
+/* Store all values of a in id2val */
+static int
+mdb_mval_putall( Operation *op, MDB_cursor *mc, ID id, Attribute *a )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_val key;
+	int i, rc = 0, adx = mdb->mi_adxs[a->a_desc->ad_index];
+
+	key.mv_data = &id;
+	key.mv_size = sizeof(ID);
+	for ( i = 0; i < a->a_numvals && !rc; i++ )
+		rc = mdb_mval_put1( mc, &key, adx, a, i );
+	return rc;
+}
+
+/* Delete the values of ad from id2val, those in nvals or all of them.
+ * Returns MDB_NOTFOUND if one of nvals isn't there.
+ */
+int
+mdb_mval_del( Operation *op, MDB_cursor *mc, ID id,
+	AttributeDescription *ad, BerVarray nvals )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_val key;
+	int i, rc = 0, adx = mdb->mi_adxs[ad->ad_index];
+
+	key.mv_data = &id;
+	key.mv_size = sizeof(ID);
+	if ( !nvals ) {
+		rc = mdb_mval_del1( mc, &key, adx, NULL );
+		if ( rc == MDB_NOTFOUND )
+			rc = 0;
+	} else {
+		for ( i = 0; !BER_BVISNULL( &nvals[i] ) && !rc; i++ ) {
+			rc = mdb_mval_del1( mc, &key, adx, &nvals[i] );
+		}
+	}
+	return rc;
+}
+
+/* Store values i of a in id2val, for those i where vals[i] is set,
+ * or all of them if vals is NULL.
+ * If the attribute can't be kept there any longer, all its values
+ * are removed and it is flagged to go back into the entry.
+ */
+int
+mdb_mval_add( Operation *op, MDB_cursor *mc, ID id, Attribute *a,
+	char *vals )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_val key;
+	int i, rc = 0, adx = mdb->mi_adxs[a->a_desc->ad_index];
+
+	key.mv_data = &id;
+	key.mv_size = sizeof(ID);
+	for ( i = 0; i < a->a_numvals && !rc; i++ ) {
+		if ( vals && !vals[i] )
+			continue;
+		if ( mdb_mval_size( a, i ) > MDB_MAXVALSIZE ) {
+			a->a_flags &= ~SLAP_ATTR_BIG_MULTI;
+			return mdb_mval_del( op, mc, id, a->a_desc, NULL );
+		}
+		rc = mdb_mval_put1( mc, &key, adx, a, i );
+	}
+	return rc;
+}
+
+/* Is the normalized value nval of ad kept in id2val for entry id?
+ * If nval is NULL, are any of its values? Returns 0 if so.
+ */
+int
+mdb_mval_find( Operation *op, MDB_txn *txn, ID id,
+	AttributeDescription *ad, struct berval *nval )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_cursor *mc;
+	MDB_val key, data;
+	int rc, adx = mdb->mi_adxs[ad->ad_index];
+
+	if ( !adx || !mdb->mi_id2val )
+		return MDB_NOTFOUND;
+	rc = mdb_cursor_open( txn, mdb->mi_id2val, &mc );
+	if ( rc )
+		return rc;
+	key.mv_data = &id;
+	key.mv_size = sizeof(ID);
+	rc = mdb_mval_seek( mc, &key, adx, nval, &data );
+	mdb_cursor_close( mc );
+	return rc;
+}
+
+/* Before an entry is written: move attributes whose value counts
+ * crossed the multival thresholds into id2val. Those that drop back
+ * into the entry are flagged here, and their ADs returned in *drop;
+ * their records are deleted once the entry is written, since their
+ * values may still point into them.
+ */
+static int
+mdb_mval_check( Operation *op, MDB_txn *txn, Entry *e,
+	AttributeDescription ***drop )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_cursor *mc = NULL;
+	Attribute *a;
+	int rc = 0, n = 0;
+
+	*drop = NULL;
+	for ( a = e->e_attrs; a && !rc; a = a->a_next ) {
+		if ( a->a_flags & SLAP_ATTR_BIG_MULTI ) {
+			if ( a->a_numvals >= mdb->mi_multi_lo )
+				continue;
+			if ( !*drop ) {
+				Attribute *b;
+				for ( b = a; b; b = b->a_next )
+					n++;
+				*drop = op->o_tmpalloc( ( n + 1 ) * sizeof(AttributeDescription *),
+					op->o_tmpmemctx );
+				n = 0;
+			}
+			(*drop)[n++] = a->a_desc;
+			a->a_flags ^= SLAP_ATTR_BIG_MULTI;
+		} else if ( mdb->mi_id2val && mdb->mi_multi_hi &&
+			a->a_numvals > mdb->mi_multi_hi &&
+			mdb_mval_fits( a ))
+		{
+			if ( !mdb->mi_adxs[a->a_desc->ad_index] ) {
+				rc = mdb_ad_get( mdb, txn, a->a_desc );
+				if ( rc )
+					break;
+			}
+			if ( !mc ) {
+				rc = mdb_cursor_open( txn, mdb->mi_id2val, &mc );
+				if ( rc )
+					break;
+			}
+			rc = mdb_mval_putall( op, mc, e->e_id, a );
+			if ( rc == 0 )
+				a->a_flags |= SLAP_ATTR_BIG_MULTI;
+		}
+	}
+	if ( *drop )
+		(*drop)[n] = NULL;
+	if ( mc )
+		mdb_cursor_close( mc );
+	return rc;
+}
+
 static int mdb_id2entry_put(
 	Operation *op,
 	MDB_txn *txn,
@@ -47,16 +423,28 @@ static int mdb_id2entry_put(
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	Ecount ec;
 	MDB_val key, data;
+	AttributeDescription **drop;
 	int rc;
 
 	/* We only store rdns, and they go in the dn2id database. */
 
+	if ( mdb->mi_cache )
+		mdb_cache_delete( mdb, txn, e->e_id );
+
 	key.mv_data = &e->e_id;
 	key.mv_size = sizeof(ID);
 
+	rc = mdb_mval_check( op, txn, e, &drop );
+	if (rc) {
+		rc = LDAP_OTHER;
+		goto done;
+	}
+
 	rc = mdb_entry_partsize( mdb, txn, e, &ec );
-	if (rc)
-		return LDAP_OTHER;
+	if (rc) {
+		rc = LDAP_OTHER;
+		goto done;
+	}
 
 	flag |= MDB_RESERVE;
 
@@ -71,8 +459,10 @@ again:
 		rc = mdb_put( txn, mdb->mi_id2entry, &key, &data, flag );
 	if (rc == MDB_SUCCESS) {
 		rc = mdb_entry_encode( op, e, &data, &ec );
-		if( rc != LDAP_SUCCESS )
-			return LDAP_OTHER;
+		if( rc != LDAP_SUCCESS ) {
+			rc = LDAP_OTHER;
+			goto done;
+		}
 	}
 	if (rc) {
 		/* Was there a hole from slapadd? */
@@ -87,6 +477,21 @@ again:
 		if ( rc != MDB_KEYEXIST )
 			rc = LDAP_OTHER;
 	}
+	if ( rc == 0 && drop ) {
+		MDB_cursor *mvc = NULL;
+		int i;
+
+		rc = mdb_cursor_open( txn, mdb->mi_id2val, &mvc );
+		for ( i = 0; drop[i] && !rc; i++ )
+			rc = mdb_mval_del( op, mvc, e->e_id, drop[i], NULL );
+		if ( mvc )
+			mdb_cursor_close( mvc );
+		if ( rc )
+			rc = LDAP_OTHER;
+	}
+done:
+	if ( drop )
+		op->o_tmpfree( drop, op->o_tmpmemctx );
 	return rc;
 }
 
@@ -119,13 +524,42 @@ int mdb_id2entry(
 	MDB_cursor *mc,
 	ID id,
 	Entry **e )
+{
+	return mdb_id2entry_partial( op, mc, id, NULL, e );
+}
+
+/* Like mdb_id2entry, but only decode the attributes wanted by am
+ * (all of them if am is NULL). An entry that was only partially
+ * decoded must be passed to mdb_entry_complete() before it is
+ * handed to anything besides the caller, and while the read txn
+ * is still open.
+ */
+int mdb_id2entry_partial(
+	Operation *op,
+	MDB_cursor *mc,
+	ID id,
+	mdb_attrmask *am,
+	Entry **e )
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	MDB_val key, data;
+	size_t txnid = 0;
 	int rc = 0;
 
 	*e = NULL;
 
+	/* with the cache, decode everything on a miss, so the entry
+	 * can be kept for whoever wants it next */
+	if ( mdb->mi_cache ) {
+		txnid = mdb_cache_txnid( op, mdb, mdb_cursor_txn( mc ));
+		if ( txnid ) {
+			*e = mdb_cache_find( op, mdb, id, txnid );
+			if ( *e )
+				return 0;
+			am = NULL;
+		}
+	}
+
 	key.mv_data = &id;
 	key.mv_size = sizeof(ID);
 
@@ -165,13 +599,16 @@ int mdb_id2entry(
 	}
 	if ( rc ) return rc;
 
-	rc = mdb_entry_decode( op, &data, e );
+	rc = mdb_entry_decode( op, mdb_cursor_txn( mc ), &data, id, am, e );
 	if ( rc ) return rc;
 
 	(*e)->e_id = id;
 	(*e)->e_name.bv_val = NULL;
 	(*e)->e_nname.bv_val = NULL;
 
+	if ( txnid )
+		mdb_cache_add( mdb, *e, txnid );
+
 	return rc;
 }
 
@@ -185,12 +622,28 @@ int mdb_id2entry_delete(
 	MDB_val key;
 	int rc;
 
+	if ( mdb->mi_cache )
+		mdb_cache_delete( mdb, tid, e->e_id );
+
 	key.mv_data = &e->e_id;
 	key.mv_size = sizeof(ID);
 
 	/* delete from database */
 	rc = mdb_del( tid, dbi, &key, NULL );
 
+	if ( rc == 0 && mdb->mi_id2val ) {
+		Attribute *a;
+		for ( a = e->e_attrs; a; a = a->a_next ) {
+			if ( a->a_flags & SLAP_ATTR_BIG_MULTI )
+				break;
+		}
+		if ( a ) {
+			rc = mdb_del( tid, mdb->mi_id2val, &key, NULL );
+			if ( rc == MDB_NOTFOUND )
+				rc = 0;
+		}
+	}
+
 	return rc;
 }
 
@@ -220,6 +673,17 @@ int mdb_entry_return(
 )
 {
 	if ( e->e_private ) {
+		/* a copy of a cached entry */
+		if ( e->e_private != e ) {
+			mdb_cache_release( e );
+		} else {
+			Attribute *a;
+			/* values copied out of id2val */
+			for ( a = e->e_attrs; a; a = a->a_next ) {
+				if ( !( a->a_flags & SLAP_ATTR_DONT_FREE_VALS ))
+					op->o_tmpfree( a->a_vals, op->o_tmpmemctx );
+			}
+		}
 		if ( op->o_hdr ) {
 			op->o_tmpfree( e->e_nname.bv_val, op->o_tmpmemctx );
 			op->o_tmpfree( e->e_name.bv_val, op->o_tmpmemctx );
@@ -343,7 +807,8 @@ return_results:
 		if ( e )
 			mdb_entry_return( op, e );
 
-		if (moi->moi_ref == 1) {
+		/* the txn of an LDAP transaction belongs to mdb_txn() */
+		if (moi->moi_ref == 1 && !( moi->moi_flag & MOI_KEEPER )) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &moi->moi_oe, OpExtra, oe_next );
 			mdb_txn_reset( txn );
 			op->o_tmpfree( moi, op->o_tmpmemctx );
@@ -433,7 +898,9 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 		/* This op is continuing an existing write txn */
 			*moip = moi;
 		}
-		moi->moi_ref++;
+		/* a keeper holds its one reference until mdb_txn() ends it */
+		if ( !( moi->moi_flag & MOI_KEEPER ))
+			moi->moi_ref++;
 		if ( !moi->moi_txn ) {
 			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &moi->moi_txn );
 			if (rc) {
@@ -484,19 +951,106 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 	if ( renew ) {
 		mdb_txn_renew( moi->moi_txn );
 	}
-	moi->moi_ref++;
+	if ( !( moi->moi_flag & MOI_KEEPER ))
+		moi->moi_ref++;
 	if ( *moip != moi )
 		*moip = moi;
 
 	return 0;
 }
 
+/* Is txn the read-only txn of op? */
+static int
+mdb_txn_reader( Operation *op, struct mdb_info *mdb, MDB_txn *txn )
+{
+	OpExtra *oex;
+
+	LDAP_SLIST_FOREACH( oex, &op->o_extra, oe_next ) {
+		if ( oex->oe_key == mdb )
+			break;
+	}
+	return oex && ( ((mdb_op_info *)oex)->moi_flag & MOI_READER ) &&
+		((mdb_op_info *)oex)->moi_txn == txn;
+}
+
+/* Run the updates of an LDAP transaction in a single MDB txn.
+ * The frontend calls this to begin the txn before replaying the
+ * queued updates, and to commit or abort it at the end.
+ */
+int
+mdb_txn( Operation *op, int txnop, OpExtra **ptr )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_op_info *moi;
+	int rc;
+
+	switch( txnop ) {
+	case SLAP_TXN_BEGIN:
+		moi = ch_calloc( 1, sizeof(mdb_op_info) );
+		moi->moi_oe.oe_key = mdb;
+		moi->moi_flag = MOI_KEEPER;
+		moi->moi_ref = 1;
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &moi->moi_txn );
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY, "mdb_txn: txn_begin failed %s(%d)\n",
+				mdb_strerror(rc), rc, 0 );
+			ch_free( moi );
+			return LDAP_OTHER;
+		}
+		moi->moi_numads = mdb->mi_numads;
+		*ptr = &moi->moi_oe;
+		return LDAP_SUCCESS;
+	case SLAP_TXN_COMMIT:
+		moi = (mdb_op_info *)*ptr;
+		/* a failed commit drops the writer lock, keep the next
+		 * writer from assigning descriptions until they're undone */
+		ldap_pvt_thread_mutex_lock( &mdb->mi_ads_mutex );
+		rc = mdb_txn_commit( moi->moi_txn );
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY, "mdb_txn: txn_commit failed %s(%d)\n",
+				mdb_strerror(rc), rc, 0 );
+			mdb_ad_unwind( mdb, moi->moi_numads );
+			rc = LDAP_OTHER;
+		}
+		ldap_pvt_thread_mutex_unlock( &mdb->mi_ads_mutex );
+		break;
+	case SLAP_TXN_ABORT:
+		moi = (mdb_op_info *)*ptr;
+		mdb_ad_unwind( mdb, moi->moi_numads );
+		mdb_txn_abort( moi->moi_txn );
+		rc = LDAP_SUCCESS;
+		break;
+	default:
+		return LDAP_OTHER;
+	}
+	ch_free( moi );
+	*ptr = NULL;
+	mdb_map_check( mdb );
+	return rc;
+}
+
+/* Get the txn an update writes to. Inside an LDAP transaction each
+ * update gets a nested txn so that its own failure leaves no partial
+ * changes behind. Nested txns are not supported with a writable map,
+ * updates then go straight into the transaction's txn; any failure
+ * aborts the whole transaction anyway.
+ */
+int
+mdb_txn_nest( struct mdb_info *mdb, mdb_op_info *moi, MDB_txn **txn )
+{
+	*txn = moi->moi_txn;
+	if ( !( moi->moi_flag & MOI_KEEPER ) ||
+		( mdb->mi_dbenv_flags & MDB_WRITEMAP ))
+		return 0;
+	return mdb_txn_begin( mdb->mi_dbenv, moi->moi_txn, 0, txn );
+}
+
 /* Count up the sizes of the components of an entry */
 static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
 	Ecount *eh)
 {
 	ber_len_t len;
-	int i, nat = 0, nval = 0, nnval = 0;
+	int i, nat = 0, nval = 0, nlen = 0;
 	Attribute *a;
 
 	len = 4*sizeof(int);	/* nattrs, nvals, ocflags, offset */
@@ -514,16 +1068,22 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
 				return rc;
 		}
 		len += 2*sizeof(int);	/* AD index, numvals */
+		nlen += 2;
 		nval += a->a_numvals + 1;	/* empty berval at end */
+		if (a->a_nvals != a->a_vals)
+			nval += a->a_numvals + 1;
+		/* the values are in id2val */
+		if (a->a_flags & SLAP_ATTR_BIG_MULTI)
+			continue;
 		for (i=0; i<a->a_numvals; i++) {
 			len += a->a_vals[i].bv_len + 1 + sizeof(int);	/* len */
 		}
+		nlen += a->a_numvals;
 		if (a->a_nvals != a->a_vals) {
-			nval += a->a_numvals + 1;
-			nnval++;
 			for (i=0; i<a->a_numvals; i++) {
 				len += a->a_nvals[i].bv_len + 1 + sizeof(int);;
 			}
+			nlen += a->a_numvals;
 		}
 	}
 	/* padding */
@@ -531,12 +1091,10 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
 	eh->len = len;
 	eh->nattrs = nat;
 	eh->nvals = nval;
-	eh->offset = nat + nval - nnval;
+	eh->offset = nlen;
 	return 0;
 }
 
-#define HIGH_BIT (1<<(sizeof(unsigned int)*CHAR_BIT-1))
-
 /* Flatten an Entry into a buffer. The buffer starts with the count of the
  * number of attributes in the entry, the total number of values in the
  * entry, and the e_ocflags. It then contains a list of integers for each
@@ -547,7 +1105,12 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
  * it's possible to receive an attribute that we can't encode due to size
  * overflow. In practice, this should not be an issue.) Then the length
  * of each value is listed. If there are normalized values, their lengths
- * come next. This continues for each attribute. After all of the lengths
+ * come next. If the second bit is set as well, the values are kept in
+ * id2val and no lengths are listed for them; the number of values is
+ * still counted in the total. With sortvals-stored on, the third bit
+ * says the values are stored in the order of their SORTED_VAL attribute
+ * type, so they don't have to be sorted again when they're read back.
+ * This continues for each attribute. After all of the lengths
  * for the last attribute, the actual values are copied, with a NUL
  * terminator after each value. The buffer is padded to the sizeof(ID).
  * The entire buffer size is precomputed so that a single malloc can be
@@ -581,8 +1144,13 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
 		l = a->a_numvals;
 		if (a->a_nvals != a->a_vals)
 			l |= HIGH_BIT;
+		if (a->a_flags & SLAP_ATTR_BIG_MULTI)
+			l |= MULTI_BIT;
+		else if (slap_sortvals_stored &&
+			(a->a_flags & SLAP_ATTR_SORTED_VALS))
+			l |= SORTED_BIT;
 		*lp++ = l;
-		if (a->a_vals) {
+		if (a->a_vals && !(l & MULTI_BIT)) {
 			for (i=0; a->a_vals[i].bv_val; i++);
 			assert( i == a->a_numvals );
 			for (i=0; i<a->a_numvals; i++) {
@@ -611,13 +1179,18 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
 }
 
 /* Retrieve an Entry that was stored using entry_encode above.
+ * If am is given, only the attributes it wants are decoded; the
+ * lengths of the others are just skipped over. The stored data is
+ * then remembered in e_bv so mdb_entry_complete() can pick up the
+ * rest later.
  *
  * Note: everything is stored in a single contiguous block, so
  * you can not free individual attributes or names from this
  * structure. Attempting to do so will likely corrupt memory.
  */
 
-int mdb_entry_decode(Operation *op, MDB_val *data, Entry **e)
+int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id,
+	mdb_attrmask *am, Entry **e)
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	int i, j, nattrs, nvals;
@@ -629,6 +1202,8 @@ int mdb_entry_decode(Operation *op, MDB_val *data, Entry **e)
 	unsigned int *lp = (unsigned int *)data->mv_data;
 	unsigned char *ptr;
 	BerVarray bptr;
+	MDB_cursor *mvc = NULL;
+	int copy = -1;
 
 	Debug( LDAP_DEBUG_TRACE,
 		"=> mdb_entry_decode:\n",
@@ -636,25 +1211,113 @@ int mdb_entry_decode(Operation *op, MDB_val *data, Entry **e)
 
 	nattrs = *lp++;
 	nvals = *lp++;
-	x = mdb_entry_alloc(op, nattrs, nvals);
+	if (am && nvals) {
+		/* Size the entry for just the wanted attributes */
+		unsigned int *lq = lp+2, n;
+		int nkeep = 0, nvkeep = 0;
+		for (i=0; i<nattrs; i++) {
+			int want;
+			j = *lq++;
+			n = *lq++ & ~SORTED_BIT;
+			want = MDB_AM_WANT(am, j) ||
+				((am->am_flags & MDB_AM_MULTI) && !(n & MULTI_BIT));
+			if (n & MULTI_BIT) {
+				n ^= MULTI_BIT;
+				if (n & HIGH_BIT) {
+					n ^= HIGH_BIT;
+					if (want)
+						nvkeep += n+1;
+				}
+				if (want) {
+					nkeep++;
+					nvkeep += n+1;
+				}
+				continue;
+			}
+			if (n & HIGH_BIT) {
+				n ^= HIGH_BIT;
+				if (want)
+					nvkeep += n+1;
+				lq += n;
+			}
+			if (want) {
+				nkeep++;
+				nvkeep += n+1;
+			}
+			lq += n;
+		}
+		if (nkeep < nattrs) {
+			x = mdb_entry_alloc(op, nkeep, nvkeep);
+			x->e_bv.bv_val = data->mv_data;
+			x->e_bv.bv_len = data->mv_size;
+		} else {
+			am = NULL;
+			x = mdb_entry_alloc(op, nattrs, nvals);
+		}
+	} else {
+		am = NULL;
+		x = mdb_entry_alloc(op, nattrs, nvals);
+	}
 	x->e_ocflags = *lp++;
 	if (!nvals) {
 		goto done;
 	}
 	a = x->e_attrs;
-	bptr = a->a_vals;
+	bptr = a ? a->a_vals : NULL;
 	i = *lp++;
 	ptr = (unsigned char *)(lp + i);
 
 	for (;nattrs>0; nattrs--) {
-		int have_nval = 0;
-		a->a_desc = mdb->mi_ads[*lp++];
+		int have_nval = 0, sorted = 0;
+		j = *lp++;
+		if (am && !MDB_AM_WANT(am, j) &&
+			(!(am->am_flags & MDB_AM_MULTI) || (*lp & MULTI_BIT))) {
+			unsigned int n = *lp++ & ~SORTED_BIT;
+			if (n & MULTI_BIT)
+				continue;
+			if (n & HIGH_BIT)
+				n = (n ^ HIGH_BIT) * 2;
+			for (i=0; i<n; i++)
+				ptr += *lp++ + 1;
+			continue;
+		}
+		a->a_desc = mdb->mi_ads[j];
 		a->a_flags = SLAP_ATTR_DONT_FREE_DATA | SLAP_ATTR_DONT_FREE_VALS;
 		a->a_numvals = *lp++;
+		if (a->a_numvals & SORTED_BIT) {
+			a->a_numvals ^= SORTED_BIT;
+			sorted = 1;
+		}
 		if (a->a_numvals & HIGH_BIT) {
 			a->a_numvals ^= HIGH_BIT;
 			have_nval = 1;
 		}
+		if (a->a_numvals & MULTI_BIT) {
+			a->a_numvals ^= MULTI_BIT;
+			a->a_flags |= SLAP_ATTR_BIG_MULTI;
+			rc = 0;
+			if (copy < 0)
+				copy = !(slapMode & SLAP_TOOL_READONLY) &&
+					!mdb_txn_reader(op, mdb, txn);
+			if (!mvc)
+				rc = mdb_cursor_open(txn, mdb->mi_id2val, &mvc);
+			if (rc == 0)
+				rc = mdb_mval_get(op, mvc, id, j, a, have_nval, bptr, copy);
+			if (rc) {
+				Attribute *b;
+				if (mvc)
+					mdb_cursor_close(mvc);
+				for (b = x->e_attrs; b < a; b++)
+					if (!(b->a_flags & SLAP_ATTR_DONT_FREE_VALS))
+						op->o_tmpfree(b->a_vals, op->o_tmpmemctx);
+				op->o_tmpfree(x, op->o_tmpmemctx);
+				return LDAP_OTHER;
+			}
+			bptr += a->a_numvals + 1;
+			if (have_nval)
+				bptr += a->a_numvals + 1;
+			goto sort;
+		}
 		a->a_vals = bptr;
 		for (i=0; i<a->a_numvals; i++) {
 			bptr->bv_len = *lp++;;
@@ -680,23 +1343,33 @@ int mdb_entry_decode(Operation *op, MDB_val *data, Entry **e)
 		} else {
 			a->a_nvals = a->a_vals;
 		}
-		/* FIXME: This is redundant once a sorted entry is saved into the DB */
+sort:
+		/* Entries written before their values were stored sorted,
+		 * or before the type was made SORTED_VAL, still need it.
+		 */
 		if ( a->a_desc->ad_type->sat_flags & SLAP_AT_SORTED_VAL ) {
-			rc = slap_sort_vals( (Modifications *)a, &text, &j, NULL );
-			if ( rc == LDAP_SUCCESS ) {
+			if ( sorted ) {
 				a->a_flags |= SLAP_ATTR_SORTED_VALS;
-			} else if ( rc == LDAP_TYPE_OR_VALUE_EXISTS ) {
-				/* should never happen */
-				Debug( LDAP_DEBUG_ANY,
-					"mdb_entry_decode: attributeType %s value #%d provided more than once\n",
-					a->a_desc->ad_cname.bv_val, j, 0 );
-				return rc;
+			} else {
+				rc = slap_sort_vals( (Modifications *)a, &text, &j, NULL );
+				if ( rc == LDAP_SUCCESS ) {
+					a->a_flags |= SLAP_ATTR_SORTED_VALS;
+				} else if ( rc == LDAP_TYPE_OR_VALUE_EXISTS ) {
+					/* should never happen */
+					Debug( LDAP_DEBUG_ANY,
+						"mdb_entry_decode: attributeType %s value #%d provided more than once\n",
+						a->a_desc->ad_cname.bv_val, j, 0 );
+					return rc;
+				}
 			}
 		}
 		a->a_next = a+1;
 		a = a->a_next;
 	}
-	a[-1].a_next = NULL;
+	if (a != x->e_attrs)
+		a[-1].a_next = NULL;
+	if (mvc)
+		mdb_cursor_close(mvc);
 done:
 
 	Debug(LDAP_DEBUG_TRACE, "<= mdb_entry_decode\n",
@@ -704,3 +1377,32 @@ done:
 	*e = x;
 	return 0;
 }
+
+/* Decode the attributes wanted by am (all of them if am is NULL)
+ * of an entry that was only partially decoded before, replacing
+ * *e. The data it came from must still be valid, i.e. the txn it
+ * was read in must not have ended.
+ */
+int mdb_entry_complete(Operation *op, MDB_txn *txn, mdb_attrmask *am,
+	Entry **e)
+{
+	Entry *x = *e, *y;
+	MDB_val data;
+	int rc;
+
+	if (BER_BVISNULL(&x->e_bv))
+		return 0;
+
+	data.mv_data = x->e_bv.bv_val;
+	data.mv_size = x->e_bv.bv_len;
+	rc = mdb_entry_decode(op, txn, &data, x->e_id, am, &y);
+	if (rc)
+		return rc;
+	BER_BVZERO(&y->e_bv);
+	y->e_id = x->e_id;
+	y->e_name = x->e_name;
+	y->e_nname = x->e_nname;
+	op->o_tmpfree(x, op->o_tmpmemctx);
+	*e = y;
+	return 0;
+}
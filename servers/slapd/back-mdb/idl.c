@@ -31,6 +31,10 @@ static void idl_check( ID *ids )
 {
 	if( MDB_IDL_IS_RANGE( ids ) ) {
 		assert( MDB_IDL_RANGE_FIRST(ids) <= MDB_IDL_RANGE_LAST(ids) );
+	} else if( MDB_IDL_IS_BITMAP( ids ) ) {
+		assert( MDB_IDL_BM_BASE(ids) <= ids[1] && ids[1] <= ids[2] );
+		assert( MDB_IDL_BM_WORDS(ids) <= MDB_IDL_BM_MAXWORDS );
+		assert( MDB_IDL_BM_COUNT(ids) > 0 );
 	} else {
 		ID i;
 		for( i=1; i < ids[0]; i++ ) {
@@ -48,6 +52,12 @@ static void idl_dump( ID *ids )
 			(long) MDB_IDL_RANGE_FIRST( ids ),
 			(long) MDB_IDL_RANGE_LAST( ids ) );
 
+	} else if( MDB_IDL_IS_BITMAP( ids ) ) {
+		Debug( LDAP_DEBUG_ANY,
+			"IDL: bitmap ( %ld - %ld ) count %ld\n",
+			(long) ids[1], (long) ids[2],
+			(long) MDB_IDL_BM_COUNT( ids ) );
+
 	} else {
 		ID i;
 		Debug( LDAP_DEBUG_ANY, "IDL: size %ld", (long) ids[0], 0, 0 );
@@ -125,6 +135,250 @@ unsigned mdb_idl_search( ID *ids, ID id )
 #endif
 }
 
+/* Bitmap IDLs. The base of a map is always a multiple of the
+ * word size, so the maps of two IDLs line up word for word.
+ */
+#define BM_BITS		MDB_IDL_BM_BITS
+#define BM_MASK		(BM_BITS-1)
+#define BM_MAP(ids)	((ids) + MDB_IDL_BM_HDR)
+#define BM_WORD(ids, id)	(((id) - MDB_IDL_BM_BASE(ids)) / BM_BITS)
+#define BM_BIT(id)	((ID)1 << ((id) & BM_MASK))
+
+static unsigned
+mdb_idl_bm_popcount( ID w )
+{
+	w -= (w >> 1) & (~(ID)0/3);
+	w = (w & (~(ID)0/15*3)) + ((w >> 2) & (~(ID)0/15*3));
+	w = (w + (w >> 4)) & (~(ID)0/255*15);
+	return (ID)(w * (~(ID)0/255)) >> (sizeof(ID) - 1) * 8;
+}
+
+/* Can a single bitmap hold IDs lo through hi? */
+static int
+mdb_idl_bm_fits( ID lo, ID hi )
+{
+	return (hi - (lo & ~BM_MASK)) / BM_BITS < MDB_IDL_BM_MAXWORDS;
+}
+
+/* Start an empty bitmap that can hold IDs lo through hi */
+static void
+mdb_idl_bm_init( ID *ids, ID lo, ID hi )
+{
+	ids[0] = MDB_IDL_BITMAP;
+	ids[1] = lo;
+	ids[2] = hi;
+	MDB_IDL_BM_COUNT( ids ) = 0;
+	MDB_IDL_BM_BASE( ids ) = lo & ~BM_MASK;
+	memset( BM_MAP( ids ), 0, MDB_IDL_BM_WORDS( ids ) * sizeof(ID) );
+}
+
+/* Set the bit of an ID that the map already covers */
+static int
+mdb_idl_bm_set( ID *ids, ID id )
+{
+	ID *w = &BM_MAP( ids )[BM_WORD( ids, id )];
+
+	if ( *w & BM_BIT( id ))
+		return -1;
+	*w |= BM_BIT( id );
+	MDB_IDL_BM_COUNT( ids )++;
+	if ( id < ids[1] )
+		ids[1] = id;
+	else if ( id > ids[2] )
+		ids[2] = id;
+	return 0;
+}
+
+static int
+mdb_idl_bm_test( ID *ids, ID id )
+{
+	return id >= ids[1] && id <= ids[2] &&
+		( BM_MAP( ids )[BM_WORD( ids, id )] & BM_BIT( id ));
+}
+
+/* Find the first ID in the map that is at least id */
+static ID
+mdb_idl_bm_next( ID *ids, ID id )
+{
+	ID *map = BM_MAP( ids ), n, nw, w;
+	unsigned b;
+
+	if ( id < ids[1] )
+		id = ids[1];
+	if ( id > ids[2] )
+		return NOID;
+	n = BM_WORD( ids, id );
+	nw = MDB_IDL_BM_WORDS( ids );
+	b = id & BM_MASK;
+	w = map[n] >> b;
+	while ( !w ) {
+		if ( ++n >= nw )
+			return NOID;
+		w = map[n];
+		b = 0;
+	}
+	for ( ; !( w & 1 ); w >>= 1 )
+		b++;
+	return MDB_IDL_BM_BASE( ids ) + n * BM_BITS + b;
+}
+
+/* Grow the map to cover IDs lo through hi. The new words are
+ * zeroed; the first and last IDs are left alone.
+ */
+static int
+mdb_idl_bm_extend( ID *ids, ID lo, ID hi )
+{
+	ID base = MDB_IDL_BM_BASE( ids ), nbase = lo & ~BM_MASK;
+	ID nw = MDB_IDL_BM_WORDS( ids ), hw, shift;
+
+	if ( nbase > base )
+		nbase = base;
+	if ( hi < ids[2] )
+		hi = ids[2];
+	if ( !mdb_idl_bm_fits( nbase, hi ))
+		return -1;
+
+	shift = ( base - nbase ) / BM_BITS;
+	if ( shift ) {
+		AC_MEMCPY( BM_MAP( ids ) + shift, BM_MAP( ids ), nw * sizeof(ID) );
+		memset( BM_MAP( ids ), 0, shift * sizeof(ID) );
+		MDB_IDL_BM_BASE( ids ) = nbase;
+		nw += shift;
+	}
+	hw = ( hi - nbase ) / BM_BITS + 1;
+	if ( hw > nw )
+		memset( BM_MAP( ids ) + nw, 0, ( hw - nw ) * sizeof(ID) );
+	return 0;
+}
+
+/* Add an ID, growing the map as needed. Returns -1 if the ID was
+ * already present, -2 if the map can't grow that far.
+ */
+static int
+mdb_idl_bm_insert( ID *ids, ID id )
+{
+	if ( id < MDB_IDL_BM_BASE( ids ) ||
+		BM_WORD( ids, id ) >= MDB_IDL_BM_WORDS( ids )) {
+		if ( mdb_idl_bm_extend( ids, id, id ))
+			return -2;
+	}
+	return mdb_idl_bm_set( ids, id );
+}
+
+/* Recount the map after bits were cleared, reset its first and
+ * last IDs and drop leading empty words.
+ */
+static void
+mdb_idl_bm_trim( ID *ids )
+{
+	ID *map = BM_MAP( ids ), nw = MDB_IDL_BM_WORDS( ids );
+	ID i, lo, hi, n = 0, w;
+	unsigned b;
+
+	for ( i=0; i<nw; i++ )
+		n += mdb_idl_bm_popcount( map[i] );
+	if ( !n ) {
+		MDB_IDL_ZERO( ids );
+		return;
+	}
+	for ( lo = 0; !map[lo]; lo++ ) ;
+	for ( hi = nw-1; !map[hi]; hi-- ) ;
+
+	for ( w = map[hi], b = BM_MASK; !( w >> b ); b-- ) ;
+	ids[2] = MDB_IDL_BM_BASE( ids ) + hi * BM_BITS + b;
+	for ( w = map[lo], b = 0; !( w & 1 ); w >>= 1 )
+		b++;
+	ids[1] = MDB_IDL_BM_BASE( ids ) + lo * BM_BITS + b;
+	if ( lo ) {
+		AC_MEMCPY( map, map + lo, ( hi - lo + 1 ) * sizeof(ID) );
+		MDB_IDL_BM_BASE( ids ) += lo * BM_BITS;
+	}
+	MDB_IDL_BM_COUNT( ids ) = n;
+}
+
+/* Keep only the IDs from lo through hi */
+static void
+mdb_idl_bm_clip( ID *ids, ID lo, ID hi )
+{
+	ID *map = BM_MAP( ids ), i, n;
+
+	if ( hi < ids[2] ) {
+		map[BM_WORD( ids, hi )] &= ~(ID)0 >> ( BM_MASK - ( hi & BM_MASK ));
+		ids[2] = hi;
+	}
+	if ( lo > ids[1] ) {
+		n = BM_WORD( ids, lo );
+		for ( i=0; i<n; i++ )
+			map[i] = 0;
+		map[n] &= ~(ID)0 << ( lo & BM_MASK );
+	}
+	mdb_idl_bm_trim( ids );
+}
+
+/* a = a intersection b, for two bitmaps */
+static void
+mdb_idl_bm_and( ID *a, ID *b )
+{
+	ID *ma = BM_MAP( a ), *mb = BM_MAP( b );
+	ID na = MDB_IDL_BM_WORDS( a ), nb = MDB_IDL_BM_WORDS( b ), i, j, id;
+
+	for ( i=0; i<na; i++ ) {
+		id = MDB_IDL_BM_BASE( a ) + i * BM_BITS;
+		if ( id < MDB_IDL_BM_BASE( b ) ||
+			( j = BM_WORD( b, id )) >= nb )
+			ma[i] = 0;
+		else
+			ma[i] &= mb[j];
+	}
+	mdb_idl_bm_trim( a );
+}
+
+/* a = a union b, for two bitmaps. The map of a must
+ * already cover all of b.
+ */
+static void
+mdb_idl_bm_or( ID *a, ID *b )
+{
+	ID *ma = BM_MAP( a ), *mb = BM_MAP( b ), j, nb;
+
+	if ( b[1] < a[1] )
+		a[1] = b[1];
+	if ( b[2] > a[2] )
+		a[2] = b[2];
+	nb = BM_WORD( b, b[2] );
+	for ( j = BM_WORD( b, b[1] ); j <= nb; j++ )
+		ma[BM_WORD( a, MDB_IDL_BM_BASE( b ) + j * BM_BITS )] |= mb[j];
+	mdb_idl_bm_trim( a );
+}
+
+/* Turn the sorted list ids, plus the sorted list b if given, into
+ * a bitmap. Fails if the IDs are too far apart.
+ */
+static int
+mdb_idl_bm_pack( ID *ids, ID *b )
+{
+	ID *tmp, i, n = ids[0], lo = ids[1], hi = ids[n];
+
+	if ( b && b[0] ) {
+		lo = IDL_MIN( lo, b[1] );
+		hi = IDL_MAX( hi, b[b[0]] );
+	}
+	if ( !mdb_idl_bm_fits( lo, hi ))
+		return -1;
+
+	tmp = ch_malloc( n * sizeof(ID) );
+	AC_MEMCPY( tmp, ids+1, n * sizeof(ID) );
+	mdb_idl_bm_init( ids, lo, hi );
+	for ( i=0; i<n; i++ )
+		mdb_idl_bm_set( ids, tmp[i] );
+	ch_free( tmp );
+	if ( b ) {
+		for ( i=1; i<=b[0]; i++ )
+			mdb_idl_bm_set( ids, b[i] );
+	}
+	return 0;
+}
+
 int mdb_idl_insert( ID *ids, ID id )
 {
 	unsigned x;
@@ -147,6 +401,17 @@ int mdb_idl_insert( ID *ids, ID id )
 		return 0;
 	}
 
+	if (MDB_IDL_IS_BITMAP( ids )) {
+		int rc = mdb_idl_bm_insert( ids, id );
+		if ( rc == -2 ) {
+			/* Out of room, fall back to a range */
+			ID lo = IDL_MIN( ids[1], id ), hi = IDL_MAX( ids[2], id );
+			MDB_IDL_RANGE( ids, lo, hi );
+			rc = 0;
+		}
+		return rc;
+	}
+
 	x = mdb_idl_search( ids, id );
 	assert( x > 0 );
 
@@ -160,6 +425,11 @@ int mdb_idl_insert( ID *ids, ID id )
 		return -1;
 	}
 
+	if ( ids[0] + 1 >= MDB_IDL_DB_MAX && mdb_idl_bm_pack( ids, NULL ) == 0 ) {
+		/* The list is full, carry on as a bitmap */
+		return mdb_idl_insert( ids, id );
+	}
+
 	if ( ++ids[0] >= MDB_IDL_DB_MAX ) {
 		if( id < ids[1] ) {
 			ids[1] = id;
@@ -213,6 +483,14 @@ static int mdb_idl_delete( ID *ids, ID id )
 		return 0;
 	}
 
+	if (MDB_IDL_IS_BITMAP( ids )) {
+		if ( !mdb_idl_bm_test( ids, id ))
+			return -1;
+		BM_MAP( ids )[BM_WORD( ids, id )] &= ~BM_BIT( id );
+		mdb_idl_bm_trim( ids );
+		return 0;
+	}
+
 	x = mdb_idl_search( ids, id );
 	assert( x > 0 );
 
@@ -270,8 +548,8 @@ mdb_idl_fetch_key(
 {
 	MDB_val data, key2, *kptr;
 	MDB_cursor *cursor;
-	ID *i;
-	size_t len;
+	ID *i, lo, hi;
+	size_t len, count;
 	int rc;
 	MDB_cursor_op opflag;
 
@@ -332,6 +610,36 @@ mdb_idl_fetch_key(
 		rc = MDB_NOTFOUND;
 	}
 	if (rc == 0) {
+		memcpy( &lo, data.mv_data, sizeof(ID) );
+		count = 0;
+		if ( lo != 0 )
+			rc = mdb_cursor_count( cursor, &count );
+	}
+	if (rc == 0 && count > MDB_IDL_DB_MAX) {
+		/* Too many IDs for a list. Load them into a bitmap, or
+		 * settle for their range if they're too spread out.
+		 */
+		rc = mdb_cursor_get( cursor, key, &data, MDB_LAST_DUP );
+		if (rc == 0) {
+			memcpy( &hi, data.mv_data, sizeof(ID) );
+			if ( mdb_idl_bm_fits( lo, hi )) {
+				mdb_idl_bm_init( ids, lo, hi );
+				rc = mdb_cursor_get( cursor, key, &data, MDB_FIRST_DUP );
+				if (rc == 0)
+					rc = mdb_cursor_get( cursor, key, &data, MDB_GET_MULTIPLE );
+				while (rc == 0) {
+					ID *end = (ID *)((char *)data.mv_data + data.mv_size);
+					for ( i = data.mv_data; i < end; i++ )
+						mdb_idl_bm_set( ids, *i );
+					rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_MULTIPLE );
+				}
+				if ( rc == MDB_NOTFOUND ) rc = 0;
+			} else {
+				MDB_IDL_RANGE( ids, lo, hi );
+			}
+		}
+		data.mv_size = MDB_IDL_SIZEOF(ids);
+	} else if (rc == 0) {
 		i = ids+1;
 		rc = mdb_cursor_get( cursor, key, &data, MDB_GET_MULTIPLE );
 		while (rc == 0) {
@@ -389,6 +697,50 @@ mdb_idl_fetch_key(
 	return rc;
 }
 
+/* An upper bound of the number of IDs stored under a key, found
+ * without reading them: the number of duplicates, or the size of
+ * the range.
+ */
+int
+mdb_idl_count_key(
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	ID			*count )
+{
+	MDB_val data;
+	ID lo, hi;
+	size_t n;
+	int rc;
+
+	rc = mdb_cursor_get( cursor, key, &data, MDB_SET );
+	if ( rc == MDB_NOTFOUND ) {
+		*count = 0;
+		return 0;
+	} else if ( rc != 0 ) {
+		return rc;
+	}
+
+	memcpy( &lo, data.mv_data, sizeof(ID) );
+	if ( lo != 0 ) {
+		rc = mdb_cursor_count( cursor, &n );
+		if ( rc == 0 )
+			*count = n;
+		return rc;
+	}
+
+	/* On disk, a range is 0 followed by its boundaries */
+	rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_DUP );
+	if ( rc == 0 ) {
+		memcpy( &lo, data.mv_data, sizeof(ID) );
+		rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_DUP );
+	}
+	if ( rc == 0 ) {
+		memcpy( &hi, data.mv_data, sizeof(ID) );
+		*count = hi - lo + 1;
+	}
+	return rc;
+}
+
 int
 mdb_idl_insert_keys(
 	BackendDB	*be,
@@ -398,7 +750,7 @@ mdb_idl_insert_keys(
 {
 	struct mdb_info *mdb = be->be_private;
 	MDB_val key, data;
-	ID lo, hi, *i;
+	ID lo, hi, nid, *i;
 	char *err;
 	int	rc = 0, k;
 	unsigned int flag = MDB_NODUPDATA;
@@ -447,7 +799,11 @@ mdb_idl_insert_keys(
 				err = "c_count";
 				goto fail;
 			}
-			if ( count >= MDB_IDL_DB_MAX ) {
+			/* With idlexact a key holds any number of IDs,
+			 * mdb_idl_fetch_key() decides how to load them.
+			 */
+			if ( count >= MDB_IDL_DB_MAX &&
+				!( mdb->mi_flags & MDB_IDL_EXACT )) {
 			/* No room, convert to a range */
 				lo = *i;
 				rc = mdb_cursor_get( cursor, &key, &data, MDB_LAST_DUP );
@@ -469,22 +825,22 @@ mdb_idl_insert_keys(
 					err = "c_del dups";
 					goto fail;
 				}
-				/* Store the range */
+				/* Store the range, keep id for the next keys */
 				data.mv_size = sizeof(ID);
-				data.mv_data = &id;
-				id = 0;
+				data.mv_data = &nid;
+				nid = 0;
 				rc = mdb_cursor_put( cursor, &key, &data, 0 );
 				if ( rc != 0 ) {
 					err = "c_put range";
 					goto fail;
 				}
-				id = lo;
+				nid = lo;
 				rc = mdb_cursor_put( cursor, &key, &data, 0 );
 				if ( rc != 0 ) {
 					err = "c_put lo";
 					goto fail;
 				}
-				id = hi;
+				nid = hi;
 				rc = mdb_cursor_put( cursor, &key, &data, 0 );
 				if ( rc != 0 ) {
 					err = "c_put hi";
@@ -702,13 +1058,42 @@ mdb_idl_intersection(
 		}
 	}
 
+	/* A bitmap is cut down to a range or another bitmap in place.
+	 * Against a list, swap so that the list is filtered instead.
+	 */
+	if ( MDB_IDL_IS_BITMAP( a ) ) {
+		if ( MDB_IDL_IS_LIST( b ) ) {
+			ID *tmp = a;
+			a = b;
+			b = tmp;
+			swap = 1;
+		} else {
+			if ( MDB_IDL_IS_RANGE( b ) )
+				mdb_idl_bm_clip( a, idmin, idmax );
+			else
+				mdb_idl_bm_and( a, b );
+			goto done;
+		}
+	}
+
+	if ( MDB_IDL_IS_BITMAP( b ) ) {
+		cursorc = 0;
+		for ( cursora = mdb_idl_search( a, idmin );
+			cursora <= a[0] && a[cursora] <= idmax; cursora++ ) {
+			if ( mdb_idl_bm_test( b, a[cursora] ))
+				a[++cursorc] = a[cursora];
+		}
+		a[0] = cursorc;
+		goto done;
+	}
+
 	/* If a range completely covers the list, the result is
 	 * just the list. If idmin to idmax is contiguous, just
 	 * turn it into a range.
 	 */
 	if ( MDB_IDL_IS_RANGE( b )
-		&& MDB_IDL_RANGE_FIRST( b ) <= MDB_IDL_RANGE_FIRST( a )
-		&& MDB_IDL_RANGE_LAST( b ) >= MDB_IDL_RANGE_LAST( a ) ) {
+		&& MDB_IDL_RANGE_FIRST( b ) <= MDB_IDL_FIRST( a )
+		&& MDB_IDL_RANGE_LAST( b ) >= MDB_IDL_LAST( a ) ) {
 		if (idmax - idmin + 1 == a[0])
 		{
 			a[0] = NOID;
@@ -775,6 +1160,27 @@ over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 		return 0;
 	}
 
+	/* If either is a bitmap, merge the other one into it */
+	if ( MDB_IDL_IS_BITMAP( a ) || MDB_IDL_IS_BITMAP( b ) ) {
+		ID *c = a;
+		if ( !MDB_IDL_IS_BITMAP( c ) )
+			c = b;
+		if ( mdb_idl_bm_extend( c, MDB_IDL_FIRST( a ), MDB_IDL_LAST( a )) ||
+			mdb_idl_bm_extend( c, MDB_IDL_FIRST( b ), MDB_IDL_LAST( b )))
+			goto over;
+		if ( c == b )
+			b = a;
+		if ( MDB_IDL_IS_BITMAP( b ) ) {
+			mdb_idl_bm_or( c, b );
+		} else {
+			for ( cursorb = 1; cursorb <= b[0]; cursorb++ )
+				mdb_idl_bm_set( c, b[cursorb] );
+		}
+		if ( c != a )
+			MDB_IDL_CPY( a, c );
+		return 0;
+	}
+
 	ida = mdb_idl_first( a, &cursora );
 	idb = mdb_idl_first( b, &cursorb );
 
@@ -784,6 +1190,9 @@ over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 	while( ida != NOID || idb != NOID ) {
 		if ( ida < idb ) {
 			if( ++cursorc > MDB_IDL_UM_MAX ) {
+				/* Too many for a list, try a bitmap */
+				if ( mdb_idl_bm_pack( a, b ) == 0 )
+					return 0;
 				goto over;
 			}
 			b[cursorc] = ida;
@@ -818,7 +1227,6 @@ over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 }
 
 
-#if 0
 /*
  * mdb_idl_notin - return a intersection ~b (or a minus b)
  */
@@ -844,6 +1252,38 @@ mdb_idl_notin(
 		return 0;
 	}
 
+	if( MDB_IDL_IS_BITMAP( a ) ) {
+		ID *map;
+
+		MDB_IDL_CPY( ids, a );
+		map = BM_MAP( ids );
+		if( MDB_IDL_IS_BITMAP( b ) ) {
+			ID *mb = BM_MAP( b ), nb = BM_WORD( b, b[2] );
+			for( cursorb = BM_WORD( b, b[1] ); cursorb <= nb; cursorb++ ) {
+				idb = MDB_IDL_BM_BASE( b ) + cursorb * BM_BITS;
+				if( idb >= MDB_IDL_BM_BASE( ids ) && idb <= ids[2] )
+					map[BM_WORD( ids, idb )] &= ~mb[cursorb];
+			}
+		} else {
+			for( cursorb = 1; cursorb <= b[0]; cursorb++ ) {
+				idb = b[cursorb];
+				if( idb >= ids[1] && idb <= ids[2] )
+					map[BM_WORD( ids, idb )] &= ~BM_BIT( idb );
+			}
+		}
+		mdb_idl_bm_trim( ids );
+		return 0;
+	}
+
+	if( MDB_IDL_IS_BITMAP( b ) ) {
+		ids[0] = 0;
+		for( cursora = 1; cursora <= a[0]; cursora++ ) {
+			if( !mdb_idl_bm_test( b, a[cursora] ))
+				ids[++ids[0]] = a[cursora];
+		}
+		return 0;
+	}
+
 	ida = mdb_idl_first( a, &cursora ),
 	idb = mdb_idl_first( b, &cursorb );
 
@@ -870,7 +1310,6 @@ mdb_idl_notin(
 
 	return 0;
 }
-#endif
 
 ID mdb_idl_first( ID *ids, ID *cursor )
 {
@@ -888,6 +1327,12 @@ ID mdb_idl_first( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+	/* For a bitmap the cursor is the current ID */
+	if ( MDB_IDL_IS_BITMAP( ids ) ) {
+		*cursor = mdb_idl_bm_next( ids, *cursor );
+		return *cursor;
+	}
+
 	if ( *cursor == 0 )
 		pos = 1;
 	else
@@ -910,6 +1355,14 @@ ID mdb_idl_next( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+	if ( MDB_IDL_IS_BITMAP( ids ) ) {
+		if( *cursor >= ids[2] ) {
+			return NOID;
+		}
+		*cursor = mdb_idl_bm_next( ids, *cursor + 1 );
+		return *cursor;
+	}
+
 	if ( ++(*cursor) <= ids[0] ) {
 		return ids[*cursor];
 	}
@@ -923,6 +1376,9 @@ ID mdb_idl_next( ID *ids, ID *cursor )
  */
 int mdb_idl_append_one( ID *ids, ID id )
 {
+	if (MDB_IDL_IS_BITMAP( ids )) {
+		return mdb_idl_insert( ids, id );
+	}
 	if (MDB_IDL_IS_RANGE( ids )) {
 		/* if already in range, treat as a dup */
 		if (id >= MDB_IDL_RANGE_FIRST(ids) && id <= MDB_IDL_RANGE_LAST(ids))
@@ -973,6 +1429,10 @@ int mdb_idl_append( ID *a, ID *b )
 		return 0;
 	}
 
+	if ( MDB_IDL_IS_BITMAP( a ) || MDB_IDL_IS_BITMAP( b ) ) {
+		return mdb_idl_union( a, b );
+	}
+
 	ida = MDB_IDL_LAST( a );
 	idb = MDB_IDL_LAST( b );
 	if ( MDB_IDL_IS_RANGE( a ) || MDB_IDL_IS_RANGE(b) ||
@@ -1023,7 +1483,7 @@ mdb_idl_sort( ID *ids, ID *tmp )
 	int i,j,k,l,ir,jstack;
 	ID a, itmp;
 
-	if ( MDB_IDL_IS_RANGE( ids ))
+	if ( !MDB_IDL_IS_LIST( ids ))
 		return;
 
 	ir = ids[0];
@@ -1102,7 +1562,7 @@ mdb_idl_sort( ID *ids, ID *tmp )
 	ID *idls[2];
 	unsigned char *maxv = (unsigned char *)&ids[size];
 
- 	if ( MDB_IDL_IS_RANGE( ids ))
+ 	if ( !MDB_IDL_IS_LIST( ids ))
  		return;
 
 	/* Use insertion sort for small lists */
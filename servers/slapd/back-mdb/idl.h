@@ -32,8 +32,26 @@
 #define MDB_IDL_IS_RANGE(ids)	((ids)[0] == NOID)
 #define MDB_IDL_RANGE_SIZE		(3)
 #define MDB_IDL_RANGE_SIZEOF	(MDB_IDL_RANGE_SIZE * sizeof(ID))
+
+/* A bitmap IDL holds sets too large for a list. Word 0 is the
+ * marker, words 1 and 2 are the first and last IDs in the set,
+ * word 3 is the number of IDs and word 4 the ID of bit 0 of the
+ * map. The map follows, one bit per ID from the base to the last
+ * ID. Bitmaps are always small enough to fit a DB_SIZE IDL.
+ */
+#define MDB_IDL_BITMAP			(NOID-1)
+#define MDB_IDL_IS_BITMAP(ids)	((ids)[0] == MDB_IDL_BITMAP)
+#define MDB_IDL_IS_LIST(ids)	((ids)[0] < MDB_IDL_BITMAP)
+#define MDB_IDL_BM_HDR			(5)
+#define MDB_IDL_BM_BITS			(sizeof(ID) * 8)
+#define MDB_IDL_BM_MAXWORDS		(MDB_IDL_DB_SIZE - MDB_IDL_BM_HDR)
+#define MDB_IDL_BM_COUNT(ids)	((ids)[3])
+#define MDB_IDL_BM_BASE(ids)	((ids)[4])
+#define MDB_IDL_BM_WORDS(ids)	(((ids)[2] - (ids)[4]) / MDB_IDL_BM_BITS + 1)
+
 #define MDB_IDL_SIZEOF(ids)		((MDB_IDL_IS_RANGE(ids) \
-	? MDB_IDL_RANGE_SIZE : ((ids)[0]+1)) * sizeof(ID))
+	? MDB_IDL_RANGE_SIZE : MDB_IDL_IS_BITMAP(ids) \
+	? MDB_IDL_BM_HDR + MDB_IDL_BM_WORDS(ids) : ((ids)[0]+1)) * sizeof(ID))
 
 #define MDB_IDL_RANGE_FIRST(ids)	((ids)[1])
 #define MDB_IDL_RANGE_LAST(ids)		((ids)[2])
@@ -62,11 +80,12 @@
 #define MDB_IDL_ALL( ids ) MDB_IDL_RANGE( ids, 1, NOID )
 
 #define MDB_IDL_FIRST( ids )	( (ids)[1] )
-#define MDB_IDL_LAST( ids )		( MDB_IDL_IS_RANGE(ids) \
-	? (ids)[2] : (ids)[(ids)[0]] )
+#define MDB_IDL_LAST( ids )		( MDB_IDL_IS_LIST(ids) \
+	? (ids)[(ids)[0]] : (ids)[2] )
 
 #define MDB_IDL_N( ids )		( MDB_IDL_IS_RANGE(ids) \
-	? ((ids)[2]-(ids)[1])+1 : (ids)[0] )
+	? ((ids)[2]-(ids)[1])+1 : MDB_IDL_IS_BITMAP(ids) \
+	? MDB_IDL_BM_COUNT(ids) : (ids)[0] )
 
 	/** An ID2 is an ID/value pair.
 	 */
@@ -31,6 +31,7 @@ static const struct berval mdmi_databases[] = {
 	BER_BVC("ad2i"),
 	BER_BVC("dn2i"),
 	BER_BVC("id2e"),
+	BER_BVC("id2v"),
 	BER_BVNULL
 };
 
@@ -59,10 +60,13 @@ mdb_db_init( BackendDB *be, ConfigReply *cr )
 	mdb->mi_dbenv_mode = SLAPD_DEFAULT_DB_MODE;
 
 	mdb->mi_search_stack_depth = DEFAULT_SEARCH_STACK_DEPTH;
+	mdb->mi_search_min = DEFAULT_SEARCH_MIN;
 	mdb->mi_search_stack = NULL;
 
 	mdb->mi_mapsize = DEFAULT_MAPSIZE;
 
+	ldap_pvt_thread_mutex_init( &mdb->mi_ads_mutex );
+
 	be->be_private = mdb;
 	be->be_cf_ocs = be->bd_info->bi_cf_ocs;
 
@@ -198,7 +202,7 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 			if ( !(slapMode & (SLAP_TOOL_READMAIN|SLAP_TOOL_READONLY) ))
 				flags |= MDB_CREATE;
 		} else {
-			if ( i == MDB_DN2ID )
+			if ( i == MDB_DN2ID || i == MDB_ID2VAL )
 				flags |= MDB_DUPSORT;
 			if ( !(slapMode & SLAP_TOOL_READONLY) )
 				flags |= MDB_CREATE;
@@ -209,6 +213,12 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 			flags,
 			&mdb->mi_dbis[i] );
 
+		/* databases from before id2val was added have no values in it */
+		if ( rc == MDB_NOTFOUND && i == MDB_ID2VAL ) {
+			mdb->mi_dbis[i] = 0;
+			continue;
+		}
+
 		if ( rc != 0 ) {
 			snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
 				"mdb_open(%s/%s) failed: %s (%d).", 
@@ -234,6 +244,16 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		goto fail;
 	}
 
+	/* the first open with idlexact changes the database format */
+	if (( mdb->mi_flags & (MDB_IDL_EXACT|MDB_IDL_EXACT_DB)) == MDB_IDL_EXACT &&
+		!( slapMode & SLAP_TOOL_READONLY )) {
+		rc = mdb_ad_format( mdb, txn );
+		if ( rc ) {
+			mdb_txn_abort( txn );
+			goto fail;
+		}
+	}
+
 	rc = mdb_attr_dbs_open( be, txn, cr );
 	if ( rc ) {
 		mdb_txn_abort( txn );
@@ -245,6 +265,11 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		goto fail;
 	}
 
+	rc = mdb_cache_open( mdb );
+	if ( rc != 0 ) {
+		goto fail;
+	}
+
 	/* monitor setup */
 	rc = mdb_monitor_db_open( be );
 	if ( rc != 0 ) {
@@ -271,6 +296,8 @@ mdb_db_close( BackendDB *be, ConfigReply *cr )
 
 	mdb->mi_flags &= ~MDB_IS_OPEN;
 
+	mdb_cache_close( mdb );
+
 	if( mdb->mi_dbenv ) {
 		mdb_reader_flush( mdb->mi_dbenv );
 	}
@@ -320,6 +347,11 @@ mdb_db_destroy( BackendDB *be, ConfigReply *cr )
 		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
 	}
 
+	/* stop and remove backup task */
+	mdb_backup_stop( mdb );
+	mdb_map_grow_stop( mdb );
+	if( mdb->mi_backup_dir ) ch_free( mdb->mi_backup_dir );
+
 	/* monitor handling */
 	(void)mdb_monitor_db_destroy( be );
 
@@ -327,6 +359,8 @@ mdb_db_destroy( BackendDB *be, ConfigReply *cr )
 
 	mdb_attr_index_destroy( mdb );
 
+	ldap_pvt_thread_mutex_destroy( &mdb->mi_ads_mutex );
+
 	ch_free( mdb );
 	be->be_private = NULL;
 
@@ -444,6 +478,8 @@ mdb_back_initialize(
 	bi->bi_connection_init = 0;
 	bi->bi_connection_destroy = 0;
 
+	bi->bi_op_txn = mdb_txn;
+
 	rc = mdb_back_init_cf( bi );
 
 	return rc;
@@ -20,6 +20,7 @@
 
 #include <ac/string.h>
 #include <ac/socket.h>
+#include <ac/time.h>
 
 #include "slap.h"
 #include "back-mdb.h"
@@ -37,8 +38,10 @@ mdb_key_read(
 	int get_flag
 )
 {
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
 	int rc;
 	MDB_val key;
+	struct timeval start, end;
 #ifndef MISALIGNED_OK
 	int kbuf[2];
 #endif
@@ -58,8 +61,18 @@ mdb_key_read(
 		key.mv_data = k->bv_val;
 	}
 
+	if ( mdb->mi_idx_stats )
+		gettimeofday( &start, NULL );
+
 	rc = mdb_idl_fetch_key( be, txn, dbi, &key, ids, saved_cursor, get_flag );
 
+	if ( mdb->mi_idx_stats ) {
+		gettimeofday( &end, NULL );
+		mdb_monitor_idx_lookup( mdb, dbi, rc == 0 ? MDB_IDL_N( ids ) : 0,
+			( end.tv_sec - start.tv_sec ) * 1000000UL +
+			end.tv_usec - start.tv_usec );
+	}
+
 	if( rc != LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_TRACE, "<= mdb_index_read: failed (%d)\n",
 			rc, 0, 0 );
@@ -70,3 +83,30 @@ mdb_key_read(
 
 	return rc;
 }
+
+/* estimate the number of IDs under a key, see mdb_idl_count_key() */
+int
+mdb_key_count(
+	MDB_cursor *mc,
+	struct berval *k,
+	ID *count
+)
+{
+	MDB_val key;
+#ifndef MISALIGNED_OK
+	int kbuf[2];
+
+	if (k->bv_len & ALIGNER) {
+		key.mv_size = sizeof(kbuf);
+		key.mv_data = kbuf;
+		kbuf[1] = 0;
+		memcpy(kbuf, k->bv_val, k->bv_len);
+	} else
+#endif
+	{
+		key.mv_size = k->bv_len;
+		key.mv_data = k->bv_val;
+	}
+
+	return mdb_idl_count_key( mc, &key, count );
+}
@@ -65,6 +65,111 @@ mdb_modify_idxflags(
 	}
 }
 
+/* Bring id2val in line with the modifications made to e. Only the
+ * values that were added or deleted are touched, unless we can't
+ * tell which those are. Attributes that are no longer kept there
+ * lose all their records; the ones moving there are taken care of
+ * by mdb_id2entry_put(). The old values must not be looked at once
+ * id2val has been written to, they may live in its pages.
+ */
+static int
+mdb_modify_mvals(
+	Operation *op,
+	MDB_txn *tid,
+	Modifications *modlist,
+	Entry *e,
+	Attribute *save_attrs )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_cursor *mc;
+	Modifications *ml;
+	Modification *mod;
+	Attribute *a, *old;
+	BerVarray vals;
+	char *add;
+	unsigned slot;
+	int i, rc;
+
+	if ( !mdb->mi_id2val )
+		return 0;
+	for ( old = save_attrs; old; old = old->a_next ) {
+		if ( old->a_flags & SLAP_ATTR_BIG_MULTI )
+			break;
+	}
+	if ( !old )
+		return 0;
+
+	rc = mdb_cursor_open( tid, mdb->mi_id2val, &mc );
+	if ( rc )
+		return rc;
+
+	for ( ml = modlist; ml != NULL && !rc; ml = ml->sml_next ) {
+		mod = &ml->sml_mod;
+		old = attr_find( save_attrs, mod->sm_desc );
+		a = attr_find( e->e_attrs, mod->sm_desc );
+		if ( !old || !a || !( old->a_flags & SLAP_ATTR_BIG_MULTI ) ||
+			!( a->a_flags & SLAP_ATTR_BIG_MULTI ))
+			continue;
+		vals = mod->sm_nvalues ? mod->sm_nvalues : mod->sm_values;
+
+		switch ( mod->sm_op ) {
+		case LDAP_MOD_ADD:
+		case SLAP_MOD_SOFTADD:
+		case SLAP_MOD_ADD_IF_NOT_PRESENT:
+			add = op->o_tmpcalloc( a->a_numvals, 1, op->o_tmpmemctx );
+			for ( i = 0; vals && !BER_BVISNULL( &vals[i] ); i++ ) {
+				if ( attr_valfind( a,
+					SLAP_MR_ATTRIBUTE_VALUE_NORMALIZED_MATCH |
+						SLAP_MR_ASSERTED_VALUE_NORMALIZED_MATCH,
+					&vals[i], &slot, op->o_tmpmemctx ) == 0 )
+					add[slot] = 1;
+			}
+			rc = mdb_mval_add( op, mc, e->e_id, a, add );
+			op->o_tmpfree( add, op->o_tmpmemctx );
+			break;
+
+		case LDAP_MOD_DELETE:
+		case SLAP_MOD_SOFTDEL:
+			rc = vals ? 0 : MDB_NOTFOUND;
+			for ( i = 0; vals && !BER_BVISNULL( &vals[i] ) && !rc; i++ ) {
+				struct berval del[2];
+
+				if ( attr_valfind( a,
+					SLAP_MR_ATTRIBUTE_VALUE_NORMALIZED_MATCH |
+						SLAP_MR_ASSERTED_VALUE_NORMALIZED_MATCH,
+					&vals[i], NULL, op->o_tmpmemctx ) == 0 )
+					continue;
+				del[0] = vals[i];
+				BER_BVZERO( &del[1] );
+				rc = mdb_mval_del( op, mc, e->e_id, a->a_desc, del );
+			}
+			/* The stored value may be normalized differently
+			 * from the asserted one, which only the matching
+			 * rule could tell us.
+			 */
+			if ( rc != MDB_NOTFOUND )
+				break;
+			/* FALLTHRU */
+		default:
+			rc = mdb_mval_del( op, mc, e->e_id, a->a_desc, NULL );
+			if ( rc == 0 )
+				rc = mdb_mval_add( op, mc, e->e_id, a, NULL );
+			break;
+		}
+	}
+
+	/* Attributes that were deleted, replaced, or got too big */
+	for ( old = save_attrs; old != NULL && !rc; old = old->a_next ) {
+		if ( !( old->a_flags & SLAP_ATTR_BIG_MULTI ))
+			continue;
+		a = attr_find( e->e_attrs, old->a_desc );
+		if ( !a || !( a->a_flags & SLAP_ATTR_BIG_MULTI ))
+			rc = mdb_mval_del( op, mc, e->e_id, old->a_desc, NULL );
+	}
+	mdb_cursor_close( mc );
+	return rc;
+}
+
 int mdb_modify_internal(
 	Operation *op,
 	MDB_txn *tid,
@@ -389,6 +494,17 @@ int mdb_modify_internal(
 		}
 	}
 
+	/* values kept apart from the entry */
+	rc = mdb_modify_mvals( op, tid, modlist, e, save_attrs );
+	if ( rc != 0 ) {
+		Debug( LDAP_DEBUG_ANY,
+			"%s: mdb_modify_internal: id2val update failed: %s (%d)\n",
+			op->o_log_prefix, mdb_strerror(rc), rc );
+		attrs_free( e->e_attrs );
+		e->e_attrs = save_attrs;
+		rc = LDAP_OTHER;
+	}
+
 	return rc;
 }
 
@@ -410,51 +526,9 @@ mdb_modify( Operation *op, SlapReply *rs )
 	LDAPControl *ctrls[SLAP_MAX_RESPONSE_CONTROLS];
 	int num_ctrls = 0;
 
-#ifdef LDAP_X_TXN
-	int settle = 0;
-#endif
-
 	Debug( LDAP_DEBUG_ARGS, LDAP_XSTRING(mdb_modify) ": %s\n",
 		op->o_req_dn.bv_val, 0, 0 );
 
-#ifdef LDAP_X_TXN
-	if( op->o_txnSpec ) {
-		/* acquire connection lock */
-		ldap_pvt_thread_mutex_lock( &op->o_conn->c_mutex );
-		if( op->o_conn->c_txn == CONN_TXN_INACTIVE ) {
-			rs->sr_text = "invalid transaction identifier";
-			rs->sr_err = LDAP_X_TXN_ID_INVALID;
-			goto txnReturn;
-		} else if( op->o_conn->c_txn == CONN_TXN_SETTLE ) {
-			settle=1;
-			goto txnReturn;
-		}
-
-		if( op->o_conn->c_txn_backend == NULL ) {
-			op->o_conn->c_txn_backend = op->o_bd;
-
-		} else if( op->o_conn->c_txn_backend != op->o_bd ) {
-			rs->sr_text = "transaction cannot span multiple database contexts";
-			rs->sr_err = LDAP_AFFECTS_MULTIPLE_DSAS;
-			goto txnReturn;
-		}
-
-		/* insert operation into transaction */
-
-		rs->sr_text = "transaction specified";
-		rs->sr_err = LDAP_X_TXN_SPECIFY_OKAY;
-
-txnReturn:
-		/* release connection lock */
-		ldap_pvt_thread_mutex_unlock( &op->o_conn->c_mutex );
-
-		if( !settle ) {
-			send_ldap_result( op, rs );
-			return rs->sr_err;
-		}
-	}
-#endif
-
 	ctrls[num_ctrls] = NULL;
 
 	/* Don't touch the opattrs, if this is a contextCSN update
@@ -477,7 +551,15 @@ txnReturn:
 		goto return_results;
 	}
 
-	txn = moi->moi_txn;
+	rs->sr_err = mdb_txn_nest( mdb, moi, &txn );
+	if( rs->sr_err != 0 ) {
+		Debug( LDAP_DEBUG_TRACE,
+			LDAP_XSTRING(mdb_modify) ": nested txn_begin failed: "
+			"%s (%d)\n", mdb_strerror(rs->sr_err), rs->sr_err, 0 );
+		rs->sr_err = LDAP_OTHER;
+		rs->sr_text = "internal error";
+		goto return_results;
+	}
 
 	/* get entry or ancestor */
 	rs->sr_err = mdb_dn2entry( op, txn, NULL, &op->o_req_ndn, &e, 1 );
@@ -615,9 +697,11 @@ txnReturn:
 
 	/* Only free attrs if they were dup'd.  */
 	if ( dummy.e_attrs == e->e_attrs ) dummy.e_attrs = NULL;
-	if( moi == &opinfo ) {
-		LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
-		opinfo.moi_oe.oe_key = NULL;
+	if( moi == &opinfo || txn != moi->moi_txn ) {
+		if ( moi == &opinfo ) {
+			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
+			opinfo.moi_oe.oe_key = NULL;
+		}
 		if( op->o_noop ) {
 			mdb_txn_abort( txn );
 			rs->sr_err = LDAP_X_NO_OPERATION;
@@ -672,6 +756,9 @@ done:
 		if ( opinfo.moi_oe.oe_key ) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
 		}
+		mdb_map_check( mdb );
+	} else if( txn != NULL && txn != moi->moi_txn ) {
+		mdb_txn_abort( txn );
 	}
 
 	if( e != NULL ) {
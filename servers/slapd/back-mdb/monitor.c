@@ -31,7 +31,19 @@
 
 static ObjectClass		*oc_olmMDBDatabase;
 
-static AttributeDescription *ad_olmDbDirectory;
+static AttributeDescription *ad_olmDbDirectory,
+	*ad_olmMDBReadersMax, *ad_olmMDBDeadReaders,
+	*ad_olmMDBEntryCacheBytes, *ad_olmMDBEntryCacheEntries,
+	*ad_olmMDBEntryCacheHits, *ad_olmMDBEntryCacheMisses,
+	*ad_olmMDBEntryCacheEvictions, *ad_olmMDBFilterPlans,
+	*ad_olmMDBFilterSkipped, *ad_olmMDBLastFilterPlan,
+	*ad_olmMDBIndexStats, *ad_olmMDBUnusedIndexes;
+
+static int
+mdb_monitor_idx_stats_entry(
+	Operation	*op,
+	struct mdb_info	*mdb,
+	Entry		*e );
 
 #ifdef MDB_MONITOR_IDX
 static int
@@ -88,9 +100,143 @@ static struct {
 		&ad_olmDbNotIndexed },
 #endif /* MDB_MONITOR_IDX */
 
+	{ "( olmDatabaseAttributes:3 "
+		"NAME ( 'olmMDBReadersMax' ) "
+		"DESC 'Size of the reader table of the environment' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBReadersMax },
+
+	{ "( olmDatabaseAttributes:4 "
+		"NAME ( 'olmMDBDeadReaders' ) "
+		"DESC 'Number of reader slots reclaimed from dead processes' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBDeadReaders },
+
+	{ "( olmDatabaseAttributes:5 "
+		"NAME ( 'olmMDBEntryCacheBytes' ) "
+		"DESC 'Bytes used by the entry cache' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBEntryCacheBytes },
+
+	{ "( olmDatabaseAttributes:6 "
+		"NAME ( 'olmMDBEntryCacheEntries' ) "
+		"DESC 'Number of entries in the entry cache' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBEntryCacheEntries },
+
+	{ "( olmDatabaseAttributes:7 "
+		"NAME ( 'olmMDBEntryCacheHits' ) "
+		"DESC 'Number of entries readers found in the entry cache' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBEntryCacheHits },
+
+	{ "( olmDatabaseAttributes:8 "
+		"NAME ( 'olmMDBEntryCacheMisses' ) "
+		"DESC 'Number of entries readers had to decode' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBEntryCacheMisses },
+
+	{ "( olmDatabaseAttributes:9 "
+		"NAME ( 'olmMDBEntryCacheEvictions' ) "
+		"DESC 'Number of entries dropped to keep the entry cache in size' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBEntryCacheEvictions },
+
+	{ "( olmDatabaseAttributes:10 "
+		"NAME ( 'olmMDBFilterPlans' ) "
+		"DESC 'Number of AND filters whose components were ordered "
+			"by their estimated size' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBFilterPlans },
+
+	{ "( olmDatabaseAttributes:11 "
+		"NAME ( 'olmMDBFilterSkipped' ) "
+		"DESC 'Number of filter components whose index lookup "
+			"was skipped' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBFilterSkipped },
+
+	{ "( olmDatabaseAttributes:12 "
+		"NAME ( 'olmMDBLastFilterPlan' ) "
+		"DESC 'How the candidates of a recently planned filter were found' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBLastFilterPlan },
+
+	{ "( olmDatabaseAttributes:13 "
+		"NAME ( 'olmMDBIndexStats' ) "
+		"DESC 'Size and usage of the index of an attribute' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBIndexStats },
+
+	{ "( olmDatabaseAttributes:14 "
+		"NAME ( 'olmMDBUnusedIndexes' ) "
+		"DESC 'Indexed attributes no search has looked up yet' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBUnusedIndexes },
+
 	{ NULL }
 };
 
+/* the counters, in the order mdb_monitor_counters() returns them */
+#define	MDB_MONITOR_COUNTERS	7
+static AttributeDescription **s_counter_ad[] = {
+	&ad_olmMDBEntryCacheBytes,
+	&ad_olmMDBEntryCacheEntries,
+	&ad_olmMDBEntryCacheHits,
+	&ad_olmMDBEntryCacheMisses,
+	&ad_olmMDBEntryCacheEvictions,
+	&ad_olmMDBFilterPlans,
+	&ad_olmMDBFilterSkipped
+};
+
+static void
+mdb_monitor_counters( struct mdb_info *mdb, unsigned long *vals )
+{
+	mdb_cache_stat	cs;
+	int		i;
+
+	mdb_cache_stats( mdb, &cs );
+	vals[ 0 ] = cs.cs_size;
+	vals[ 1 ] = cs.cs_count;
+	vals[ 2 ] = cs.cs_hits;
+	vals[ 3 ] = cs.cs_misses;
+	vals[ 4 ] = cs.cs_evictions;
+
+	vals[ 5 ] = vals[ 6 ] = 0;
+	for ( i = 0; i < MDB_PLAN_STRIPES; i++ ) {
+		mdb_plan_stat	*ps = &mdb->mi_plan_stats[ i ];
+
+		ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+		vals[ 5 ] += ps->ps_count;
+		vals[ 6 ] += ps->ps_skipped;
+		ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+	}
+}
+
 static struct {
 	char		*desc;
 	ObjectClass	**oc;
@@ -105,6 +251,18 @@ static struct {
 #ifdef MDB_MONITOR_IDX
 			"$ olmDbNotIndexed "
 #endif /* MDB_MONITOR_IDX */
+			"$ olmMDBReadersMax "
+			"$ olmMDBDeadReaders "
+			"$ olmMDBEntryCacheBytes "
+			"$ olmMDBEntryCacheEntries "
+			"$ olmMDBEntryCacheHits "
+			"$ olmMDBEntryCacheMisses "
+			"$ olmMDBEntryCacheEvictions "
+			"$ olmMDBFilterPlans "
+			"$ olmMDBFilterSkipped "
+			"$ olmMDBLastFilterPlan "
+			"$ olmMDBIndexStats "
+			"$ olmMDBUnusedIndexes "
 			") )",
 		&oc_olmMDBDatabase },
 
@@ -119,11 +277,63 @@ mdb_monitor_update(
 	void		*priv )
 {
 	struct mdb_info		*mdb = (struct mdb_info *) priv;
+	Attribute		*a;
+	char			buf[ LDAP_PVT_INTTYPE_CHARS( unsigned long ) ];
+	struct berval		bv;
+	unsigned long		vals[ MDB_MONITOR_COUNTERS ];
+	int			dead, i;
 
 #ifdef MDB_MONITOR_IDX
 	mdb_monitor_idx_entry_add( mdb, e );
 #endif /* MDB_MONITOR_IDX */
 
+	/* reading the entry also reclaims the reader slots of
+	 * processes that died without closing the environment */
+	if ( mdb_reader_check( mdb->mi_dbenv, &dead ) == 0 && dead ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_monitor_update)
+			": cleared %d stale reader slots\n", dead, 0, 0 );
+		mdb->mi_dead_readers += dead;
+	}
+
+	a = attr_find( e->e_attrs, ad_olmMDBDeadReaders );
+	if ( a != NULL ) {
+		bv.bv_val = buf;
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu",
+			mdb->mi_dead_readers );
+		ber_bvreplace( &a->a_vals[ 0 ], &bv );
+	}
+
+	mdb_monitor_counters( mdb, vals );
+	for ( i = 0; i < MDB_MONITOR_COUNTERS; i++ ) {
+		a = attr_find( e->e_attrs, *s_counter_ad[ i ] );
+		if ( a != NULL ) {
+			bv.bv_val = buf;
+			bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", vals[ i ] );
+			ber_bvreplace( &a->a_vals[ 0 ], &bv );
+		}
+	}
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_plan_mutex );
+	if ( mdb->mi_plan_len ) {
+		bv.bv_val = mdb->mi_plan_last;
+		bv.bv_len = mdb->mi_plan_len;
+		a = attr_find( e->e_attrs, ad_olmMDBLastFilterPlan );
+		if ( a != NULL ) {
+			ber_bvreplace( &a->a_vals[ 0 ], &bv );
+
+		} else {
+			Attribute	**ap;
+
+			for ( ap = &e->e_attrs; *ap != NULL; ap = &(*ap)->a_next )
+				;
+			*ap = attr_alloc( ad_olmMDBLastFilterPlan );
+			attr_valadd( *ap, &bv, NULL, 1 );
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_plan_mutex );
+
+	mdb_monitor_idx_stats_entry( op, mdb, e );
+
 	return SLAP_CB_CONTINUE;
 }
 
@@ -260,6 +470,7 @@ int
 mdb_monitor_db_init( BackendDB *be )
 {
 	struct mdb_info		*mdb = (struct mdb_info *) be->be_private;
+	int			i;
 
 	if ( mdb_monitor_initialize() == LDAP_SUCCESS ) {
 		/* monitoring in back-mdb is on by default */
@@ -270,6 +481,9 @@ mdb_monitor_db_init( BackendDB *be )
 	mdb->mi_idx = NULL;
 	ldap_pvt_thread_mutex_init( &mdb->mi_idx_mutex );
 #endif /* MDB_MONITOR_IDX */
+	ldap_pvt_thread_mutex_init( &mdb->mi_plan_mutex );
+	for ( i = 0; i < MDB_PLAN_STRIPES; i++ )
+		ldap_pvt_thread_mutex_init( &mdb->mi_plan_stats[ i ].ps_mutex );
 
 	return 0;
 }
@@ -313,7 +527,7 @@ mdb_monitor_db_open( BackendDB *be )
 	}
 
 	/* alloc as many as required (plus 1 for objectClass) */
-	a = attrs_alloc( 1 + 1 );
+	a = attrs_alloc( 1 + 3 + MDB_MONITOR_COUNTERS );
 	if ( a == NULL ) {
 		rc = 1;
 		goto cleanup;
@@ -374,6 +588,35 @@ mdb_monitor_db_open( BackendDB *be )
 		next = next->a_next;
 	}
 
+	{
+		struct berval	bv;
+		char		buf[ LDAP_PVT_INTTYPE_CHARS( unsigned long ) ];
+		unsigned long	vals[ MDB_MONITOR_COUNTERS ];
+		unsigned int	readers = 0;
+		int		i;
+
+		mdb_env_get_maxreaders( mdb->mi_dbenv, &readers );
+		bv.bv_val = buf;
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%u", readers );
+		next->a_desc = ad_olmMDBReadersMax;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu",
+			mdb->mi_dead_readers );
+		next->a_desc = ad_olmMDBDeadReaders;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		mdb_monitor_counters( mdb, vals );
+		for ( i = 0; i < MDB_MONITOR_COUNTERS; i++ ) {
+			bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", vals[ i ] );
+			next->a_desc = *s_counter_ad[ i ];
+			attr_valadd( next, &bv, NULL, 1 );
+			next = next->a_next;
+		}
+	}
+
 	cb = ch_calloc( sizeof( monitor_callback_t ), 1 );
 	cb->mc_update = mdb_monitor_update;
 #if 0	/* uncomment if required */
@@ -389,6 +632,20 @@ mdb_monitor_db_open( BackendDB *be )
 			NULL, -1, NULL );
 	}
 
+	/* start counting index lookups */
+	if ( rc == 0 && mdb->mi_idx_stats == NULL ) {
+		mdb_idx_stat	*is;
+		time_t		now = slap_get_time();
+		int		i;
+
+		is = ch_calloc( MDB_IDX_STATS, sizeof( mdb_idx_stat ) );
+		for ( i = 0; i < MDB_IDX_STATS; i++ ) {
+			ldap_pvt_thread_mutex_init( &is[ i ].is_mutex );
+			is[ i ].is_since = now;
+		}
+		mdb->mi_idx_stats = is;
+	}
+
 cleanup:;
 	if ( rc != 0 ) {
 		if ( cb != NULL ) {
@@ -445,13 +702,269 @@ mdb_monitor_db_close( BackendDB *be )
 int
 mdb_monitor_db_destroy( BackendDB *be )
 {
-#ifdef MDB_MONITOR_IDX
 	struct mdb_info		*mdb = (struct mdb_info *) be->be_private;
+	int			i;
 
+#ifdef MDB_MONITOR_IDX
 	/* TODO: free tree */
 	ldap_pvt_thread_mutex_destroy( &mdb->mi_idx_mutex );
 	avl_free( mdb->mi_idx, ch_free );
 #endif /* MDB_MONITOR_IDX */
+	ldap_pvt_thread_mutex_destroy( &mdb->mi_plan_mutex );
+	for ( i = 0; i < MDB_PLAN_STRIPES; i++ )
+		ldap_pvt_thread_mutex_destroy( &mdb->mi_plan_stats[ i ].ps_mutex );
+
+	if ( mdb->mi_idx_stats != NULL ) {
+		for ( i = 0; i < MDB_IDX_STATS; i++ )
+			ldap_pvt_thread_mutex_destroy( &mdb->mi_idx_stats[ i ].is_mutex );
+		ch_free( mdb->mi_idx_stats );
+		mdb->mi_idx_stats = NULL;
+	}
+
+	return 0;
+}
+
+/*
+ * record a filter plan made by mdb_filter_candidates() on connection
+ * connid, and its text if plan is not NULL
+ */
+void
+mdb_monitor_plan_add(
+	struct mdb_info		*mdb,
+	unsigned long		connid,
+	struct berval		*plan,
+	int			skipped )
+{
+	mdb_plan_stat		*ps;
+
+	ps = &mdb->mi_plan_stats[ connid % MDB_PLAN_STRIPES ];
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	ps->ps_count++;
+	ps->ps_skipped += skipped;
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+
+	if ( plan == NULL || !plan->bv_len )
+		return;
+
+	ldap_pvt_thread_mutex_lock( &mdb->mi_plan_mutex );
+	mdb->mi_plan_len = plan->bv_len < sizeof( mdb->mi_plan_last ) ?
+		plan->bv_len : sizeof( mdb->mi_plan_last );
+	AC_MEMCPY( mdb->mi_plan_last, plan->bv_val, mdb->mi_plan_len );
+	ldap_pvt_thread_mutex_unlock( &mdb->mi_plan_mutex );
+}
+
+/*
+ * count a lookup of an index key, called from mdb_key_read()
+ */
+void
+mdb_monitor_idx_lookup(
+	struct mdb_info		*mdb,
+	MDB_dbi			dbi,
+	ID			nids,
+	unsigned long		usec )
+{
+	mdb_idx_stat		*is;
+
+	if ( dbi >= MDB_IDX_STATS )
+		return;
+
+	is = &mdb->mi_idx_stats[ dbi ];
+	ldap_pvt_thread_mutex_lock( &is->is_mutex );
+	is->is_lookups++;
+	is->is_ids += nids;
+	is->is_usec += usec;
+	ldap_pvt_thread_mutex_unlock( &is->is_mutex );
+}
+
+/*
+ * start over for an index database that was just opened
+ */
+void
+mdb_monitor_idx_reset(
+	struct mdb_info		*mdb,
+	MDB_dbi			dbi )
+{
+	mdb_idx_stat		*is;
+
+	if ( mdb->mi_idx_stats == NULL || dbi >= MDB_IDX_STATS )
+		return;
+
+	is = &mdb->mi_idx_stats[ dbi ];
+	ldap_pvt_thread_mutex_lock( &is->is_mutex );
+	is->is_since = slap_get_time();
+	is->is_lookups = 0;
+	is->is_ids = 0;
+	is->is_usec = 0;
+	is->is_scanned = 0;
+	ldap_pvt_thread_mutex_unlock( &is->is_mutex );
+}
+
+/* count the keys and IDs of an index database */
+static int
+mdb_monitor_idx_scan(
+	MDB_txn			*txn,
+	MDB_dbi			dbi,
+	mdb_idx_stat		*is )
+{
+	MDB_cursor		*mc;
+	MDB_val			key, data;
+	unsigned long		keys = 0, total = 0, ranges = 0;
+	size_t			n;
+	ID			lo, hi;
+	int			rc;
+
+	rc = mdb_cursor_open( txn, dbi, &mc );
+	if ( rc != 0 )
+		return rc;
+
+	rc = mdb_cursor_get( mc, &key, &data, MDB_FIRST );
+	while ( rc == 0 ) {
+		keys++;
+		memcpy( &lo, data.mv_data, sizeof( ID ) );
+		if ( lo != 0 ) {
+			rc = mdb_cursor_count( mc, &n );
+			if ( rc == 0 )
+				total += n;
+		} else {
+			/* a range: 0, lo, hi */
+			ranges++;
+			rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_DUP );
+			if ( rc == 0 ) {
+				memcpy( &lo, data.mv_data, sizeof( ID ) );
+				rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_DUP );
+			}
+			if ( rc == 0 ) {
+				memcpy( &hi, data.mv_data, sizeof( ID ) );
+				total += hi - lo + 1;
+			}
+		}
+		if ( rc == 0 )
+			rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_NODUP );
+	}
+	mdb_cursor_close( mc );
+	if ( rc != MDB_NOTFOUND )
+		return rc;
+
+	ldap_pvt_thread_mutex_lock( &is->is_mutex );
+	is->is_scanned = slap_get_time();
+	is->is_keys = keys;
+	is->is_total = total;
+	is->is_ranges = ranges;
+	ldap_pvt_thread_mutex_unlock( &is->is_mutex );
+
+	return 0;
+}
+
+static void
+mdb_monitor_attr_set(
+	Entry			*e,
+	AttributeDescription	*ad,
+	BerVarray		vals )
+{
+	Attribute		*a, **ap;
+
+	a = attr_find( e->e_attrs, ad );
+	if ( vals == NULL ) {
+		if ( a != NULL )
+			attr_delete( &e->e_attrs, ad );
+		return;
+	}
+
+	if ( a != NULL ) {
+		assert( a->a_nvals == a->a_vals );
+		ber_bvarray_free( a->a_vals );
+
+	} else {
+		for ( ap = &e->e_attrs; *ap != NULL; ap = &(*ap)->a_next )
+			;
+		*ap = attr_alloc( ad );
+		a = *ap;
+	}
+	a->a_vals = vals;
+	a->a_nvals = a->a_vals;
+	for ( a->a_numvals = 0; !BER_BVISNULL( &vals[ a->a_numvals ] );
+		a->a_numvals++ )
+		;
+}
+
+/*
+ * One olmMDBIndexStats value per indexed attribute, e.g.
+ *	cn#keys=120#ids=480#ranges=0#avgIDs=4.00#lookups=12
+ *		#lookupsPerSec=0.02#fetchUsec=310
+ * and the attributes without lookups in olmMDBUnusedIndexes.
+ */
+static int
+mdb_monitor_idx_stats_entry(
+	Operation		*op,
+	struct mdb_info		*mdb,
+	Entry			*e )
+{
+	mdb_op_info		opinfo = {{{0}}}, *moi = &opinfo;
+	MDB_txn			*txn = NULL;
+	BerVarray		stats = NULL, unused = NULL;
+	struct berval		bv;
+	char			buf[ 256 ];
+	time_t			now = slap_get_time();
+	unsigned long		secs;
+	int			i;
+
+	if ( mdb->mi_idx_stats == NULL || !( mdb->mi_flags & MDB_IS_OPEN ))
+		return 0;
+
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		AttrInfo	*ai = mdb->mi_attrs[ i ];
+		mdb_idx_stat	*is;
+		unsigned long	keys, total, ranges, lookups, usec;
+
+		if ( !ai->ai_dbi || ai->ai_dbi >= MDB_IDX_STATS ||
+			( ai->ai_indexmask & MDB_INDEX_DELETING ))
+			continue;
+		is = &mdb->mi_idx_stats[ ai->ai_dbi ];
+
+		if ( now - is->is_scanned >= MDB_IDX_SCAN_INTERVAL ) {
+			if ( txn == NULL ) {
+				if ( mdb_opinfo_get( op, mdb, 1, &moi ) != 0 )
+					break;
+				txn = moi->moi_txn;
+			}
+			mdb_monitor_idx_scan( txn, ai->ai_dbi, is );
+		}
+
+		ldap_pvt_thread_mutex_lock( &is->is_mutex );
+		keys = is->is_keys;
+		total = is->is_total;
+		ranges = is->is_ranges;
+		lookups = is->is_lookups;
+		usec = is->is_usec;
+		secs = now > is->is_since ? now - is->is_since : 1;
+		ldap_pvt_thread_mutex_unlock( &is->is_mutex );
+
+		bv.bv_len = snprintf( buf, sizeof( buf ),
+			"%s#keys=%lu#ids=%lu#ranges=%lu#avgIDs=%lu.%02lu"
+			"#lookups=%lu#lookupsPerSec=%lu.%02lu#fetchUsec=%lu",
+			ai->ai_desc->ad_cname.bv_val,
+			keys, total, ranges,
+			keys ? total / keys : 0,
+			keys ? total * 100 / keys % 100 : 0,
+			lookups,
+			lookups / secs, lookups * 100 / secs % 100,
+			usec );
+		if ( bv.bv_len >= sizeof( buf ) )
+			bv.bv_len = sizeof( buf ) - 1;
+		bv.bv_val = buf;
+		value_add_one( &stats, &bv );
+
+		if ( lookups == 0 )
+			value_add_one( &unused, &ai->ai_desc->ad_cname );
+	}
+
+	if ( txn != NULL && moi == &opinfo ) {
+		mdb_txn_reset( moi->moi_txn );
+		LDAP_SLIST_REMOVE( &op->o_extra, &moi->moi_oe, OpExtra, oe_next );
+	}
+
+	mdb_monitor_attr_set( e, ad_olmMDBIndexStats, stats );
+	mdb_monitor_attr_set( e, ad_olmMDBUnusedIndexes, unused );
 
 	return 0;
 }
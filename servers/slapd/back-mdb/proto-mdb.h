@@ -48,12 +48,38 @@ void mdb_attr_info_free( AttrInfo *ai );
 
 int mdb_ad_read( struct mdb_info *mdb, MDB_txn *txn );
 int mdb_ad_get( struct mdb_info *mdb, MDB_txn *txn, AttributeDescription *ad );
+void mdb_ad_unwind( struct mdb_info *mdb, int prev_ads );
+int mdb_ad_format( struct mdb_info *mdb, MDB_txn *txn );
+
+void mdb_attrmask_ad( struct mdb_info *mdb, mdb_attrmask *am,
+	AttributeDescription *ad );
+int mdb_attrmask_filter( struct mdb_info *mdb, mdb_attrmask *am, Filter *f );
+int mdb_attrmask_acls( struct mdb_info *mdb, mdb_attrmask *am,
+	AccessControl *a );
+
+/*
+ * cache.c
+ */
+
+int mdb_cache_open( struct mdb_info *mdb );
+void mdb_cache_close( struct mdb_info *mdb );
+void mdb_cache_resize( struct mdb_info *mdb );
+size_t mdb_cache_txnid( Operation *op, struct mdb_info *mdb, MDB_txn *txn );
+Entry *mdb_cache_find( Operation *op, struct mdb_info *mdb, ID id,
+	size_t txnid );
+void mdb_cache_release( Entry *e );
+void mdb_cache_add( struct mdb_info *mdb, Entry *e, size_t txnid );
+void mdb_cache_delete( struct mdb_info *mdb, MDB_txn *txn, ID id );
+void mdb_cache_stats( struct mdb_info *mdb, mdb_cache_stat *cs );
 
 /*
  * config.c
  */
 
 int mdb_back_init_cf( BackendInfo *bi );
+void mdb_backup_stop( struct mdb_info *mdb );
+void mdb_map_check( struct mdb_info *mdb );
+void mdb_map_grow_stop( struct mdb_info *mdb );
 
 /*
  * dn2entry.c
@@ -61,6 +87,8 @@ int mdb_back_init_cf( BackendInfo *bi );
 
 int mdb_dn2entry LDAP_P(( Operation *op, MDB_txn *tid, MDB_cursor *mc,
 	struct berval *dn, Entry **e, int matched ));
+int mdb_dn2entry_partial LDAP_P(( Operation *op, MDB_txn *tid, MDB_cursor *mc,
+	struct berval *dn, mdb_attrmask *am, Entry **e, int matched ));
 
 /*
  * dn2id.c
@@ -175,14 +203,52 @@ int mdb_id2entry(
 	ID id,
 	Entry **e);
 
+int mdb_id2entry_partial(
+	Operation *op,
+	MDB_cursor *mc,
+	ID id,
+	mdb_attrmask *am,
+	Entry **e);
+
+int mdb_entry_complete(
+	Operation *op,
+	MDB_txn *txn,
+	mdb_attrmask *am,
+	Entry **e);
+
+int mdb_mval_find(
+	Operation *op,
+	MDB_txn *txn,
+	ID id,
+	AttributeDescription *ad,
+	struct berval *nval);
+
+int mdb_mval_add(
+	Operation *op,
+	MDB_cursor *mc,
+	ID id,
+	Attribute *a,
+	char *vals);
+
+int mdb_mval_del(
+	Operation *op,
+	MDB_cursor *mc,
+	ID id,
+	AttributeDescription *ad,
+	BerVarray nvals);
+
 int mdb_entry_return( Operation *op, Entry *e );
 BI_entry_release_rw mdb_entry_release;
 BI_entry_get_rw mdb_entry_get;
 
-int mdb_entry_decode( Operation *op, MDB_val *data, Entry **e );
+int mdb_entry_decode( Operation *op, MDB_txn *txn, MDB_val *data, ID id,
+	mdb_attrmask *am, Entry **e );
 
 void mdb_reader_flush( MDB_env *env );
 int mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **moi );
+int mdb_txn_nest( struct mdb_info *mdb, mdb_op_info *moi, MDB_txn **txn );
+
+BI_op_txn mdb_txn;
 
 /*
  * idl.c
@@ -199,6 +265,11 @@ int mdb_idl_fetch_key(
 	MDB_cursor	**saved_cursor,
 	int                     get_flag );
 
+int mdb_idl_count_key(
+	MDB_cursor	*cursor,
+	MDB_val		*key,
+	ID			*count );
+
 int mdb_idl_insert( ID *ids, ID id );
 
 typedef int (mdb_idl_keyfunc)(
@@ -220,6 +291,12 @@ mdb_idl_union(
 	ID *a,
 	ID *b );
 
+int
+mdb_idl_notin(
+	ID *a,
+	ID *b,
+	ID *ids );
+
 ID mdb_idl_first( ID *ids, ID *cursor );
 ID mdb_idl_next( ID *ids, ID *cursor );
 
@@ -294,6 +371,12 @@ mdb_key_read(
     MDB_cursor **saved_cursor,
         int get_flags );
 
+extern int
+mdb_key_count(
+	MDB_cursor *mc,
+	struct berval *k,
+	ID *count );
+
 /*
  * nextid.c
  */
@@ -322,6 +405,25 @@ int mdb_monitor_db_open( BackendDB *be );
 int mdb_monitor_db_close( BackendDB *be );
 int mdb_monitor_db_destroy( BackendDB *be );
 
+void
+mdb_monitor_plan_add(
+	struct mdb_info		*mdb,
+	unsigned long		connid,
+	struct berval		*plan,
+	int			skipped );
+
+void
+mdb_monitor_idx_lookup(
+	struct mdb_info		*mdb,
+	MDB_dbi			dbi,
+	ID			nids,
+	unsigned long		usec );
+
+void
+mdb_monitor_idx_reset(
+	struct mdb_info		*mdb,
+	MDB_dbi			dbi );
+
 #ifdef MDB_MONITOR_IDX
 int
 mdb_monitor_idx_add(
@@ -364,10 +466,7 @@ extern BI_tool_entry_reindex		mdb_tool_entry_reindex;
 extern BI_tool_dn2id_get		mdb_tool_dn2id_get;
 extern BI_tool_entry_modify		mdb_tool_entry_modify;
 
-int mdb_tool_idl_add(
-	MDB_cursor *mc,
-	struct berval *keys,
-	ID id );
+mdb_idl_keyfunc mdb_tool_idl_add;
 
 LDAP_END_DECL
 
@@ -314,6 +314,558 @@ static void scope_chunk_ret( Operation *op, ID2 *scopes )
 			(void *)scopes, scope_chunk_free, NULL, NULL );
 }
 
+/* Set the DN of candidate e, which is below base, from the RDNs
+ * mdb_idscopes() collected in isc.
+ */
+static void
+search_entry_dn( Operation *op, MDB_txn *txn, Entry *base, Entry *e,
+	IdScopes *isc )
+{
+	struct berval pdn, pndn;
+	char *d, *n;
+	int i;
+	/* child of base, just append RDNs to base->e_name */
+	if ( isc->nscope == 1 ) {
+		pdn = base->e_name;
+		pndn = base->e_nname;
+	} else {
+		mdb_id2name( op, txn, &isc->mc, isc->scopes[isc->nscope].mid, &pdn, &pndn );
+	}
+	e->e_name.bv_len = pdn.bv_len;
+	e->e_nname.bv_len = pndn.bv_len;
+	for (i=0; i<isc->numrdns; i++) {
+		e->e_name.bv_len += isc->rdns[i].bv_len + 1;
+		e->e_nname.bv_len += isc->nrdns[i].bv_len + 1;
+	}
+	e->e_name.bv_val = op->o_tmpalloc(e->e_name.bv_len + 1, op->o_tmpmemctx);
+	e->e_nname.bv_val = op->o_tmpalloc(e->e_nname.bv_len + 1, op->o_tmpmemctx);
+	d = e->e_name.bv_val;
+	n = e->e_nname.bv_val;
+	for (i=0; i<isc->numrdns; i++) {
+		memcpy(d, isc->rdns[i].bv_val, isc->rdns[i].bv_len);
+		d += isc->rdns[i].bv_len;
+		*d++ = ',';
+		memcpy(n, isc->nrdns[i].bv_val, isc->nrdns[i].bv_len);
+		n += isc->nrdns[i].bv_len;
+		*n++ = ',';
+	}
+	if (pdn.bv_len) {
+		memcpy(d, pdn.bv_val, pdn.bv_len+1);
+		memcpy(n, pndn.bv_val, pndn.bv_len+1);
+	} else {
+		*--d = '\0';
+		*--n = '\0';
+		e->e_name.bv_len--;
+		e->e_nname.bv_len--;
+	}
+	if (isc->nscope != 1) {
+		op->o_tmpfree(pndn.bv_val, op->o_tmpmemctx);
+		op->o_tmpfree(pdn.bv_val, op->o_tmpmemctx);
+	}
+}
+
+/* Work out which attributes the candidate loop has to decode:
+ * tmask covers what the filter and the ACLs look at, smask what
+ * goes into the entries that are returned. A NULL mask means all
+ * attributes, which is what we use whenever a callback gets to
+ * see the entries, since it may look at anything. If both masks
+ * are the same, smask == tmask.
+ */
+static void
+search_attrmasks( Operation *op, mdb_attrmask **tmask, mdb_attrmask **smask )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	slap_callback *sc;
+	mdb_attrmask *tm, *sm;
+	AttributeDescription *ad;
+	int i, n = mdb->mi_numads, tall = 1, sall = 1;
+
+	*tmask = *smask = NULL;
+	for ( sc = op->o_callback; sc; sc = sc->sc_next ) {
+		if ( sc->sc_response )
+			return;
+	}
+
+	tm = op->o_tmpalloc( 2 * ( sizeof(mdb_attrmask) + n + 1 ),
+		op->o_tmpmemctx );
+	sm = tm + 1;
+	tm->am_numads = sm->am_numads = n;
+	tm->am_want = (char *)( sm + 1 );
+	sm->am_want = tm->am_want + n + 1;
+	tm->am_flags = sm->am_flags = 0;
+	memset( tm->am_want, 0, n + 1 );
+
+	mdb_attrmask_ad( mdb, tm, slap_schema.si_ad_objectClass );
+	mdb_attrmask_ad( mdb, tm, slap_schema.si_ad_ref );
+	if ( mdb_attrmask_filter( mdb, tm, op->ors_filter ) ||
+		mdb_attrmask_acls( mdb, tm, op->o_bd->be_acl ) ||
+		mdb_attrmask_acls( mdb, tm, frontendDB->be_acl ))
+	{
+		goto all;
+	}
+
+	for ( i = 1; i <= n; i++ ) {
+		ad = mdb->mi_ads[i];
+		if ( !ad ) {
+			tm->am_want[i] = 1;
+		} else if ( !tm->am_want[i] ) {
+			tall = 0;
+		}
+		if ( tm->am_want[i] ) {
+			sm->am_want[i] = 1;
+		} else if ( op->ors_attrs ) {
+			sm->am_want[i] = ad_inlist( ad, op->ors_attrs );
+		} else {
+			sm->am_want[i] = !is_at_operational( ad->ad_type );
+		}
+		if ( !sm->am_want[i] )
+			sall = 0;
+	}
+	if ( tall )
+		goto all;
+
+	*tmask = tm;
+	if ( !sall ) {
+		if ( memcmp( tm->am_want, sm->am_want, n + 1 ))
+			*smask = sm;
+		else
+			*smask = tm;
+	}
+	return;
+
+all:
+	op->o_tmpfree( tm, op->o_tmpmemctx );
+}
+
+/* Parallel candidate scan.
+ *
+ * When a search has many candidates, worker threads from the
+ * connection pool go through them ahead of the main loop and drop
+ * the ones that can't be returned: those out of scope or not
+ * matching the filter, with the same tests the main loop does.
+ * The main loop then only sees the rest. The candidates are split
+ * into chunks by ID; each worker opens its own read txn and only
+ * takes part if it got the same snapshot as the search. A chunk no
+ * worker has started yet is taken by the main loop as it stands,
+ * so the search never waits for a thread that isn't there. With
+ * unordered results the main loop takes whichever chunk is done
+ * first, otherwise it goes through them in order.
+ */
+
+#define SC_PENDING	0
+#define SC_RUNNING	1	/* a worker is on it */
+#define SC_DONE		2	/* sc_ids holds what the worker kept */
+#define SC_TAKEN	3	/* taken by the main loop */
+
+typedef struct search_chunk {
+	ID		sc_lo, sc_hi;
+	ID		*sc_ids;
+	ID		sc_nids;
+	ID		sc_size;
+	int		sc_state;
+	int		sc_whole;	/* main loop goes through all candidates */
+} search_chunk;
+
+typedef struct search_scan {
+	Operation	*ss_op;
+	Entry		*ss_base;
+	ID			*ss_candidates;
+	ID2			*ss_scopes;
+	mdb_attrmask	*ss_tmask;
+	size_t		ss_txnid;
+	int			ss_unordered;
+
+	ldap_pvt_thread_mutex_t	ss_mutex;
+	ldap_pvt_thread_cond_t	ss_cond;
+	search_chunk	*ss_chunks;
+	int			ss_nchunks;
+	int			ss_next;	/* next chunk for the workers */
+	int			ss_taken;	/* chunks before this are taken */
+	int			ss_nthreads;	/* tasks submitted */
+	int			ss_workers;	/* tasks not finished yet */
+	int			ss_abort;
+
+	/* main loop position */
+	search_chunk	*ss_cur;
+	ID			ss_pos;
+	int			ss_first;
+} search_scan;
+
+/* Keep the ID of a candidate the main loop must look at */
+static void
+search_chunk_keep( search_chunk *sc, ID id )
+{
+	if ( sc->sc_nids == sc->sc_size ) {
+		sc->sc_size = sc->sc_size ? sc->sc_size * 2 : 256;
+		sc->sc_ids = ch_realloc( sc->sc_ids, sc->sc_size * sizeof(ID) );
+	}
+	sc->sc_ids[sc->sc_nids++] = id;
+}
+
+/* Run the tests of the candidate loop in mdb_search() on the
+ * candidates of one chunk. Anything that may be returned, including
+ * referrals and candidates that couldn't be read, is kept for the
+ * main loop.
+ */
+static void
+search_chunk_scan( Operation *op, search_scan *ss, search_chunk *sc,
+	MDB_txn *txn, MDB_cursor *mci, IdScopes *isc )
+{
+	ID *candidates = ss->ss_candidates;
+	Entry *e, *base = ss->ss_base;
+	ID id, cursor = sc->sc_lo;
+	int manageDSAit = get_manageDSAit( op );
+	int rc;
+
+	for ( id = mdb_idl_first( candidates, &cursor );
+		id != NOID && id <= sc->sc_hi;
+		id = mdb_idl_next( candidates, &cursor ))
+	{
+		if ( ss->ss_abort || ss->ss_op->o_abandon )
+			break;
+
+		if ( id == base->e_id ) {
+			search_chunk_keep( sc, id );
+			continue;
+		}
+
+		rc = mdb_id2entry_partial( op, mci, id, ss->ss_tmask, &e );
+		if ( rc && rc != MDB_NOTFOUND ) {
+			search_chunk_keep( sc, id );
+			continue;
+		}
+		if ( e == NULL ) {
+			if ( MDB_IDL_IS_RANGE( candidates )) {
+				if ( mdb_get_nextid( mci, &cursor ))
+					break;
+				cursor--;
+			}
+			continue;
+		}
+
+		if ( is_entry_subentry( e ) ) {
+			if ( !get_subentries_visibility( op ))
+				goto next;
+		} else if ( get_subentries_visibility( op )) {
+			goto next;
+		}
+
+		/* the base was kept above, anything else must be below it */
+		isc->numrdns = 0;
+		isc->id = id;
+		if ( mdb_idscopes( op, isc ) != MDB_SUCCESS )
+			goto next;
+
+		/* aliases were already dereferenced in candidate list */
+		if (( op->ors_deref & LDAP_DEREF_SEARCHING ) && is_entry_alias( e ))
+			goto next;
+
+		if ( !manageDSAit && is_entry_glue( e ))
+			goto next;
+
+		search_entry_dn( op, txn, base, e, isc );
+
+		if (( !manageDSAit && is_entry_referral( e )) ||
+			test_filter( op, e, op->ors_filter ) == LDAP_COMPARE_TRUE )
+		{
+			search_chunk_keep( sc, id );
+		}
+next:
+		mdb_entry_return( op, e );
+	}
+}
+
+static void *
+search_scan_task( void *ctx, void *arg )
+{
+	search_scan *ss = arg;
+	Operation *op = ss->ss_op, op2;
+	Opheader ohdr;
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_op_info opinfo = {{{0}}}, *moi = &opinfo;
+	MDB_cursor *mci = NULL;
+	IdScopes isc;
+	search_chunk *sc;
+	int rc;
+
+	/* the same op, but with our own thread, memory and txn */
+	op2 = *op;
+	ohdr = *op->o_hdr;
+	op2.o_hdr = &ohdr;
+	op2.o_threadctx = ctx;
+	op2.o_tid = ldap_pvt_thread_pool_tid( ctx );
+	op2.o_tmpmemctx = slap_sl_mem_create( SLAP_SLAB_SIZE, SLAP_SLAB_STACK,
+		ctx, 1 );
+	op2.o_tmpmfuncs = &slap_sl_mfuncs;
+	op2.o_groups = NULL;
+	LDAP_SLIST_INIT( &op2.o_extra );
+
+	rc = mdb_opinfo_get( &op2, mdb, 1, &moi );
+	if ( rc == 0 ) {
+		/* a write got in since the search started */
+		if ( mdb_txn_id( moi->moi_txn ) != ss->ss_txnid )
+			rc = -1;
+		else
+			rc = mdb_cursor_open( moi->moi_txn, mdb->mi_id2entry, &mci );
+	}
+
+	if ( rc == 0 ) {
+		isc.mt = moi->moi_txn;
+		isc.mc = NULL;
+		isc.scopes = scope_chunk_get( &op2 );
+		AC_MEMCPY( isc.scopes, ss->ss_scopes,
+			( ss->ss_scopes[0].mid + 1 ) * sizeof(ID2) );
+
+		ldap_pvt_thread_mutex_lock( &ss->ss_mutex );
+		while ( !ss->ss_abort ) {
+			for ( ; ss->ss_next < ss->ss_nchunks; ss->ss_next++ ) {
+				if ( ss->ss_chunks[ss->ss_next].sc_state == SC_PENDING )
+					break;
+			}
+			if ( ss->ss_next == ss->ss_nchunks )
+				break;
+			sc = &ss->ss_chunks[ss->ss_next++];
+			sc->sc_state = SC_RUNNING;
+			ldap_pvt_thread_mutex_unlock( &ss->ss_mutex );
+
+			search_chunk_scan( &op2, ss, sc, moi->moi_txn, mci, &isc );
+
+			ldap_pvt_thread_mutex_lock( &ss->ss_mutex );
+			sc->sc_state = SC_DONE;
+			ldap_pvt_thread_cond_broadcast( &ss->ss_cond );
+		}
+		ldap_pvt_thread_mutex_unlock( &ss->ss_mutex );
+
+		if ( isc.mc )
+			mdb_cursor_close( isc.mc );
+		scope_chunk_ret( &op2, isc.scopes );
+	}
+
+	if ( mci )
+		mdb_cursor_close( mci );
+	if ( moi == &opinfo ) {
+		if ( moi->moi_txn )
+			mdb_txn_reset( moi->moi_txn );
+		LDAP_SLIST_REMOVE( &op2.o_extra, &moi->moi_oe, OpExtra, oe_next );
+	}
+
+	ldap_pvt_thread_mutex_lock( &ss->ss_mutex );
+	ss->ss_workers--;
+	ldap_pvt_thread_cond_broadcast( &ss->ss_cond );
+	ldap_pvt_thread_mutex_unlock( &ss->ss_mutex );
+	return NULL;
+}
+
+/* Split the candidates into chunks and start the workers. Returns
+ * NULL if the search is better done by the main loop alone.
+ */
+static search_scan *
+search_scan_start( Operation *op, MDB_txn *txn, MDB_cursor *mci,
+	ID *candidates, ID2 *scopes, Entry *base, mdb_attrmask *tmask )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	search_scan *ss;
+	MDB_val key;
+	ID first, last, n, span;
+	int i, nchunks;
+
+	n = MDB_IDL_N( candidates );
+	first = MDB_IDL_FIRST( candidates );
+	last = MDB_IDL_LAST( candidates );
+
+	/* a range may go up to NOID, stop at the last entry */
+	if ( MDB_IDL_IS_RANGE( candidates )) {
+		ID id;
+		if ( mdb_cursor_get( mci, &key, NULL, MDB_LAST ))
+			return NULL;
+		memcpy( &id, key.mv_data, sizeof(ID) );
+		if ( id < last )
+			last = id;
+		if ( last < first )
+			return NULL;
+		n = last - first + 1;
+	}
+	if ( n < mdb->mi_search_min )
+		return NULL;
+
+	/* a few chunks per thread, so a slow one doesn't hold up the rest */
+	nchunks = ( mdb->mi_search_threads + 1 ) * 4;
+	if ( (ID)nchunks > n )
+		nchunks = n;
+
+	ss = ch_calloc( 1, sizeof(search_scan) + nchunks * sizeof(search_chunk) );
+	ss->ss_chunks = (search_chunk *)(ss+1);
+	ss->ss_nchunks = nchunks;
+	ss->ss_op = op;
+	ss->ss_base = base;
+	ss->ss_candidates = candidates;
+	ss->ss_tmask = tmask;
+	ss->ss_txnid = mdb_txn_id( txn );
+	ss->ss_unordered = mdb->mi_search_flags & MDB_SEARCH_UNORDERED;
+
+	/* the main loop adds to its scopes as it goes; the workers start
+	 * from the ones search_candidates() set up */
+	ss->ss_scopes = ch_malloc( ( scopes[0].mid + 1 ) * sizeof(ID2) );
+	ss->ss_scopes[0].mid = 0;
+	for ( i = 1; i <= (int)scopes[0].mid; i++ ) {
+		if ( !scopes[i].mval.mv_data )
+			ss->ss_scopes[++ss->ss_scopes[0].mid] = scopes[i];
+	}
+
+	if ( MDB_IDL_IS_LIST( candidates )) {
+		for ( i = 0; i < nchunks; i++ ) {
+			ss->ss_chunks[i].sc_lo = candidates[ 1 + i * n / nchunks ];
+			ss->ss_chunks[i].sc_hi = candidates[ ( i + 1 ) * n / nchunks ];
+		}
+	} else {
+		span = ( last - first ) / nchunks + 1;
+		for ( i = 0; i < nchunks; i++ ) {
+			ss->ss_chunks[i].sc_lo = first + i * span;
+			ss->ss_chunks[i].sc_hi = ss->ss_chunks[i].sc_lo + span - 1;
+		}
+		ss->ss_chunks[nchunks-1].sc_hi = last;
+	}
+
+	ldap_pvt_thread_mutex_init( &ss->ss_mutex );
+	ldap_pvt_thread_cond_init( &ss->ss_cond );
+
+	ldap_pvt_thread_mutex_lock( &ss->ss_mutex );
+	for ( i = 0; i < mdb->mi_search_threads; i++ ) {
+		if ( ldap_pvt_thread_pool_submit( &connection_pool,
+			search_scan_task, ss ))
+			break;
+		ss->ss_nthreads++;
+		ss->ss_workers++;
+	}
+	ldap_pvt_thread_mutex_unlock( &ss->ss_mutex );
+
+	Debug( LDAP_DEBUG_TRACE, LDAP_XSTRING(mdb_search)
+		": scanning %ld candidates in %d chunks with %d threads\n",
+		(long) n, nchunks, ss->ss_nthreads );
+	return ss;
+}
+
+/* Pick the next chunk for the main loop. ss_mutex is locked. */
+static search_chunk *
+search_scan_pick( search_scan *ss )
+{
+	search_chunk *sc, *pending;
+	int i, running;
+
+	for (;;) {
+		while ( ss->ss_taken < ss->ss_nchunks &&
+			ss->ss_chunks[ss->ss_taken].sc_state == SC_TAKEN )
+			ss->ss_taken++;
+		if ( ss->ss_taken == ss->ss_nchunks )
+			return NULL;
+
+		if ( !ss->ss_unordered ) {
+			sc = &ss->ss_chunks[ss->ss_taken];
+			if ( sc->sc_state == SC_RUNNING ) {
+				ldap_pvt_thread_cond_wait( &ss->ss_cond, &ss->ss_mutex );
+				continue;
+			}
+			break;
+		}
+
+		/* rather a chunk that is done, else one nobody started,
+		 * from the end since the workers start at the front */
+		pending = NULL;
+		running = 0;
+		for ( i = ss->ss_taken; i < ss->ss_nchunks; i++ ) {
+			sc = &ss->ss_chunks[i];
+			if ( sc->sc_state == SC_DONE )
+				break;
+			if ( sc->sc_state == SC_PENDING )
+				pending = sc;
+			else if ( sc->sc_state == SC_RUNNING )
+				running = 1;
+		}
+		if ( i < ss->ss_nchunks )
+			break;
+		if ( pending ) {
+			sc = pending;
+			break;
+		}
+		if ( running )
+			ldap_pvt_thread_cond_wait( &ss->ss_cond, &ss->ss_mutex );
+	}
+
+	sc->sc_whole = ( sc->sc_state == SC_PENDING );
+	sc->sc_state = SC_TAKEN;
+	return sc;
+}
+
+/* The next candidate for the main loop */
+static ID
+search_scan_next( search_scan *ss )
+{
+	search_chunk *sc;
+	ID id;
+
+	for (;;) {
+		sc = ss->ss_cur;
+		if ( sc ) {
+			if ( sc->sc_whole ) {
+				if ( ss->ss_first ) {
+					ss->ss_pos = sc->sc_lo;
+					id = mdb_idl_first( ss->ss_candidates, &ss->ss_pos );
+					ss->ss_first = 0;
+				} else {
+					id = mdb_idl_next( ss->ss_candidates, &ss->ss_pos );
+				}
+				if ( id != NOID && id <= sc->sc_hi )
+					return id;
+			} else if ( ss->ss_pos < sc->sc_nids ) {
+				return sc->sc_ids[ss->ss_pos++];
+			}
+		}
+
+		ldap_pvt_thread_mutex_lock( &ss->ss_mutex );
+		sc = search_scan_pick( ss );
+		ldap_pvt_thread_mutex_unlock( &ss->ss_mutex );
+		if ( !sc )
+			return NOID;
+		ss->ss_cur = sc;
+		ss->ss_pos = 0;
+		ss->ss_first = 1;
+	}
+}
+
+/* Stop the workers and free everything */
+static void
+search_scan_end( search_scan *ss )
+{
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &ss->ss_mutex );
+	ss->ss_abort = 1;
+	ldap_pvt_thread_mutex_unlock( &ss->ss_mutex );
+
+	/* tasks that didn't start yet never will */
+	for ( i = 0; i < ss->ss_nthreads; i++ ) {
+		if ( ldap_pvt_thread_pool_retract( &connection_pool,
+			search_scan_task, ss ) > 0 )
+		{
+			ldap_pvt_thread_mutex_lock( &ss->ss_mutex );
+			ss->ss_workers--;
+			ldap_pvt_thread_mutex_unlock( &ss->ss_mutex );
+		}
+	}
+
+	ldap_pvt_thread_mutex_lock( &ss->ss_mutex );
+	while ( ss->ss_workers )
+		ldap_pvt_thread_cond_wait( &ss->ss_cond, &ss->ss_mutex );
+	ldap_pvt_thread_mutex_unlock( &ss->ss_mutex );
+
+	for ( i = 0; i < ss->ss_nchunks; i++ )
+		ch_free( ss->ss_chunks[i].sc_ids );
+	ch_free( ss->ss_scopes );
+	ldap_pvt_thread_cond_destroy( &ss->ss_cond );
+	ldap_pvt_thread_mutex_destroy( &ss->ss_mutex );
+	ch_free( ss );
+}
+
 int
 mdb_search( Operation *op, SlapReply *rs )
 {
@@ -331,6 +883,8 @@ mdb_search( Operation *op, SlapReply *rs )
 	int		tentries = 0;
 	IdScopes	isc;
 	MDB_cursor	*mci;
+	mdb_attrmask	*tmask = NULL, *smask = NULL;
+	search_scan	*ss = NULL;
 
 	mdb_op_info	opinfo = {{{0}}}, *moi = &opinfo;
 	MDB_txn			*ltid = NULL;
@@ -601,8 +1155,19 @@ dn2entry_retry:
 		goto loop_begin;
 	}
 
-	for ( id = mdb_idl_first( candidates, &cursor );
-		  id != NOID ; id = mdb_idl_next( candidates, &cursor ) )
+	/* Only decode what we need of each candidate. Anything else
+	 * is decoded once the candidate turns out to be returned.
+	 */
+	if ( op->ors_scope != LDAP_SCOPE_BASE ) {
+		search_attrmasks( op, &tmask, &smask );
+		if ( mdb->mi_search_threads )
+			ss = search_scan_start( op, ltid, mci, candidates, scopes,
+				base, tmask );
+	}
+
+	for ( id = ss ? search_scan_next( ss ) : mdb_idl_first( candidates, &cursor );
+		  id != NOID ;
+		  id = ss ? search_scan_next( ss ) : mdb_idl_next( candidates, &cursor ) )
 	{
 		int scopeok;
 
@@ -640,7 +1205,7 @@ loop_begin:
 		} else {
 
 			/* get the entry */
-			rs->sr_err = mdb_id2entry( op, mci, id, &e );
+			rs->sr_err = mdb_id2entry_partial( op, mci, id, tmask, &e );
 
 			if (rs->sr_err == LDAP_BUSY) {
 				rs->sr_text = "ldap server busy";
@@ -660,7 +1225,7 @@ loop_begin:
 						LDAP_XSTRING(mdb_search)
 						": candidate %ld not found\n",
 						(long) id, 0, 0 );
-				} else {
+				} else if ( !ss ) {
 					/* get the next ID from the DB */
 					rs->sr_err = mdb_get_nextid( mci, &cursor );
 					if ( rs->sr_err == MDB_NOTFOUND ) {
@@ -752,49 +1317,8 @@ loop_begin:
 			goto loop_continue;
 		}
 
-		if (e != base) {
-			struct berval pdn, pndn;
-			char *d, *n;
-			int i;
-			/* child of base, just append RDNs to base->e_name */
-			if ( isc.nscope == 1 ) {
-				pdn = base->e_name;
-				pndn = base->e_nname;
-			} else {
-				mdb_id2name( op, ltid, &isc.mc, scopes[isc.nscope].mid, &pdn, &pndn );
-			}
-			e->e_name.bv_len = pdn.bv_len;
-			e->e_nname.bv_len = pndn.bv_len;
-			for (i=0; i<isc.numrdns; i++) {
-				e->e_name.bv_len += isc.rdns[i].bv_len + 1;
-				e->e_nname.bv_len += isc.nrdns[i].bv_len + 1;
-			}
-			e->e_name.bv_val = op->o_tmpalloc(e->e_name.bv_len + 1, op->o_tmpmemctx);
-			e->e_nname.bv_val = op->o_tmpalloc(e->e_nname.bv_len + 1, op->o_tmpmemctx);
-			d = e->e_name.bv_val;
-			n = e->e_nname.bv_val;
-			for (i=0; i<isc.numrdns; i++) {
-				memcpy(d, isc.rdns[i].bv_val, isc.rdns[i].bv_len);
-				d += isc.rdns[i].bv_len;
-				*d++ = ',';
-				memcpy(n, isc.nrdns[i].bv_val, isc.nrdns[i].bv_len);
-				n += isc.nrdns[i].bv_len;
-				*n++ = ',';
-			}
-			if (pdn.bv_len) {
-				memcpy(d, pdn.bv_val, pdn.bv_len+1);
-				memcpy(n, pndn.bv_val, pndn.bv_len+1);
-			} else {
-				*--d = '\0';
-				*--n = '\0';
-				e->e_name.bv_len--;
-				e->e_nname.bv_len--;
-			}
-			if (isc.nscope != 1) {
-				op->o_tmpfree(pndn.bv_val, op->o_tmpmemctx);
-				op->o_tmpfree(pdn.bv_val, op->o_tmpmemctx);
-			}
-		}
+		if (e != base)
+			search_entry_dn( op, ltid, base, e, &isc );
 
 		/*
 		 * if it's a referral, add it to the list of referrals. only do
@@ -840,6 +1364,22 @@ loop_begin:
 				lastid = id;
 			}
 
+			if ( e && !BER_BVISNULL( &e->e_bv )) {
+				if ( smask == tmask ) {
+					BER_BVZERO( &e->e_bv );
+				} else {
+					rs->sr_err = mdb_entry_complete( op, ltid, smask, &e );
+					if ( rs->sr_err ) {
+						mdb_entry_return( op, e );
+						e = NULL;
+						rs->sr_err = LDAP_OTHER;
+						rs->sr_text = "internal error";
+						send_ldap_result( op, rs );
+						goto done;
+					}
+				}
+			}
+
 			if (e) {
 				/* safe default */
 				rs->sr_attrs = op->oq_search.rs_attrs;
@@ -906,6 +1446,8 @@ nochange:
 	rs->sr_err = LDAP_SUCCESS;
 
 done:
+	if ( ss )
+		search_scan_end( ss );
 	if( isc.mc )
 		mdb_cursor_close( isc.mc );
 	if (mci)
@@ -920,6 +1462,8 @@ done:
 	}
 	if (base)
 		mdb_entry_return( op,base);
+	if ( tmask )
+		op->o_tmpfree( tmask, op->o_tmpmemctx );
 	scope_chunk_ret( op, scopes );
 
 	return rs->sr_err;
@@ -36,6 +36,7 @@ typedef struct mdb_tool_idl_cache_entry {
 
 typedef struct mdb_tool_idl_cache {
 	struct berval kstr;
+	ber_len_t ksize;	/* room for the key after the struct */
 	mdb_tool_idl_cache_entry *head, *tail;
 	ID first, last;
 	int count;
@@ -44,10 +45,11 @@ typedef struct mdb_tool_idl_cache {
 } mdb_tool_idl_cache;
 #define WAS_FOUND	0x01
 #define WAS_RANGE	0x02
+#define TO_RANGE	0x04	/* grew too big without idlexact */
 
 #define MDB_TOOL_IDL_FLUSH(be, txn)	mdb_tool_idl_flush(be, txn)
 #else
-#define MDB_TOOL_IDL_FLUSH(be, txn)
+#define MDB_TOOL_IDL_FLUSH(be, txn)	0
 #endif /* MDB_TOOL_IDL_CACHING */
 
 static MDB_txn *txn = NULL, *txi = NULL;
@@ -82,6 +84,35 @@ static ldap_pvt_thread_cond_t mdb_tool_index_cond_main;
 static ldap_pvt_thread_cond_t mdb_tool_index_cond_work;
 static void * mdb_tool_index_task( void *ctx, void *ptr );
 
+/* Reading ahead for slapcat: with tool-threads > 1 the ID space is cut
+ * into ranges of MDB_TOOL_READ_IDS IDs, which reader tasks decode ahead
+ * of mdb_tool_entry_next(), each in a read txn of its own. A task only
+ * helps if its txn sees the same snapshot as the tool txn; the main
+ * thread reads any range nobody has taken when it gets there.
+ */
+#define MDB_TOOL_READ_IDS	1024
+
+typedef struct mdb_tool_range {
+	int tr_state;
+#define	TR_FREE	0
+#define	TR_BUSY	1
+#define	TR_DONE	2
+	int tr_n;		/* entries read */
+	int tr_pos;		/* next one to return */
+	ID tr_ids[MDB_TOOL_READ_IDS];
+	Entry *tr_ents[MDB_TOOL_READ_IDS];	/* NULL if it could not be read */
+} mdb_tool_range;
+
+static mdb_tool_range *mdb_tool_ranges;
+static int mdb_tool_nranges, mdb_tool_readers, mdb_tool_read_stop;
+static ID mdb_tool_read_in, mdb_tool_read_out, mdb_tool_read_last;
+static size_t mdb_tool_read_txnid;
+static ldap_pvt_thread_mutex_t mdb_tool_read_mutex;
+static ldap_pvt_thread_cond_t mdb_tool_read_cond;
+static void mdb_tool_read_start( BackendDB *be );
+static void mdb_tool_read_end( BackendDB *be );
+static ID mdb_tool_read_next( BackendDB *be );
+
 static int	mdb_writes, mdb_writes_per_commit;
 
 static int
@@ -154,6 +185,9 @@ int mdb_tool_entry_close(
 		mdb_tool_index_tcount = mdb_tool_threads - 1;
 	}
 
+	if ( mdb_tool_ranges )
+		mdb_tool_read_end( be );
+
 	if( idcursor ) {
 		mdb_cursor_close( idcursor );
 		idcursor = NULL;
@@ -163,7 +197,11 @@ int mdb_tool_entry_close(
 		cursor = NULL;
 	}
 	if( txn ) {
-		MDB_TOOL_IDL_FLUSH( be, txn );
+		if ( MDB_TOOL_IDL_FLUSH( be, txn )) {
+			mdb_txn_abort( txn );
+			txn = NULL;
+			return -1;
+		}
 		if ( mdb_txn_commit( txn ))
 			return -1;
 		txn = NULL;
@@ -219,8 +257,13 @@ ID mdb_tool_entry_next(
 			mdb_txn_abort( txn );
 			return NOID;
 		}
+		if (( slapMode & SLAP_TOOL_READONLY ) && slap_tool_thread_max > 1 )
+			mdb_tool_read_start( be );
 	}
 
+	if ( mdb_tool_ranges )
+		return mdb_tool_read_next( be );
+
 next:;
 	rc = mdb_cursor_get( cursor, &key, &data, MDB_NEXT );
 
@@ -311,7 +354,7 @@ mdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep )
 	assert( be != NULL );
 	assert( slapMode & SLAP_TOOL_MODE );
 
-	if ( ( tool_filter || tool_base ) && id == previd && tool_next_entry != NULL ) {
+	if ( id == previd && tool_next_entry != NULL ) {
 		*ep = tool_next_entry;
 		tool_next_entry = NULL;
 		return LDAP_SUCCESS;
@@ -346,10 +389,15 @@ mdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep )
 				ch_free( dn.bv_val );
 				ch_free( ndn.bv_val );
 				rc = LDAP_NO_SUCH_OBJECT;
+				goto done;
 			}
 		}
 	}
-	rc = mdb_entry_decode( &op, &data, &e );
+	rc = mdb_entry_decode( &op, mdb_cursor_txn( cursor ), &data, id, NULL, &e );
+	if ( rc ) {
+		rc = LDAP_OTHER;
+		goto done;
+	}
 	e->e_id = id;
 	if ( !BER_BVISNULL( &dn )) {
 		e->e_name = dn;
@@ -528,9 +576,10 @@ mdb_tool_index_add(
 			if ( rc )
 				return rc;
 		}
+		/* open the cursors here, the index threads share the txn */
 		for (i=0; i<mdb->mi_nattrs; i++) {
-			if ( !ir[i].ir_ai )
-				break;
+			if ( !ir[i].ir_ai || ir[i].ir_ai->ai_cursor )
+				continue;
 			rc = mdb_cursor_open( txn, ir[i].ir_ai->ai_dbi,
 				 &ir[i].ir_ai->ai_cursor );
 			if ( rc )
@@ -683,13 +732,18 @@ done:
 		mdb_writes++;
 		if ( mdb_writes >= mdb_writes_per_commit ) {
 			unsigned i;
-			MDB_TOOL_IDL_FLUSH( be, txn );
-			rc = mdb_txn_commit( txn );
+			rc = MDB_TOOL_IDL_FLUSH( be, txn );
+			if ( rc == 0 )
+				rc = mdb_txn_commit( txn );
+			else
+				mdb_txn_abort( txn );
 			for ( i=0; i<mdb->mi_nattrs; i++ )
 				mdb->mi_attrs[i]->ai_cursor = NULL;
 			mdb_writes = 0;
 			txn = NULL;
 			idcursor = NULL;
+			if( rc == 0 )
+				mdb_map_check( mdb );
 			if( rc != 0 ) {
 				snprintf( text->bv_val, text->bv_len,
 						"txn_commit failed: %s (%d)",
@@ -845,8 +899,11 @@ done:
 		mdb_writes++;
 		if ( mdb_writes >= mdb_writes_per_commit ) {
 			unsigned i;
-			MDB_TOOL_IDL_FLUSH( be, txi );
-			rc = mdb_txn_commit( txi );
+			rc = MDB_TOOL_IDL_FLUSH( be, txi );
+			if ( rc == 0 )
+				rc = mdb_txn_commit( txi );
+			else
+				mdb_txn_abort( txi );
 			mdb_writes = 0;
 			for ( i=0; i<mi->mi_nattrs; i++ )
 				mi->mi_attrs[i]->ai_cursor = NULL;
@@ -925,6 +982,32 @@ ID mdb_tool_entry_modify(
 	op.o_tmpmemctx = NULL;
 	op.o_tmpmfuncs = &ch_mfuncs;
 
+	/* An entry that didn't come from the database has none of its
+	 * values in id2val; drop any that the stored one had there.
+	 */
+	if ( mdb->mi_id2val ) {
+		Attribute *a;
+		for ( a = e->e_attrs; a; a = a->a_next ) {
+			if ( a->a_flags & SLAP_ATTR_BIG_MULTI )
+				break;
+		}
+		if ( !a ) {
+			MDB_val key;
+			key.mv_data = &e->e_id;
+			key.mv_size = sizeof(ID);
+			rc = mdb_del( txn, mdb->mi_id2val, &key, NULL );
+			if ( rc && rc != MDB_NOTFOUND ) {
+				snprintf( text->bv_val, text->bv_len,
+						"id2val delete failed: %s (%d)",
+						mdb_strerror(rc), rc );
+				Debug( LDAP_DEBUG_ANY,
+					"=> " LDAP_XSTRING(mdb_tool_entry_modify) ": %s\n",
+					text->bv_val, 0, 0 );
+				goto done;
+			}
+		}
+	}
+
 	/* id2entry index */
 	rc = mdb_id2entry_update( &op, txn, NULL, e );
 	if( rc != 0 ) {
@@ -965,6 +1048,278 @@ done:
 	return e->e_id;
 }
 
+/* Decode an entry read from id2entry, with its DN. Returns
+ * LDAP_NO_SUCH_OBJECT if it is outside the tool's base or does
+ * not match its filter.
+ */
+static int
+mdb_tool_entry_read( Operation *op, MDB_txn *rtxn, MDB_cursor **idc,
+	ID id, MDB_val *d, Entry **ep )
+{
+	struct berval dn, ndn;
+	Entry *e;
+	int rc;
+
+	rc = mdb_id2name( op, rtxn, idc, id, &dn, &ndn );
+	if ( rc )
+		return LDAP_OTHER;
+	if ( tool_base && !dnIsSuffixScope( &ndn, tool_base, tool_scope )) {
+		ch_free( dn.bv_val );
+		ch_free( ndn.bv_val );
+		return LDAP_NO_SUCH_OBJECT;
+	}
+	rc = mdb_entry_decode( op, rtxn, d, id, NULL, &e );
+	if ( rc ) {
+		ch_free( dn.bv_val );
+		ch_free( ndn.bv_val );
+		return LDAP_OTHER;
+	}
+	e->e_id = id;
+	e->e_name = dn;
+	e->e_nname = ndn;
+	if ( tool_filter && test_filter( NULL, e, tool_filter ) != LDAP_COMPARE_TRUE ) {
+		mdb_entry_release( op, e, 0 );
+		return LDAP_NO_SUCH_OBJECT;
+	}
+	*ep = e;
+	return LDAP_SUCCESS;
+}
+
+/* Read the entries of range r with the given id2entry cursor */
+static void
+mdb_tool_read_range( Operation *op, MDB_cursor *mc, MDB_cursor **idc,
+	mdb_tool_range *tr, ID r )
+{
+	MDB_txn *rtxn = mdb_cursor_txn( mc );
+	MDB_val k, d;
+	ID id, lo, hi;
+	Entry *e;
+	int rc;
+
+	lo = r * MDB_TOOL_READ_IDS + 1;
+	hi = lo + MDB_TOOL_READ_IDS - 1;
+	tr->tr_n = 0;
+	tr->tr_pos = 0;
+
+	k.mv_size = sizeof(ID);
+	k.mv_data = &lo;
+	for ( rc = mdb_cursor_get( mc, &k, &d, MDB_SET_RANGE ); rc == 0;
+		rc = mdb_cursor_get( mc, &k, &d, MDB_NEXT )) {
+		memcpy( &id, k.mv_data, sizeof(ID) );
+		if ( id > hi )
+			break;
+		e = NULL;
+		if ( mdb_tool_entry_read( op, rtxn, idc, id, &d, &e ) ==
+			LDAP_NO_SUCH_OBJECT )
+			continue;
+		tr->tr_ids[tr->tr_n] = id;
+		tr->tr_ents[tr->tr_n++] = e;
+	}
+}
+
+/* The next range for a reader, NULL if there are no more.
+ * Called with mdb_tool_read_mutex held.
+ */
+static mdb_tool_range *
+mdb_tool_read_claim( ID *r )
+{
+	mdb_tool_range *tr;
+
+	for (;;) {
+		if ( mdb_tool_read_stop || mdb_tool_read_in > mdb_tool_read_last )
+			return NULL;
+		tr = &mdb_tool_ranges[ mdb_tool_read_in % mdb_tool_nranges ];
+		if ( tr->tr_state == TR_FREE )
+			break;
+		ldap_pvt_thread_cond_wait( &mdb_tool_read_cond,
+			&mdb_tool_read_mutex );
+	}
+	tr->tr_state = TR_BUSY;
+	*r = mdb_tool_read_in++;
+	return tr;
+}
+
+static void *
+mdb_tool_read_task( void *ctx, void *ptr )
+{
+	BackendDB *be = ptr;
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	Operation op = {0};
+	Opheader ohdr = {0};
+	MDB_txn *rtxn = NULL;
+	MDB_cursor *mc = NULL, *idc = NULL;
+	mdb_tool_range *tr;
+	ID r;
+	int rc;
+
+	op.o_hdr = &ohdr;
+	op.o_bd = be;
+	op.o_threadctx = ctx;
+	op.o_tmpmemctx = NULL;
+	op.o_tmpmfuncs = &ch_mfuncs;
+
+	/* Not the txn kept by the thread for slapd ops, the pool
+	 * outlives the database in the tools.
+	 */
+	rc = mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &rtxn );
+	if ( rc == 0 ) {
+		/* a write got in since the tool txn began */
+		if ( mdb_txn_id( rtxn ) != mdb_tool_read_txnid )
+			rc = -1;
+		else
+			rc = mdb_cursor_open( rtxn, mdb->mi_id2entry, &mc );
+	}
+
+	if ( rc == 0 ) {
+		ldap_pvt_thread_mutex_lock( &mdb_tool_read_mutex );
+		while (( tr = mdb_tool_read_claim( &r ))) {
+			ldap_pvt_thread_mutex_unlock( &mdb_tool_read_mutex );
+			mdb_tool_read_range( &op, mc, &idc, tr, r );
+			ldap_pvt_thread_mutex_lock( &mdb_tool_read_mutex );
+			tr->tr_state = TR_DONE;
+			ldap_pvt_thread_cond_broadcast( &mdb_tool_read_cond );
+		}
+		ldap_pvt_thread_mutex_unlock( &mdb_tool_read_mutex );
+	}
+
+	if ( idc )
+		mdb_cursor_close( idc );
+	if ( mc )
+		mdb_cursor_close( mc );
+	if ( rtxn )
+		mdb_txn_abort( rtxn );
+
+	ldap_pvt_thread_mutex_lock( &mdb_tool_read_mutex );
+	mdb_tool_readers--;
+	ldap_pvt_thread_cond_broadcast( &mdb_tool_read_cond );
+	ldap_pvt_thread_mutex_unlock( &mdb_tool_read_mutex );
+	return NULL;
+}
+
+static void
+mdb_tool_read_start( BackendDB *be )
+{
+	MDB_val k, d;
+	ID last;
+	int i;
+
+	if ( mdb_cursor_get( cursor, &k, &d, MDB_LAST ))
+		return;
+	memcpy( &last, k.mv_data, sizeof(ID) );
+
+	mdb_tool_read_last = ( last - 1 ) / MDB_TOOL_READ_IDS;
+	mdb_tool_read_in = 0;
+	mdb_tool_read_out = 0;
+	mdb_tool_read_stop = 0;
+	mdb_tool_read_txnid = mdb_txn_id( txn );
+	mdb_tool_nranges = ( slap_tool_thread_max - 1 ) * 2 + 1;
+	mdb_tool_ranges = ch_calloc( mdb_tool_nranges, sizeof( mdb_tool_range ));
+	ldap_pvt_thread_mutex_init( &mdb_tool_read_mutex );
+	ldap_pvt_thread_cond_init( &mdb_tool_read_cond );
+
+	ldap_pvt_thread_mutex_lock( &mdb_tool_read_mutex );
+	for ( i = 1; i < slap_tool_thread_max; i++ ) {
+		if ( ldap_pvt_thread_pool_submit( &connection_pool,
+			mdb_tool_read_task, be ) == 0 )
+			mdb_tool_readers++;
+	}
+	ldap_pvt_thread_mutex_unlock( &mdb_tool_read_mutex );
+}
+
+static ID
+mdb_tool_read_next( BackendDB *be )
+{
+	Operation op = {0};
+	Opheader ohdr = {0};
+	mdb_tool_range *tr;
+	ID id = NOID;
+
+	op.o_hdr = &ohdr;
+	op.o_bd = be;
+	op.o_tmpmemctx = NULL;
+	op.o_tmpmfuncs = &ch_mfuncs;
+
+	/* not picked up by mdb_tool_entry_get() */
+	if ( tool_next_entry ) {
+		mdb_entry_release( &op, tool_next_entry, 0 );
+		tool_next_entry = NULL;
+	}
+
+	ldap_pvt_thread_mutex_lock( &mdb_tool_read_mutex );
+	while ( mdb_tool_read_out <= mdb_tool_read_last ) {
+		tr = &mdb_tool_ranges[ mdb_tool_read_out % mdb_tool_nranges ];
+		if ( mdb_tool_read_in == mdb_tool_read_out ) {
+			/* nobody has taken it, read it ourselves */
+			tr->tr_state = TR_BUSY;
+			mdb_tool_read_in++;
+			ldap_pvt_thread_mutex_unlock( &mdb_tool_read_mutex );
+			mdb_tool_read_range( &op, cursor, &idcursor, tr,
+				mdb_tool_read_out );
+			ldap_pvt_thread_mutex_lock( &mdb_tool_read_mutex );
+			tr->tr_state = TR_DONE;
+		}
+		if ( tr->tr_state != TR_DONE ) {
+			ldap_pvt_thread_cond_wait( &mdb_tool_read_cond,
+				&mdb_tool_read_mutex );
+			continue;
+		}
+		if ( tr->tr_pos < tr->tr_n ) {
+			id = tr->tr_ids[tr->tr_pos];
+			tool_next_entry = tr->tr_ents[tr->tr_pos++];
+			break;
+		}
+		tr->tr_state = TR_FREE;
+		mdb_tool_read_out++;
+		ldap_pvt_thread_cond_broadcast( &mdb_tool_read_cond );
+	}
+	ldap_pvt_thread_mutex_unlock( &mdb_tool_read_mutex );
+
+	/* entries that could not be read are tried again by entry_get */
+	previd = tool_next_entry ? id : NOID;
+	return id;
+}
+
+static void
+mdb_tool_read_end( BackendDB *be )
+{
+	Operation op = {0};
+	Opheader ohdr = {0};
+	mdb_tool_range *tr;
+	int i;
+
+	op.o_hdr = &ohdr;
+	op.o_bd = be;
+	op.o_tmpmemctx = NULL;
+	op.o_tmpmfuncs = &ch_mfuncs;
+
+	ldap_pvt_thread_mutex_lock( &mdb_tool_read_mutex );
+	mdb_tool_read_stop = 1;
+	ldap_pvt_thread_cond_broadcast( &mdb_tool_read_cond );
+	while ( mdb_tool_readers > 0 )
+		ldap_pvt_thread_cond_wait( &mdb_tool_read_cond,
+			&mdb_tool_read_mutex );
+	ldap_pvt_thread_mutex_unlock( &mdb_tool_read_mutex );
+
+	if ( tool_next_entry ) {
+		mdb_entry_release( &op, tool_next_entry, 0 );
+		tool_next_entry = NULL;
+	}
+	for ( i = 0; i < mdb_tool_nranges; i++ ) {
+		tr = &mdb_tool_ranges[i];
+		if ( tr->tr_state != TR_DONE )
+			continue;
+		for ( ; tr->tr_pos < tr->tr_n; tr->tr_pos++ ) {
+			if ( tr->tr_ents[tr->tr_pos] )
+				mdb_entry_release( &op, tr->tr_ents[tr->tr_pos], 0 );
+		}
+	}
+	ch_free( mdb_tool_ranges );
+	mdb_tool_ranges = NULL;
+	previd = NOID;
+	ldap_pvt_thread_cond_destroy( &mdb_tool_read_cond );
+	ldap_pvt_thread_mutex_destroy( &mdb_tool_read_mutex );
+}
+
 static void *
 mdb_tool_index_task( void *ctx, void *ptr )
 {
@@ -1010,64 +1365,76 @@ mdb_tool_idl_flush_one( MDB_cursor *mc, AttrInfo *ai, mdb_tool_idl_cache *ic )
 {
 	mdb_tool_idl_cache_entry *ice;
 	MDB_val key, data[2];
-	int i, rc;
-	ID id, nid;
+	int i, rc, flag;
+	ID id;
 
 	/* Freshly allocated, ignore it */
-	if ( !ic->head && ic->count <= MDB_IDL_DB_SIZE ) {
+	if ( !ic->head && !ic->last ) {
 		return 0;
 	}
 
 	key.mv_data = ic->kstr.bv_val;
 	key.mv_size = ic->kstr.bv_len;
 
-	if ( ic->count > MDB_IDL_DB_SIZE ) {
-		while ( ic->flags & WAS_FOUND ) {
-			rc = mdb_cursor_get( mc, &key, data, MDB_SET );
-			if ( rc ) {
-				/* FIXME: find out why this happens */
-				ic->flags = 0;
-				break;
-			}
-			if ( ic->flags & WAS_RANGE ) {
-				/* Skip lo */
-				rc = mdb_cursor_get( mc, &key, data, MDB_NEXT_DUP );
+	if ( ic->flags & WAS_RANGE ) {
+		/* An existing range, just extend it */
+		rc = mdb_cursor_get( mc, &key, data, MDB_SET );
+		if ( rc == 0 ) {
+			/* Skip lo */
+			rc = mdb_cursor_get( mc, &key, data, MDB_NEXT_DUP );
 
-				/* Get hi */
-				rc = mdb_cursor_get( mc, &key, data, MDB_NEXT_DUP );
+			/* Get hi */
+			rc = mdb_cursor_get( mc, &key, data, MDB_NEXT_DUP );
 
-				/* Store range hi */
-				data[0].mv_data = &ic->last;
-				rc = mdb_cursor_put( mc, &key, data, MDB_CURRENT );
-			} else {
-				/* Delete old data, replace with range */
-				ic->first = *(ID *)data[0].mv_data;
-				mdb_cursor_del( mc, MDB_NODUPDATA );
-			}
-			break;
+			/* Store range hi */
+			data[0].mv_data = &ic->last;
+			rc = mdb_cursor_put( mc, &key, data, MDB_CURRENT );
+		}
+	} else if ( ic->flags & TO_RANGE ) {
+		ID nid = 0;
+
+		/* Delete old data, replace with range */
+		if ( ic->flags & WAS_FOUND ) {
+			rc = mdb_cursor_get( mc, &key, data, MDB_SET );
+			if ( rc == 0 )
+				rc = mdb_cursor_del( mc, MDB_NODUPDATA );
+		} else {
+			rc = 0;
 		}
-		if ( !(ic->flags & WAS_RANGE)) {
-			/* range, didn't exist before */
-			nid = 0;
-			data[0].mv_size = sizeof(ID);
-			data[0].mv_data = &nid;
+		data[0].mv_size = sizeof(ID);
+		data[0].mv_data = &nid;
+		if ( rc == 0 )
+			rc = mdb_cursor_put( mc, &key, data, 0 );
+		if ( rc == 0 ) {
+			data[0].mv_data = &ic->first;
 			rc = mdb_cursor_put( mc, &key, data, 0 );
-			if ( rc == 0 ) {
-				data[0].mv_data = &ic->first;
-				rc = mdb_cursor_put( mc, &key, data, 0 );
-				if ( rc == 0 ) {
-					data[0].mv_data = &ic->last;
-					rc = mdb_cursor_put( mc, &key, data, 0 );
-				}
-			}
-			if ( rc ) {
-				rc = -1;
-			}
+		}
+		if ( rc == 0 ) {
+			data[0].mv_data = &ic->last;
+			rc = mdb_cursor_put( mc, &key, data, 0 );
+		}
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				"mdb_tool_idl_flush_one: %s: range put failed: %s (%d)\n",
+				ai->ai_desc->ad_cname.bv_val, mdb_strerror( rc ), rc );
 		}
 	} else {
 		/* Normal write */
 		int n;
 
+		/* Only append keys that sort after everything already
+		 * in the DB; an existing or lower key must be inserted.
+		 */
+		flag = MDB_NODUPDATA|MDB_MULTIPLE;
+		if ( !( ic->flags & WAS_FOUND )) {
+			MDB_val lkey;
+
+			rc = mdb_cursor_get( mc, &lkey, data, MDB_LAST );
+			if ( rc == MDB_NOTFOUND || ( rc == 0 &&
+				mdb_cmp( mdb_cursor_txn( mc ), ai->ai_dbi, &key, &lkey ) > 0 ))
+				flag |= MDB_APPEND;
+		}
+
 		data[0].mv_size = sizeof(ID);
 		rc = 0;
 		i = ic->offset;
@@ -1083,15 +1450,14 @@ mdb_tool_idl_flush_one( MDB_cursor *mc, AttrInfo *ai, mdb_tool_idl_cache *ic )
 			data[1].mv_size = end - i;
 			data[0].mv_data = &ice->ids[i];
 			i = 0;
-			rc = mdb_cursor_put( mc, &key, data, MDB_NODUPDATA|MDB_APPEND|MDB_MULTIPLE );
+			rc = mdb_cursor_put( mc, &key, data, flag );
 			if ( rc ) {
-				if ( rc == MDB_KEYEXIST ) {
-					rc = 0;
-					continue;
-				}
-				rc = -1;
+				Debug( LDAP_DEBUG_ANY,
+					"mdb_tool_idl_flush_one: %s: put failed: %s (%d)\n",
+					ai->ai_desc->ad_cname.bv_val, mdb_strerror( rc ), rc );
 				break;
 			}
+			flag &= ~MDB_APPEND;
 		}
 		if ( ic->head ) {
 			ic->tail->next = ai->ai_flist;
@@ -1114,9 +1480,7 @@ mdb_tool_idl_flush_db( MDB_txn *txn, AttrInfo *ai )
 	root = tavl_end( ai->ai_root, TAVL_DIR_LEFT );
 	do {
 		rc = mdb_tool_idl_flush_one( mc, ai, root->avl_data );
-		if ( rc != -1 )
-			rc = 0;
-	} while ((root = tavl_next(root, TAVL_DIR_RIGHT)));
+	} while ( !rc && (root = tavl_next(root, TAVL_DIR_RIGHT)));
 	mdb_cursor_close( mc );
 
 	return rc;
@@ -1141,20 +1505,36 @@ mdb_tool_idl_flush( BackendDB *be, MDB_txn *txn )
 }
 
 int mdb_tool_idl_add(
+	BackendDB *be,
 	MDB_cursor *mc,
 	struct berval *keys,
 	ID id )
 {
+	struct mdb_info *mdb = be->be_private;
 	MDB_dbi dbi;
 	mdb_tool_idl_cache *ic, itmp;
 	mdb_tool_idl_cache_entry *ice;
 	int i, rc, lcount;
 	AttrInfo *ai = (AttrInfo *)mc;
+#ifndef MISALIGNED_OK
+	int kbuf[2];
+#endif
 	mc = ai->ai_cursor;
 
 	dbi = ai->ai_dbi;
 	for (i=0; keys[i].bv_val; i++) {
-	itmp.kstr = keys[i];
+	/* Same key layout as mdb_idl_insert_keys() */
+#ifndef MISALIGNED_OK
+	if (keys[i].bv_len & ALIGNER) {
+		itmp.kstr.bv_len = sizeof(kbuf);
+		itmp.kstr.bv_val = (char *)kbuf;
+		kbuf[1] = 0;
+		memcpy(kbuf, keys[i].bv_val, keys[i].bv_len);
+	} else
+#endif
+	{
+		itmp.kstr = keys[i];
+	}
 	ic = tavl_find( (Avlnode *)ai->ai_root, &itmp, mdb_tool_idl_cmp );
 
 	/* No entry yet, create one */
@@ -1166,14 +1546,20 @@ int mdb_tool_idl_add(
 		if ( ai->ai_clist ) {
 			ic = ai->ai_clist;
 			ai->ai_clist = ic->head;
+			/* a recycled record only has room for its old key */
+			if ( ic->ksize < itmp.kstr.bv_len ) {
+				ic = ch_realloc( ic, sizeof( mdb_tool_idl_cache ) + itmp.kstr.bv_len + 4 );
+				ic->ksize = itmp.kstr.bv_len;
+			}
 		} else {
 			ic = ch_malloc( sizeof( mdb_tool_idl_cache ) + itmp.kstr.bv_len + 4 );
+			ic->ksize = itmp.kstr.bv_len;
 		}
 		ic->kstr.bv_len = itmp.kstr.bv_len;
 		ic->kstr.bv_val = (char *)(ic+1);
 		memcpy( ic->kstr.bv_val, itmp.kstr.bv_val, ic->kstr.bv_len );
 		ic->head = ic->tail = NULL;
-		ic->last = 0;
+		ic->first = ic->last = 0;
 		ic->count = 0;
 		ic->offset = 0;
 		ic->flags = 0;
@@ -1181,14 +1567,13 @@ int mdb_tool_idl_add(
 			avl_dup_error );
 
 		/* load existing key count here */
-		key.mv_size = keys[i].bv_len;
-		key.mv_data = keys[i].bv_val;
+		key.mv_size = ic->kstr.bv_len;
+		key.mv_data = ic->kstr.bv_val;
 		rc = mdb_cursor_get( mc, &key, &data, MDB_SET );
 		if ( rc == 0 ) {
 			ic->flags |= WAS_FOUND;
 			nid = *(ID *)data.mv_data;
 			if ( nid == 0 ) {
-				ic->count = MDB_IDL_DB_SIZE+1;
 				ic->flags |= WAS_RANGE;
 			} else {
 				size_t count;
@@ -1201,20 +1586,30 @@ int mdb_tool_idl_add(
 		}
 	}
 	/* are we a range already? */
-	if ( ic->count > MDB_IDL_DB_SIZE ) {
+	if ( ic->flags & (WAS_RANGE|TO_RANGE) ) {
 		ic->last = id;
 		continue;
-	/* Are we at the limit, and converting to a range? */
-	} else if ( ic->count == MDB_IDL_DB_SIZE ) {
+	}
+	/* An entry may yield the same key more than once */
+	if ( ic->last == id )
+		continue;
+	/* Are we at the limit, and converting to a range? With
+	 * idlexact all IDs are stored, however many there are.
+	 */
+	if ( ic->count == MDB_IDL_DB_SIZE &&
+		!( mdb->mi_flags & MDB_IDL_EXACT )) {
 		if ( ic->head ) {
 			ic->tail->next = ai->ai_flist;
 			ai->ai_flist = ic->head;
 		}
 		ic->head = ic->tail = NULL;
+		ic->flags |= TO_RANGE;
 		ic->last = id;
-		ic->count++;
 		continue;
 	}
+	if ( !ic->count )
+		ic->first = id;
+	ic->last = id;
 	/* No free block, create that too */
 	lcount = ic->count & (IDBLOCK-1);
 	if ( !ic->tail || lcount == 0) {
@@ -1231,14 +1626,9 @@ int mdb_tool_idl_add(
 			ic->tail->next = ice;
 		}
 		ic->tail = ice;
-		if ( lcount )
-			ice->ids[lcount-1] = 0;
-		if ( !ic->count )
-			ic->first = id;
 	}
 	ice = ic->tail;
-	if (!lcount || ice->ids[lcount-1] != id)
-		ice->ids[lcount] = id;
+	ice->ids[lcount] = id;
 	ic->count++;
 	}
 
@@ -162,6 +162,7 @@ enum {
 	CFG_TLS_CRL_FILE,
 	CFG_CONCUR,
 	CFG_THREADS,
+	CFG_THREADQS,
 	CFG_SALT,
 	CFG_LIMITS,
 	CFG_RO,
@@ -196,6 +197,7 @@ enum {
 	CFG_ACL_ADD,
 	CFG_SYNC_SUBENTRY,
 	CFG_LTHREADS,
+	CFG_CONNINLINE,
 
 	CFG_LAST
 };
@@ -350,6 +352,9 @@ static ConfigTable config_back_cf_table[] = {
 	{ "concurrency", "level", 2, 2, 0, ARG_INT|ARG_MAGIC|CFG_CONCUR,
 		&config_generic, "( OLcfgGlAt:10 NAME 'olcConcurrency' "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "conn_max_inline", "max", 2, 2, 0, ARG_INT|ARG_MAGIC|CFG_CONNINLINE,
+		&config_generic, "( OLcfgGlAt:96 NAME 'olcConnMaxInline' "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "conn_max_pending", "max", 2, 2, 0, ARG_INT,
 		&slap_conn_max_pending, "( OLcfgGlAt:11 NAME 'olcConnMaxPending' "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
@@ -433,6 +438,14 @@ static ConfigTable config_back_cf_table[] = {
 #endif
 		"( OLcfgGlAt:93 NAME 'olcListenerThreads' "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "listener-reuseport", "on|off", 2, 2, 0,
+#if defined(SO_REUSEPORT) && !defined(NO_THREADS)
+		ARG_ON_OFF, &slapd_listener_reuseport,
+#else
+		ARG_IGNORED, NULL,
+#endif
+		"( OLcfgGlAt:95 NAME 'olcListenerReusePort' "
+			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
 	{ "localSSF", "ssf", 2, 2, 0, ARG_INT,
 		&local_ssf, "( OLcfgGlAt:26 NAME 'olcLocalSSF' "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
@@ -643,6 +656,10 @@ static ConfigTable config_back_cf_table[] = {
 			"DESC 'Attributes whose values will always be sorted' "
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "sortvals-stored", "on|off", 2, 2, 0, ARG_ON_OFF,
+		&slap_sortvals_stored, "( OLcfgGlAt:97 NAME 'olcSortValsStored' "
+			"DESC 'Mark sorted values in stored entries' "
+			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
 	{ "subordinate", "[advertise]", 1, 2, 0, ARG_DB|ARG_MAGIC,
 		&config_subordinate, "( OLcfgDbAt:0.15 NAME 'olcSubordinate' "
 			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
@@ -675,6 +692,14 @@ static ConfigTable config_back_cf_table[] = {
 #endif
 		"( OLcfgGlAt:66 NAME 'olcThreads' "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "threadqueues", "count", 2, 2, 0,
+#ifdef NO_THREADS
+		ARG_IGNORED, NULL,
+#else
+		ARG_INT|ARG_MAGIC|CFG_THREADQS, &config_generic,
+#endif
+		"( OLcfgGlAt:94 NAME 'olcThreadQueues' "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "timelimit", "limit", 2, 0, 0, ARG_MAY_DB|ARG_MAGIC,
 		&config_timelimit, "( OLcfgGlAt:67 NAME 'olcTimeLimit' "
 			"SYNTAX OMsDirectoryString )", NULL, NULL },
@@ -823,11 +848,11 @@ static ConfigOCs cf_ocs[] = {
 		"MAY ( cn $ olcConfigFile $ olcConfigDir $ olcAllows $ olcArgsFile $ "
 		 "olcAttributeOptions $ olcAuthIDRewrite $ "
 		 "olcAuthzPolicy $ olcAuthzRegexp $ olcConcurrency $ "
-		 "olcConnMaxPending $ olcConnMaxPendingAuth $ "
+		 "olcConnMaxInline $ olcConnMaxPending $ olcConnMaxPendingAuth $ "
 		 "olcDisallows $ olcGentleHUP $ olcIdleTimeout $ "
 		 "olcIndexSubstrIfMaxLen $ olcIndexSubstrIfMinLen $ "
 		 "olcIndexSubstrAnyLen $ olcIndexSubstrAnyStep $ olcIndexIntLen $ "
-		 "olcLocalSSF $ olcLogFile $ olcLogLevel $ "
+		 "olcListenerReusePort $ olcLocalSSF $ olcLogFile $ olcLogLevel $ "
 		 "olcPasswordCryptSaltFormat $ olcPasswordHash $ olcPidFile $ "
 		 "olcPluginLogFile $ olcReadOnly $ olcReferral $ "
 		 "olcReplogFile $ olcRequires $ olcRestrict $ olcReverseLookup $ "
@@ -837,7 +862,7 @@ static ConfigOCs cf_ocs[] = {
 		 "olcSecurity $ olcServerID $ olcSizeLimit $ "
 		 "olcSockbufMaxIncoming $ olcSockbufMaxIncomingAuth $ "
 		 "olcTCPBuffer $ "
-		 "olcThreads $ olcTimeLimit $ olcTLSCACertificateFile $ "
+		 "olcThreads $ olcThreadQueues $ olcTimeLimit $ olcTLSCACertificateFile $ "
 		 "olcTLSCACertificatePath $ olcTLSCertificateFile $ "
 		 "olcTLSCertificateKeyFile $ olcTLSCipherSuite $ olcTLSCRLCheck $ "
 		 "olcTLSRandFile $ olcTLSVerifyClient $ olcTLSDHParamFile $ "
@@ -891,7 +916,8 @@ static ConfigOCs cf_ocs[] = {
 		"NAME 'olcFrontendConfig' "
 		"DESC 'OpenLDAP frontend configuration' "
 		"AUXILIARY "
-		"MAY ( olcDefaultSearchBase $ olcPasswordHash $ olcSortVals ) )",
+		"MAY ( olcDefaultSearchBase $ olcPasswordHash $ olcSortVals $ "
+		 "olcSortValsStored ) )",
 		Cft_Database, NULL, NULL },
 #ifdef SLAPD_MODULES
 	{ "( OLcfgGlOc:8 "
@@ -938,12 +964,18 @@ config_generic(ConfigArgs *c) {
 		case CFG_THREADS:
 			c->value_int = connection_pool_max;
 			break;
+		case CFG_THREADQS:
+			c->value_int = connection_pool_queues;
+			break;
 		case CFG_TTHREADS:
 			c->value_int = slap_tool_thread_max;
 			break;
 		case CFG_LTHREADS:
 			c->value_uint = slapd_daemon_threads;
 			break;
+		case CFG_CONNINLINE:
+			c->value_int = slap_conn_max_inline;
+			break;
 		case CFG_SALT:
 			if ( passwd_salt )
 				c->value_string = ch_strdup( passwd_salt );
@@ -1285,8 +1317,10 @@ config_generic(ConfigArgs *c) {
 		/* single-valued attrs, no-ops */
 		case CFG_CONCUR:
 		case CFG_THREADS:
+		case CFG_THREADQS:
 		case CFG_TTHREADS:
 		case CFG_LTHREADS:
+		case CFG_CONNINLINE:
 		case CFG_RO:
 		case CFG_AZPOLICY:
 		case CFG_DEPTH:
@@ -1645,6 +1679,28 @@ config_generic(ConfigArgs *c) {
 			connection_pool_max = c->value_int;	/* save for reference */
 			break;
 
+		case CFG_THREADQS:
+			if ( c->value_int < 1 ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"threadqueues=%d smaller than minimum value 1",
+					c->value_int );
+				Debug(LDAP_DEBUG_ANY, "%s: %s.\n",
+					c->log, c->cr_msg, 0 );
+				return 1;
+			}
+			if ( ( slapMode & SLAP_SERVER_MODE ) &&
+				ldap_pvt_thread_pool_queues( &connection_pool, c->value_int ) )
+			{
+				/* the pool already has threads */
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"threadqueues=%d takes effect after a restart",
+					c->value_int );
+				Debug(LDAP_DEBUG_ANY, "%s: %s.\n",
+					c->log, c->cr_msg, 0 );
+			}
+			connection_pool_queues = c->value_int;	/* save for reference */
+			break;
+
 		case CFG_TTHREADS:
 			if ( slapMode & SLAP_TOOL_MODE )
 				ldap_pvt_thread_pool_maxthreads(&connection_pool, c->value_int);
@@ -1664,6 +1720,18 @@ config_generic(ConfigArgs *c) {
 			}
 			break;
 
+		case CFG_CONNINLINE:
+			if ( c->value_int < 0 || c->value_int > SLAP_CONN_MAX_INLINE ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"conn_max_inline=%d out of range 0..%d",
+					c->value_int, SLAP_CONN_MAX_INLINE );
+				Debug(LDAP_DEBUG_ANY, "%s: %s.\n",
+					c->log, c->cr_msg, 0 );
+				return 1;
+			}
+			slap_conn_max_inline = c->value_int;
+			break;
+
 		case CFG_SALT:
 			if ( passwd_salt ) ch_free( passwd_salt );
 			passwd_salt = c->value_string;
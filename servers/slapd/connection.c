@@ -47,10 +47,18 @@
 #include "slapi/slapi.h"
 #endif
 
-/* protected by connections_mutex */
-static ldap_pvt_thread_mutex_t connections_mutex;
+/*
+ * The c_struct_state of connections[s] is protected by CONN_MUTEX(s).
+ * Descriptors are spread over these mutexes the same way they are spread
+ * over the daemon threads, so that setting up and tearing down sessions
+ * on different daemon threads does not contend.
+ */
+static ldap_pvt_thread_mutex_t *connections_mutex;
+static int connections_mask;
 static Connection *connections = NULL;
 
+#define CONN_MUTEX(s)	(&connections_mutex[(s) & connections_mask])
+
 static ldap_pvt_thread_mutex_t conn_nextid_mutex;
 static unsigned long conn_nextid = SLAPD_SYNC_SYNCCONN_OFFSET;
 
@@ -79,6 +87,8 @@ typedef struct conn_readinfo {
 	void *arg;
 	void *ctx;
 	int nullop;
+	int ninline;
+	Operation *ops[SLAP_CONN_MAX_INLINE];	/* run after op, in order */
 } conn_readinfo;
 
 static int connection_input( Connection *c, conn_readinfo *cri );
@@ -108,7 +118,11 @@ int connections_init(void)
 	}
 
 	/* should check return of every call */
-	ldap_pvt_thread_mutex_init( &connections_mutex );
+	connections_mask = slapd_daemon_mask;
+	connections_mutex = ch_malloc( ( connections_mask + 1 ) *
+		sizeof( ldap_pvt_thread_mutex_t ));
+	for ( i = 0; i <= connections_mask; i++ )
+		ldap_pvt_thread_mutex_init( &connections_mutex[i] );
 	ldap_pvt_thread_mutex_init( &conn_nextid_mutex );
 
 	connections = (Connection *) ch_calloc( dtblsize, sizeof(Connection) );
@@ -169,7 +183,10 @@ int connections_destroy(void)
 	free( connections );
 	connections = NULL;
 
-	ldap_pvt_thread_mutex_destroy( &connections_mutex );
+	for ( i = 0; i <= connections_mask; i++ )
+		ldap_pvt_thread_mutex_destroy( &connections_mutex[i] );
+	ch_free( connections_mutex );
+	connections_mutex = NULL;
 	ldap_pvt_thread_mutex_destroy( &conn_nextid_mutex );
 	return 0;
 }
@@ -292,6 +309,17 @@ static Connection* connection_get( ber_socket_t s )
 	assert( s < dtblsize );
 	c = &connections[s];
 
+	/* an event left over from a session that is gone; don't wait on
+	 * c_mutex just to find out.  The slot is only put into use before
+	 * its descriptor is polled, so a live session is never missed.
+	 */
+	if( c->c_struct_state != SLAP_C_USED ) {
+		Debug( LDAP_DEBUG_CONNS,
+			"connection_get(%d): connection not used\n",
+			s, 0, 0 );
+		return NULL;
+	}
+
 	if( c != NULL ) {
 		ldap_pvt_thread_mutex_lock( &c->c_mutex );
 
@@ -460,10 +488,10 @@ Connection * connection_init(
 
 	if ( flags & CONN_IS_CLIENT ) {
 		c->c_connid = 0;
-		ldap_pvt_thread_mutex_lock( &connections_mutex );
+		ldap_pvt_thread_mutex_lock( CONN_MUTEX( s ));
 		c->c_conn_state = SLAP_C_CLIENT;
 		c->c_struct_state = SLAP_C_USED;
-		ldap_pvt_thread_mutex_unlock( &connections_mutex );
+		ldap_pvt_thread_mutex_unlock( CONN_MUTEX( s ));
 		c->c_close_reason = "?";			/* should never be needed */
 		ber_sockbuf_ctrl( c->c_sb, LBER_SB_OPT_SET_FD, &sfd );
 		ldap_pvt_thread_mutex_unlock( &c->c_mutex );
@@ -547,10 +575,10 @@ Connection * connection_init(
 	id = c->c_connid = conn_nextid++;
 	ldap_pvt_thread_mutex_unlock( &conn_nextid_mutex );
 
-	ldap_pvt_thread_mutex_lock( &connections_mutex );
+	ldap_pvt_thread_mutex_lock( CONN_MUTEX( s ));
 	c->c_conn_state = SLAP_C_INACTIVE;
 	c->c_struct_state = SLAP_C_USED;
-	ldap_pvt_thread_mutex_unlock( &connections_mutex );
+	ldap_pvt_thread_mutex_unlock( CONN_MUTEX( s ));
 	c->c_close_reason = "?";			/* should never be needed */
 
 	c->c_ssf = c->c_transport_ssf = ssf;
@@ -636,9 +664,9 @@ connection_destroy( Connection *c )
 	connid = c->c_connid;
 	close_reason = c->c_close_reason;
 
-	ldap_pvt_thread_mutex_lock( &connections_mutex );
+	ldap_pvt_thread_mutex_lock( CONN_MUTEX( c->c_conn_idx ));
 	c->c_struct_state = SLAP_C_PENDING;
-	ldap_pvt_thread_mutex_unlock( &connections_mutex );
+	ldap_pvt_thread_mutex_unlock( CONN_MUTEX( c->c_conn_idx ));
 
 	backend_connection_destroy(c);
 
@@ -747,7 +775,7 @@ static void connection_abandon( Connection *c )
 	while ( (o = LDAP_STAILQ_FIRST( &c->c_txn_ops )) != NULL) {
 		LDAP_STAILQ_REMOVE_HEAD( &c->c_txn_ops, o_next );
 		LDAP_STAILQ_NEXT(o, o_next) = NULL;
-		slap_op_free( o, NULL );
+		txn_op_free( o );
 	}
 
 	/* clear transaction */
@@ -880,14 +908,7 @@ Connection* connection_first( ber_socket_t *index )
 	assert( connections != NULL );
 	assert( index != NULL );
 
-	ldap_pvt_thread_mutex_lock( &connections_mutex );
-	for( *index = 0; *index < dtblsize; (*index)++) {
-		if( connections[*index].c_struct_state != SLAP_C_UNINITIALIZED ) {
-			break;
-		}
-	}
-	ldap_pvt_thread_mutex_unlock( &connections_mutex );
-
+	*index = 0;
 	return connection_next(NULL, index);
 }
 
@@ -902,41 +923,43 @@ Connection* connection_next( Connection *c, ber_socket_t *index )
 
 	c = NULL;
 
-	ldap_pvt_thread_mutex_lock( &connections_mutex );
 	for(; *index < dtblsize; (*index)++) {
-		int c_struct;
-		if( connections[*index].c_struct_state == SLAP_C_UNINITIALIZED ) {
-			/* FIXME: accessing c_conn_state without locking c_mutex */
-			assert( connections[*index].c_conn_state == SLAP_C_INVALID );
+		ldap_pvt_thread_mutex_t *mutex;
+
+		/* Most slots of a large table are free. Skip them without
+		 * locking; a slot that goes into use meanwhile holds a session
+		 * that started after the loop did.
+		 */
+		if( connections[*index].c_struct_state != SLAP_C_USED ) {
 			continue;
 		}
 
-		if( connections[*index].c_struct_state == SLAP_C_USED ) {
-			c = &connections[(*index)++];
-			if ( ldap_pvt_thread_mutex_trylock( &c->c_mutex )) {
-				/* avoid deadlock */
-				ldap_pvt_thread_mutex_unlock( &connections_mutex );
-				ldap_pvt_thread_mutex_lock( &c->c_mutex );
-				ldap_pvt_thread_mutex_lock( &connections_mutex );
-				if ( c->c_struct_state != SLAP_C_USED ) {
-					ldap_pvt_thread_mutex_unlock( &c->c_mutex );
-					c = NULL;
-					continue;
-				}
-			}
-			assert( c->c_conn_state != SLAP_C_INVALID );
-			break;
+		mutex = CONN_MUTEX( *index );
+		ldap_pvt_thread_mutex_lock( mutex );
+		if( connections[*index].c_struct_state != SLAP_C_USED ) {
+			ldap_pvt_thread_mutex_unlock( mutex );
+			continue;
 		}
 
-		c_struct = connections[*index].c_struct_state;
-		if ( c_struct == SLAP_C_PENDING )
-			continue;
-		assert( c_struct == SLAP_C_UNUSED );
-		/* FIXME: accessing c_conn_state without locking c_mutex */
-		assert( connections[*index].c_conn_state == SLAP_C_INVALID );
+		c = &connections[*index];
+		if ( ldap_pvt_thread_mutex_trylock( &c->c_mutex )) {
+			/* avoid deadlock */
+			ldap_pvt_thread_mutex_unlock( mutex );
+			ldap_pvt_thread_mutex_lock( &c->c_mutex );
+			ldap_pvt_thread_mutex_lock( mutex );
+			if ( c->c_struct_state != SLAP_C_USED ) {
+				ldap_pvt_thread_mutex_unlock( mutex );
+				ldap_pvt_thread_mutex_unlock( &c->c_mutex );
+				c = NULL;
+				continue;
+			}
+		}
+		assert( c->c_conn_state != SLAP_C_INVALID );
+		ldap_pvt_thread_mutex_unlock( mutex );
+		(*index)++;
+		break;
 	}
 
-	ldap_pvt_thread_mutex_unlock( &connections_mutex );
 	return c;
 }
 
@@ -1267,8 +1290,8 @@ static int connection_read( ber_socket_t s, conn_readinfo *cri );
 
 static void* connection_read_thread( void* ctx, void* argv )
 {
-	int rc ;
-	conn_readinfo cri = { NULL, NULL, NULL, NULL, 0 };
+	int rc, i;
+	conn_readinfo cri = { NULL, NULL, NULL, NULL, 0, 0 };
 	ber_socket_t s = (long)argv;
 
 	/*
@@ -1284,6 +1307,12 @@ static void* connection_read_thread( void* ctx, void* argv )
 	/* execute a single queued request in the same thread */
 	if( cri.op && !cri.nullop ) {
 		rc = (long)connection_operation( ctx, cri.op );
+
+		/* and the pipelined requests that were read along with it */
+		for ( i = 0; i < cri.ninline; i++ ) {
+			ldap_pvt_thread_pool_pausecheck( &connection_pool );
+			rc = (long)connection_operation( ctx, cri.ops[i] );
+		}
 	} else if ( cri.func ) {
 		rc = (long)cri.func( ctx, cri.arg );
 	}
@@ -1309,8 +1338,9 @@ int connection_read_activate( ber_socket_t s )
 		ldap_pvt_thread_pool_pausing( &connection_pool ))
 		connection_wake_writers( &connections[s] );
 
-	rc = ldap_pvt_thread_pool_submit( &connection_pool,
-		connection_read_thread, (void *)(long)s );
+	/* keep the work of a connection on one queue of the pool */
+	rc = ldap_pvt_thread_pool_submit_hash( &connection_pool,
+		connection_read_thread, (void *)(long)s, s );
 
 	if( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -1484,6 +1514,24 @@ connection_read( ber_socket_t s, conn_readinfo *cri )
 	return 0;
 }
 
+/* Is this request a Cancel extended op? */
+static int
+connection_op_is_cancel( BerElement *ber )
+{
+	BerElementBuffer berbuf;
+	BerElement *b = (BerElement *)&berbuf;
+	struct berval bv, oid;
+
+	if ( ber_peek_element( ber, &bv ) != LDAP_REQ_EXTENDED )
+		return 0;
+
+	ber_init2( b, &bv, 0 );
+	if ( ber_get_stringbv( b, &oid, LBER_BV_NOTERM ) != LDAP_TAG_EXOP_REQ_OID )
+		return 0;
+
+	return bvmatch( &oid, &slap_EXOP_CANCEL );
+}
+
 static int
 connection_input( Connection *conn , conn_readinfo *cri )
 {
@@ -1685,17 +1733,29 @@ connection_input( Connection *conn , conn_readinfo *cri )
 		 * The first op will be processed in the same thread context,
 		 * as long as there is only one op total.
 		 * Subsequent ops will be submitted to the pool by
-		 * calling connection_op_activate()
+		 * calling connection_op_activate(), unless conn_max_inline
+		 * lets this thread run them one after the other once the
+		 * first op is done.  Abandons and Cancels always go to the
+		 * pool so they don't wait behind the ops they target.
 		 */
 		if ( cri->op == NULL ) {
 			/* the first incoming request */
 			connection_op_queue( op );
 			cri->op = op;
+		} else if ( !cri->nullop && cri->ninline < slap_conn_max_inline &&
+			cri->ninline < SLAP_CONN_MAX_INLINE &&
+			tag != LDAP_REQ_ABANDON &&
+			!( tag == LDAP_REQ_EXTENDED && connection_op_is_cancel( ber )))
+		{
+			connection_op_queue( op );
+			cri->ops[cri->ninline++] = op;
 		} else {
-			if ( !cri->nullop ) {
+			if ( !cri->nullop && !cri->ninline &&
+				slap_conn_max_inline <= 0 )
+			{
 				cri->nullop = 1;
-				rc = ldap_pvt_thread_pool_submit( &connection_pool,
-					connection_operation, (void *) cri->op );
+				rc = ldap_pvt_thread_pool_submit_hash( &connection_pool,
+					connection_operation, (void *) cri->op, conn->c_sd );
 			}
 			connection_op_activate( op );
 		}
@@ -1885,8 +1945,8 @@ static int connection_op_activate( Operation *op )
 
 	connection_op_queue( op );
 
-	rc = ldap_pvt_thread_pool_submit( &connection_pool,
-		connection_operation, (void *) op );
+	rc = ldap_pvt_thread_pool_submit_hash( &connection_pool,
+		connection_operation, (void *) op, op->o_conn->c_sd );
 
 	if ( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
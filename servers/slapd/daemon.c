@@ -76,6 +76,7 @@ struct runqueue_s slapd_rq;
 #define MAX_DAEMON_THREADS	16
 int slapd_daemon_threads = 1;
 int slapd_daemon_mask;
+int slapd_listener_reuseport;
 
 #ifdef LDAP_TCP_BUFFER
 int slapd_tcp_rmem;
@@ -869,10 +870,11 @@ slapd_add( ber_socket_t s, int isactive, Listener *sl, int id )
 }
 
 /*
- * Remove the descriptor from daemon control
+ * Remove the descriptor from the control of daemon thread id
  */
-void
-slapd_remove(
+static void
+slapd_remove_id(
+	int id,
 	ber_socket_t s,
 	Sockbuf *sb,
 	int wasactive,
@@ -881,7 +883,6 @@ slapd_remove(
 {
 	int waswriter;
 	int wasreader;
-	int id = DAEMON_ID(s);
 
 	if ( !locked )
 		ldap_pvt_thread_mutex_lock( &slap_daemon[id].sd_mutex );
@@ -919,8 +920,8 @@ slapd_remove(
 			if ( lr->sl_mute ) {
 				lr->sl_mute = 0;
 				emfile--;
-				if ( DAEMON_ID(lr->sl_sd) != id )
-					WAKE_LISTENER(DAEMON_ID(lr->sl_sd), wake);
+				if ( lr->sl_id != id )
+					WAKE_LISTENER(lr->sl_id, wake);
 				break;
 			}
 		}
@@ -933,6 +934,20 @@ slapd_remove(
 	WAKE_LISTENER(id, wake || slapd_gentle_shutdown == 2);
 }
 
+/*
+ * Remove the descriptor from daemon control
+ */
+void
+slapd_remove(
+	ber_socket_t s,
+	Sockbuf *sb,
+	int wasactive,
+	int wake,
+	int locked )
+{
+	slapd_remove_id( DAEMON_ID(s), s, sb, wasactive, wake, locked );
+}
+
 void
 slapd_clr_write( ber_socket_t s, int wake )
 {
@@ -1312,6 +1327,7 @@ slap_open_listener(
 	l.sl_url.bv_val = NULL;
 	l.sl_mute = 0;
 	l.sl_busy = 0;
+	l.sl_id = 0;
 
 #ifndef HAVE_TLS
 	if( ldap_pvt_url_scheme2tls( lud->lud_scheme ) ) {
@@ -1752,7 +1768,7 @@ close_listeners(
 		if ( lr->sl_sd != AC_SOCKET_INVALID ) {
 			int s = lr->sl_sd;
 			lr->sl_sd = AC_SOCKET_INVALID;
-			if ( remove ) slapd_remove( s, NULL, 0, 0, 0 );
+			if ( remove ) slapd_remove_id( lr->sl_id, s, NULL, 0, 0, 0 );
 
 #ifdef LDAP_PF_LOCAL
 			if ( lr->sl_sa.sa_addr.sa_family == AF_LOCAL ) {
@@ -1844,7 +1860,7 @@ slap_listener(
 	 * additional incoming connections.
 	 */
 	sl->sl_busy = 0;
-	WAKE_LISTENER(DAEMON_ID(sl->sl_sd),1);
+	WAKE_LISTENER(sl->sl_id,1);
 
 	if ( s == AC_SOCKET_INVALID ) {
 		int err = sock_errno();
@@ -2333,7 +2349,8 @@ slapd_daemon_task(
 			return (void*)-1;
 		}
 
-		slapd_add( slap_listeners[l]->sl_sd, 0, slap_listeners[l], -1 );
+		slapd_add( slap_listeners[l]->sl_sd, 0, slap_listeners[l],
+			slap_listeners[l]->sl_id );
 	}
 
 #ifdef HAVE_NT_SERVICE_MANAGER
@@ -2443,7 +2460,7 @@ loop:
 			Listener *lr = slap_listeners[l];
 
 			if ( lr->sl_sd == AC_SOCKET_INVALID ) continue;
-			if ( DAEMON_ID( lr->sl_sd ) != tid ) continue;
+			if ( lr->sl_id != tid ) continue;
 
 			if ( lr->sl_mute || lr->sl_busy )
 			{
@@ -2886,11 +2903,147 @@ connectionless_init( void )
 }
 #endif /* LDAP_CONNECTIONLESS */
 
+#ifdef SO_REUSEPORT
+/*
+ * Open a socket per daemon thread for every TCP listener, all bound to
+ * the listener's address with SO_REUSEPORT, so that the kernel spreads
+ * new connections over the daemon threads and each one accepts on its
+ * own socket.  The listeners were bound before the config was read, so
+ * this may fail on privileged ports once privileges were dropped; the
+ * listener then stays a single socket.
+ */
+static void
+slap_reuseport_listeners( void )
+{
+	Listener **ll;
+	int i, j, n, t;
+
+	for ( n = 0; slap_listeners[n] != NULL; n++ )
+		/* count */ ;
+	ll = ch_malloc( ( n * slapd_daemon_threads + 1 ) * sizeof(Listener *) );
+
+	for ( i = 0, j = 0; i < n; i++ ) {
+		Listener *lr = slap_listeners[i];
+		ber_socklen_t addrlen;
+		int shards = 0, tmp = 1;
+
+		ll[j++] = lr;
+
+		if ( lr->sl_sd == AC_SOCKET_INVALID ) continue;
+#ifdef LDAP_CONNECTIONLESS
+		if ( lr->sl_is_udp ) continue;
+#endif /* LDAP_CONNECTIONLESS */
+
+		switch ( lr->sl_sa.sa_addr.sa_family ) {
+		case AF_INET:
+			addrlen = sizeof(struct sockaddr_in);
+			break;
+#ifdef LDAP_PF_INET6
+		case AF_INET6:
+			addrlen = sizeof(struct sockaddr_in6);
+			break;
+#endif /* LDAP_PF_INET6 */
+		default:
+			continue;
+		}
+
+		for ( t = 0; t < slapd_daemon_threads; t++ ) {
+			Listener *li;
+			ber_socket_t s;
+			int err;
+
+			if ( t == lr->sl_id ) continue;
+
+			s = socket( lr->sl_sa.sa_addr.sa_family, SOCK_STREAM, 0 );
+			if ( s == AC_SOCKET_INVALID ) {
+				err = sock_errno();
+				Debug( LDAP_DEBUG_ANY,
+					"daemon: reuseport socket() for %s failed errno=%d (%s)\n",
+					lr->sl_url.bv_val, err, sock_errstr(err) );
+				break;
+			}
+			if ( SLAP_SOCKNEW( s ) >= dtblsize ) {
+				Debug( LDAP_DEBUG_ANY,
+					"daemon: listener descriptor %ld is too great %ld\n",
+					(long) SLAP_SOCKNEW( s ), (long) dtblsize, 0 );
+				tcp_close( s );
+				break;
+			}
+
+			(void) setsockopt( s, SOL_SOCKET, SO_REUSEADDR,
+				(char *) &tmp, sizeof(tmp) );
+			(void) setsockopt( s, SOL_SOCKET, SO_REUSEPORT,
+				(char *) &tmp, sizeof(tmp) );
+#if defined(LDAP_PF_INET6) && defined(IPV6_V6ONLY)
+			if ( lr->sl_sa.sa_addr.sa_family == AF_INET6 ) {
+				(void) setsockopt( s, IPPROTO_IPV6, IPV6_V6ONLY,
+					(char *) &tmp, sizeof(tmp) );
+			}
+#endif /* LDAP_PF_INET6 && IPV6_V6ONLY */
+
+			if ( bind( s, &lr->sl_sa.sa_addr, addrlen ) ) {
+				err = sock_errno();
+				Debug( LDAP_DEBUG_ANY,
+					"daemon: reuseport bind(%s) failed errno=%d (%s)\n",
+					lr->sl_url.bv_val, err, sock_errstr(err) );
+				tcp_close( s );
+				break;
+			}
+
+			li = ch_malloc( sizeof( Listener ) );
+			*li = *lr;
+			li->sl_sd = SLAP_SOCKNEW( s );
+			li->sl_id = t;
+			ber_dupbv( &li->sl_url, &lr->sl_url );
+			ber_dupbv( &li->sl_name, &lr->sl_name );
+			ll[j++] = li;
+			shards++;
+		}
+
+		/* the first socket must share the port before any of them listen */
+		if ( shards && setsockopt( SLAP_FD2SOCK( lr->sl_sd ), SOL_SOCKET,
+			SO_REUSEPORT, (char *) &tmp, sizeof(tmp) ) == AC_SOCKET_ERROR )
+		{
+			int err = sock_errno();
+			Debug( LDAP_DEBUG_ANY,
+				"daemon: setsockopt(SO_REUSEPORT) on %s failed errno=%d (%s)\n",
+				lr->sl_url.bv_val, err, sock_errstr(err) );
+			while ( shards-- ) {
+				Listener *li = ll[--j];
+				slapd_close( li->sl_sd );
+				ber_memfree( li->sl_url.bv_val );
+				ber_memfree( li->sl_name.bv_val );
+				ch_free( li );
+			}
+			continue;
+		}
+
+		Debug( LDAP_DEBUG_TRACE,
+			"daemon: listener %s shared by %d threads\n",
+			lr->sl_url.bv_val, shards + 1, 0 );
+	}
+	ll[j] = NULL;
+
+	ch_free( slap_listeners );
+	slap_listeners = ll;
+}
+#endif /* SO_REUSEPORT */
+
 int
 slapd_daemon( void )
 {
 	int i, rc;
 
+	for ( i = 0; slap_listeners[i] != NULL; i++ ) {
+		if ( slap_listeners[i]->sl_sd != AC_SOCKET_INVALID )
+			slap_listeners[i]->sl_id = DAEMON_ID( slap_listeners[i]->sl_sd );
+	}
+
+#ifdef SO_REUSEPORT
+	if ( slapd_listener_reuseport && slapd_daemon_threads > 1 )
+		slap_reuseport_listeners();
+#endif /* SO_REUSEPORT */
+
 #ifdef LDAP_CONNECTIONLESS
 	connectionless_init();
 #endif /* LDAP_CONNECTIONLESS */
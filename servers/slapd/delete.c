@@ -171,6 +171,13 @@ fe_op_delete( Operation *op, SlapReply *rs )
 			int		org_managedsait;
 
 			op->o_bd = op_be;
+#ifdef LDAP_X_TXN
+			if ( op->o_txnSpec ) {
+				/* queued, performed when the transaction ends */
+				txn_preop( op, rs );
+				goto cleanup;
+			}
+#endif
 			op->o_bd->be_delete( op, rs );
 
 			org_req_dn = op->o_req_dn;
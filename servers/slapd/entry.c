@@ -37,7 +37,6 @@
 #include "ldif.h"
 
 static char		*ebuf;	/* buf returned by entry2str		 */
-static char		*ecur;	/* pointer to end of currently used ebuf */
 static int		emaxsize;/* max size of ebuf			 */
 
 /*
@@ -73,7 +72,6 @@ int entry_destroy(void)
 	slap_list *e;
 	if ( ebuf ) free( ebuf );
 	ebuf = NULL;
-	ecur = NULL;
 	emaxsize = 0;
 
 	for ( e=entry_chunks; e; e=entry_chunks ) {
@@ -416,13 +414,13 @@ fail:
 #define GRABSIZE	BUFSIZ
 
 #define MAKE_SPACE( n )	{ \
-		while ( ecur + (n) > ebuf + emaxsize ) { \
+		while ( ecur + (n) > *ebufp + *emaxp ) { \
 			ptrdiff_t	offset; \
-			offset = (int) (ecur - ebuf); \
-			ebuf = ch_realloc( ebuf, \
-				emaxsize + GRABSIZE ); \
-			emaxsize += GRABSIZE; \
-			ecur = ebuf + offset; \
+			offset = (int) (ecur - *ebufp); \
+			*ebufp = ch_realloc( *ebufp, \
+				*emaxp + GRABSIZE ); \
+			*emaxp += GRABSIZE; \
+			ecur = *ebufp + offset; \
 		} \
 	}
 
@@ -440,11 +438,27 @@ entry2str_wrap(
 	Entry		*e,
 	int			*len,
 	ber_len_t	wrap )
+{
+	return entry2str_wrap_r( e, len, wrap, &ebuf, &emaxsize );
+}
+
+/* Same as entry2str_wrap(), but into the caller's buffer *ebufp of
+ * *emaxp bytes, which is grown as needed. Does not need the
+ * entry2str_mutex.
+ */
+char *
+entry2str_wrap_r(
+	Entry		*e,
+	int			*len,
+	ber_len_t	wrap,
+	char		**ebufp,
+	int			*emaxp )
 {
 	Attribute	*a;
 	struct berval	*bv;
 	int		i;
 	ber_len_t tmplen;
+	char		*ecur;
 
 	assert( e != NULL );
 
@@ -454,7 +468,7 @@ entry2str_wrap(
 	 *	[<attr>: <value>\n]*
 	 */
 
-	ecur = ebuf;
+	ecur = *ebufp;
 
 	/* put the dn */
 	if ( e->e_dn != NULL ) {
@@ -478,9 +492,9 @@ entry2str_wrap(
 	}
 	MAKE_SPACE( 1 );
 	*ecur = '\0';
-	*len = ecur - ebuf;
+	*len = ecur - *ebufp;
 
-	return( ebuf );
+	return( *ebufp );
 }
 
 void
@@ -627,6 +641,15 @@ entry_id_cmp( const void *v_e1, const void *v_e2 )
 	return( e1->e_id < e2->e_id ? -1 : (e1->e_id > e2->e_id ? 1 : 0) );
 }
 
+/* Set in an attribute's count of values if they are stored in the
+ * order of their SORTED_VAL attribute type. Only written when
+ * slap_sortvals_stored is on, releases that don't know the flag
+ * can't read such entries.
+ */
+#define ENTRY_SORTED_VALS	0x40000000
+
+int slap_sortvals_stored;
+
 /* This is like a ber_len */
 #define entry_lenlen(l)	(((l) < 0x80) ? 1 : ((l) < 0x100) ? 2 : \
 	((l) < 0x10000) ? 3 : ((l) < 0x1000000) ? 4 : 5)
@@ -693,6 +716,8 @@ void entry_partsize(Entry *e, ber_len_t *plen,
 			len += a->a_vals[i].bv_len + 1;
 			len += entry_lenlen(a->a_vals[i].bv_len);
 		}
+		if (slap_sortvals_stored && (a->a_flags & SLAP_ATTR_SORTED_VALS))
+			i |= ENTRY_SORTED_VALS;
 		len += entry_lenlen(i);
 		nval++;	/* empty berval at end */
 		if (norm && a->a_nvals != a->a_vals) {
@@ -731,7 +756,8 @@ ber_len_t entry_flatsize(Entry *e, int norm)
  * by its length, encoded the way ber_put_len works. Every field is NUL
  * terminated.  The entire buffer size is precomputed so that a single
  * malloc can be performed. The entry size is also recorded,
- * to aid in entry_decode.
+ * to aid in entry_decode. With sortvals-stored on, the count of an
+ * attribute's values carries ENTRY_SORTED_VALS if they are sorted.
  */
 int entry_encode(Entry *e, struct berval *bv)
 {
@@ -771,7 +797,11 @@ int entry_encode(Entry *e, struct berval *bv)
 		if (a->a_vals) {
 			for (i=0; a->a_vals[i].bv_val; i++);
 			assert( i == a->a_numvals );
-			entry_putlen(&ptr, i);
+			if (slap_sortvals_stored &&
+				(a->a_flags & SLAP_ATTR_SORTED_VALS))
+				entry_putlen(&ptr, i | ENTRY_SORTED_VALS);
+			else
+				entry_putlen(&ptr, i);
 			for (i=0; a->a_vals[i].bv_val; i++) {
 				entry_putlen(&ptr, a->a_vals[i].bv_len);
 				AC_MEMCPY(ptr, a->a_vals[i].bv_val,
@@ -858,7 +888,7 @@ int entry_decode(EntryHeader *eh, Entry **e, void *ctx)
 int entry_decode(EntryHeader *eh, Entry **e)
 #endif
 {
-	int i, j, nattrs, nvals;
+	int i, j, nattrs, nvals, sorted;
 	int rc;
 	Attribute *a;
 	Entry *x;
@@ -911,6 +941,8 @@ int entry_decode(EntryHeader *eh, Entry **e)
 		a->a_desc = ad;
 		a->a_flags = SLAP_ATTR_DONT_FREE_DATA | SLAP_ATTR_DONT_FREE_VALS;
 		j = entry_getlen(&ptr);
+		sorted = j & ENTRY_SORTED_VALS;
+		j &= ~ENTRY_SORTED_VALS;
 		a->a_numvals = j;
 		a->a_vals = bptr;
 
@@ -943,17 +975,23 @@ int entry_decode(EntryHeader *eh, Entry **e)
 		} else {
 			a->a_nvals = a->a_vals;
 		}
-		/* FIXME: This is redundant once a sorted entry is saved into the DB */
+		/* Entries written before their values were stored sorted,
+		 * or before the type was made SORTED_VAL, still need it.
+		 */
 		if ( a->a_desc->ad_type->sat_flags & SLAP_AT_SORTED_VAL ) {
-			rc = slap_sort_vals( (Modifications *)a, &text, &j, NULL );
-			if ( rc == LDAP_SUCCESS ) {
+			if ( sorted ) {
 				a->a_flags |= SLAP_ATTR_SORTED_VALS;
-			} else if ( rc == LDAP_TYPE_OR_VALUE_EXISTS ) {
-				/* should never happen */
-				Debug( LDAP_DEBUG_ANY,
-					"entry_decode: attributeType %s value #%d provided more than once\n",
-					a->a_desc->ad_cname.bv_val, j, 0 );
-				return rc;
+			} else {
+				rc = slap_sort_vals( (Modifications *)a, &text, &j, NULL );
+				if ( rc == LDAP_SUCCESS ) {
+					a->a_flags |= SLAP_ATTR_SORTED_VALS;
+				} else if ( rc == LDAP_TYPE_OR_VALUE_EXISTS ) {
+					/* should never happen */
+					Debug( LDAP_DEBUG_ANY,
+						"entry_decode: attributeType %s value #%d provided more than once\n",
+						a->a_desc->ad_cname.bv_val, j, 0 );
+					return rc;
+				}
 			}
 		}
 		a = a->a_next;
@@ -300,6 +300,13 @@ fe_op_modify( Operation *op, SlapReply *rs )
 					goto cleanup;
 				}
 			}
+#ifdef LDAP_X_TXN
+			if ( op->o_txnSpec ) {
+				/* queued, performed when the transaction ends */
+				txn_preop( op, rs );
+				goto cleanup;
+			}
+#endif
 			op->o_bd->be_modify( op, rs );
 
 		} else { /* send a referral */
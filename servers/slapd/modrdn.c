@@ -311,6 +311,13 @@ fe_op_modrdn( Operation *op, SlapReply *rs )
 		if ( !SLAP_SINGLE_SHADOW(op->o_bd) || repl_user )
 		{
 			op->o_bd = op_be;
+#ifdef LDAP_X_TXN
+			if ( op->o_txnSpec ) {
+				/* queued, performed when the transaction ends */
+				txn_preop( op, rs );
+				goto cleanup;
+			}
+#endif
 			op->o_bd->be_modrdn( op, rs );
 
 			if ( op->o_bd->be_delete ) {
@@ -279,16 +279,86 @@ rs_entry2modifiable( Operation *op, SlapReply *rs, slap_overinst *on )
 	return 1;
 }
 
-static long send_ldap_ber(
+/*
+ * Search entries and references are collected per thread and written
+ * to the connection in batches of up to SLAP_BATCH_SIZE bytes, instead
+ * of taking the connection's write locks and doing a write for every
+ * PDU.  The batch is flushed when it is full, when it holds
+ * SLAP_BATCH_ENTRIES PDUs, when a PDU is added in a later second than
+ * the first one it holds, ahead of any result or intermediate response,
+ * and when the search returns.  So a client sees the first entries of a
+ * search that finds few of them slowly without waiting for all of it.
+ * The batch is written through the Sockbuf like any other PDU so TLS
+ * and SASL layers apply.
+ */
+#define SLAP_BATCH_SIZE	65536
+#define SLAP_BATCH_ENTRIES	256
+
+typedef struct send_batch {
+	BerElement	*sb_ber;
+	Connection	*sb_conn;
+	ber_int_t	sb_msgid;
+	ber_len_t	sb_len;
+	int		sb_count;
+	time_t		sb_time;	/* when the first PDU was added */
+} send_batch;
+
+static void
+send_batch_free( void *key, void *data )
+{
+	send_batch *sb = data;
+
+	if ( sb->sb_ber )
+		ber_free( sb->sb_ber, 1 );
+	ch_free( sb );
+}
+
+static send_batch *
+send_batch_get( Operation *op )
+{
+	void *data = NULL;
+	send_batch *sb;
+
+	if ( !op->o_threadctx || ldap_pvt_thread_pool_getkey( op->o_threadctx,
+		(void *)send_ldap_batch_begin, &data, NULL ) || !data )
+		return NULL;
+
+	/* only the operation that started the batch uses it */
+	sb = data;
+	if ( sb->sb_conn != op->o_conn || sb->sb_msgid != op->o_msgid )
+		return NULL;
+	return sb;
+}
+
+/* empty the batch, keeping its buffer unless it grew too big */
+static void
+send_batch_reset( send_batch *sb )
+{
+	ber_len_t total;
+
+	if ( !sb->sb_len )
+		return;
+	sb->sb_len = 0;
+	sb->sb_count = 0;
+
+	ber_get_option( sb->sb_ber, LBER_OPT_BER_TOTAL_BYTES, &total );
+	if ( total > 2 * SLAP_BATCH_SIZE ) {
+		ber_free( sb->sb_ber, 1 );
+		sb->sb_ber = NULL;
+		return;
+	}
+	ber_reset( sb->sb_ber, 1 );
+	ber_set_option( sb->sb_ber, LBER_OPT_BER_TOTAL_BYTES, &total );
+}
+
+static long send_ldap_flush(
 	Operation *op,
-	BerElement *ber )
+	BerElement *ber,
+	ber_len_t bytes )
 {
 	Connection *conn = op->o_conn;
-	ber_len_t bytes;
 	long ret = 0;
 
-	ber_get_option( ber, LBER_OPT_BER_BYTES_TO_WRITE, &bytes );
-
 	/* write only one pdu at a time - wait til it's our turn */
 	ldap_pvt_thread_mutex_lock( &conn->c_write1_mutex );
 	if (( op->o_abandon && !op->o_cancel ) || !connection_valid( conn ) ||
@@ -395,6 +465,106 @@ static long send_ldap_ber(
 	return ret;
 }
 
+static long
+send_ldap_batch_flush( Operation *op, send_batch *sb )
+{
+	long ret = 0;
+
+	if ( sb->sb_len ) {
+		ret = send_ldap_flush( op, sb->sb_ber, sb->sb_len );
+		send_batch_reset( sb );
+	}
+	return ret;
+}
+
+/* collect the PDUs of this operation until send_ldap_batch_end() */
+void
+send_ldap_batch_begin( Operation *op )
+{
+	void *data = NULL;
+	send_batch *sb;
+
+	if ( !op->o_threadctx || !op->o_conn )
+		return;
+#ifdef LDAP_CONNECTIONLESS
+	if ( op->o_conn->c_is_udp )
+		return;
+#endif
+
+	if ( ldap_pvt_thread_pool_getkey( op->o_threadctx,
+		(void *)send_ldap_batch_begin, &data, NULL ) || !data )
+	{
+		data = ch_calloc( 1, sizeof( send_batch ));
+		if ( ldap_pvt_thread_pool_setkey( op->o_threadctx,
+			(void *)send_ldap_batch_begin, data, send_batch_free,
+			NULL, NULL ))
+		{
+			ch_free( data );
+			return;
+		}
+	}
+	sb = data;
+	sb->sb_conn = op->o_conn;
+	sb->sb_msgid = op->o_msgid;
+}
+
+/* write out whatever is left of the batch and stop collecting */
+void
+send_ldap_batch_end( Operation *op )
+{
+	send_batch *sb = send_batch_get( op );
+
+	if ( sb == NULL )
+		return;
+	send_ldap_batch_flush( op, sb );
+	sb->sb_conn = NULL;
+}
+
+static long send_ldap_ber(
+	Operation *op,
+	BerElement *ber,
+	int more )
+{
+	send_batch *sb;
+	struct berval bv;
+	ber_len_t bytes;
+	time_t now;
+	long ret;
+
+	ber_get_option( ber, LBER_OPT_BER_BYTES_TO_WRITE, &bytes );
+
+	sb = send_batch_get( op );
+	if ( sb == NULL || ( !sb->sb_len && bytes >= SLAP_BATCH_SIZE ))
+		return send_ldap_flush( op, ber, bytes );
+
+	if ( sb->sb_ber == NULL ) {
+		sb->sb_ber = ber_alloc_t( LBER_USE_DER );
+		if ( sb->sb_ber == NULL )
+			return send_ldap_flush( op, ber, bytes );
+	}
+	if ( ber_flatten2( ber, &bv, 0 ) == -1 ||
+		ber_write( sb->sb_ber, bv.bv_val, bv.bv_len, 0 ) != (ber_slen_t)bv.bv_len )
+	{
+		/* keep what was batched in order ahead of this pdu */
+		ret = send_ldap_batch_flush( op, sb );
+		if ( ret < 0 )
+			return ret;
+		return send_ldap_flush( op, ber, bytes );
+	}
+	now = slap_get_time();
+	if ( !sb->sb_len )
+		sb->sb_time = now;
+	sb->sb_len += bv.bv_len;
+	sb->sb_count++;
+
+	if ( more && sb->sb_len < SLAP_BATCH_SIZE &&
+		sb->sb_count < SLAP_BATCH_ENTRIES && now == sb->sb_time )
+		return bytes;
+
+	ret = send_ldap_batch_flush( op, sb );
+	return ret > 0 ? bytes : ret;
+}
+
 static int
 send_ldap_control( BerElement *ber, LDAPControl *c )
 {
@@ -701,7 +871,7 @@ send_ldap_response(
 	}
 
 	/* send BER */
-	bytes = send_ldap_ber( op, ber );
+	bytes = send_ldap_ber( op, ber, 0 );
 #ifdef LDAP_CONNECTIONLESS
 	if (!op->o_conn || op->o_conn->c_is_udp == 0)
 #endif
@@ -1426,7 +1596,7 @@ slap_send_search_entry( Operation *op, SlapReply *rs )
 	rs_flush_entry( op, rs, NULL );
 
 	if ( op->o_res_ber == NULL ) {
-		bytes = send_ldap_ber( op, ber );
+		bytes = send_ldap_ber( op, ber, 1 );
 		ber_free_buf( ber );
 
 		if ( bytes < 0 ) {
@@ -1594,7 +1764,7 @@ slap_send_search_reference( Operation *op, SlapReply *rs )
 #ifdef LDAP_CONNECTIONLESS
 	if (!op->o_conn || op->o_conn->c_is_udp == 0) {
 #endif
-	bytes = send_ldap_ber( op, ber );
+	bytes = send_ldap_ber( op, ber, 1 );
 	ber_free_buf( ber );
 
 	if ( bytes < 0 ) {
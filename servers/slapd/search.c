@@ -244,7 +244,9 @@ do_search(
 	}
 
 	op->o_bd = frontendDB;
+	send_ldap_batch_begin( op );
 	rs->sr_err = frontendDB->be_search( op, rs );
+	send_ldap_batch_end( op );
 
 return_results:;
 	if ( !BER_BVISNULL( &op->o_req_dn ) ) {
@@ -48,15 +48,29 @@ typedef struct Erec {
 	int nextline;
 } Erec;
 
+/* A record on its way from the LDIF file to the database. Records
+ * are read in order by whichever parser thread is free, parsed and
+ * checked in parallel, and handed to the database in the order they
+ * were read.
+ */
 typedef struct Trec {
 	Entry *e;
 	int lineno;
 	int nextline;
 	int rc;
-	int ready;
+	int state;
+#define	TREC_FREE	0
+#define	TREC_PARSING	1
+#define	TREC_READY	2
+	char *buf;
+	int lmax;
 } Trec;
 
-static Trec trec;
+static Trec *trecs;
+static int ntrecs;
+static int trec_in, trec_out;
+static int trec_eof;
+static int readline;
 static unsigned long sid = SLAP_SYNC_SID_MAX + 1;
 static int checkvals;
 static int enable_meter;
@@ -70,42 +84,49 @@ static ldap_pvt_thread_mutex_t add_mutex;
 static ldap_pvt_thread_cond_t add_cond;
 static int add_stop;
 
-/* returns:
+/* read the next record into *bufp. returns:
  *	1: got a record
  *	0: EOF
  * -1: read failure
- * -2: parse failure
  */
 static int
-getrec0(Erec *erec)
+getrec_read(int *lineno, int *nextline, char **bufp, int *lmaxp)
 {
-	const char *text;
 	int ldifrc;
-	char textbuf[SLAP_TEXT_BUFLEN] = { '\0' };
-	size_t textlen = sizeof textbuf;
-	struct berval csn;
-	Operation *op = &opbuf.ob_op;
-	op->o_hdr = &opbuf.ob_hdr;
 
 again:
-	erec->lineno = erec->nextline+1;
+	*lineno = *nextline+1;
 	/* nextline is the line number of the end of the current entry */
-	ldifrc = ldif_read_record( ldiffp, &erec->nextline, &buf, &lmax );
+	ldifrc = ldif_read_record( ldiffp, nextline, bufp, lmaxp );
 	if (ldifrc < 1)
 		return ldifrc < 0 ? -1 : 0;
+
+	if ( *lineno < jumpline )
+		goto again;
+
+	if ( enable_meter )
+		lutil_meter_update( &meter,
+				 ftell( ldiffp->fp ),
+				 0);
+	return 1;
+}
+
+/* turn a record into an entry and check it. returns:
+ *	1: got an entry
+ * -2: parse failure
+ */
+static int
+getrec_parse(Operation *op, Erec *erec, char *rbuf)
+{
+	const char *text;
+	char textbuf[SLAP_TEXT_BUFLEN] = { '\0' };
+	size_t textlen = sizeof textbuf;
+
 	{
 		BackendDB *bd;
 		Entry *e;
 
-		if ( erec->lineno < jumpline )
-			goto again;
-
-		e = str2entry2( buf, checkvals );
-
-		if ( enable_meter )
-			lutil_meter_update( &meter,
-					 ftell( ldiffp->fp ),
-					 0);
+		e = str2entry2( rbuf, checkvals );
 
 		if( e == NULL ) {
 			fprintf( stderr, "%s: could not parse entry (line=%d)\n",
@@ -177,6 +198,21 @@ again:
 			entry_free( e );
 			return -2;
 		}
+		erec->e = e;
+	}
+	return 1;
+}
+
+/* add the operational attributes; done in LDIF order since it
+ * generates CSNs and tracks the contextCSN
+ */
+static void
+getrec_stamp(Erec *erec)
+{
+	struct berval csn;
+
+	{
+		Entry *e = erec->e;
 
 		if ( SLAP_LASTMOD(be) ) {
 			time_t now = slap_get_time();
@@ -280,47 +316,100 @@ again:
 
 			sid = slap_tool_update_ctxcsn_check( progname, e );
 		}
-		erec->e = e;
 	}
-	return 1;
+}
+
+/* returns:
+ *	1: got a record
+ *	0: EOF
+ * -1: read failure
+ * -2: parse failure
+ */
+static int
+getrec0(Erec *erec)
+{
+	Operation *op = &opbuf.ob_op;
+	int rc;
+
+	op->o_hdr = &opbuf.ob_hdr;
+
+	rc = getrec_read( &erec->lineno, &erec->nextline, &buf, &lmax );
+	if ( rc == 1 )
+		rc = getrec_parse( op, erec, buf );
+	if ( rc == 1 )
+		getrec_stamp( erec );
+	return rc;
 }
 
 static void *
 getrec_thr(void *ctx)
 {
+	OperationBuffer *opb = ch_calloc( 1, sizeof( OperationBuffer ));
+	Operation *op = &opb->ob_op;
+	Trec *t;
+
+	op->o_hdr = &opb->ob_hdr;
+
 	ldap_pvt_thread_mutex_lock( &add_mutex );
 	while (!add_stop) {
-		trec.rc = getrec0((Erec *)&trec);
-		trec.ready = 1;
-		while (trec.ready)
+		t = &trecs[ trec_in % ntrecs ];
+		if ( trec_eof || t->state != TREC_FREE ) {
 			ldap_pvt_thread_cond_wait( &add_cond, &add_mutex );
-		/* eof or read failure */
-		if ( trec.rc == 0 || trec.rc == -1 )
-			break;
+			continue;
+		}
+		trec_in++;
+
+		/* reading stays serial, the parsing is done unlocked */
+		t->rc = getrec_read( &t->lineno, &readline, &t->buf, &t->lmax );
+		t->nextline = readline;
+		if ( t->rc == 1 ) {
+			t->state = TREC_PARSING;
+			ldap_pvt_thread_mutex_unlock( &add_mutex );
+			t->rc = getrec_parse( op, (Erec *)t, t->buf );
+			ldap_pvt_thread_mutex_lock( &add_mutex );
+		} else {
+			/* eof or read failure */
+			trec_eof = 1;
+		}
+		t->state = TREC_READY;
+		ldap_pvt_thread_cond_broadcast( &add_cond );
 	}
 	ldap_pvt_thread_mutex_unlock( &add_mutex );
+	ch_free( opb );
 	return NULL;
 }
 
 static int ldif_threaded;
+static ldap_pvt_thread_t *ldif_thr;
 
 static int
 getrec(Erec *erec)
 {
+	Trec *t;
 	int rc;
+
 	if ( !ldif_threaded )
 		return getrec0(erec);
 
-	while (!trec.ready)
-		ldap_pvt_thread_yield();
-	erec->e = trec.e;
-	erec->lineno = trec.lineno;
-	erec->nextline = trec.nextline;
-	trec.ready = 0;
-	rc = trec.rc;
+	t = &trecs[ trec_out % ntrecs ];
 	ldap_pvt_thread_mutex_lock( &add_mutex );
+	while ( t->state != TREC_READY )
+		ldap_pvt_thread_cond_wait( &add_cond, &add_mutex );
+	erec->e = t->e;
+	erec->lineno = t->lineno;
+	erec->nextline = t->nextline;
+	rc = t->rc;
+	/* eof and read failures stay put for the parser threads to see */
+	if ( rc != 0 && rc != -1 ) {
+		t->e = NULL;
+		t->state = TREC_FREE;
+		trec_out++;
+		ldap_pvt_thread_cond_broadcast( &add_cond );
+	}
 	ldap_pvt_thread_mutex_unlock( &add_mutex );
-	ldap_pvt_thread_cond_signal( &add_cond );
+
+	if ( rc == 1 )
+		getrec_stamp( erec );
 	return rc;
 }
 
@@ -331,7 +420,6 @@ slapadd( int argc, char **argv )
 	size_t textlen = sizeof textbuf;
 	Erec erec;
 	struct berval bvtext;
-	ldap_pvt_thread_t thr;
 	ID id;
 	Entry *prev = NULL;
 
@@ -404,10 +492,17 @@ slapadd( int argc, char **argv )
 	}
 
 	if ( slap_tool_thread_max > 1 ) {
+		int i;
+
+		/* the parser threads share the records to fill */
+		ldif_threaded = slap_tool_thread_max - 1;
+		ntrecs = ldif_threaded * 8;
+		trecs = ch_calloc( ntrecs, sizeof( Trec ));
+		ldif_thr = ch_calloc( ldif_threaded, sizeof( ldap_pvt_thread_t ));
 		ldap_pvt_thread_mutex_init( &add_mutex );
 		ldap_pvt_thread_cond_init( &add_cond );
-		ldap_pvt_thread_create( &thr, 0, getrec_thr, NULL );
-		ldif_threaded = 1;
+		for ( i = 0; i < ldif_threaded; i++ )
+			ldap_pvt_thread_create( &ldif_thr[i], 0, getrec_thr, NULL );
 	}
 
 	erec.nextline = 0;
@@ -456,12 +551,25 @@ slapadd( int argc, char **argv )
 	}
 
 	if ( ldif_threaded ) {
+		int i;
+
 		ldap_pvt_thread_mutex_lock( &add_mutex );
 		add_stop = 1;
-		trec.ready = 0;
-		ldap_pvt_thread_cond_signal( &add_cond );
+		ldap_pvt_thread_cond_broadcast( &add_cond );
 		ldap_pvt_thread_mutex_unlock( &add_mutex );
-		ldap_pvt_thread_join( thr, NULL );
+		for ( i = 0; i < ldif_threaded; i++ )
+			ldap_pvt_thread_join( ldif_thr[i], NULL );
+
+		/* drop what was parsed but not added */
+		for ( i = 0; i < ntrecs; i++ ) {
+			if ( trecs[i].state == TREC_READY && trecs[i].rc == 1 )
+				entry_free( trecs[i].e );
+			ch_free( trecs[i].buf );
+		}
+		ch_free( trecs );
+		ch_free( ldif_thr );
+		ldap_pvt_thread_cond_destroy( &add_cond );
+		ldap_pvt_thread_mutex_destroy( &add_mutex );
 	}
 	if ( erec.e ) entry_free( erec.e );
 
@@ -33,6 +33,33 @@
 #include "ldif.h"
 
 static volatile sig_atomic_t gotsig;
+static const char *progname = "slapcat";
+
+/* An entry on its way to the output. With tool-threads > 1 entries
+ * are turned into LDIF by several threads, and written out in the
+ * order the database returned them.
+ */
+typedef struct Crec {
+	Entry *e;
+	ID id;
+	int state;
+#define	CREC_FREE	0
+#define	CREC_FULL	1	/* waiting to be formatted */
+#define	CREC_BUSY	2
+#define	CREC_READY	3
+	char *data;
+	int len;
+	char *buf;
+	int size;
+} Crec;
+
+static Crec *crecs;
+static int ncrecs;
+static int crec_in, crec_fmt;
+static int cat_stop;	/* stop writing, after a fatal error */
+static int cat_done;	/* stop formatting */
+static ldap_pvt_thread_mutex_t cat_mutex;
+static ldap_pvt_thread_cond_t cat_cond;
 
 static RETSIGTYPE
 slapcat_sig( int sig )
@@ -40,15 +67,129 @@ slapcat_sig( int sig )
 	gotsig=1;
 }
 
+static int
+slapcat_write( ID id, char *data )
+{
+	if ( verbose ) {
+		printf( "# id=%08lx\n", (long) id );
+	}
+
+	if ( data == NULL ) {
+		printf("# bad data for entry id=%08lx\n\n", (long) id );
+		if ( !continuemode )
+			cat_stop = 1;
+		return EXIT_FAILURE;
+	}
+
+	if ( fputs( data, ldiffp->fp ) == EOF ||
+		fputs( "\n", ldiffp->fp ) == EOF ) {
+		fprintf(stderr, "%s: error writing output.\n",
+			progname);
+		cat_stop = 1;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+static void *
+slapcat_thr( void *ctx )
+{
+	Crec *c;
+
+	ldap_pvt_thread_mutex_lock( &cat_mutex );
+	while ( !cat_done ) {
+		c = &crecs[ crec_fmt % ncrecs ];
+		if ( c->state != CREC_FULL ) {
+			ldap_pvt_thread_cond_wait( &cat_cond, &cat_mutex );
+			continue;
+		}
+		c->state = CREC_BUSY;
+		crec_fmt++;
+		ldap_pvt_thread_mutex_unlock( &cat_mutex );
+
+		c->data = entry2str_wrap_r( c->e, &c->len, ldif_wrap,
+			&c->buf, &c->size );
+
+		ldap_pvt_thread_mutex_lock( &cat_mutex );
+		c->state = CREC_READY;
+		ldap_pvt_thread_cond_broadcast( &cat_cond );
+	}
+	ldap_pvt_thread_mutex_unlock( &cat_mutex );
+	return NULL;
+}
+
+/* wait for the entry in a slot to be formatted and write it out */
+static int
+slapcat_drain( Operation *op, Crec *c )
+{
+	int rc = EXIT_SUCCESS;
+
+	ldap_pvt_thread_mutex_lock( &cat_mutex );
+	while ( c->state != CREC_READY )
+		ldap_pvt_thread_cond_wait( &cat_cond, &cat_mutex );
+	ldap_pvt_thread_mutex_unlock( &cat_mutex );
+
+	if ( !cat_stop )
+		rc = slapcat_write( c->id, c->data );
+	be_entry_release_r( op, c->e );
+	c->e = NULL;
+
+	ldap_pvt_thread_mutex_lock( &cat_mutex );
+	c->state = CREC_FREE;
+	ldap_pvt_thread_mutex_unlock( &cat_mutex );
+	return rc;
+}
+
+/* write out all queued entries, in order */
+static int
+slapcat_flush( Operation *op )
+{
+	int i, rc = EXIT_SUCCESS;
+
+	for ( i = 0; i < ncrecs; i++ ) {
+		Crec *c = &crecs[ ( crec_in + i ) % ncrecs ];
+		if ( c->e && slapcat_drain( op, c ) != EXIT_SUCCESS )
+			rc = EXIT_FAILURE;
+	}
+	return rc;
+}
+
+/* hand an entry to the formatting threads, after writing out the
+ * one that had its slot
+ */
+static int
+slapcat_queue( Operation *op, ID id, Entry *e )
+{
+	Crec *c = &crecs[ crec_in % ncrecs ];
+	int rc = EXIT_SUCCESS;
+
+	if ( c->e )
+		rc = slapcat_drain( op, c );
+	if ( cat_stop ) {
+		be_entry_release_r( op, e );
+		return rc;
+	}
+
+	c->e = e;
+	c->id = id;
+	ldap_pvt_thread_mutex_lock( &cat_mutex );
+	c->state = CREC_FULL;
+	crec_in++;
+	ldap_pvt_thread_cond_broadcast( &cat_cond );
+	ldap_pvt_thread_mutex_unlock( &cat_mutex );
+	return rc;
+}
+
 int
 slapcat( int argc, char **argv )
 {
 	ID id;
 	int rc = EXIT_SUCCESS;
 	Operation op = {0};
-	const char *progname = "slapcat";
 	int requestBSF;
 	int doBSF = 0;
+	int nthr = 0, i;
+	ldap_pvt_thread_t *thr = NULL;
 
 	slap_tool_init( progname, SLAPCAT, argc, argv );
 
@@ -80,6 +221,17 @@ slapcat( int argc, char **argv )
 		exit( EXIT_FAILURE );
 	}
 
+	if ( slap_tool_thread_max > 1 ) {
+		nthr = slap_tool_thread_max - 1;
+		ncrecs = nthr * 16;
+		crecs = ch_calloc( ncrecs, sizeof( Crec ));
+		thr = ch_calloc( nthr, sizeof( ldap_pvt_thread_t ));
+		ldap_pvt_thread_mutex_init( &cat_mutex );
+		ldap_pvt_thread_cond_init( &cat_cond );
+		for ( i = 0; i < nthr; i++ )
+			ldap_pvt_thread_create( &thr[i], 0, slapcat_thr, NULL );
+	}
+
 	op.o_bd = be;
 	if ( !requestBSF && be->be_entry_first ) {
 		id = be->be_entry_first( be );
@@ -102,11 +254,16 @@ slapcat( int argc, char **argv )
 		int len;
 		Entry* e;
 
-		if ( gotsig )
+		if ( gotsig || cat_stop )
 			break;
 
 		e = be->be_entry_get( be, id );
 		if ( e == NULL ) {
+			if ( ncrecs && slapcat_flush( &op ) != EXIT_SUCCESS ) {
+				rc = EXIT_FAILURE;
+				if ( cat_stop )
+					break;
+			}
 			printf("# no data for entry id=%08lx\n\n", (long) id );
 			rc = EXIT_FAILURE;
 			if ( continuemode == 0 ) {
@@ -144,27 +301,39 @@ slapcat( int argc, char **argv )
 			}
 		}
 
-		if ( verbose ) {
-			printf( "# id=%08lx\n", (long) id );
+		if ( ncrecs ) {
+			if ( slapcat_queue( &op, id, e ) != EXIT_SUCCESS )
+				rc = EXIT_FAILURE;
+			continue;
 		}
 
 		data = entry2str_wrap( e, &len, ldif_wrap );
 		be_entry_release_r( &op, e );
 
-		if ( data == NULL ) {
-			printf("# bad data for entry id=%08lx\n\n", (long) id );
+		if ( slapcat_write( id, data ) != EXIT_SUCCESS ) {
 			rc = EXIT_FAILURE;
-			if( continuemode ) continue;
-			break;
+			if ( cat_stop )
+				break;
 		}
+	}
 
-		if ( fputs( data, ldiffp->fp ) == EOF ||
-			fputs( "\n", ldiffp->fp ) == EOF ) {
-			fprintf(stderr, "%s: error writing output.\n",
-				progname);
+	if ( ncrecs ) {
+		if ( slapcat_flush( &op ) != EXIT_SUCCESS )
 			rc = EXIT_FAILURE;
-			break;
-		}
+
+		ldap_pvt_thread_mutex_lock( &cat_mutex );
+		cat_done = 1;
+		ldap_pvt_thread_cond_broadcast( &cat_cond );
+		ldap_pvt_thread_mutex_unlock( &cat_mutex );
+		for ( i = 0; i < nthr; i++ )
+			ldap_pvt_thread_join( thr[i], NULL );
+
+		for ( i = 0; i < ncrecs; i++ )
+			ch_free( crecs[i].buf );
+		ch_free( crecs );
+		ch_free( thr );
+		ldap_pvt_thread_cond_destroy( &cat_cond );
+		ldap_pvt_thread_mutex_destroy( &cat_mutex );
 	}
 
 	be->be_entry_close( be );
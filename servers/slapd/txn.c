@@ -111,6 +111,170 @@ int txn_spec_ctrl(
 	return LDAP_SUCCESS;
 }
 
+/* Copy a modlist, values included, so it outlives the request */
+static Modifications *
+txn_mods_dup( Modifications *ml )
+{
+	Modifications *mod, *head = NULL, **tail = &head;
+
+	for ( ; ml; ml = ml->sml_next ) {
+		mod = ch_malloc( sizeof( Modifications ));
+		mod->sml_mod = ml->sml_mod;
+		mod->sml_type = ml->sml_desc ? ml->sml_desc->ad_cname : ml->sml_type;
+		mod->sml_values = NULL;
+		mod->sml_nvalues = NULL;
+		if ( ml->sml_values )
+			ber_bvarray_dup_x( &mod->sml_values, ml->sml_values, NULL );
+		if ( ml->sml_nvalues )
+			ber_bvarray_dup_x( &mod->sml_nvalues, ml->sml_nvalues, NULL );
+		mod->sml_next = NULL;
+		*tail = mod;
+		tail = &mod->sml_next;
+	}
+	return head;
+}
+
+/* Make a private copy of an update op. The frontend frees the
+ * original's request data as soon as the op returns, so everything
+ * the backend will look at is duplicated here.
+ */
+static Operation *
+txn_op_dup( Operation *op )
+{
+	OperationBuffer *opbuf;
+	Operation *o;
+	struct berval *sup;
+
+	opbuf = ch_calloc( 1, sizeof( OperationBuffer ) + 2 * sizeof( struct berval ));
+	o = &opbuf->ob_op;
+	*o = *op;
+	o->o_hdr = &opbuf->ob_hdr;
+	*o->o_hdr = *op->o_hdr;
+	o->o_controls = opbuf->ob_controls;
+	AC_MEMCPY( o->o_controls, op->o_controls, sizeof( opbuf->ob_controls ));
+
+	/* request data lives on the heap, not in a thread's slab */
+	o->o_tmpmemctx = NULL;
+	o->o_tmpmfuncs = &ch_mfuncs;
+	o->o_threadctx = NULL;
+
+	o->o_ber = NULL;
+	o->o_res_ber = NULL;
+	o->o_callback = NULL;
+	o->o_ctrls = NULL;
+	o->o_groups = NULL;
+	o->o_private = NULL;
+	BER_BVZERO( &o->o_csn );
+	LDAP_SLIST_INIT( &o->o_extra );
+	LDAP_STAILQ_NEXT( o, o_next ) = NULL;
+	o->o_pagedresults_state = NULL;
+
+	ber_dupbv( &o->o_dn, &op->o_dn );
+	ber_dupbv( &o->o_ndn, &op->o_ndn );
+	ber_dupbv( &o->o_authmech, &op->o_authmech );
+	ber_dupbv( &o->o_req_dn, &op->o_req_dn );
+	ber_dupbv( &o->o_req_ndn, &op->o_req_ndn );
+
+	switch( op->o_tag ) {
+	case LDAP_REQ_ADD:
+		o->ora_e = entry_dup( op->ora_e );
+		o->ora_modlist = NULL;
+		break;
+	case LDAP_REQ_MODIFY:
+		o->orm_modlist = txn_mods_dup( op->orm_modlist );
+		break;
+	case LDAP_REQ_MODRDN:
+		ber_dupbv( &o->orr_newrdn, &op->orr_newrdn );
+		ber_dupbv( &o->orr_nnewrdn, &op->orr_nnewrdn );
+		o->orr_modlist = txn_mods_dup( op->orr_modlist );
+		if ( op->orr_newSup ) {
+			sup = (struct berval *)(opbuf+1);
+			ber_dupbv( &sup[0], op->orr_newSup );
+			ber_dupbv( &sup[1], op->orr_nnewSup );
+			o->orr_newSup = &sup[0];
+			o->orr_nnewSup = &sup[1];
+		}
+		break;
+	}
+	return o;
+}
+
+/* Free an op queued by txn_preop() */
+void
+txn_op_free( Operation *o )
+{
+	switch( o->o_tag ) {
+	case LDAP_REQ_ADD:
+		if ( o->ora_e )
+			entry_free( o->ora_e );
+		break;
+	case LDAP_REQ_MODIFY:
+		slap_mods_free( o->orm_modlist, 1 );
+		break;
+	case LDAP_REQ_MODRDN:
+		ch_free( o->orr_newrdn.bv_val );
+		ch_free( o->orr_nnewrdn.bv_val );
+		slap_mods_free( o->orr_modlist, 1 );
+		if ( o->orr_newSup ) {
+			ch_free( o->orr_newSup->bv_val );
+			ch_free( o->orr_nnewSup->bv_val );
+		}
+		break;
+	}
+	ch_free( o->o_req_dn.bv_val );
+	ch_free( o->o_req_ndn.bv_val );
+	slap_op_free( o, NULL );
+}
+
+/* Called by the frontend in place of the backend update when the
+ * op carries the txnSpec control. The op is queued on the connection
+ * and performed by txn_end_extop(), together with the other updates
+ * of the transaction, inside a single backend transaction.
+ */
+int txn_preop( Operation *op, SlapReply *rs )
+{
+	Operation *o;
+
+	/* the backend must be able to batch the updates */
+	if ( !op->o_bd->bd_info->bi_op_txn ) {
+		send_ldap_error( op, rs, LDAP_UNWILLING_TO_PERFORM,
+			"backend does not support transactions" );
+		return rs->sr_err;
+	}
+
+	/* acquire connection lock */
+	ldap_pvt_thread_mutex_lock( &op->o_conn->c_mutex );
+
+	if( op->o_conn->c_txn != CONN_TXN_SPECIFY ) {
+		rs->sr_text = "invalid transaction identifier";
+		rs->sr_err = LDAP_X_TXN_ID_INVALID;
+		goto done;
+	}
+
+	if( op->o_conn->c_txn_backend == NULL ) {
+		op->o_conn->c_txn_backend = op->o_bd;
+
+	} else if( op->o_conn->c_txn_backend != op->o_bd ) {
+		rs->sr_text = "transaction cannot span multiple database contexts";
+		rs->sr_err = LDAP_AFFECTS_MULTIPLE_DSAS;
+		goto done;
+	}
+
+	/* insert operation into transaction */
+	o = txn_op_dup( op );
+	LDAP_STAILQ_INSERT_TAIL( &op->o_conn->c_txn_ops, o, o_next );
+
+	rs->sr_text = "transaction specified";
+	rs->sr_err = LDAP_X_TXN_SPECIFY_OKAY;
+
+done:
+	/* release connection lock */
+	ldap_pvt_thread_mutex_unlock( &op->o_conn->c_mutex );
+
+	send_ldap_result( op, rs );
+	return rs->sr_err;
+}
+
 int txn_end_extop(
 	Operation *op, SlapReply *rs )
 {
@@ -121,6 +285,9 @@ int txn_end_extop(
 	ber_len_t len;
 	ber_int_t commit=1;
 	struct berval txnid;
+	Connection *c = op->o_conn;
+	BackendDB *bd;
+	struct c_to ops;
 
 	Statslog( LDAP_DEBUG_STATS, "%s TXN END\n",
 		op->o_log_prefix, 0, 0, 0, 0 );
@@ -170,46 +337,143 @@ int txn_end_extop(
 	}
 
 	/* acquire connection lock */
-	ldap_pvt_thread_mutex_lock( &op->o_conn->c_mutex );
+	ldap_pvt_thread_mutex_lock( &c->c_mutex );
 
-	if( op->o_conn->c_txn != CONN_TXN_SPECIFY ) {
+	if( c->c_txn != CONN_TXN_SPECIFY ) {
 		rs->sr_text = "invalid transaction identifier";
 		rc = LDAP_X_TXN_ID_INVALID;
 		goto done;
 	}
-	op->o_conn->c_txn = CONN_TXN_SETTLE;
+	c->c_txn = CONN_TXN_SETTLE;
+
+	if ( LDAP_STAILQ_EMPTY( &c->c_txn_ops )) {
+		LDAP_STAILQ_INIT( &ops );
+	} else {
+		ops = c->c_txn_ops;
+		LDAP_STAILQ_INIT( &c->c_txn_ops );
+	}
+	bd = c->c_txn_backend;
+
+	/* the ops are ours now, don't hold the lock while running them */
+	ldap_pvt_thread_mutex_unlock( &c->c_mutex );
 
 	if( commit ) {
-		if ( op->o_abandon ) {
-		}
+		OpExtra *txn = NULL;
+		slap_callback cb = { NULL, slap_null_cb, NULL, NULL };
+		Operation *o;
 
-		if( LDAP_STAILQ_EMPTY(&op->o_conn->c_txn_ops) ) {
+		if( LDAP_STAILQ_EMPTY( &ops ) ) {
 			/* no updates to commit */
 			rs->sr_text = "no updates to commit";
 			rc = LDAP_OPERATIONS_ERROR;
-			goto settled;
+			goto drain;
+		}
+
+		if ( op->o_abandon ) {
+			rc = SLAPD_ABANDON;
+			goto drain;
 		}
 
-		rs->sr_text = "not yet implemented";
-		rc = LDAP_UNWILLING_TO_PERFORM;
+		op->o_bd = bd;
+		rc = bd->bd_info->bi_op_txn( op, SLAP_TXN_BEGIN, &txn );
+		if ( rc != LDAP_SUCCESS ) {
+			rs->sr_text = "unable to start transaction";
+			rc = LDAP_OTHER;
+			goto drain;
+		}
+
+		/* Run the updates in the backend's txn, in the order they
+		 * were received. Their results were already reported as
+		 * txnSpecifyOkay, so the individual responses are dropped.
+		 */
+		LDAP_STAILQ_FOREACH( o, &ops, o_next ) {
+			SlapReply rs2 = { REP_RESULT };
+
+			if ( op->o_abandon ) {
+				rc = SLAPD_ABANDON;
+				break;
+			}
+			o->o_threadctx = op->o_threadctx;
+			o->o_tid = op->o_tid;
+			o->o_callback = &cb;
+			o->o_bd = bd;
+			LDAP_SLIST_INSERT_HEAD( &o->o_extra, txn, oe_next );
+			switch( o->o_tag ) {
+			case LDAP_REQ_ADD:
+				rc = bd->be_add( o, &rs2 );
+				break;
+			case LDAP_REQ_DELETE:
+				rc = bd->be_delete( o, &rs2 );
+				break;
+			case LDAP_REQ_MODIFY:
+				rc = bd->be_modify( o, &rs2 );
+				break;
+			case LDAP_REQ_MODRDN:
+				rc = bd->be_modrdn( o, &rs2 );
+				break;
+			default:
+				assert( 0 );
+				rc = LDAP_OTHER;
+				break;
+			}
+			LDAP_SLIST_REMOVE( &o->o_extra, txn, OpExtra, oe_next );
+			if ( rc == LDAP_SUCCESS )
+				rc = rs2.sr_err;
+			if ( rc != LDAP_SUCCESS ) {
+				Statslog( LDAP_DEBUG_STATS, "%s TXN END msgid=%d failed err=%d\n",
+					op->o_log_prefix, o->o_msgid, rc, 0, 0 );
+				break;
+			}
+		}
+
+		if ( rc == LDAP_SUCCESS ) {
+			rc = bd->bd_info->bi_op_txn( op, SLAP_TXN_COMMIT, &txn );
+			if ( rc != LDAP_SUCCESS ) {
+				rs->sr_text = "transaction commit failed";
+				rc = LDAP_OTHER;
+			}
+		} else {
+			bd->bd_info->bi_op_txn( op, SLAP_TXN_ABORT, &txn );
+			if ( rc != SLAPD_ABANDON ) {
+				/* Tell the client which update failed */
+				ber_init2( ber, NULL, LBER_USE_DER );
+				if ( ber_printf( ber, "{i}", o->o_msgid ) >= 0 ) {
+					struct berval *bv = ch_malloc( sizeof( struct berval ));
+					if ( ber_flatten2( ber, bv, 1 ) == 0 ) {
+						rs->sr_rspdata = bv;
+					} else {
+						ch_free( bv );
+					}
+				}
+				ber_free_buf( ber );
+				rs->sr_text = "transaction aborted, update failed";
+			}
+		}
 
 	} else {
 		rs->sr_text = "transaction aborted";
-		rc = LDAP_SUCCESS;;
+		rc = LDAP_SUCCESS;
 	}
 
 drain:
 	/* drain txn ops list */
+	{
+		Operation *o;
+		while (( o = LDAP_STAILQ_FIRST( &ops )) != NULL ) {
+			LDAP_STAILQ_REMOVE_HEAD( &ops, o_next );
+			LDAP_STAILQ_NEXT( o, o_next ) = NULL;
+			txn_op_free( o );
+		}
+	}
+	ldap_pvt_thread_mutex_lock( &c->c_mutex );
 
-settled:
-	assert( LDAP_STAILQ_EMPTY(&op->o_conn->c_txn_ops) );
-	assert( op->o_conn->c_txn == CONN_TXN_SETTLE );
-	op->o_conn->c_txn = CONN_TXN_INACTIVE;
-	op->o_conn->c_txn_backend = NULL;
+	assert( LDAP_STAILQ_EMPTY(&c->c_txn_ops) );
+	c->c_txn = CONN_TXN_INACTIVE;
+	c->c_txn_backend = NULL;
 
 done:
 	/* release connection lock */
-	ldap_pvt_thread_mutex_unlock( &op->o_conn->c_mutex );
+	ldap_pvt_thread_mutex_unlock( &c->c_mutex );
 
 	return rc;
 }
@@ -136,6 +136,15 @@ PASSWDCONF=$DATADIR/slapd-passwd.conf
 UNDOCONF=$DATADIR/slapd-config-undo.conf
 NAKEDCONF=$DATADIR/slapd-config-naked.conf
 VALREGEXCONF=$DATADIR/slapd-valregex.conf
+MULTIVALCONF=$DATADIR/slapd-multival.conf
+QUICKINDEXCONF=$DATADIR/slapd-quickindex.conf
+PAUSECONF=$DATADIR/slapd-pause.conf
+IDLEXACTCONF=$DATADIR/slapd-idlexact.conf
+INLINECONF=$DATADIR/slapd-inline.conf
+ENTRYCACHECONF=$DATADIR/slapd-entrycache.conf
+PARALLELCONF=$DATADIR/slapd-parallel.conf
+REUSEPORTCONF=$DATADIR/slapd-reuseport.conf
+IDLETIMEOUTCONF=$DATADIR/slapd-idletimeout.conf
 
 DYNAMICCONF=$DATADIR/slapd-dynamic.ldif
 
@@ -195,6 +204,7 @@ LDAPEXOP="$CLIENTDIR/ldapexop $TOOLARGS"
 SLAPDTESTER=$PROGDIR/slapd-tester
 LDIFFILTER=$PROGDIR/ldif-filter
 SLAPDMTREAD=$PROGDIR/slapd-mtread
+SLAPDSEARCH=$PROGDIR/slapd-search
 LVL=${SLAPD_DEBUG-0x4105}
 LOCALHOST=localhost
 BASEPORT=${SLAPD_BASEPORT-9010}